@@ -1,5 +1,7 @@
 #include <iostream>         // cout, cerr
 #include <cstdlib>          // EXIT_FAILURE
+#include <cstring>          // strcmp
+#include <random>           // mt19937
 #include <GL/glew.h>        // GLEW library
 #include <GLFW/glfw3.h>     // GLFW library
 #define STB_IMAGE_IMPLEMENTATION
@@ -12,6 +14,30 @@
 
 // include the provided basic shape meshes code
 #include "meshes.h"
+#include "meshsimplify.h"
+#include "meshlets.h"
+#include "meshimport.h"
+#include "texturearray.h"
+#include "texturecook.h"
+#include "imagekernels.h"
+#include "blockcompress.h"
+#include "texturestreaming.h"
+#include "texturefeedback.h"
+#include "resourceregistry.h"
+#include "packfile.h"
+#include "worldstreaming.h"
+#include "clusteredlighting.h"
+#include "deferredshading.h"
+#include "visibilitybuffer.h"
+#include "depthprepass.h"
+#include "shadowmaps.h"
+#include "staticbatch.h"
+#include "scenebvh.h"
+#include "lightmapbaker.h"
+#include "vertexocclusion.h"
+#include "irradianceprobes.h"
+#include "shadingcache.h"
+#include "shaderpermutations.h"
 #include <learnOpengl/camera.h> // Camera class
 
 using namespace std; // Standard namespace
@@ -41,27 +67,220 @@ namespace
 	const char* couchTex = "./resources/textures/couch.jpg";
 	const char* metalTex = "./resources/textures/metal.jpg";
 	const char* woodFloorTex = "./resources/textures/woodfloor.jpg";
-	GLuint gCouchTexId;
-	GLuint gMetalTexId;
-	GLuint gWoodFloorTexId;
+	// Materials, in the order their textures are loaded
+	enum Material {
+		MATERIAL_COUCH,
+		MATERIAL_METAL,
+		MATERIAL_WOOD_FLOOR
+	};
+	const std::vector<const char*> gMaterialTextures = { couchTex, metalTex, woodFloorTex };
+	TextureArraySet gTextureArrays;
+	std::vector<TextureRef> gMaterials;
+	MaterialUniforms gMaterialUniforms;
+	// Mip residency of the materials under --texture-budget
+	std::shared_ptr<TextureStreamer> gTextureStreamer;
+	// Mips the materials were sampled at, under --texture-feedback
+	TextureFeedback gTextureFeedback;
 	glm::vec2 gUVScale(5.0f, 5.0f);
 	GLint gTexWrapMode = GL_REPEAT;
 
 
 	// Main GLFW window
 	GLFWwindow* gWindow = nullptr;
+	// Owns the GL objects below and reports any left at exit
+	ResourceRegistry gResources;
 	// Shader program
+	ResourceHandle gProgram;
+	ResourceHandle gLampProgram;
 	GLuint gProgramId;
 	GLuint gLampProgramId;
+	// The scene's other passes, each its own program instead of a branch in the cube shader
+	ResourceHandle gFeedbackProgram;
+	ResourceHandle gGeometryProgram;
+	GLuint gFeedbackProgramId = 0;
+	GLuint gGeometryProgramId = 0;
+	MaterialUniforms gFeedbackMaterialUniforms;
+	MaterialUniforms gGeometryMaterialUniforms;
 
 	//Shape Meshes from Professor Brian
 	Meshes meshes;
 
+	// Same order as worldShapeNames, so world files can name them
 	enum class Shape {
 		CUBE,
 		CYLINDER,
-		PLANE
+		PLANE,
+		SPHERE,
+		TORUS
+	};
+
+	// Every object in the scene; the material indexes gMaterials
+	struct SceneObject
+	{
+		Shape shape;
+		int material;
+		glm::vec3 scale;
+		float rotAmt;
+		glm::vec3 rotation;
+		glm::vec3 translation;
+	};
+
+	const SceneObject gSceneObjects[] = {
+		// Floor Plane
+		{ Shape::PLANE, MATERIAL_WOOD_FLOOR, glm::vec3(9.0f, 1.0f, 8.0f), 0.0f, glm::vec3(1.0f, 1.0f, 1.0f), glm::vec3(3.5f, 0.0f, -2.0f) },
+		// Close Left Couch Leg
+		{ Shape::CYLINDER, MATERIAL_METAL, glm::vec3(0.1f, 0.4f, 0.1f), 0.0f, glm::vec3(1.0f, 1.0f, 1.0f), glm::vec3(-4.7f, 0.01f, -2.0f) },
+		// Close Right Couch Leg
+		{ Shape::CYLINDER, MATERIAL_METAL, glm::vec3(0.1f, 0.4f, 0.1f), 0.0f, glm::vec3(1.0f, 1.0f, 1.0f), glm::vec3(-2.5f, 0.01f, -2.0f) },
+		// Back Middle Couch Leg
+		{ Shape::CYLINDER, MATERIAL_METAL, glm::vec3(0.1f, 0.4f, 0.1f), 0.0f, glm::vec3(1.0f, 1.0f, 1.0f), glm::vec3(-1.9f, 0.01f, -7.0f) },
+		// Back Right Couch Leg
+		{ Shape::CYLINDER, MATERIAL_METAL, glm::vec3(0.1f, 0.4f, 0.1f), 0.0f, glm::vec3(1.0f, 1.0f, 1.0f), glm::vec3(3.0f, 0.01f, -7.0f) },
+		// Closest Seat Cushion
+		{ Shape::CUBE, MATERIAL_COUCH, glm::vec3(3.0f, 1.5f, 8.0f), 0.0f, glm::vec3(1.0f, 1.0f, 1.0f), glm::vec3(-3.5f, 1.0f, -5.75f) },
+		// Left Side Back Rest
+		{ Shape::CUBE, MATERIAL_COUCH, glm::vec3(1.0f, 1.5f, 6.0f), 0.0f, glm::vec3(1.0f, 1.0f, 1.0f), glm::vec3(-4.5f, 2.5f, -6.75f) },
+		// Further Seat Cushion
+		{ Shape::CUBE, MATERIAL_COUCH, glm::vec3(5.5f, 1.5f, 3.0f), 0.0f, glm::vec3(1.0f, 1.0f, 1.0f), glm::vec3(0.75f, 1.0f, -8.25f) },
+		// Further Back Rest
+		{ Shape::CUBE, MATERIAL_COUCH, glm::vec3(7.5f, 1.5f, 0.5f), 0.0f, glm::vec3(1.0f, 1.0f, 1.0f), glm::vec3(-0.25f, 2.5f, -9.5f) },
+		// Right Side Arm Rest
+		{ Shape::CUBE, MATERIAL_COUCH, glm::vec3(0.5f, 2.5f, 3.125f), 0.0f, glm::vec3(1.0f, 1.0f, 1.0f), glm::vec3(3.75f, 1.5f, -8.25f) },
+		// Table Left Leg
+		{ Shape::CUBE, MATERIAL_WOOD_FLOOR, glm::vec3(0.15f, 1.5f, 3.125f), 0.0f, glm::vec3(1.0f, 1.0f, 1.0f), glm::vec3(0.0f, 0.751f, -1.25f) },
+		// Table Right Leg
+		{ Shape::CUBE, MATERIAL_WOOD_FLOOR, glm::vec3(0.15f, 1.5f, 3.125f), 0.0f, glm::vec3(1.0f, 1.0f, 1.0f), glm::vec3(4.0f, 0.751f, -1.25f) },
+		// Table Center Leg
+		{ Shape::CUBE, MATERIAL_WOOD_FLOOR, glm::vec3(0.15f, 1.5f, 3.125f), 0.0f, glm::vec3(1.0f, 1.0f, 1.0f), glm::vec3(1.8f, 0.751f, -1.25f) },
+		// Table Surface
+		{ Shape::CUBE, MATERIAL_WOOD_FLOOR, glm::vec3(4.15f, 0.15f, 3.125f), 0.0f, glm::vec3(1.0f, 1.0f, 1.0f), glm::vec3(2.0f, 1.575f, -1.25f) },
+		// Plate
+		{ Shape::CYLINDER, MATERIAL_METAL, glm::vec3(0.4f, 0.1f, 0.4f), 0.0f, glm::vec3(1.0f, 1.0f, 1.0f), glm::vec3(2.8f, 1.6f, -1.5f) },
+		// Lamp Leg Back Right
+		{ Shape::CYLINDER, MATERIAL_WOOD_FLOOR, glm::vec3(0.1f, 1.4f, 0.1f), 0.5f, glm::vec3(0.5f, 0.0f, 0.5f), glm::vec3(-3.0f, 0.05f, 1.0f) },
+		// Lamp Leg Front
+		{ Shape::CYLINDER, MATERIAL_WOOD_FLOOR, glm::vec3(0.1f, 1.4f, 0.1f), 0.5f, glm::vec3(-0.5f, 0.0f, 0.0f), glm::vec3(-3.7f, 0.05f, 2.5f) },
+		// Lamp Leg Back Right
+		{ Shape::CYLINDER, MATERIAL_WOOD_FLOOR, glm::vec3(0.1f, 1.4f, 0.1f), 0.5f, glm::vec3(0.5f, 0.0f, -0.5f), glm::vec3(-4.4f, 0.05f, 1.0f) },
+		// Lamp Leg Connector Back Left Bottom
+		{ Shape::CUBE, MATERIAL_METAL, glm::vec3(0.025f, 0.05f, 0.8f), 0.9f, glm::vec3(0.0, 1.0f, 0.0f), glm::vec3(-4.0f, 0.22f, 1.35f) },
+		// Lamp Leg Connectors Back Left Upper
+		{ Shape::CUBE, MATERIAL_METAL, glm::vec3(0.025f, 0.05f, 0.2f), 0.9f, glm::vec3(0.0, 1.0f, 0.0f), glm::vec3(-3.8f, 1.2f, 1.55f) },
+		// Lamp Leg Connectors Back Right Lower
+		{ Shape::CUBE, MATERIAL_METAL, glm::vec3(0.025f, 0.05f, 0.8f), 0.9f, glm::vec3(0.0, -0.5f, 0.0f), glm::vec3(-3.4f, 0.22f, 1.35f) },
+		// Lamp Leg Connectors Back Right Upper
+		{ Shape::CUBE, MATERIAL_METAL, glm::vec3(0.025f, 0.05f, 0.2f), 1.0f, glm::vec3(0.0, -0.5f, 0.0f), glm::vec3(-3.6f, 1.2f, 1.55f) },
+		// Lamp Leg Connectors Front Bottom
+		{ Shape::CUBE, MATERIAL_METAL, glm::vec3(0.025f, 0.05f, 0.8f), 0.0f, glm::vec3(1.0f, 1.0f, 1.0f), glm::vec3(-3.7f, 0.22f, 2.0f) },
+		// Lamp Leg Connectors Front Upper
+		{ Shape::CUBE, MATERIAL_METAL, glm::vec3(0.025f, 0.05f, 0.2f), 0.0f, glm::vec3(1.0f, 1.0f, 1.0f), glm::vec3(-3.7f, 1.2f, 1.71f) },
+		// Lamp Pole
+		{ Shape::CYLINDER, MATERIAL_WOOD_FLOOR, glm::vec3(0.05f, 5.5f, 0.05f), 0.0f, glm::vec3(1.0f, 1.0f, 1.0f), glm::vec3(-3.7f, 0.18f, 1.6f) },
+		// Lamp Arm
+		{ Shape::CYLINDER, MATERIAL_WOOD_FLOOR, glm::vec3(0.05f, 0.5f, 0.05f), 1.0f, glm::vec3(-1.0f, 0.0f, -1.0f), glm::vec3(-3.7f, 5.68f, 1.6f) },
+		// Lamp Shade
+		{ Shape::CYLINDER, MATERIAL_WOOD_FLOOR, glm::vec3(0.2f, 0.3f, 0.2f), 1.0f, glm::vec3(1.0f, 0.0, 1.0f), glm::vec3(-3.2f, 5.9f, 1.1f) },
+		// Lamp Shade Bigger Piece
+		{ Shape::CYLINDER, MATERIAL_WOOD_FLOOR, glm::vec3(0.4f, 0.2f, 0.4f), 1.0f, glm::vec3(1.0f, 0.0, 1.0f), glm::vec3(-3.1f, 5.8f, 1.0f) },
 	};
+
+	// Clustered copies of the large curved meshes, drawn with per-cluster
+	// frustum and backface culling instead of the whole mesh
+	bool gClusterCulling = true;
+	ClusterMesh gCylinderClusters;
+	ClusterMesh gSphereClusters;
+	ClusterMesh gTorusClusters;
+	ClusterIndexRing gClusterRing;
+	ClusterCullView gClusterView;
+	ClusterCullStats gClusterStats;
+
+	// Level of detail chains of the shapes, indexed by Shape, built with --build-lods;
+	// each object draws the coarsest level within a pixel of the full mesh
+	MeshLodChain gShapeLods[5];
+	Meshes::GLMesh gShapeLodMeshes[5];
+	std::vector<ResourceHandle> gShapeLodResources;	// vao, vertex and index buffer of each
+
+	// Meshes loaded with --import, drawn as authored (identity model matrix)
+	std::vector<Meshes::GLMesh> gImportedMeshes;
+	std::vector<ResourceHandle> gImportedMeshResources;	// vao, vertex and index buffer of each
+
+	// Chunks of a --world or --world-rooms world, drawn instead of the room
+	std::shared_ptr<WorldStreamer> gWorld;
+	// Spacing of the rooms --world-rooms lays out, and the middle of the
+	// authored room, which each chunk is centred on
+	const float worldRoomSpacing = 20.0f;
+	const glm::vec2 worldRoomCenter(3.5f, -2.0f);
+
+	// Scripted camera path of --flythrough and the frame times measured along it
+	struct Flythrough
+	{
+		std::vector<glm::vec3> points;
+		float speed = 6.0f;			// units per second
+		float lookAhead = 4.0f;		// units along the path the camera faces
+		float travelled = 0.0f;
+		std::vector<float> frameTimes;
+	};
+	Flythrough gFlythrough;
+
+	// Every point light, the room's two lamps first, and the clusters
+	// they are binned into each frame
+	std::vector<PointLight> gLights;
+	LightClusterGrid gLightClusters;
+
+	// Extra lamps each step of --bench-lights renders with
+	const int benchmarkLightCounts[] = { 0, 16, 64, 256, 1024 };
+
+	// --deferred: the scene goes into a G-buffer and is lit in one full-screen pass
+	bool gDeferred = false;
+	GBuffer gGBuffer;
+	ResourceHandle gDeferredProgram;
+	GLuint gDeferredProgramId = 0;
+
+	// --visibility: only (draw, triangle) ids are rasterized, and a full-screen
+	// resolve rebuilds and shades each pixel's surface from the mesh buffers
+	bool gVisibility = false;
+	VisibilityBuffer gVisibilityBuffer;
+	ResourceHandle gVisibilityProgram;
+	ResourceHandle gResolveProgram;
+	GLuint gVisibilityProgramId = 0;
+	GLuint gResolveProgramId = 0;
+	int gVisibilityShapes[5] = { -1, -1, -1, -1, -1 };	// per Shape, into gVisibilityBuffer.meshes
+	std::vector<int> gVisibilityImportedMeshes;
+
+	// --depth-prepass: the forward pass lays down depth first and then shades only visible fragments
+	bool gUseDepthPrepass = false;
+	DepthPrepass gDepthPrepass;
+	ResourceHandle gDepthPrepassProgram;
+	GLuint gDepthPrepassProgramId = 0;
+
+	// Cached cube shadow maps of the room's lamps, off with --no-shadows
+	bool gShadows = false;
+	ShadowMaps gShadowMaps;
+	ResourceHandle gShadowProgram;
+	GLuint gShadowProgramId = 0;
+	ShadowMesh gShadowShapes[5];	// per Shape
+	std::vector<ShadowMesh> gShadowImportedMeshes;
+	std::vector<ShadowCaster> gShadowCasters;	// this frame's
+
+	// --lightmap and --vertex-ao: the room drawn as one static batch, with the lamps' diffuse light
+	// baked into a lightmap and / or ambient occlusion baked into its vertices at load
+	bool gLightmapped = false;
+	bool gVertexOcclusion = false;
+	Meshes::GLMesh gStaticBatch;	// vao 0 when nothing is baked
+	std::vector<StaticBatchRange> gStaticBatchRanges;
+	Lightmap gLightmap;
+	std::vector<ResourceHandle> gStaticBatchResources;	// batch vao, buffers and the lightmap texture
+
+	// --probes: a grid of irradiance probes over the room in place of the flat ambient term,
+	// traced again a few per frame when a lamp moves
+	bool gIrradianceProbes = false;
+	IrradianceProbeGrid gProbes;	// no texture when off
+
+	// --shading-cache: the static batch's view independent light shaded into an atlas a budget of texels per frame
+	bool gShadingCached = false;
+	ShadingCache gShadingCache;
+	ResourceHandle gShadingCacheProgram;
+	GLuint gShadingCacheProgramId = 0;
 }
 
 // camera
@@ -105,12 +324,38 @@ void UMousePositionCallback(GLFWwindow* window, double xpos, double ypos);
 void UMouseScrollCallback(GLFWwindow* window, double xoffset, double yoffset);
 void UCreateMesh(GLMesh& mesh);
 void UDestroyMesh(GLMesh& mesh);
-bool UCreateTexture(const char* filename, GLuint& textureId);
-void UDestroyTexture(GLuint textureId);
 void URender();
-bool UCreateShaderProgram(const char* vtxShaderSource, const char* fragShaderSource, GLuint& programId);
+bool UCreateShaderProgram(const char* vtxShaderSource, const char* fragShaderSource, GLuint& programId, const char* geomShaderSource = nullptr);
 void UDestroyShaderProgram(GLuint programId);
-void MakeShape(GLuint p_texId, glm::vec3 p_scale, float p_rotAmt, glm::vec3 p_rotation, glm::vec3 p_translation, GLint p_modelLoc, Shape p_shape);
+bool UCreateProgramResource(const char* vtxShaderSource, const char* fragShaderSource, const char* label, ResourceHandle& program, const char* geomShaderSource = nullptr);
+void MakeShape(const TextureRef& p_texture, const MaterialUniforms& p_materialUniforms, glm::vec3 p_scale, float p_rotAmt, glm::vec3 p_rotation, glm::vec3 p_translation, GLint p_modelLoc, Shape p_shape);
+glm::mat4 UShapeModel(glm::vec3 p_scale, float p_rotAmt, glm::vec3 p_rotation, glm::vec3 p_translation);
+std::string UComposeShaderSource(const char* source, const char* header, const char* tail);
+bool UHasArgument(int argc, char* argv[], const char* flag);
+void UBuildShapeLods();
+void UDestroyShapeLods();
+void UCreateShapeClusters();
+void UDestroyShapeClusters();
+void UImportSceneMeshes(int argc, char* argv[]);
+float UProjectedSize(const glm::vec3& center, float radius, const glm::mat4& projection);
+void URequestSceneTextures(const glm::mat4& projection);
+void UDrawScene(GLint modelLoc, const MaterialUniforms& materialUniforms);
+void UDestroyImportedMeshes();
+bool UPackAssets(int argc, char* argv[]);
+std::string ULoadShaderSource(const char* path, const char* builtIn);
+bool UCreateWorld(int argc, char* argv[]);
+void UCreateFlythrough();
+bool UAdvanceFlythrough(float deltaTime);
+glm::vec3 UFlythroughPoint(float distance);
+void UReportFlythrough();
+bool UCreateLights(int argc, char* argv[]);
+void UScatterLights(int count);
+void UBenchmarkRenderers();
+void UCreateVisibilityScene();
+void UDrawSceneVisibility();
+void UCreateShadowScene();
+void UCollectShadowCasters();
+bool UBakeStaticBatch(int argc, char* argv[]);
 ////////////////////////////////////////////////////////////////////////////////////////
 // SHADER CODE
 /* Vertex Shader Source Code*/
@@ -120,24 +365,35 @@ const GLchar* cubeVertexShaderSource = GLSL(440,
 	layout(location = 0) in vec3 position; // VAP position 0 for vertex position data
 layout(location = 1) in vec3 normal; // VAP position 1 for normals
 layout(location = 2) in vec2 textureCoordinate;
+layout(location = 3) in vec3 lightmapCoordinate; // Coords and atlas layer; only the static batch has them
+layout(location = 4) in float occlusion; // Baked ambient occlusion, also only in the static batch
 
 out vec3 vertexNormal; // For outgoing normals to fragment shader
 out vec3 vertexFragmentPos; // For outgoing color / pixels to fragment shader
 out vec2 vertexTextureCoordinate;
+out vec3 vertexLightmapCoordinate;
+out float vertexOcclusion;
+out float vertexViewDepth; // Distance in front of the camera, picks the light cluster's depth slice
 
 //Uniform / Global variables for the  transform matrices
 uniform mat4 model;
 uniform mat4 view;
 uniform mat4 projection;
 
+invariant gl_Position; // Same depth as the depth prepass program, which the shading pass tests GL_EQUAL against
+
 void main()
 {
-	gl_Position = projection * view * model * vec4(position, 1.0f); // Transforms vertices into clip coordinates
+	vec4 viewPosition = view * model * vec4(position, 1.0f);
+	gl_Position = projection * viewPosition; // Transforms vertices into clip coordinates
+	vertexViewDepth = -viewPosition.z;
 
 	vertexFragmentPos = vec3(model * vec4(position, 1.0f)); // Gets fragment / pixel position in world space only (exclude view and projection)
 
 	vertexNormal = mat3(transpose(inverse(model))) * normal; // get normal vectors in world space only and exclude normal translation properties
 	vertexTextureCoordinate = textureCoordinate;
+	vertexLightmapCoordinate = lightmapCoordinate;
+	vertexOcclusion = occlusion;
 }
 );
 
@@ -148,61 +404,311 @@ const GLchar* cubeFragmentShaderSource = GLSL(440,
 	in vec3 vertexNormal; // For incoming normals
 in vec3 vertexFragmentPos; // For incoming fragment position
 in vec2 vertexTextureCoordinate;
+in vec3 vertexLightmapCoordinate;
+in float vertexOcclusion;
+in float vertexViewDepth;
 
-out vec4 fragmentColor; // For outgoing cube color to the GPU
+layout(location = 0) out vec4 fragmentColor; // For outgoing cube color to the GPU
 
-// Uniform / Global variables for object color, light color, light position, and camera/view position
+// Uniform / Global variables for object color, ambient light, and camera/view position
 uniform vec3 objectColor;
-uniform vec3 lightColor;
-uniform vec3 lightPos;
-uniform vec3 lightColor2;
-uniform vec3 lightPos2;
+uniform vec3 ambientColor;
 uniform vec3 viewPosition;
-uniform sampler2D uTexture; // Useful when working with multiple textures
 uniform vec2 uvScale;
+uniform sampler2DArray uLightmap; // The lamps' diffuse light, in variants with FEATURE_LIGHTMAP
+uniform sampler2DArray uShadingCache; // Ambient and the lamps' diffuse light, in variants with FEATURE_SHADING_CACHE
+
+// Samples the current material from its texture array layer (see texturearray.cpp)
+vec4 sampleMaterial(vec2 uv);
+// Diffuse and specular light from every lamp reaching this fragment's cluster (see clusteredlighting.cpp)
+vec3 shadeLights(vec3 position, vec3 normal, vec3 viewDir, float viewDepth, vec2 fragCoord);
+vec3 ambientLight(vec3 ambient, vec3 position, vec3 normal);
 
 void main()
 {
-	/*Phong lighting model calculations to generate ambient, diffuse, and specular components*/
+	vec3 norm = normalize(vertexNormal); // Normalize vectors to 1 unit
 
-		//Calculate Ambient lighting*/
-	float ambientStrength = 0.2f; // Set ambient or global lighting strength
-	vec3 ambient = ambientStrength * lightColor; // Generate ambient light color
+	// Texture holds the color to be used for all three components
+	vec4 textureColor = sampleMaterial(vertexTextureCoordinate * uvScale);
 
-	//Calculate Diffuse lighting*/
-	vec3 norm = normalize(vertexNormal); // Normalize vectors to 1 unit
-	vec3 lightDirection = normalize(lightPos - vertexFragmentPos); // Calculate distance (light direction) between light source and fragments/pixels on cube
-	float impact = max(dot(norm, lightDirection), 0.0);// Calculate diffuse impact by generating dot product of normal and light
-	vec3 diffuse = impact * lightColor; // Generate diffuse light color
-
-	vec3 lightDirection2 = normalize(lightPos2 - vertexFragmentPos); // Calculate distance (light direction) between light source and fragments/pixels on cube
-	float impact2 = max(dot(norm, lightDirection2), 0.0);// Calculate diffuse impact by generating dot product of normal and light
-	vec3 diffuse2 = impact2 * lightColor2; // Generate diffuse light color
-
-	//Calculate Specular lighting*/
-	float specularIntensity = 1.0f; // Set specular light strength
-	float highlightSize = 16.0f; // Set specular highlight size
-	float specularIntensity2 = 0.1f; // Set specular light strength
-	float highlightSize2 = 16.0f; // Set specular highlight size
+	/*Phong lighting model: one ambient term, plus diffuse and specular from each light*/
 	vec3 viewDir = normalize(viewPosition - vertexFragmentPos); // Calculate view direction
-	vec3 reflectDir = reflect(-lightDirection, norm);// Calculate reflection vector
-	vec3 reflectDir2 = reflect(-lightDirection2, norm);// Calculate reflection vector
-	//Calculate specular component
-	float specularComponent = pow(max(dot(viewDir, reflectDir), 0.0), highlightSize);
-	vec3 specular = specularIntensity * specularComponent * lightColor;
+	// The FEATURE_ switches are compile time constants (see shaderpermutations.h), so the branches not taken are compiled out
+	// Baked occlusion only darkens the ambient term; the lamps' own shadows come from the shadow maps
+	float occlusion = FEATURE_VERTEX_OCCLUSION != 0 ? vertexOcclusion : 1.0;
+	vec3 lighting = shadeLights(vertexFragmentPos, norm, viewDir, vertexViewDepth, gl_FragCoord.xy);
+	if (FEATURE_SHADING_CACHE != 0)
+		lighting += texture(uShadingCache, vertexLightmapCoordinate).rgb; // Shaded in texture space, at most a few frames ago
+	else
+	{
+		lighting += ambientLight(ambientColor, vertexFragmentPos, norm) * occlusion;
+		if (FEATURE_LIGHTMAP != 0)
+			lighting += texture(uLightmap, vertexLightmapCoordinate).rgb;
+	}
 
-	//Calculate specular component
-	float specularComponent2 = pow(max(dot(viewDir, reflectDir2), 0.0), highlightSize2);
-	vec3 specular2 = specularIntensity2 * specularComponent2 * lightColor2;
+	fragmentColor = vec4(lighting * textureColor.xyz, 1.0); // Send lighting results to GPU
+}
+);
 
-	// Texture holds the color to be used for all three components
-	vec4 textureColor = texture(uTexture, vertexTextureCoordinate * uvScale);
 
-	// Calculate phong result
-	vec3 phong = (ambient + diffuse + specular) * textureColor.xyz;
-	vec3 phong2 = (ambient + diffuse2 + specular2) * textureColor.xyz;
+/* Texture Feedback Shader Source Code*/
+// Drawn with the cube vertex shader; only records which mip of which material each fragment needs
+const GLchar* feedbackFragmentShaderSource = GLSL(440,
+
+	in vec2 vertexTextureCoordinate;
+
+layout(location = 1) out uint feedback; // Material and mip level, to the feedback target (see texturefeedback.cpp)
+
+uniform vec2 uvScale;
+uniform float uFeedbackLodBias;
+
+// The material id and the mip its lookup wants (see texturearray.cpp)
+uint materialFeedback(vec2 uv, float lodBias);
+
+void main()
+{
+	feedback = materialFeedback(vertexTextureCoordinate * uvScale, uFeedbackLodBias);
+}
+);
+
+
+/* Geometry Pass Shader Source Code*/
+// Drawn with the cube vertex shader; only stores the surface, the deferred lighting pass shades it
+const GLchar* geometryFragmentShaderSource = GLSL(440,
+
+	in vec3 vertexNormal;
+in vec2 vertexTextureCoordinate;
+
+layout(location = 0) out vec4 gbufferAlbedo; // gbufferAlbedoLocation
+layout(location = 2) out vec2 gbufferNormal; // gbufferNormalLocation, octahedral
+
+uniform vec2 uvScale;
+
+vec4 sampleMaterial(vec2 uv);
+// Packs a unit normal into the G-buffer (see deferredshading.cpp)
+vec2 encodeNormal(vec3 normal);
+
+void main()
+{
+	gbufferAlbedo = vec4(sampleMaterial(vertexTextureCoordinate * uvScale).xyz, 1.0);
+	gbufferNormal = encodeNormal(normalize(vertexNormal));
+}
+);
+
+
+/* Depth Prepass Shader Source Code*/
+const GLchar* depthPrepassVertexShaderSource = GLSL(440,
+
+	layout(location = 0) in vec3 position; // Only the position: the prepass writes depth and nothing else
 
-	fragmentColor = vec4(phong + phong2, 1.0); // Send lighting results to GPU
+uniform mat4 model;
+uniform mat4 view;
+uniform mat4 projection;
+
+invariant gl_Position; // Must match the cube program's depth exactly
+
+void main()
+{
+	gl_Position = projection * (view * model * vec4(position, 1.0f)); // Same operations in the same order as the cube shader
+}
+);
+
+
+// No colour is written, so there is nothing to compute
+const GLchar* depthPrepassFragmentShaderSource = GLSL(440,
+
+void main()
+{
+}
+);
+
+
+/* Deferred Lighting Shader Source Code*/
+const GLchar* deferredVertexShaderSource = GLSL(440,
+
+void main()
+{
+	// One triangle covering the screen: (-1, -1), (3, -1), (-1, 3)
+	vec2 corner = vec2((gl_VertexID << 1) & 2, gl_VertexID & 2);
+	gl_Position = vec4(corner * 2.0 - 1.0, 0.0, 1.0);
+}
+);
+
+
+const GLchar* deferredLightingFragmentShaderSource = GLSL(440,
+
+	out vec4 fragmentColor; // For outgoing lit color to the GPU
+
+uniform vec3 ambientColor;
+uniform vec3 viewPosition;
+uniform mat4 view;
+
+// G-buffer decoding (see deferredshading.cpp) and the lights of a cluster (see clusteredlighting.cpp)
+vec3 decodeNormal(vec2 encoded);
+vec3 gbufferPosition(ivec2 pixel, float depth);
+vec3 shadeLights(vec3 position, vec3 normal, vec3 viewDir, float viewDepth, vec2 fragCoord);
+vec3 ambientLight(vec3 ambient, vec3 position, vec3 normal);
+
+void main()
+{
+	ivec2 pixel = ivec2(gl_FragCoord.xy);
+	float depth = texelFetch(uGBufferDepth, pixel, 0).r;
+	gl_FragDepth = depth; // Lamps drawn afterwards are still hidden behind the scene
+	if (depth == 1.0)
+	{
+		fragmentColor = vec4(0.0, 0.0, 0.0, 1.0); // Nothing drawn here: background
+		return;
+	}
+
+	// Same Phong terms as the forward pass, from the stored surface
+	vec3 position = gbufferPosition(pixel, depth);
+	vec3 norm = decodeNormal(texelFetch(uGBufferNormal, pixel, 0).xy);
+	vec3 viewDir = normalize(viewPosition - position);
+	float viewDepth = -(view * vec4(position, 1.0)).z;
+	vec3 lighting = ambientLight(ambientColor, position, norm) + shadeLights(position, norm, viewDir, viewDepth, gl_FragCoord.xy);
+
+	fragmentColor = vec4(lighting * texelFetch(uGBufferAlbedo, pixel, 0).xyz, 1.0);
+}
+);
+
+
+/* Visibility Buffer Shader Source Code*/
+const GLchar* visibilityFragmentShaderSource = GLSL(440,
+
+	layout(location = 0) out uint visibilityId; // For outgoing draw and triangle id, 0 is left for empty pixels
+
+uniform uint uDrawId;
+
+void main()
+{
+	visibilityId = ((uDrawId + 1u) << 20) | uint(gl_PrimitiveID); // visibilityTriangleBits of visibilitybuffer.h
+}
+);
+
+
+const GLchar* resolveFragmentShaderSource = GLSL(440,
+
+	out vec4 fragmentColor; // For outgoing lit color to the GPU
+
+uniform vec3 ambientColor;
+uniform vec3 viewPosition;
+uniform mat4 view;
+uniform vec2 uvScale;
+
+// Surface of the id under a pixel (see visibilitybuffer.cpp) and the lights of a cluster (see clusteredlighting.cpp)
+bool visibilitySurface(ivec2 pixel, out VisibilitySurface surface);
+vec4 sampleVisibilityMaterial(VisibilitySurface surface);
+vec3 shadeLights(vec3 position, vec3 normal, vec3 viewDir, float viewDepth, vec2 fragCoord);
+vec3 ambientLight(vec3 ambient, vec3 position, vec3 normal);
+
+void main()
+{
+	ivec2 pixel = ivec2(gl_FragCoord.xy);
+	gl_FragDepth = texelFetch(uVisibilityDepth, pixel, 0).r; // Lamps drawn afterwards are still hidden behind the scene
+	VisibilitySurface surface;
+	if (!visibilitySurface(pixel, surface))
+	{
+		fragmentColor = vec4(0.0, 0.0, 0.0, 1.0); // Nothing drawn here: background
+		return;
+	}
+
+	// Same texture scale and Phong terms as the forward pass, from the rebuilt surface
+	surface.uv *= uvScale;
+	surface.uvDx *= uvScale;
+	surface.uvDy *= uvScale;
+	vec3 viewDir = normalize(viewPosition - surface.position);
+	float viewDepth = -(view * vec4(surface.position, 1.0)).z;
+	vec3 lighting = ambientLight(ambientColor, surface.position, surface.normal) + shadeLights(surface.position, surface.normal, viewDir, viewDepth, gl_FragCoord.xy);
+
+	fragmentColor = vec4(lighting * sampleVisibilityMaterial(surface).xyz, 1.0);
+}
+);
+
+
+const GLchar* shadingCacheFragmentShaderSource = GLSL(440,
+
+	out vec4 fragmentColor; // For the cached light of one atlas texel
+
+uniform vec3 ambientColor;
+uniform sampler2DArray uLightmap; // The lamps' diffuse light, in variants with FEATURE_LIGHTMAP
+
+// Surface under a texel (see shadingcache.cpp), the lamps' diffuse light (see clusteredlighting.cpp) and the ambient light (see irradianceprobes.cpp)
+bool shadingCacheSurface(ivec2 texel, out vec3 position, out vec3 normal, out float occlusion);
+vec3 shadeGlobalDiffuse(vec3 position, vec3 normal);
+vec3 ambientLight(vec3 ambient, vec3 position, vec3 normal);
+
+void main()
+{
+	vec3 position;
+	vec3 norm;
+	float occlusion;
+	if (!shadingCacheSurface(ivec2(gl_FragCoord.xy), position, norm, occlusion))
+	{
+		fragmentColor = vec4(0.0); // No triangle here
+		return;
+	}
+
+	// The forward pass's ambient and diffuse terms, which do not depend on the view
+	vec3 diffuse = FEATURE_LIGHTMAP != 0 ? texelFetch(uLightmap, ivec3(gl_FragCoord.xy, uShadingCacheLayer), 0).rgb : shadeGlobalDiffuse(position, norm);
+	fragmentColor = vec4(ambientLight(ambientColor, position, norm) * occlusion + diffuse, 1.0);
+}
+);
+
+
+/* Shadow Map Shader Source Code*/
+const GLchar* shadowVertexShaderSource = GLSL(440,
+
+	layout(location = 0) in vec3 position; // VAP position 0 for vertex position data
+
+uniform mat4 model;
+
+void main()
+{
+	gl_Position = model * vec4(position, 1.0f); // World space; the geometry shader projects it onto each cube face
+}
+);
+
+
+const GLchar* shadowGeometryShaderSource = GLSL(440,
+
+	layout(triangles) in;
+layout(triangle_strip, max_vertices = 18) out;
+
+out vec3 shadowWorldPosition; // For outgoing world position to the fragment shader
+
+uniform mat4 uShadowFaces[6]; // View projection of each cube face, in layer order
+uniform int uShadowFaceMask; // Faces this caster reaches
+
+void main()
+{
+	// One pass fills the whole cube: the triangle is sent to every face its caster touches
+	for (int face = 0; face < 6; ++face)
+	{
+		if ((uShadowFaceMask & (1 << face)) == 0)
+			continue;
+		for (int corner = 0; corner < 3; ++corner)
+		{
+			gl_Layer = face;
+			shadowWorldPosition = gl_in[corner].gl_Position.xyz;
+			gl_Position = uShadowFaces[face] * gl_in[corner].gl_Position;
+			EmitVertex();
+		}
+		EndPrimitive();
+	}
+}
+);
+
+
+const GLchar* shadowFragmentShaderSource = GLSL(440,
+
+	in vec3 shadowWorldPosition;
+
+uniform vec3 uShadowLight;
+uniform float uShadowRange;
+
+void main()
+{
+	gl_FragDepth = length(shadowWorldPosition - uShadowLight) / uShadowRange; // Distance to the light, comparable across faces
 }
 );
 
@@ -239,73 +745,809 @@ void main()
 
 int main(int argc, char* argv[])
 {
+	// Write a pack of the assets and quit
+	if (UHasArgument(argc, argv, "--pack-assets"))
+		return UPackAssets(argc, argv) ? EXIT_SUCCESS : EXIT_FAILURE;
+
+	// Asset packs are searched before the loose files
+	for (int i = 1; i + 1 < argc; ++i)
+	{
+		if (strcmp(argv[i], "--pack") == 0 && !UMountPack(argv[++i]))
+			return EXIT_FAILURE;
+	}
+
+	// Measure the texture pipeline's image kernels and quit
+	if (UHasArgument(argc, argv, "--bench-image"))
+	{
+		UBenchmarkImageKernels();
+		return EXIT_SUCCESS;
+	}
+
+	// Encode every material texture to BC1 and BC7, report speed and PSNR and quit
+	if (UHasArgument(argc, argv, "--bench-bc"))
+	{
+		for (const char* texture : gMaterialTextures)
+			UBenchmarkBlockCompression(texture);
+		return EXIT_SUCCESS;
+	}
+
+	// Cook every material texture next to its source image and quit (no window needed)
+	if (UHasArgument(argc, argv, "--cook"))
+	{
+		const bool compress = UHasArgument(argc, argv, "--compress");
+		const bool highQuality = UHasArgument(argc, argv, "--bc7");
+		bool cooked = true;
+		for (const char* texture : gMaterialTextures)
+			cooked = UCookTexture(texture, UCookedTexturePath(texture).c_str(), compress, highQuality) && cooked;
+		return cooked ? EXIT_SUCCESS : EXIT_FAILURE;
+	}
+
 	if (!UInitialize(argc, argv, &gWindow))
 		return EXIT_FAILURE;
 
 	// Create the basic shape meshes for use
 	meshes.CreateMeshes();
 
-	// Create the shader program
-	if (!UCreateShaderProgram(cubeVertexShaderSource, cubeFragmentShaderSource, gProgramId))
+	// Build LOD chains for every shape and report simplifier throughput
+	if (UHasArgument(argc, argv, "--build-lods"))
+		UBuildShapeLods();
+
+	// Split the curved meshes into culling clusters
+	gClusterCulling = !UHasArgument(argc, argv, "--no-cluster-culling");
+	if (gClusterCulling)
+		UCreateShapeClusters();
+
+	// Compare the mapped OBJ parser against a plain ifstream reader
+	for (int i = 1; i + 1 < argc; ++i)
+	{
+		if (strcmp(argv[i], "--import-bench") == 0)
+			UBenchmarkObjImport(argv[i + 1]);
+	}
+
+	// A chunked world streams in around the camera; otherwise load any
+	// OBJ / glTF files named on the command line into the room
+	if (!UCreateWorld(argc, argv))
+		return EXIT_FAILURE;
+	if (!gWorld)
+		UImportSceneMeshes(argc, argv);
+	if (gWorld && UHasArgument(argc, argv, "--flythrough"))
+		UCreateFlythrough();
+
+	// Load textures into texture arrays, grouped by size and format
+	TextureArrayOptions textureOptions;
+	textureOptions.allowBindless = !UHasArgument(argc, argv, "--no-bindless");
+	textureOptions.compress = UHasArgument(argc, argv, "--compress-textures");
+	size_t textureBudget = 0;
+	for (int i = 1; i + 1 < argc; ++i)
+	{
+		if (strcmp(argv[i], "--texture-budget") == 0)
+			textureBudget = size_t(std::max(0.0, atof(argv[i + 1])) * 1024.0 * 1024.0);
+	}
+	textureOptions.streamed = textureBudget > 0;
+	textureOptions.registry = &gResources;
+	if (!UCreateTextureArrays(gMaterialTextures, textureOptions, gTextureArrays, gMaterials))
 		return EXIT_FAILURE;
 
-	// Load textures
-	
-	if (!UCreateTexture(couchTex, gCouchTexId))
+	// Page the large mips in and out to stay inside the budget
+	if (textureOptions.streamed)
+	{
+		gTextureStreamer = UCreateTextureStreamer(gMaterialTextures, gTextureArrays, gMaterials, textureBudget);
+		if (!gTextureStreamer)
+			return EXIT_FAILURE;
+
+		// Measure the mips actually sampled instead of estimating them from object sizes
+		if (UHasArgument(argc, argv, "--texture-feedback") &&
+			!UCreateTextureFeedback(WINDOW_WIDTH, WINDOW_HEIGHT, 8, 4, gMaterialTextures.size(), gTextureFeedback))
+			return EXIT_FAILURE;
+	}
+
+	// The room's lamps and any --lights, binned per frame into view clusters
+	if (!UCreateLights(argc, argv))
+		return EXIT_FAILURE;
+
+	// Bake the lamps' diffuse light and shadows on the room into a lightmap, and / or its ambient occlusion into the vertices,
+	// and / or trace the irradiance probes
+	gLightmapped = UHasArgument(argc, argv, "--lightmap");
+	gVertexOcclusion = UHasArgument(argc, argv, "--vertex-ao");
+	gIrradianceProbes = UHasArgument(argc, argv, "--probes");
+	gShadingCached = UHasArgument(argc, argv, "--shading-cache");
+	if ((gLightmapped || gVertexOcclusion || gIrradianceProbes || gShadingCached) && !UBakeStaticBatch(argc, argv))
+		return EXIT_FAILURE;
+
+	// One variant of each lighting shader, compiled for what this scene has: the switches every program shares,
+	// the global lamps' count to unroll their loop, and what only the static batch's cube program reads
+	gShadows = !UHasArgument(argc, argv, "--no-shadows");
+	GLuint globalLights = 0;
+	for (const PointLight& light : gLights)
+		globalLights += light.radius <= 0.0f ? 1 : 0;
+	const ShaderFeatures sceneFeatures = (gShadows ? shaderShadows : 0) | (gProbes.texture ? shaderProbes : 0) | UShaderGlobalLights(globalLights);
+	const ShaderFeatures cubeFeatures = sceneFeatures | (gLightmapped ? shaderLightmap : 0) | (gVertexOcclusion ? shaderVertexOcclusion : 0) |
+		(gShadingCached ? shaderShadingCache : 0);
+	const std::string sceneDefines = UShaderFeatureDefines(sceneFeatures);
+
+	// Create the shader program, with the material lookup that matches the texture path
+	const std::string vertexShaderSource = ULoadShaderSource("shaders/cube.vert", cubeVertexShaderSource);
+	const std::string materialShaderSource = UComposeShaderSource(ULoadShaderSource("shaders/cube.frag", cubeFragmentShaderSource).c_str(),
+		UTextureArrayShaderHeader(gTextureArrays.bindless), UTextureArrayShaderSource(gTextureArrays.bindless));
+	const std::string lightingShaderSource = std::string(UShadowMapShaderSource()) + ULightClusterShaderSource() + UIrradianceProbeShaderSource();
+	const std::string fragmentShaderSource = UComposeShaderSource(materialShaderSource.c_str(),
+		UShaderFeatureDefines(cubeFeatures).c_str(), lightingShaderSource.c_str());
+	if (!UCreateProgramResource(vertexShaderSource.c_str(), fragmentShaderSource.c_str(), "cube", gProgram))
+		return EXIT_FAILURE;
+	std::cout << "INFO: Cube shader variant: " << UShaderFeatureName(cubeFeatures) << std::endl;
+
+	// The feedback pass, with the cube vertex shader and the same material lookup
+	if (gTextureFeedback.framebuffer)
+	{
+		const std::string feedbackFragmentSource = UComposeShaderSource(ULoadShaderSource("shaders/feedback.frag", feedbackFragmentShaderSource).c_str(),
+			UTextureArrayShaderHeader(gTextureArrays.bindless), UTextureArrayShaderSource(gTextureArrays.bindless));
+		if (!UCreateProgramResource(vertexShaderSource.c_str(), feedbackFragmentSource.c_str(), "texture feedback", gFeedbackProgram))
+			return EXIT_FAILURE;
+		gFeedbackProgramId = UResourceName(gResources, gFeedbackProgram);
+		glUseProgram(gFeedbackProgramId);
+		gFeedbackMaterialUniforms = UGetMaterialUniforms(gFeedbackProgramId, gTextureArrays);
+		glUniform2fv(glGetUniformLocation(gFeedbackProgramId, "uvScale"), 1, glm::value_ptr(gUVScale));
+		glUniform1f(glGetUniformLocation(gFeedbackProgramId, "uFeedbackLodBias"), gTextureFeedback.lodBias);
+	}
+	if (!UCreateProgramResource(ULoadShaderSource("shaders/lamp.vert", lampVertexShaderSource).c_str(),
+		ULoadShaderSource("shaders/lamp.frag", lampFragmentShaderSource).c_str(), "lamp", gLampProgram))
+		return EXIT_FAILURE;
+	gProgramId = UResourceName(gResources, gProgram);
+	gLampProgramId = UResourceName(gResources, gLampProgram);
+
+	// Deferred shading: G-buffer and lighting pass, also needed to compare the two paths
+	const bool benchmarkRenderers = UHasArgument(argc, argv, "--bench-lights");
+	gDeferred = UHasArgument(argc, argv, "--deferred");
+	if (gDeferred || benchmarkRenderers)
+	{
+		const std::string geometryFragmentSource = UComposeShaderSource(ULoadShaderSource("shaders/geometry.frag", geometryFragmentShaderSource).c_str(),
+			(std::string(UTextureArrayShaderHeader(gTextureArrays.bindless)) + UGBufferShaderHeader()).c_str(), (std::string(UTextureArrayShaderSource(gTextureArrays.bindless)) + UGBufferShaderSource()).c_str());
+		const std::string lightingFragmentSource = UComposeShaderSource(ULoadShaderSource("shaders/deferred.frag", deferredLightingFragmentShaderSource).c_str(),
+			(sceneDefines + UGBufferShaderHeader()).c_str(), (lightingShaderSource + UGBufferShaderSource()).c_str());
+		if (!UCreateGBuffer(WINDOW_WIDTH, WINDOW_HEIGHT, gGBuffer) ||
+			!UCreateProgramResource(vertexShaderSource.c_str(), geometryFragmentSource.c_str(), "geometry", gGeometryProgram) ||
+			!UCreateProgramResource(ULoadShaderSource("shaders/deferred.vert", deferredVertexShaderSource).c_str(), lightingFragmentSource.c_str(), "deferred lighting", gDeferredProgram))
+			return EXIT_FAILURE;
+		gGeometryProgramId = UResourceName(gResources, gGeometryProgram);
+		gDeferredProgramId = UResourceName(gResources, gDeferredProgram);
+		glUseProgram(gGeometryProgramId);
+		gGeometryMaterialUniforms = UGetMaterialUniforms(gGeometryProgramId, gTextureArrays);
+		glUniform2fv(glGetUniformLocation(gGeometryProgramId, "uvScale"), 1, glm::value_ptr(gUVScale));
+	}
+
+	// Visibility buffer: id target, every mesh in shared buffers, and the resolve pass
+	gVisibility = UHasArgument(argc, argv, "--visibility");
+	if (gVisibility || benchmarkRenderers)
+	{
+		const std::string resolveFragmentSource = UComposeShaderSource(ULoadShaderSource("shaders/resolve.frag", resolveFragmentShaderSource).c_str(),
+			(sceneDefines + UVisibilityShaderHeader()).c_str(), (std::string(UVisibilityShaderSource()) + UShadowMapShaderSource() + ULightClusterShaderSource() + UIrradianceProbeShaderSource()).c_str());
+		if (!UCreateVisibilityBuffer(WINDOW_WIDTH, WINDOW_HEIGHT, gVisibilityBuffer) ||
+			!UCreateProgramResource(ULoadShaderSource("shaders/lamp.vert", lampVertexShaderSource).c_str(),
+				ULoadShaderSource("shaders/visibility.frag", visibilityFragmentShaderSource).c_str(), "visibility", gVisibilityProgram) ||
+			!UCreateProgramResource(ULoadShaderSource("shaders/deferred.vert", deferredVertexShaderSource).c_str(), resolveFragmentSource.c_str(), "visibility resolve", gResolveProgram))
+			return EXIT_FAILURE;
+		gVisibilityProgramId = UResourceName(gResources, gVisibilityProgram);
+		gResolveProgramId = UResourceName(gResources, gResolveProgram);
+		UCreateVisibilityScene();
+	}
+
+	// tell opengl for each sampler to which texture unit it belongs to (only has to be done once)
+	glUseProgram(gProgramId);
+	gMaterialUniforms = UGetMaterialUniforms(gProgramId, gTextureArrays);
+	glUniform1i(glGetUniformLocation(gProgramId, "uLightmap"), lightmapTextureUnit);
+	glUniform1i(glGetUniformLocation(gProgramId, "uShadingCache"), shadingCacheTextureUnit);
+	// A single ambient term for the whole scene, however many lights there are
+	const glm::vec3 ambientColor = 0.2f * gLightColor;
+	glUniform3f(glGetUniformLocation(gProgramId, "ambientColor"), ambientColor.r, ambientColor.g, ambientColor.b);
+	if (gDeferredProgramId)
+	{
+		glUseProgram(gDeferredProgramId);
+		glUniform3f(glGetUniformLocation(gDeferredProgramId, "ambientColor"), ambientColor.r, ambientColor.g, ambientColor.b);
+		glUseProgram(gProgramId);
+	}
+	if (gResolveProgramId)
+	{
+		glUseProgram(gResolveProgramId);
+		glUniform3f(glGetUniformLocation(gResolveProgramId, "ambientColor"), ambientColor.r, ambientColor.g, ambientColor.b);
+		glUniform2fv(glGetUniformLocation(gResolveProgramId, "uvScale"), 1, glm::value_ptr(gUVScale));
+		glUseProgram(gProgramId);
+	}
+
+	// Shadows of the room's lamps, drawn once and kept until a lamp or a caster near it changes
+	if (gShadows)
+	{
+		if (!UCreateProgramResource(ULoadShaderSource("shaders/shadow.vert", shadowVertexShaderSource).c_str(),
+			ULoadShaderSource("shaders/shadow.frag", shadowFragmentShaderSource).c_str(), "shadow", gShadowProgram,
+			ULoadShaderSource("shaders/shadow.geom", shadowGeometryShaderSource).c_str()) ||
+			!UCreateShadowMaps(512, 30.0f, maxShadowLights, gShadowMaps))
+			return EXIT_FAILURE;
+		gShadowProgramId = UResourceName(gResources, gShadowProgram);
+		UCreateShadowScene();
+	}
+
+	// Depth prepass for the forward path: on, off (measured only) or on while overdraw is high
+	DepthPrepassMode prepassMode = DepthPrepassMode::Off;
+	float prepassThreshold = 1.5f;
+	for (int i = 1; i + 1 < argc; ++i)
+	{
+		if (strcmp(argv[i], "--depth-prepass") == 0)
+		{
+			gUseDepthPrepass = true;
+			if (strcmp(argv[i + 1], "on") == 0)
+				prepassMode = DepthPrepassMode::On;
+			else if (strcmp(argv[i + 1], "auto") == 0)
+				prepassMode = DepthPrepassMode::Auto;
+		}
+		if (strcmp(argv[i], "--prepass-threshold") == 0)
+			prepassThreshold = (float)atof(argv[i + 1]);
+	}
+	if (gUseDepthPrepass)
+	{
+		if (!UCreateDepthPrepass(prepassMode, prepassThreshold, gDepthPrepass) ||
+			!UCreateProgramResource(ULoadShaderSource("shaders/prepass.vert", depthPrepassVertexShaderSource).c_str(),
+				ULoadShaderSource("shaders/prepass.frag", depthPrepassFragmentShaderSource).c_str(), "depth prepass", gDepthPrepassProgram))
+			return EXIT_FAILURE;
+		gDepthPrepassProgramId = UResourceName(gResources, gDepthPrepassProgram);
+	}
+
+	if (gShadingCached)
+	{
+		const ShaderFeatures cacheFeatures = sceneFeatures | (gLightmapped ? shaderLightmap : 0);
+		const std::string cacheFragmentSource = UComposeShaderSource(ULoadShaderSource("shaders/shadingcache.frag", shadingCacheFragmentShaderSource).c_str(),
+			(UShaderFeatureDefines(cacheFeatures) + UShadingCacheShaderHeader()).c_str(), (std::string(UShadowMapShaderSource()) + ULightClusterShaderSource() + UIrradianceProbeShaderSource() + UShadingCacheShaderSource()).c_str());
+		if (!UCreateProgramResource(ULoadShaderSource("shaders/deferred.vert", deferredVertexShaderSource).c_str(), cacheFragmentSource.c_str(), "shading cache", gShadingCacheProgram))
+			return EXIT_FAILURE;
+		gShadingCacheProgramId = UResourceName(gResources, gShadingCacheProgram);
+		glUseProgram(gShadingCacheProgramId);
+		glUniform3f(glGetUniformLocation(gShadingCacheProgramId, "ambientColor"), ambientColor.r, ambientColor.g, ambientColor.b);
+		glUniform1i(glGetUniformLocation(gShadingCacheProgramId, "uLightmap"), lightmapTextureUnit);
+		glUseProgram(gProgramId);
+	}
+	// Sets the background color of the window to black (it will be implicitely used by glClear)
+	glClearColor(0.0f, 0.0f, 0.0f, 1.0f);
+
+	// Time forward against deferred shading as lamps are added, then quit
+	if (benchmarkRenderers)
+	{
+		UBenchmarkRenderers();
+		glfwSetWindowShouldClose(gWindow, true);
+	}
+
+	// render loop
+	// -----------
+	while (!glfwWindowShouldClose(gWindow))
+	{
+		// per-frame timing
+		// --------------------
+		float currentFrame = glfwGetTime();
+		gDeltaTime = currentFrame - gLastFrame;
+		gLastFrame = currentFrame;
+
+		// input
+		// -----
+		UProcessInput(gWindow);
+		if (!gFlythrough.points.empty() && !UAdvanceFlythrough(gDeltaTime))
+		{
+			UReportFlythrough();
+			glfwSetWindowShouldClose(gWindow, true);
+		}
+
+		// Render this frame
+		URender();
+
+		glfwPollEvents();
+	}
+
+	// Release mesh data
+	//UDestroyMesh(gMesh);
+	meshes.DestroyMeshes();
+	UDestroyShapeLods();
+	if (gClusterCulling)
+		UDestroyShapeClusters();
+	UDestroyImportedMeshes();
+	if (gWorld)
+	{
+		const WorldStreamingStats stats = UGetWorldStreamingStats(*gWorld);
+		std::cout << "INFO: World streaming loaded " << stats.loads << " and unloaded " << stats.unloads << " chunks, peak "
+			<< stats.peak / (1024 * 1024) << " MB of " << stats.budget / (1024 * 1024) << " MB, longest update " << stats.maxUpdateMs << " ms" << std::endl;
+		UDestroyWorldStreamer(gWorld);
+	}
+
+	// Release texture
+	if (gTextureFeedback.framebuffer)
+	{
+		std::cout << "INFO: Texture feedback ran " << gTextureFeedback.passes << " passes, read back " << gTextureFeedback.readbacks << std::endl;
+		UDestroyTextureFeedback(gTextureFeedback);
+	}
+	if (gTextureStreamer)
+	{
+		const TextureStreamingStats stats = UGetTextureStreamingStats(*gTextureStreamer);
+		std::cout << "INFO: Texture streaming loaded " << stats.loads << " and evicted " << stats.evictions << " levels, peak "
+			<< stats.peak / (1024 * 1024) << " MB of " << stats.budget / (1024 * 1024) << " MB" << std::endl;
+		gTextureStreamer.reset();
+	}
+	UDestroyTextureArrays(gTextureArrays);
+	UPrintLightClusterStats(gLightClusters);
+	UDestroyLightClusterGrid(gLightClusters);
+	UDestroyGBuffer(gGBuffer);
+	if (gVisibilityBuffer.droppedDraws > 0)
+		std::cout << "INFO: Visibility buffer dropped " << gVisibilityBuffer.droppedDraws << " draws past " << visibilityMaxDraws << " a frame" << std::endl;
+	UDestroyVisibilityBuffer(gVisibilityBuffer);
+	UPrintDepthPrepassStats(gDepthPrepass);
+	UDestroyDepthPrepass(gDepthPrepass);
+	UPrintShadowMapStats(gShadowMaps);
+	UDestroyShadowMaps(gShadowMaps);
+	UPrintIrradianceProbeStats(gProbes);
+	UDestroyIrradianceProbes(gProbes);
+	UPrintShadingCacheStats(gShadingCache);
+	UDestroyShadingCache(gShadingCache);
+
+	// Release shader program
+	UReleaseResource(gResources, gProgram);
+	UReleaseResource(gResources, gLampProgram);
+	UReleaseResource(gResources, gFeedbackProgram);
+	UReleaseResource(gResources, gGeometryProgram);
+	UReleaseResource(gResources, gDeferredProgram);
+	UReleaseResource(gResources, gVisibilityProgram);
+	UReleaseResource(gResources, gResolveProgram);
+	UReleaseResource(gResources, gShadowProgram);
+	UReleaseResource(gResources, gShadingCacheProgram);
+	UReleaseResource(gResources, gDepthPrepassProgram);
+	for (ResourceHandle& resource : gStaticBatchResources)
+		UReleaseResource(gResources, resource);
+
+	// Anything still registered now was leaked
+	UDestroyResourceRegistry(gResources);
+	UUnmountPacks();
+
+	exit(EXIT_SUCCESS); // Terminates the program successfully
+}
+
+
+///////////////////////////////////////////////////
+//	UPackAssets(int, char*[])
+//
+//	--pack-assets <pack> [--lz4 | --zstd] [files...]
+//
+//	Writes the files into a pack; without a file list,
+//	the material textures and any cooked containers next
+//	to them. Paths are stored as given, so list them the
+//	way the program opens them.
+///////////////////////////////////////////////////
+bool UPackAssets(int argc, char* argv[])
+{
+	const char* packPath = nullptr;
+	std::vector<std::string> files;
+	for (int i = 1; i < argc; ++i)
+	{
+		if (strcmp(argv[i], "--pack-assets") == 0 && i + 1 < argc)
+		{
+			packPath = argv[++i];
+			while (i + 1 < argc && strncmp(argv[i + 1], "--", 2) != 0)
+				files.push_back(argv[++i]);
+		}
+	}
+	if (!packPath)
+	{
+		std::cout << "--pack-assets needs the pack to write" << std::endl;
+		return false;
+	}
+
+	if (files.empty())
+	{
+		for (const char* texture : gMaterialTextures)
+		{
+			files.push_back(texture);
+			const std::string cooked = UCookedTexturePath(texture);
+			if (MappedFile().Open(cooked.c_str()))
+				files.push_back(cooked);
+		}
+	}
+
+	PackCompression compression = PackCompression::None;
+	if (UHasArgument(argc, argv, "--lz4"))
+		compression = PackCompression::LZ4;
+	if (UHasArgument(argc, argv, "--zstd"))
+		compression = PackCompression::Zstd;
+	return UWritePack(packPath, files, compression);
+}
+
+// Shader source from a mounted pack (or loose file) at path, else the built in one
+std::string ULoadShaderSource(const char* path, const char* builtIn)
+{
+	AssetFile file;
+	if (!file.Open(path))
+		return builtIn;
+	std::cout << "INFO: Using shader " << path << std::endl;
+	return std::string((const char*)file.Data(), file.Size());
+}
+
+
+///////////////////////////////////////////////////
+//	UProjectedSize(const glm::vec3&, float, const glm::mat4&)
+//
+//	center, radius: world space bounding sphere
+//	projection: this frame's projection matrix
+//
+//	Approximate diameter of the sphere on screen in pixels
+///////////////////////////////////////////////////
+float UProjectedSize(const glm::vec3& center, float radius, const glm::mat4& projection)
+{
+	const float pixelsPerUnit = projection[1][1] * WINDOW_HEIGHT * 0.5f;
+	if (!isPerspective)
+		return 2.0f * radius * pixelsPerUnit;
+	const float distance = std::max(glm::length(center - gCamera.Position), radius);
+	return 2.0f * radius * pixelsPerUnit / distance;
+}
+
+
+///////////////////////////////////////////////////
+//	URequestSceneTextures(const glm::mat4&)
+//
+//	projection: this frame's projection matrix
+//
+//	Tells the streamer which mips the materials need next:
+//	the levels the last feedback readback measured, or
+//	without feedback an estimate from each object's size
+///////////////////////////////////////////////////
+void URequestSceneTextures(const glm::mat4& projection)
+{
+	if (gTextureFeedback.framebuffer)
+	{
+		UCollectTextureFeedback(gTextureFeedback);
+		for (size_t i = 0; i < gTextureFeedback.levels.size(); ++i)
+		{
+			if (gTextureFeedback.levels[i] >= 0)
+				URequestTextureLevel(*gTextureStreamer, i, gTextureFeedback.levels[i]);
+		}
+		return;
+	}
+
+	const float uvRepeat = std::max(gUVScale.x, gUVScale.y);
+	if (gWorld)
+	{
+		// only the resident chunks' materials are wanted
+		for (const WorldChunk& chunk : UWorldChunks(*gWorld))
+		{
+			if (!chunk.resident)
+				continue;
+			for (const ChunkObject& object : chunk.objects)
+			{
+				const float radius = 0.5f * glm::length(object.scale);
+				URequestTextureResidency(*gTextureStreamer, object.material, UProjectedSize(object.translation, radius, projection), uvRepeat);
+			}
+			for (const ChunkMesh& mesh : chunk.meshes)
+				URequestTextureResidency(*gTextureStreamer, mesh.material, UProjectedSize(mesh.center, mesh.radius, projection), uvRepeat);
+		}
+		return;
+	}
+	for (const SceneObject& object : gSceneObjects)
+	{
+		const float radius = 0.5f * glm::length(object.scale);
+		URequestTextureResidency(*gTextureStreamer, object.material, UProjectedSize(object.translation, radius, projection), uvRepeat);
+	}
+	if (!gImportedMeshes.empty()) // extent unknown: ask for the full window
+		URequestTextureResidency(*gTextureStreamer, MATERIAL_METAL, (float)WINDOW_HEIGHT, uvRepeat);
+}
+
+
+// Draws the scene objects and imported meshes, or the resident world chunks, with the bound program
+// and its material uniforms (empty ones for a program that reads no material)
+void UDrawScene(GLint modelLoc, const MaterialUniforms& materialUniforms)
+{
+	if (gWorld)
+	{
+		for (const WorldChunk& chunk : UWorldChunks(*gWorld))
+		{
+			if (!chunk.resident)
+				continue;
+			for (const ChunkObject& object : chunk.objects)
+				MakeShape(gMaterials[object.material], materialUniforms, object.scale, object.rotAmt, object.rotation, object.translation, modelLoc, (Shape)object.shape);
+			for (const ChunkMesh& mesh : chunk.meshes)
+			{
+				if (!mesh.mesh.vao)
+					continue;
+				glUniformMatrix4fv(modelLoc, 1, GL_FALSE, glm::value_ptr(glm::translate(mesh.offset)));
+				USetMaterial(materialUniforms, gMaterials[mesh.material]);
+				glBindVertexArray(mesh.mesh.vao);
+				glDrawElements(GL_TRIANGLES, mesh.mesh.nIndices, GL_UNSIGNED_INT, nullptr);
+			}
+		}
+		glBindVertexArray(0);
+		return;
+	}
+
+	// The static batch already holds the objects and imported meshes in world space
+	if (gStaticBatch.vao != 0)
+	{
+		glUniformMatrix4fv(modelLoc, 1, GL_FALSE, glm::value_ptr(glm::mat4(1.0f)));
+		glBindVertexArray(gStaticBatch.vao);
+		for (const StaticBatchRange& range : gStaticBatchRanges)
+		{
+			USetMaterial(materialUniforms, gMaterials[range.material]);
+			glDrawElements(GL_TRIANGLES, range.count, GL_UNSIGNED_INT, (void*)(sizeof(GLuint) * range.firstIndex));
+		}
+		glBindVertexArray(0);
+		return;
+	}
+
+	for (const SceneObject& object : gSceneObjects)
+		MakeShape(gMaterials[object.material], materialUniforms, object.scale, object.rotAmt, object.rotation, object.translation, modelLoc, object.shape);
+
+	// Imported meshes
+	if (!gImportedMeshes.empty())
+	{
+		glUniformMatrix4fv(modelLoc, 1, GL_FALSE, glm::value_ptr(glm::mat4(1.0f)));
+		USetMaterial(materialUniforms, gMaterials[MATERIAL_METAL]);
+		for (const Meshes::GLMesh& mesh : gImportedMeshes)
+		{
+			glBindVertexArray(mesh.vao);
+			glDrawElements(GL_TRIANGLES, mesh.nIndices, GL_UNSIGNED_INT, nullptr);
+		}
+		glBindVertexArray(0);
+	}
+}
+
+
+///////////////////////////////////////////////////
+//	UCreateVisibilityScene()
+//
+//	Reads the shapes and imported meshes back from the
+//	GPU into the visibility buffer's shared geometry.
+//	World chunk meshes are loaded and unloaded while the
+//	program runs, so they are not drawn in this mode.
+///////////////////////////////////////////////////
+void UCreateVisibilityScene()
+{
+	const Meshes::GLMesh* shapes[] = { &meshes.gBoxMesh, &meshes.gCylinderMesh, &meshes.gPlaneMesh, &meshes.gSphereMesh, &meshes.gTorusMesh };
+	for (size_t i = 0; i < 5; ++i)
+	{
+		MeshData data;
+		if (UReadbackMesh(*shapes[i], UShapeDrawRanges(meshes, *shapes[i]), data))
+			gVisibilityShapes[i] = UAddVisibilityMesh(gVisibilityBuffer, data);
+	}
+	for (const Meshes::GLMesh& mesh : gImportedMeshes)
+	{
+		MeshData data;
+		if (UReadbackMesh(mesh, {}, data))
+			gVisibilityImportedMeshes.push_back(UAddVisibilityMesh(gVisibilityBuffer, data));
+	}
+	UUploadVisibilityGeometry(gVisibilityBuffer);
+}
+
+// UDrawScene() for the visibility pass: every object becomes one draw record
+void UDrawSceneVisibility()
+{
+	if (gWorld)
+	{
+		for (const WorldChunk& chunk : UWorldChunks(*gWorld))
+		{
+			if (!chunk.resident)
+				continue;
+			for (const ChunkObject& object : chunk.objects)
+				UDrawVisibilityMesh(gVisibilityBuffer, gVisibilityShapes[object.shape],
+					UShapeModel(object.scale, object.rotAmt, object.rotation, object.translation), gMaterials[object.material]);
+		}
+		return;
+	}
+
+	for (const SceneObject& object : gSceneObjects)
+		UDrawVisibilityMesh(gVisibilityBuffer, gVisibilityShapes[int(object.shape)],
+			UShapeModel(object.scale, object.rotAmt, object.rotation, object.translation), gMaterials[object.material]);
+	for (int mesh : gVisibilityImportedMeshes)
+		UDrawVisibilityMesh(gVisibilityBuffer, mesh, glm::mat4(1.0f), gMaterials[MATERIAL_METAL]);
+}
+
+
+// Bounding spheres and draw calls of the shapes and imported meshes, read back once for the shadow casters
+void UCreateShadowScene()
+{
+	const Meshes::GLMesh* shapes[] = { &meshes.gBoxMesh, &meshes.gCylinderMesh, &meshes.gPlaneMesh, &meshes.gSphereMesh, &meshes.gTorusMesh };
+	for (size_t i = 0; i < 5; ++i)
+		UCreateShadowMesh(*shapes[i], UShapeDrawRanges(meshes, *shapes[i]), gShadowShapes[i]);
+	gShadowImportedMeshes.resize(gImportedMeshes.size());
+	for (size_t i = 0; i < gImportedMeshes.size(); ++i)
+		UCreateShadowMesh(gImportedMeshes[i], {}, gShadowImportedMeshes[i]);
+}
+
+// This frame's shadow casters: what UDrawScene() draws
+void UCollectShadowCasters()
+{
+	gShadowCasters.clear();
+	if (gWorld)
+	{
+		for (const WorldChunk& chunk : UWorldChunks(*gWorld))
+		{
+			if (!chunk.resident)
+				continue;
+			for (const ChunkObject& object : chunk.objects)
+				gShadowCasters.push_back(UMakeShadowCaster(gShadowShapes[object.shape], UShapeModel(object.scale, object.rotAmt, object.rotation, object.translation)));
+			for (const ChunkMesh& mesh : chunk.meshes)
+			{
+				ShadowCaster caster;
+				caster.vao = mesh.mesh.vao;
+				caster.indexCount = GLsizei(mesh.mesh.nIndices);
+				caster.model = glm::translate(mesh.offset);
+				caster.center = mesh.center;
+				caster.radius = mesh.radius;
+				gShadowCasters.push_back(caster);
+			}
+		}
+		return;
+	}
+
+	for (const SceneObject& object : gSceneObjects)
+		gShadowCasters.push_back(UMakeShadowCaster(gShadowShapes[int(object.shape)], UShapeModel(object.scale, object.rotAmt, object.rotation, object.translation)));
+	for (const ShadowMesh& mesh : gShadowImportedMeshes)
+		gShadowCasters.push_back(UMakeShadowCaster(mesh, glm::mat4(1.0f)));
+}
+
+
+///////////////////////////////////////////////////
+//	UBakeStaticBatch(int, char*[])
+//
+//	Merges the scene objects and imported meshes into
+//	the static batch and bakes what was asked for against
+//	a BVH of the same triangles. --lightmap unwraps the
+//	batch and bakes the lamps into a lightmap:
+//	--lightmap-density sets texels per unit (8) and
+//	--lightmap-bounce adds one bounce of indirect light,
+//	reflected with each material's average colour.
+//	--vertex-ao bakes ambient occlusion into the vertices,
+//	after splitting triangles down to edges of at most
+//	--vertex-ao-spacing (0.25) so the floor has vertices
+//	to carry it: --vertex-ao-samples rays each (64) count
+//	hits within --vertex-ao-radius (1). --probes traces a
+//	grid of irradiance probes --probe-spacing apart (2),
+//	--probe-rays each (256), retracing --probe-budget of
+//	them a frame (16) after a lamp moves; alone it keeps
+//	the objects' own draws. --shading-cache unwraps the
+//	batch as the lightmap does (sharing its layout when
+//	there is one) at --shading-cache-density (8) and
+//	reshades --shading-cache-budget texels a frame
+//	(65536). A world streams its chunks, so it keeps
+//	dynamic light.
+///////////////////////////////////////////////////
+bool UBakeStaticBatch(int argc, char* argv[])
+{
+	if (gWorld)
+	{
+		std::cout << "INFO: --lightmap, --vertex-ao, --probes and --shading-cache only bake the room; world chunks stay dynamically lit" << std::endl;
+		gLightmapped = gVertexOcclusion = gIrradianceProbes = gShadingCached = false;
+		return true;
+	}
+
+	LightmapBakeOptions options;
+	options.bounce = UHasArgument(argc, argv, "--lightmap-bounce");
+	VertexOcclusionOptions occlusionOptions;
+	float occlusionSpacing = 0.25f;
+	IrradianceProbeOptions probeOptions;
+	probeOptions.skyRadiance = 0.2f * gLightColor; // the flat ambient term the probes replace
+	ShadingCacheOptions cacheOptions;
+	for (int i = 1; i + 1 < argc; ++i)
+	{
+		if (strcmp(argv[i], "--lightmap-density") == 0)
+			options.texelsPerUnit = std::max(0.1f, (float)atof(argv[i + 1]));
+		if (strcmp(argv[i], "--vertex-ao-samples") == 0)
+			occlusionOptions.samples = std::max(4, atoi(argv[i + 1]));
+		if (strcmp(argv[i], "--vertex-ao-radius") == 0)
+			occlusionOptions.radius = std::max(0.01f, (float)atof(argv[i + 1]));
+		if (strcmp(argv[i], "--vertex-ao-spacing") == 0)
+			occlusionSpacing = std::max(0.05f, (float)atof(argv[i + 1]));
+		if (strcmp(argv[i], "--probe-spacing") == 0)
+			probeOptions.spacing = std::max(0.1f, (float)atof(argv[i + 1]));
+		if (strcmp(argv[i], "--probe-rays") == 0)
+			probeOptions.samples = std::max(16, atoi(argv[i + 1]));
+		if (strcmp(argv[i], "--probe-budget") == 0)
+			probeOptions.probesPerFrame = std::max(1, atoi(argv[i + 1]));
+		if (strcmp(argv[i], "--shading-cache-density") == 0)
+			cacheOptions.texelsPerUnit = std::max(0.1f, (float)atof(argv[i + 1]));
+		if (strcmp(argv[i], "--shading-cache-budget") == 0)
+			cacheOptions.texelsPerFrame = size_t(std::max(1, atoi(argv[i + 1])));
+	}
+	// the smallest mip of a material is its average colour
+	if ((gLightmapped && options.bounce) || gIrradianceProbes)
+	{
+		for (const char* texture : gMaterialTextures)
+		{
+			int channels;
+			std::vector<ImageLevel> mips;
+			glm::vec3 albedo(0.5f);
+			if (UDecodeTexture(texture, channels, mips))
+				albedo = glm::vec3(mips.back().pixels[0], mips.back().pixels[1], mips.back().pixels[2]) / 255.0f;
+			options.albedo.push_back(albedo);
+		}
+		probeOptions.albedo = options.albedo;
+	}
+
+	// every object moved into world space once
+	const Meshes::GLMesh* shapes[] = { &meshes.gBoxMesh, &meshes.gCylinderMesh, &meshes.gPlaneMesh, &meshes.gSphereMesh, &meshes.gTorusMesh };
+	MeshData shapeData[5];
+	for (size_t i = 0; i < 5; ++i)
+		UReadbackMesh(*shapes[i], UShapeDrawRanges(meshes, *shapes[i]), shapeData[i]);
+	StaticBatchData batch;
+	for (const SceneObject& object : gSceneObjects)
+		UAddStaticBatchInstance(batch, shapeData[int(object.shape)], UShapeModel(object.scale, object.rotAmt, object.rotation, object.translation), object.material);
+	for (const Meshes::GLMesh& mesh : gImportedMeshes)
+	{
+		MeshData data;
+		if (UReadbackMesh(mesh, {}, data))
+			UAddStaticBatchInstance(batch, data, glm::mat4(1.0f), MATERIAL_METAL);
+	}
+	if (gVertexOcclusion)
+		USubdivideStaticBatch(batch, occlusionSpacing);
+	USortStaticBatch(batch);
+
+	if (gLightmapped && !ULayoutLightmap(batch, options, gLightmap))
+	{
+		std::cout << "Lightmap of " << batch.TriangleCount() << " triangles does not fit in " << lightmapMaxAtlases << " atlases of "
+			<< options.atlasSize << "x" << options.atlasSize << std::endl;
+		return false;
+	}
+	if (gShadingCached)
+	{
+		if (gLightmapped)
+			gShadingCache.atlas = gLightmap.atlas;
+		else if (!ULayoutShadingCache(batch, cacheOptions, gShadingCache))
+		{
+			std::cout << "Shading cache of " << batch.TriangleCount() << " triangles does not fit in " << lightmapMaxAtlases << " atlases of "
+				<< cacheOptions.atlasSize << "x" << cacheOptions.atlasSize << std::endl;
+			return false;
+		}
+	}
+	const double bvhStart = glfwGetTime();
+	SceneBVH bvh;
+	UBuildSceneBVH(UStaticBatchTriangles(batch), bvh);
+	std::cout << "INFO: Scene BVH of " << batch.TriangleCount() << " triangles: " << bvh.nodes.size() << " nodes, depth " << bvh.depth
+		<< ", built in " << (glfwGetTime() - bvhStart) * 1000.0 << " ms" << std::endl;
+	if (gLightmapped)
 	{
-		cout << "Failed to load texture " << couchTex << endl;
-		return EXIT_FAILURE;
+		UBakeLightmap(batch, bvh, gLights, options, gLightmap);
+		UPrintLightmapStats(gLightmap);
+		UCreateLightmapTexture(gLightmap);
+		gStaticBatchResources.push_back(URegisterResource(gResources, ResourceType::Texture, gLightmap.texture, gLightmap.texels.size() * 6, "lightmap"));
 	}
-	if (!UCreateTexture(metalTex, gMetalTexId))
+	if (gVertexOcclusion)
 	{
-		cout << "Failed to load texture " << metalTex << endl;
-		return EXIT_FAILURE;
+		VertexOcclusionStats occlusionStats;
+		UBakeVertexOcclusion(batch, bvh, occlusionOptions, occlusionStats);
+		UPrintVertexOcclusionStats(occlusionStats);
 	}
-	if (!UCreateTexture(woodFloorTex, gWoodFloorTexId))
+	if (gIrradianceProbes)
 	{
-		cout << "Failed to load texture " << woodFloorTex << endl;
-		return EXIT_FAILURE;
+		UCreateIrradianceProbes(batch, bvh, gLights, probeOptions, gProbes);
+		UPrintIrradianceProbeStats(gProbes);
 	}
-	// tell opengl for each sampler to which texture unit it belongs to (only has to be done once)
-	glUseProgram(gProgramId);
-	// We set the texture as texture unit 0
-	glUniform1i(glGetUniformLocation(gProgramId, "uTexture"), 0);
-	// Sets the background color of the window to black (it will be implicitely used by glClear)
-	glClearColor(0.0f, 0.0f, 0.0f, 1.0f);
-
-	// render loop
-	// -----------
-	while (!glfwWindowShouldClose(gWindow))
+	if (gShadingCached)
 	{
-		// per-frame timing
-		// --------------------
-		float currentFrame = glfwGetTime();
-		gDeltaTime = currentFrame - gLastFrame;
-		gLastFrame = currentFrame;
-
-		// input
-		// -----
-		UProcessInput(gWindow);
-
-		// Render this frame
-		URender();
-
-		glfwPollEvents();
+		if (!UCreateShadingCache(batch, cacheOptions, gShadingCache))
+			return false;
+		UPrintShadingCacheStats(gShadingCache);
 	}
+	if (!gLightmapped && !gVertexOcclusion && !gShadingCached)
+		return true;
 
-	// Release mesh data
-	//UDestroyMesh(gMesh);
-	meshes.DestroyMeshes();
-
-	// Release texture
-	UDestroyTexture(gCouchTexId);
-	UDestroyTexture(gMetalTexId);
-	UDestroyTexture(gWoodFloorTexId);
+	UCreateStaticBatch(batch, gStaticBatch);
+	gStaticBatchRanges = batch.ranges;
+	gStaticBatchResources.push_back(URegisterResource(gResources, ResourceType::VertexArray, gStaticBatch.vao, 0, "static batch"));
+	gStaticBatchResources.push_back(URegisterResource(gResources, ResourceType::Buffer, gStaticBatch.vbos[0], batch.vertices.size() * sizeof(GLfloat), "static batch"));
+	gStaticBatchResources.push_back(URegisterResource(gResources, ResourceType::Buffer, gStaticBatch.vbos[1], batch.indices.size() * sizeof(GLuint), "static batch"));
+	std::cout << "INFO: Static batch of " << batch.instances << " objects, " << batch.TriangleCount() << " triangles in "
+		<< batch.ranges.size() << " draws" << std::endl;
+	return true;
+}
 
-	// Release shader program
-	UDestroyShaderProgram(gProgramId);
 
-	exit(EXIT_SUCCESS); // Terminates the program successfully
+// Inserts header right after the #version line of source and appends tail
+std::string UComposeShaderSource(const char* source, const char* header, const char* tail)
+{
+	std::string composed(source);
+	size_t afterVersion = composed.find('\n');
+	afterVersion = afterVersion == std::string::npos ? composed.size() : afterVersion + 1;
+	composed.insert(afterVersion, header);
+	composed += "\n";
+	composed += tail;
+	return composed;
 }
 
 
@@ -359,6 +1601,468 @@ bool UInitialize(int argc, char* argv[], GLFWwindow** window)
 }
 
 
+// Returns true when flag was passed on the command line
+bool UHasArgument(int argc, char* argv[], const char* flag)
+{
+	for (int i = 1; i < argc; ++i)
+	{
+		if (strcmp(argv[i], flag) == 0)
+			return true;
+	}
+	return false;
+}
+
+// Reads every shape the scene draws back from the GPU, builds a LOD chain for it on all threads and uploads the levels
+void UBuildShapeLods()
+{
+	// in Shape order
+	const Meshes::GLMesh* shapes[] = { &meshes.gBoxMesh, &meshes.gCylinderMesh, &meshes.gPlaneMesh, &meshes.gSphereMesh, &meshes.gTorusMesh };
+
+	std::vector<MeshData> shapeData(std::size(shapes));
+	for (size_t i = 0; i < shapeData.size(); ++i)
+	{
+		UReadbackMesh(*shapes[i], UShapeDrawRanges(meshes, *shapes[i]), shapeData[i]);
+		UWeldVertices(shapeData[i]);
+	}
+
+	LodChainOptions options;
+	std::vector<MeshLodChain> chains;
+	UBuildLodChains(shapeData, options, chains);
+
+	for (size_t i = 0; i < chains.size(); ++i)
+	{
+		cout << "INFO: Mesh " << i << " LODs:";
+		for (const MeshLod& lod : chains[i].lods)
+			cout << " " << lod.nIndices / 3 << " tris (error " << lod.error << ")";
+		cout << endl;
+
+		// a shape that could not be read back keeps drawing its own mesh
+		if (chains[i].data.indices.empty())
+			continue;
+		gShapeLods[i] = std::move(chains[i]);
+		Meshes::GLMesh& mesh = gShapeLodMeshes[i];
+		UCreateMeshFromData(gShapeLods[i].data, mesh);
+		gShapeLodResources.push_back(URegisterResource(gResources, ResourceType::VertexArray, mesh.vao, 0, "shape lods"));
+		gShapeLodResources.push_back(URegisterResource(gResources, ResourceType::Buffer, mesh.vbos[0], gShapeLods[i].data.vertices.size() * sizeof(GLfloat), "shape lods"));
+		gShapeLodResources.push_back(URegisterResource(gResources, ResourceType::Buffer, mesh.vbos[1], gShapeLods[i].data.indices.size() * sizeof(GLuint), "shape lods"));
+	}
+}
+
+void UDestroyShapeLods()
+{
+	for (ResourceHandle& resource : gShapeLodResources)
+		UReleaseResource(gResources, resource);
+	gShapeLodResources.clear();
+	for (size_t i = 0; i < std::size(gShapeLods); ++i)
+	{
+		gShapeLods[i] = MeshLodChain();
+		gShapeLodMeshes[i] = Meshes::GLMesh();
+	}
+}
+
+// Builds the clustered versions of the cylinder, sphere and torus and the index ring they draw from
+void UCreateShapeClusters()
+{
+	struct { const Meshes::GLMesh* mesh; ClusterMesh* clusters; } shapes[] = {
+		{ &meshes.gCylinderMesh, &gCylinderClusters },
+		{ &meshes.gSphereMesh, &gSphereClusters },
+		{ &meshes.gTorusMesh, &gTorusClusters }
+	};
+
+	GLuint totalIndices = 0;
+	for (auto& shape : shapes)
+	{
+		MeshData data;
+		UReadbackMesh(*shape.mesh, UShapeDrawRanges(meshes, *shape.mesh), data);
+		UWeldVertices(data);
+		UCreateClusterMesh(data, *shape.clusters);
+		totalIndices += shape.clusters->mesh.nIndices;
+	}
+
+	// room for every clustered object in the scene drawing all of its triangles
+	UCreateClusterIndexRing(gClusterRing, totalIndices * 32);
+}
+
+// Reports how much the cluster culling saved and releases the cluster meshes
+void UDestroyShapeClusters()
+{
+	if (gClusterStats.triangles > 0)
+	{
+		cout << "INFO: Cluster culling tested " << gClusterStats.meshlets << " clusters, rejected "
+			<< 100.0 * gClusterStats.frustumCulled / gClusterStats.meshlets << "% by frustum and "
+			<< 100.0 * gClusterStats.backfaceCulled / gClusterStats.meshlets << "% by normal cone; drew "
+			<< 100.0 * gClusterStats.trianglesDrawn / gClusterStats.triangles << "% of the triangles" << endl;
+	}
+
+	UDestroyClusterMesh(gCylinderClusters);
+	UDestroyClusterMesh(gSphereClusters);
+	UDestroyClusterMesh(gTorusClusters);
+	UDestroyClusterIndexRing(gClusterRing);
+}
+
+// Loads every --import file in parallel and uploads the results as indexed meshes
+void UImportSceneMeshes(int argc, char* argv[])
+{
+	std::vector<std::string> paths;
+	for (int i = 1; i + 1 < argc; ++i)
+	{
+		if (strcmp(argv[i], "--import") == 0)
+			paths.push_back(argv[++i]);
+	}
+	if (paths.empty())
+		return;
+
+	std::vector<MeshImport> imports;
+	UImportMeshes(paths, imports);
+	for (const MeshImport& import : imports)
+	{
+		if (!import.ok)
+			continue;
+
+		// The same geometry imported twice shares its buffers
+		const MeshData& data = import.data;
+		const uint64_t meshHash = UHashBytes(data.indices.data(), data.indices.size() * sizeof(GLuint),
+			UHashBytes(data.vertices.data(), data.vertices.size() * sizeof(GLfloat)));
+		const uint64_t vertexHash = UHashBytes(&meshHash, sizeof(meshHash)); // the index buffer is keyed by meshHash
+		ResourceHandle vao = UAcquireResource(gResources, ResourceType::VertexArray, meshHash);
+		if (vao.Valid())
+		{
+			for (const Meshes::GLMesh& mesh : gImportedMeshes)
+			{
+				if (mesh.vao == UResourceName(gResources, vao))
+				{
+					gImportedMeshes.push_back(mesh);
+					break;
+				}
+			}
+			gImportedMeshResources.push_back(vao);
+			gImportedMeshResources.push_back(UAcquireResource(gResources, ResourceType::Buffer, vertexHash));
+			gImportedMeshResources.push_back(UAcquireResource(gResources, ResourceType::Buffer, meshHash));
+			continue;
+		}
+
+		gImportedMeshes.emplace_back();
+		Meshes::GLMesh& mesh = gImportedMeshes.back();
+		UCreateMeshFromData(data, mesh);
+		const char* label = import.path.c_str();
+		gImportedMeshResources.push_back(URegisterResource(gResources, ResourceType::VertexArray, mesh.vao, 0, label, meshHash));
+		gImportedMeshResources.push_back(URegisterResource(gResources, ResourceType::Buffer, mesh.vbos[0], data.vertices.size() * sizeof(GLfloat), label, vertexHash));
+		gImportedMeshResources.push_back(URegisterResource(gResources, ResourceType::Buffer, mesh.vbos[1], data.indices.size() * sizeof(GLuint), label, meshHash));
+	}
+}
+
+void UDestroyImportedMeshes()
+{
+	for (ResourceHandle& resource : gImportedMeshResources)
+		UReleaseResource(gResources, resource);
+	gImportedMeshResources.clear();
+	gImportedMeshes.clear();
+}
+
+///////////////////////////////////////////////////
+//	UCreateWorld(int, char*[])
+//
+//	--world <file>: chunks from a world file
+//	--world-rooms <n>: n x n copies of the room, one chunk
+//	                   each, with every --import file placed
+//	                   in every room
+//	--world-budget <MB>: memory for the chunk meshes
+//
+//	Leaves gWorld empty when neither option is given
+///////////////////////////////////////////////////
+bool UCreateWorld(int argc, char* argv[])
+{
+	std::vector<WorldChunk> chunks;
+	WorldStreamingOptions options;
+	options.registry = &gResources;
+	int rooms = 0;
+	for (int i = 1; i + 1 < argc; ++i)
+	{
+		if (strcmp(argv[i], "--world") == 0 && !ULoadWorldFile(argv[i + 1], chunks))
+			return false;
+		if (strcmp(argv[i], "--world-rooms") == 0)
+			rooms = std::max(1, atoi(argv[i + 1]));
+		if (strcmp(argv[i], "--world-budget") == 0)
+			options.budget = size_t(std::max(0.0, atof(argv[i + 1])) * 1024.0 * 1024.0);
+	}
+
+	if (chunks.empty() && rooms > 0)
+	{
+		std::vector<std::string> meshes;
+		for (int i = 1; i + 1 < argc; ++i)
+		{
+			if (strcmp(argv[i], "--import") == 0)
+				meshes.push_back(argv[++i]);
+		}
+		for (int row = 0; row < rooms; ++row)
+		{
+			for (int column = 0; column < rooms; ++column)
+			{
+				const glm::vec3 offset(column * worldRoomSpacing, 0.0f, -row * worldRoomSpacing);
+				WorldChunk chunk;
+				chunk.min = worldRoomCenter + glm::vec2(offset.x, offset.z) - glm::vec2(0.5f * worldRoomSpacing);
+				chunk.max = chunk.min + glm::vec2(worldRoomSpacing);
+				for (const SceneObject& object : gSceneObjects)
+				{
+					ChunkObject chunkObject;
+					chunkObject.shape = (int)object.shape;
+					chunkObject.material = object.material;
+					chunkObject.scale = object.scale;
+					chunkObject.rotAmt = object.rotAmt;
+					chunkObject.rotation = object.rotation;
+					chunkObject.translation = object.translation + offset;
+					chunk.objects.push_back(chunkObject);
+				}
+				for (const std::string& path : meshes)
+				{
+					ChunkMesh mesh;
+					mesh.path = path;
+					mesh.material = MATERIAL_METAL;
+					mesh.offset = offset;
+					chunk.meshes.push_back(mesh);
+				}
+				chunks.push_back(chunk);
+			}
+		}
+	}
+	if (chunks.empty())
+		return true;
+
+	const int materialCount = (int)gMaterialTextures.size();
+	for (const WorldChunk& chunk : chunks)
+	{
+		for (const ChunkObject& object : chunk.objects)
+		{
+			if (object.material < 0 || object.material >= materialCount)
+			{
+				std::cout << "World object uses material " << object.material << "; there are " << materialCount << std::endl;
+				return false;
+			}
+		}
+		for (const ChunkMesh& mesh : chunk.meshes)
+		{
+			if (mesh.material < 0 || mesh.material >= materialCount)
+			{
+				std::cout << "World mesh " << mesh.path << " uses material " << mesh.material << "; there are " << materialCount << std::endl;
+				return false;
+			}
+		}
+	}
+
+	gWorld = UCreateWorldStreamer(std::move(chunks), options);
+	return gWorld != nullptr;
+}
+
+// Camera path for --flythrough: from the first chunk to the nearest one not yet visited, until all are
+void UCreateFlythrough()
+{
+	const std::vector<WorldChunk>& chunks = UWorldChunks(*gWorld);
+	std::vector<bool> visited(chunks.size(), false);
+	size_t current = 0;
+	for (size_t step = 0; step < chunks.size(); ++step)
+	{
+		visited[current] = true;
+		const glm::vec2 center = 0.5f * (chunks[current].min + chunks[current].max);
+		gFlythrough.points.push_back(glm::vec3(center.x, gCamera.Position.y, center.y));
+
+		size_t next = chunks.size();
+		float nearest = 0.0f;
+		for (size_t i = 0; i < chunks.size(); ++i)
+		{
+			const float distance = glm::length(0.5f * (chunks[i].min + chunks[i].max) - center);
+			if (!visited[i] && (next == chunks.size() || distance < nearest))
+			{
+				next = i;
+				nearest = distance;
+			}
+		}
+		if (next == chunks.size())
+			break;
+		current = next;
+	}
+	if (gFlythrough.points.size() == 1) // a single chunk: cross it
+		gFlythrough.points.push_back(gFlythrough.points[0] + glm::vec3(0.5f * worldRoomSpacing, 0.0f, 0.0f));
+	gFlythrough.frameTimes.clear();
+	gFlythrough.travelled = 0.0f;
+}
+
+// Point at a distance along the fly-through path, clamped to its ends
+glm::vec3 UFlythroughPoint(float distance)
+{
+	const std::vector<glm::vec3>& points = gFlythrough.points;
+	for (size_t i = 0; i + 1 < points.size(); ++i)
+	{
+		const float length = glm::length(points[i + 1] - points[i]);
+		if (distance <= length)
+			return points[i] + (points[i + 1] - points[i]) * (length > 0.0f ? distance / length : 0.0f);
+		distance -= length;
+	}
+	return points.back();
+}
+
+///////////////////////////////////////////////////
+//	UAdvanceFlythrough(float)
+//
+//	deltaTime: the last frame's time, which is recorded
+//
+//	Moves the camera along the path and turns it toward a
+//	point further along. Returns false past the end.
+///////////////////////////////////////////////////
+bool UAdvanceFlythrough(float deltaTime)
+{
+	if (gFlythrough.travelled > 0.0f) // the first frame includes startup
+		gFlythrough.frameTimes.push_back(deltaTime);
+	gFlythrough.travelled += gFlythrough.speed * std::max(deltaTime, 1e-4f);
+
+	float pathLength = 0.0f;
+	for (size_t i = 0; i + 1 < gFlythrough.points.size(); ++i)
+		pathLength += glm::length(gFlythrough.points[i + 1] - gFlythrough.points[i]);
+	if (gFlythrough.travelled > pathLength)
+		return false;
+
+	gCamera.Position = UFlythroughPoint(gFlythrough.travelled);
+	const glm::vec3 toward = UFlythroughPoint(gFlythrough.travelled + gFlythrough.lookAhead) - gCamera.Position;
+	if (glm::length(toward) > 1e-3f)
+	{
+		gCamera.Yaw = glm::degrees(atan2f(toward.z, toward.x));
+		gCamera.Pitch = -10.0f;
+		gCamera.ProcessMouseMovement(0.0f, 0.0f);
+	}
+	return true;
+}
+
+// Frame time statistics of the finished fly-through
+void UReportFlythrough()
+{
+	std::vector<float> times = gFlythrough.frameTimes;
+	if (times.empty())
+		return;
+	std::sort(times.begin(), times.end());
+	double total = 0.0;
+	for (float time : times)
+		total += time;
+	const float hitch = 1.0f / 30.0f;
+	const size_t hitches = size_t(times.end() - std::upper_bound(times.begin(), times.end(), hitch));
+	std::cout << "INFO: Fly-through: " << times.size() << " frames, average " << total / times.size() * 1000.0 << " ms, median "
+		<< times[times.size() / 2] * 1000.0f << " ms, 99th percentile " << times[std::min(times.size() - 1, times.size() * 99 / 100)] * 1000.0f
+		<< " ms, max " << times.back() * 1000.0f << " ms, " << hitches << " frames over " << hitch * 1000.0f << " ms" << std::endl;
+}
+
+///////////////////////////////////////////////////
+//	UCreateLights(int, char*[])
+//
+//	--lights <n>: n extra coloured lamps on a jittered
+//	              grid over the floor, of the room or of
+//	              the whole world, each lighting a few
+//	              units around it
+//
+//	The room's two lamps light everything, as before.
+///////////////////////////////////////////////////
+bool UCreateLights(int argc, char* argv[])
+{
+	int count = 0;
+	for (int i = 1; i + 1 < argc; ++i)
+	{
+		if (strcmp(argv[i], "--lights") == 0)
+			count = std::max(0, atoi(argv[i + 1]));
+	}
+	// room for the largest --bench-lights step
+	const int capacity = UHasArgument(argc, argv, "--bench-lights") ? std::max(count, benchmarkLightCounts[std::size(benchmarkLightCounts) - 1]) : count;
+
+	UScatterLights(count);
+	const GLuint lights = GLuint(2 + capacity);
+	// roughly a few hundred clusters per lamp, within a fixed ceiling
+	const GLuint maxIndices = std::min(std::max(65536u, lights * 1024u), 1u << 22);
+	return UCreateLightClusterGrid(gLightClusters, WINDOW_WIDTH, WINDOW_HEIGHT, 16, 24, 0.1f, 100.0f, lights, maxIndices);
+}
+
+// The room's two lamps, then count lamps spread over the floor
+void UScatterLights(int count)
+{
+	gLights.clear();
+	PointLight light;
+	light.position = gLightPosition;
+	light.color = gLightColor;
+	light.specular = 1.0f;
+	gLights.push_back(light);
+	light.position = gLightPosition2;
+	light.color = gLightColor2;
+	light.specular = 0.1f;
+	gLights.push_back(light);
+
+	// the room's floor, or every chunk of the world
+	glm::vec2 low(-5.5f, -10.0f), high(12.5f, 6.0f);
+	if (gWorld && !UWorldChunks(*gWorld).empty())
+	{
+		low = UWorldChunks(*gWorld).front().min;
+		high = UWorldChunks(*gWorld).front().max;
+		for (const WorldChunk& chunk : UWorldChunks(*gWorld))
+		{
+			low = glm::min(low, chunk.min);
+			high = glm::max(high, chunk.max);
+		}
+	}
+
+	std::mt19937 random(1);
+	std::uniform_real_distribution<float> unit(0.0f, 1.0f);
+	const glm::vec2 size = high - low;
+	const int columns = std::max(1, int(std::ceil(std::sqrt(count * size.x / std::max(size.y, 1.0f)))));
+	const int rows = std::max(1, (count + columns - 1) / columns);
+	const glm::vec2 cell = size / glm::vec2(float(columns), float(rows));
+	for (int i = 0; i < count; ++i)
+	{
+		const glm::vec2 corner = low + cell * glm::vec2(float(i % columns), float(i / columns));
+		const glm::vec2 spot = corner + cell * glm::vec2(unit(random), unit(random));
+		light.position = glm::vec3(spot.x, 2.0f + unit(random), spot.y);
+		light.radius = 3.0f + 2.0f * unit(random);
+		light.color = glm::vec3(0.2f) + 0.6f * glm::vec3(unit(random), unit(random), unit(random));
+		light.specular = 0.5f;
+		gLights.push_back(light);
+	}
+	if (count > 0)
+		std::cout << "INFO: " << count << " extra lamps over " << size.x << " x " << size.y << " units" << std::endl;
+}
+
+///////////////////////////////////////////////////
+//	UBenchmarkRenderers()
+//
+//	--bench-lights: renders the room from the start
+//	position with forward shading, deferred shading and
+//	the visibility buffer at each of
+//	benchmarkLightCounts, waiting for the GPU after every
+//	frame, and prints the average frame time of each.
+//	The swap interval is 0 while it runs.
+///////////////////////////////////////////////////
+void UBenchmarkRenderers()
+{
+	const int warmupFrames = 10;
+	const int timedFrames = 60;
+	glfwSwapInterval(0);
+	std::cout << "INFO: Lamps, forward ms, deferred ms, visibility ms" << std::endl;
+	for (int count : benchmarkLightCounts)
+	{
+		UScatterLights(count);
+		double frameMs[3] = {};
+		for (int renderer = 0; renderer < 3; ++renderer)
+		{
+			gDeferred = renderer == 1;
+			gVisibility = renderer == 2;
+			for (int frame = 0; frame < warmupFrames + timedFrames; ++frame)
+			{
+				const double start = glfwGetTime();
+				URender();
+				glFinish();
+				if (frame >= warmupFrames)
+					frameMs[renderer] += (glfwGetTime() - start) * 1000.0 / timedFrames;
+				glfwPollEvents();
+			}
+		}
+		std::cout << "INFO: " << count << ", " << frameMs[0] << ", " << frameMs[1] << ", " << frameMs[2] << std::endl;
+	}
+	gDeferred = false;
+	gVisibility = false;
+}
+
 // process all input: query GLFW whether relevant keys are pressed/released this frame and react accordingly
 void UProcessInput(GLFWwindow* window)
 {
@@ -389,6 +2093,15 @@ void UProcessInput(GLFWwindow* window)
 	if (glfwGetKey(window, GLFW_KEY_E) == GLFW_PRESS)
 		gCamera.ProcessKeyboard(DOWN, gDeltaTime);
 		//gCamera.Position.y -= cameraSpeed * gDeltaTime;
+
+	// Left and right slide the main lamp, unless its light is baked into the lightmap
+	if (!gLightmapped && !gLights.empty())
+	{
+		if (glfwGetKey(window, GLFW_KEY_LEFT) == GLFW_PRESS)
+			gLights[0].position.x -= 2.0f * gDeltaTime;
+		if (glfwGetKey(window, GLFW_KEY_RIGHT) == GLFW_PRESS)
+			gLights[0].position.x += 2.0f * gDeltaTime;
+	}
 }
 
 // glfw: whenever the mouse moves, this callback is called
@@ -408,7 +2121,7 @@ void UMousePositionCallback(GLFWwindow* window, double xpos, double ypos)
 	gLastX = xpos;
 	gLastY = ypos;
 
-	if (isPerspective)
+	if (isPerspective && gFlythrough.points.empty())
 		gCamera.ProcessMouseMovement(xoffset, yoffset);
 }
 
@@ -437,27 +2150,59 @@ void UResizeWindow(GLFWwindow* window, int width, int height)
 	glViewport(0, 0, width, height);
 }
 
-void MakeShape(GLuint p_texId, glm::vec3 p_scale, float p_rotAmt, glm::vec3 p_rotation, glm::vec3 p_translation, GLint p_modelLoc, Shape p_shape) {
+// Model matrix of a scene object, as MakeShape() draws it
+glm::mat4 UShapeModel(glm::vec3 p_scale, float p_rotAmt, glm::vec3 p_rotation, glm::vec3 p_translation)
+{
+	// 1. Scales the object
+	glm::mat4 scale = glm::scale(p_scale);
+	// 2. Rotate the object
+	glm::mat4 rotation = glm::rotate(p_rotAmt, p_rotation);
+	// 3. Position the object
+	glm::mat4 translation = glm::translate(p_translation);
+	// Model matrix: transformations are applied right-to-left order
+	return translation * rotation * scale;
+}
+
+void MakeShape(const TextureRef& p_texture, const MaterialUniforms& p_materialUniforms, glm::vec3 p_scale, float p_rotAmt, glm::vec3 p_rotation, glm::vec3 p_translation, GLint p_modelLoc, Shape p_shape) {
 	/// First couch leg
 	///-------Transform and draw the cylinder mesh --------
 	// Activate the VBOs contained within the mesh's VAO
-	glBindTexture(GL_TEXTURE_2D, p_texId);
+	USetMaterial(p_materialUniforms, p_texture);
 	switch (p_shape) {
 	case Shape::CUBE:glBindVertexArray(meshes.gBoxMesh.vao); break;
 	case Shape::CYLINDER: glBindVertexArray(meshes.gCylinderMesh.vao); break;
 	case Shape::PLANE: glBindVertexArray(meshes.gPlaneMesh.vao); break;
+	case Shape::SPHERE: glBindVertexArray(meshes.gSphereMesh.vao); break;
+	case Shape::TORUS: glBindVertexArray(meshes.gTorusMesh.vao); break;
 	}
 	
-	// 1. Scales the object
-	glm::mat4 scale = glm::scale(p_scale);
-	// 2. Rotate the object
-	glm::mat4 rotation = glm::rotate(p_rotAmt, p_rotation);
-	// 3. Position the object
-	glm::mat4 translation = glm::translate(p_translation);
-	// Model matrix: transformations are applied right-to-left order
-	glm::mat4 model = translation * rotation * scale;
+	glm::mat4 model = UShapeModel(p_scale, p_rotAmt, p_rotation, p_translation);
 	glUniformMatrix4fv(p_modelLoc, 1, GL_FALSE, glm::value_ptr(model));
 
+	// With --build-lods, the coarsest level whose error stays under a pixel at this distance
+	const MeshLodChain& lods = gShapeLods[int(p_shape)];
+	if (!lods.lods.empty())
+	{
+		const float objectScale = std::max(p_scale.x, std::max(p_scale.y, p_scale.z));
+		const float distance = glm::length(p_translation - gCamera.Position);
+		const MeshLod& lod = lods.lods[USelectLod(lods, objectScale, distance, float(WINDOW_HEIGHT), glm::radians(gCamera.Zoom))];
+		glBindVertexArray(gShapeLodMeshes[int(p_shape)].vao);
+		glDrawElements(GL_TRIANGLES, lod.nIndices, GL_UNSIGNED_INT, (void*)(sizeof(GLuint) * lod.firstIndex));
+		glBindVertexArray(0);
+		return;
+	}
+
+	// Curved meshes only submit the clusters that survive culling
+	if (gClusterCulling)
+	{
+		switch (p_shape) {
+		case Shape::CYLINDER: UDrawClusterMesh(gCylinderClusters, model, gClusterView, gClusterRing, gClusterStats); return;
+		case Shape::SPHERE: UDrawClusterMesh(gSphereClusters, model, gClusterView, gClusterRing, gClusterStats); return;
+		case Shape::TORUS: UDrawClusterMesh(gTorusClusters, model, gClusterView, gClusterRing, gClusterStats); return;
+		default: break;
+		}
+	}
+
 	switch (p_shape) {
 		case Shape::CUBE: {
 			glDrawElements(GL_TRIANGLES, meshes.gBoxMesh.nIndices, GL_UNSIGNED_INT, (void*)0);
@@ -473,6 +2218,14 @@ void MakeShape(GLuint p_texId, glm::vec3 p_scale, float p_rotAmt, glm::vec3 p_ro
 			glDrawElements(GL_TRIANGLES, meshes.gPlaneMesh.nIndices, GL_UNSIGNED_INT, (void*)0);
 			break;
 		}
+		case Shape::SPHERE: {
+			glDrawElements(GL_TRIANGLES, meshes.gSphereMesh.nIndices, GL_UNSIGNED_INT, (void*)0);
+			break;
+		}
+		case Shape::TORUS: {
+			glDrawArrays(GL_TRIANGLES, 0, meshes.gTorusMesh.nVertices);
+			break;
+		}
 	}
 
 	// Deactivate the Vertex Array Object
@@ -509,6 +2262,13 @@ void URender()
 	else
 		projection = glm::ortho(-10.0f, 10.0f, -10.0f, 10.0f, 0.1f, 100.0f);
 
+	// Frustum and camera for this frame's cluster culling
+	if (gClusterCulling)
+	{
+		gClusterView = UMakeClusterCullView(view, projection, gCamera.Position, gCamera.Front, isPerspective);
+		UBeginClusterFrame(gClusterRing);
+	}
+
 	// Set the shader to be used
 	glUseProgram(gProgramId);
 
@@ -521,230 +2281,178 @@ void URender()
 	glUniformMatrix4fv(viewLoc, 1, GL_FALSE, glm::value_ptr(view));
 	glUniformMatrix4fv(projLoc, 1, GL_FALSE, glm::value_ptr(projection));
 
-	// Reference matrix uniforms from the Cube Shader program for the cub color, light color, light position, and camera position
+	// Reference matrix uniforms from the Cube Shader program for the cube color and camera position
 	GLint objectColorLoc = glGetUniformLocation(gProgramId, "objectColor");;
-	GLint lightColorLoc = glGetUniformLocation(gProgramId, "lightColor");
-	GLint lightPositionLoc = glGetUniformLocation(gProgramId, "lightPos");
-	GLint lightColorLoc2 = glGetUniformLocation(gProgramId, "lightColor2");
-	GLint lightPositionLoc2 = glGetUniformLocation(gProgramId, "lightPos2");
 	GLint viewPositionLoc = glGetUniformLocation(gProgramId, "viewPosition");
 	
-	// Pass color, light, and camera data to the Cube Shader program's corresponding uniforms
+	// Pass color and camera data to the Cube Shader program's corresponding uniforms
 	glUniform3f(objectColorLoc, gObjectColor.r, gObjectColor.g, gObjectColor.b);
-	glUniform3f(lightColorLoc, gLightColor.r, gLightColor.g, gLightColor.b);
-	glUniform3f(lightPositionLoc, gLightPosition.x, gLightPosition.y, gLightPosition.z);
-	glUniform3f(lightColorLoc2, gLightColor2.r, gLightColor2.g, gLightColor2.b);
-	glUniform3f(lightPositionLoc2, gLightPosition2.x, gLightPosition2.y, gLightPosition2.z);
 	const glm::vec3 cameraPosition = gCamera.Position;
 	glUniform3f(viewPositionLoc, cameraPosition.x, cameraPosition.y, cameraPosition.z);
 
 	GLint UVScaleLoc = glGetUniformLocation(gProgramId, "uvScale");
 	glUniform2fv(UVScaleLoc, 1, glm::value_ptr(gUVScale));
 
-	// Floor Plane
-	MakeShape(gWoodFloorTexId, // Texture
-				glm::vec3(9.0f, 1.0f, 8.0f), // Scale
-				0.0f, glm::vec3(1.0f, 1.0f, 1.0f), // Rotation
-				glm::vec3(3.5f, 0.0f, -2.0f), // Translation
-				modelLoc, Shape::PLANE);
-
-	// Close Left Couch Leg
-	MakeShape(gMetalTexId, // Texture
-		glm::vec3(0.1f, 0.4f, 0.1f), // Scale
-		0.0f, glm::vec3(1.0f, 1.0f, 1.0f), // Rotation
-		glm::vec3(-4.7f, 0.01f, -2.0f), // Translation
-		modelLoc, Shape::CYLINDER);
-
-	// Close Right Couch Leg
-	MakeShape(gMetalTexId, // Texture
-		glm::vec3(0.1f, 0.4f, 0.1f), // Scale
-		0.0f, glm::vec3(1.0f, 1.0f, 1.0f), // Rotation
-		glm::vec3(-2.5f, 0.01f, -2.0f), // Translation
-		modelLoc, Shape::CYLINDER);
-
-	// Back Middle Couch Leg
-	MakeShape(gMetalTexId, // Texture
-		glm::vec3(0.1f, 0.4f, 0.1f), // Scale
-		0.0f, glm::vec3(1.0f, 1.0f, 1.0f), // Rotation
-		glm::vec3(-1.9f, 0.01f, -7.0f), // Translation
-		modelLoc, Shape::CYLINDER);
-
-	// Back Right Couch Leg
-	MakeShape(gMetalTexId, // Texture
-		glm::vec3(0.1f, 0.4f, 0.1f), // Scale
-		0.0f, glm::vec3(1.0f, 1.0f, 1.0f), // Rotation
-		glm::vec3(3.0f, 0.01f, -7.0f), // Translation
-		modelLoc, Shape::CYLINDER);
-
-	// Closest Seat Cushion
-	MakeShape(gCouchTexId, // Texture
-		glm::vec3(3.0f, 1.5f, 8.0f), // Scale
-		0.0f, glm::vec3(1.0f, 1.0f, 1.0f), // Rotation
-		glm::vec3(-3.5f, 1.0f, -5.75f), // Translation
-		modelLoc, Shape::CUBE);
-
-	// Left Side Back Rest
-	MakeShape(gCouchTexId, // Texture
-		glm::vec3(1.0f, 1.5f, 6.0f), // Scale
-		0.0f, glm::vec3(1.0f, 1.0f, 1.0f), // Rotation
-		glm::vec3(-4.5f, 2.5f, -6.75f), // Translation
-		modelLoc, Shape::CUBE);
-
-	// Further Seat Cushion
-	MakeShape(gCouchTexId, // Texture
-		glm::vec3(5.5f, 1.5f, 3.0f), // Scale
-		0.0f, glm::vec3(1.0f, 1.0f, 1.0f), // Rotation
-		glm::vec3(0.75f, 1.0f, -8.25f), // Translation
-		modelLoc, Shape::CUBE);
-
-	// Further Back Rest
-	MakeShape(gCouchTexId, // Texture
-		glm::vec3(7.5f, 1.5f, 0.5f), // Scale
-		0.0f, glm::vec3(1.0f, 1.0f, 1.0f), // Rotation
-		glm::vec3(-0.25f, 2.5f, -9.5f), // Translation
-		modelLoc, Shape::CUBE);
-
-	// Right Side Arm Rest
-	MakeShape(gCouchTexId, // Texture
-		glm::vec3(0.5f, 2.5f, 3.125f), // Scale
-		0.0f, glm::vec3(1.0f, 1.0f, 1.0f), // Rotation
-		glm::vec3(3.75f, 1.5f, -8.25f), // Translation
-		modelLoc, Shape::CUBE);
-
-	// Table Left Leg
-	MakeShape(gWoodFloorTexId, // Texture
-		glm::vec3(0.15f, 1.5f, 3.125f), // Scale
-		0.0f, glm::vec3(1.0f, 1.0f, 1.0f), // Rotation
-		glm::vec3(0.0f, 0.751f, -1.25f), // Translation
-		modelLoc, Shape::CUBE);
-
-	// Table Right Leg
-	MakeShape(gWoodFloorTexId, // Texture
-		glm::vec3(0.15f, 1.5f, 3.125f), // Scale
-		0.0f, glm::vec3(1.0f, 1.0f, 1.0f), // Rotation
-		glm::vec3(4.0f, 0.751f, -1.25f), // Translation
-		modelLoc, Shape::CUBE);
-
-	// Table Center Leg
-	MakeShape(gWoodFloorTexId, // Texture
-		glm::vec3(0.15f, 1.5f, 3.125f), // Scale
-		0.0f, glm::vec3(1.0f, 1.0f, 1.0f), // Rotation
-		glm::vec3(1.8f, 0.751f, -1.25f), // Translation
-		modelLoc, Shape::CUBE);
-
-	// Table Surface
-	MakeShape(gWoodFloorTexId, // Texture
-		glm::vec3(4.15f, 0.15f, 3.125f), // Scale
-		0.0f, glm::vec3(1.0f, 1.0f, 1.0f), // Rotation
-		glm::vec3(2.0f, 1.575f, -1.25f), // Translation
-		modelLoc, Shape::CUBE);
-
-	// Plate
-	MakeShape(gMetalTexId, // Texture
-		glm::vec3(0.4f, 0.1f, 0.4f), // Scale
-		0.0f, glm::vec3(1.0f, 1.0f, 1.0f), // Rotation
-		glm::vec3(2.8f, 1.6f, -1.5f), // Translation
-		modelLoc, Shape::CYLINDER);
-
-	// Lamp Leg Back Right
-	MakeShape(gWoodFloorTexId, // Texture
-		glm::vec3(0.1f, 1.4f, 0.1f), // Scale
-		0.5f, glm::vec3(0.5f, 0.0f, 0.5f), // Rotation
-		glm::vec3(-3.0f, 0.05f, 1.0f), // Translation
-		modelLoc, Shape::CYLINDER);
-
-	// Lamp Leg Front
-	MakeShape(gWoodFloorTexId, // Texture
-		glm::vec3(0.1f, 1.4f, 0.1f), // Scale
-		0.5f, glm::vec3(-0.5f, 0.0f, 0.0f), // Rotation
-		glm::vec3(-3.7f, 0.05f, 2.5f), // Translation
-		modelLoc, Shape::CYLINDER);
-
-	// Lamp Leg Back Right
-	MakeShape(gWoodFloorTexId, // Texture
-		glm::vec3(0.1f, 1.4f, 0.1f), // Scale
-		0.5f, glm::vec3(0.5f, 0.0f, -0.5f), // Rotation
-		glm::vec3(-4.4f, 0.05f, 1.0f), // Translation
-		modelLoc, Shape::CYLINDER);
-
-	// Lamp Leg Connector Back Left Bottom
-	MakeShape(gMetalTexId, // Texture
-		glm::vec3(0.025f, 0.05f, 0.8f), // Scale
-		0.9f, glm::vec3(0.0, 1.0f, 0.0f), // Rotation
-		glm::vec3(-4.0f, 0.22f, 1.35f), // Translation
-		modelLoc, Shape::CUBE);
-
-	// Lamp Leg Connectors Back Left Upper
-	MakeShape(gMetalTexId, // Texture
-		glm::vec3(0.025f, 0.05f, 0.2f), // Scale
-		0.9f, glm::vec3(0.0, 1.0f, 0.0f), // Rotation
-		glm::vec3(-3.8f, 1.2f, 1.55f), // Translation
-		modelLoc, Shape::CUBE);
-
-	// Lamp Leg Connectors Back Right Lower
-	MakeShape(gMetalTexId, // Texture
-		glm::vec3(0.025f, 0.05f, 0.8f), // Scale
-		0.9f, glm::vec3(0.0, -0.5f, 0.0f), // Rotation
-		glm::vec3(-3.4f, 0.22f, 1.35f), // Translation
-		modelLoc, Shape::CUBE);
-
-	// Lamp Leg Connectors Back Right Upper
-	MakeShape(gMetalTexId, // Texture
-		glm::vec3(0.025f, 0.05f, 0.2f), // Scale
-		1.0f, glm::vec3(0.0, -0.5f, 0.0f), // Rotation
-		glm::vec3(-3.6f, 1.2f, 1.55f), // Translation
-		modelLoc, Shape::CUBE);
-
-	// Lamp Leg Connectors Front Bottom
-	MakeShape(gMetalTexId, // Texture
-		glm::vec3(0.025f, 0.05f, 0.8f), // Scale
-		0.0f, glm::vec3(1.0f, 1.0f, 1.0f), // Rotation
-		glm::vec3(-3.7f, 0.22f, 2.0f), // Translation
-		modelLoc, Shape::CUBE);
-
-	// Lamp Leg Connectors Front Upper
-	MakeShape(gMetalTexId, // Texture
-		glm::vec3(0.025f, 0.05f, 0.2f), // Scale
-		0.0f, glm::vec3(1.0f, 1.0f, 1.0f), // Rotation
-		glm::vec3(-3.7f, 1.2f, 1.71f), // Translation
-		modelLoc, Shape::CUBE);
-
-	// Lamp Pole
-	MakeShape(gWoodFloorTexId, // Texture
-		glm::vec3(0.05f, 5.5f, 0.05f), // Scale
-		0.0f, glm::vec3(1.0f, 1.0f, 1.0f), // Rotation
-		glm::vec3(-3.7f, 0.18f, 1.6f), // Translation
-		modelLoc, Shape::CYLINDER);
-
-	// Lamp Arm
-	MakeShape(gWoodFloorTexId, // Texture
-		glm::vec3(0.05f, 0.5f, 0.05f), // Scale
-		1.0f, glm::vec3(-1.0f, 0.0f, -1.0f), // Rotation
-		glm::vec3(-3.7f, 5.68f, 1.6f), // Translation
-		modelLoc, Shape::CYLINDER);
-
-	// Lamp Shade
-	MakeShape(gWoodFloorTexId, // Texture
-		glm::vec3(0.2f, 0.3f, 0.2f), // Scale
-		1.0f, glm::vec3(1.0f, 0.0, 1.0f), // Rotation
-		glm::vec3(-3.2f, 5.9f, 1.1f), // Translation
-		modelLoc, Shape::CYLINDER);
-
-	// Lamp Shade Bigger Piece
-	MakeShape(gWoodFloorTexId, // Texture
-		glm::vec3(0.4f, 0.2f, 0.4f), // Scale
-		1.0f, glm::vec3(1.0f, 0.0, 1.0f), // Rotation
-		glm::vec3(-3.1f, 5.8f, 1.0f), // Translation
-		modelLoc, Shape::CYLINDER);
+	// Lights this frame, sorted into the clusters of the view frustum
+	UBuildLightClusters(gLightClusters, gLights, view, projection);
+	USetLightClusterUniforms(gProgramId, gLightClusters);
+
+
+	// Chunks near the camera load, far ones unload
+	if (gWorld)
+		UUpdateWorldStreamer(*gWorld, gCamera.Position, gCamera.Front);
+
+	// Lamp shadows: usually still cached, redrawn when a lamp or a caster in its range changed
+	if (gShadows)
+	{
+		UCollectShadowCasters();
+		UUpdateShadowMaps(gShadowMaps, gLights, gShadowCasters, gShadowProgramId);
+		glUseProgram(gProgramId);
+	}
+	UBindShadowMaps(gShadowMaps, gProgramId);
+
+	// Indirect light: a few probes retraced a frame while a lamp has moved
+	if (gIrradianceProbes)
+		UUpdateIrradianceProbes(gProbes, gLights);
+	UBindIrradianceProbes(gProbes, gProgramId);
+
+	// Texture space shading: the next rows of the static batch's atlas, lit as the forward pass would light them
+	if (gShadingCached)
+	{
+		glUseProgram(gShadingCacheProgramId);
+		USetLightClusterUniforms(gShadingCacheProgramId, gLightClusters);
+		UBindShadowMaps(gShadowMaps, gShadingCacheProgramId);
+		UBindIrradianceProbes(gProbes, gShadingCacheProgramId);
+		glActiveTexture(GL_TEXTURE0 + lightmapTextureUnit);
+		glBindTexture(GL_TEXTURE_2D_ARRAY, gLightmap.texture);
+		glActiveTexture(GL_TEXTURE0);
+		UUpdateShadingCache(gShadingCache, gShadingCacheProgramId);
+		glUseProgram(gProgramId);
+	}
+	// What the static batch baked is compiled into the cube program (see main)
+	if (gStaticBatch.vao != 0)
+	{
+		glActiveTexture(GL_TEXTURE0 + lightmapTextureUnit);
+		glBindTexture(GL_TEXTURE_2D_ARRAY, gLightmap.texture);
+		glActiveTexture(GL_TEXTURE0);
+		UBindShadingCache(gShadingCache, gProgramId);
+	}
+
+	// Scene objects; layers still loading show their placeholder
+	UUpdateTextureArrays(gTextureArrays);
+	if (gTextureStreamer)
+	{
+		// the mips the materials need decide what loads next
+		URequestSceneTextures(projection);
+		UUpdateTextureStreamer(*gTextureStreamer, gTextureArrays, gMaterials);
+	}
+	UBindTextureArrays(gTextureArrays);
+
+	// Low resolution pass recording the mip every material is sampled at
+	if (gTextureFeedback.framebuffer && UBeginTextureFeedbackPass(gTextureFeedback))
+	{
+		glUseProgram(gFeedbackProgramId);
+		glUniformMatrix4fv(glGetUniformLocation(gFeedbackProgramId, "view"), 1, GL_FALSE, glm::value_ptr(view));
+		glUniformMatrix4fv(glGetUniformLocation(gFeedbackProgramId, "projection"), 1, GL_FALSE, glm::value_ptr(projection));
+		UDrawScene(glGetUniformLocation(gFeedbackProgramId, "model"), gFeedbackMaterialUniforms);
+		UEndTextureFeedbackPass(gTextureFeedback);
+		glUseProgram(gProgramId);
+	}
+
+	if (gVisibility)
+	{
+		// Visibility pass: depth and one id per pixel, no attributes and no shading
+		glUseProgram(gVisibilityProgramId);
+		glUniformMatrix4fv(glGetUniformLocation(gVisibilityProgramId, "view"), 1, GL_FALSE, glm::value_ptr(view));
+		glUniformMatrix4fv(glGetUniformLocation(gVisibilityProgramId, "projection"), 1, GL_FALSE, glm::value_ptr(projection));
+		UBeginVisibilityPass(gVisibilityBuffer, gVisibilityProgramId);
+		UDrawSceneVisibility();
+		UEndVisibilityPass(gVisibilityBuffer);
+
+		// Resolve pass: each pixel's triangle is fetched, interpolated and shaded once
+		glUseProgram(gResolveProgramId);
+		glUniformMatrix4fv(glGetUniformLocation(gResolveProgramId, "view"), 1, GL_FALSE, glm::value_ptr(view));
+		glUniformMatrix4fv(glGetUniformLocation(gResolveProgramId, "uViewProjection"), 1, GL_FALSE, glm::value_ptr(projection * view));
+		glUniform3f(glGetUniformLocation(gResolveProgramId, "viewPosition"), cameraPosition.x, cameraPosition.y, cameraPosition.z);
+		USetLightClusterUniforms(gResolveProgramId, gLightClusters);
+		UBindShadowMaps(gShadowMaps, gResolveProgramId);
+		UBindIrradianceProbes(gProbes, gResolveProgramId);
+		UBindVisibilityBuffer(gVisibilityBuffer, gResolveProgramId, gTextureArrays);
+		glDepthFunc(GL_ALWAYS);
+		UDrawVisibilityResolve(gVisibilityBuffer);
+		glDepthFunc(GL_LESS);
+	}
+	else if (gDeferred)
+	{
+		// Geometry pass: surfaces into the G-buffer, with the same draws as the forward pass
+		glUseProgram(gGeometryProgramId);
+		glUniformMatrix4fv(glGetUniformLocation(gGeometryProgramId, "view"), 1, GL_FALSE, glm::value_ptr(view));
+		glUniformMatrix4fv(glGetUniformLocation(gGeometryProgramId, "projection"), 1, GL_FALSE, glm::value_ptr(projection));
+		UBeginGeometryPass(gGBuffer);
+		UDrawScene(glGetUniformLocation(gGeometryProgramId, "model"), gGeometryMaterialUniforms);
+		UEndGeometryPass(gGBuffer);
+
+		// Lighting pass: every pixel once, the stored depth written back for the lamps
+		glUseProgram(gDeferredProgramId);
+		glUniformMatrix4fv(glGetUniformLocation(gDeferredProgramId, "view"), 1, GL_FALSE, glm::value_ptr(view));
+		glUniformMatrix4fv(glGetUniformLocation(gDeferredProgramId, "uInverseViewProjection"), 1, GL_FALSE, glm::value_ptr(glm::inverse(projection * view)));
+		glUniform3f(glGetUniformLocation(gDeferredProgramId, "viewPosition"), cameraPosition.x, cameraPosition.y, cameraPosition.z);
+		USetLightClusterUniforms(gDeferredProgramId, gLightClusters);
+		UBindShadowMaps(gShadowMaps, gDeferredProgramId);
+		UBindIrradianceProbes(gProbes, gDeferredProgramId);
+		UBindGBuffer(gGBuffer, gDeferredProgramId);
+		glDepthFunc(GL_ALWAYS);
+		UDrawFullScreenTriangle(gGBuffer);
+		glDepthFunc(GL_LESS);
+	}
+	else if (gUseDepthPrepass)
+	{
+		// Depth first with the position only program, then shade only the fragments left on top
+		if (UBeginDepthPrepassFrame(gDepthPrepass))
+		{
+			glUseProgram(gDepthPrepassProgramId);
+			glUniformMatrix4fv(glGetUniformLocation(gDepthPrepassProgramId, "view"), 1, GL_FALSE, glm::value_ptr(view));
+			glUniformMatrix4fv(glGetUniformLocation(gDepthPrepassProgramId, "projection"), 1, GL_FALSE, glm::value_ptr(projection));
+			UBeginDepthPrepass(gDepthPrepass);
+			UDrawScene(glGetUniformLocation(gDepthPrepassProgramId, "model"), MaterialUniforms());	// no material to set
+			UEndDepthPrepass(gDepthPrepass);
+			glUseProgram(gProgramId);
+		}
+		UDrawScene(modelLoc, gMaterialUniforms);
+		UEndDepthPrepassFrame(gDepthPrepass);
+	}
+	else
+		UDrawScene(modelLoc, gMaterialUniforms);
+
+	// Lamps: small white cubes at the light positions, smaller for the --lights ones
+	glUseProgram(gLampProgramId);
+	glUniformMatrix4fv(glGetUniformLocation(gLampProgramId, "view"), 1, GL_FALSE, glm::value_ptr(view));
+	glUniformMatrix4fv(glGetUniformLocation(gLampProgramId, "projection"), 1, GL_FALSE, glm::value_ptr(projection));
+	GLint lampModelLoc = glGetUniformLocation(gLampProgramId, "model");
+	glBindVertexArray(meshes.gBoxMesh.vao);
+	for (const PointLight& light : gLights)
+	{
+		glm::mat4 lampModel = glm::translate(light.position) * glm::scale(glm::vec3(light.radius > 0.0f ? 0.1f : 0.2f));
+		glUniformMatrix4fv(lampModelLoc, 1, GL_FALSE, glm::value_ptr(lampModel));
+		glDrawElements(GL_TRIANGLES, meshes.gBoxMesh.nIndices, GL_UNSIGNED_INT, (void*)0);
+	}
+	glBindVertexArray(0);
 
 	glUseProgram(0);
 
+	// GL objects released in earlier frames are deleted once the GPU is done with them
+	UCollectResources(gResources);
+
+	if (gClusterCulling)
+		UEndClusterFrame(gClusterRing);
+	UEndLightClusterFrame(gLightClusters);
+
 	// glfw: swap buffers and poll IO events (keys pressed/released, mouse moved etc.)
 	glfwSwapBuffers(gWindow);    // Flips the the back buffer with the front buffer every frame.
 }
 
-// Implements the UCreateShaders function
-bool UCreateShaderProgram(const char* vtxShaderSource, const char* fragShaderSource, GLuint &programId)
+// Implements the UCreateShaders function; the geometry stage is optional
+bool UCreateShaderProgram(const char* vtxShaderSource, const char* fragShaderSource, GLuint &programId, const char* geomShaderSource)
 {
 	// Compilation and linkage error reporting
 	int success = 0;
@@ -784,9 +2492,27 @@ bool UCreateShaderProgram(const char* vtxShaderSource, const char* fragShaderSou
 		return false;
 	}
 
+	GLuint geometryShaderId = 0;
+	if (geomShaderSource)
+	{
+		geometryShaderId = glCreateShader(GL_GEOMETRY_SHADER);
+		glShaderSource(geometryShaderId, 1, &geomShaderSource, NULL);
+		glCompileShader(geometryShaderId);
+		glGetShaderiv(geometryShaderId, GL_COMPILE_STATUS, &success);
+		if (!success)
+		{
+			glGetShaderInfoLog(geometryShaderId, sizeof(infoLog), NULL, infoLog);
+			std::cout << "ERROR::SHADER::GEOMETRY::COMPILATION_FAILED\n" << infoLog << std::endl;
+
+			return false;
+		}
+	}
+
 	// Attached compiled shaders to the shader program
 	glAttachShader(programId, vertexShaderId);
 	glAttachShader(programId, fragmentShaderId);
+	if (geometryShaderId)
+		glAttachShader(programId, geometryShaderId);
 
 	glLinkProgram(programId);   // links the shader program
 	// check for linking errors
@@ -799,74 +2525,43 @@ bool UCreateShaderProgram(const char* vtxShaderSource, const char* fragShaderSou
 		return false;
 	}
 
+	// The program keeps the compiled code; the shader objects go with it
+	glDeleteShader(vertexShaderId);
+	glDeleteShader(fragmentShaderId);
+	if (geometryShaderId)
+		glDeleteShader(geometryShaderId);
+
 	glUseProgram(programId);    // Uses the shader program
 
 	return true;
 }
 
-// Images are loaded with Y axis going down, but OpenGL's Y axis goes up, so let's flip it
-void flipImageVertically(unsigned char* image, int width, int height, int channels)
+///////////////////////////////////////////////////
+//	UCreateProgramResource(const char*, const char*, const char*, ResourceHandle&, const char*)
+//
+//	Like UCreateShaderProgram, but the program is owned by
+//	gResources and shared with any earlier program built from
+//	the same sources. Release it with UReleaseResource.
+///////////////////////////////////////////////////
+bool UCreateProgramResource(const char* vtxShaderSource, const char* fragShaderSource, const char* label, ResourceHandle& program, const char* geomShaderSource)
 {
-	for (int j = 0; j < height / 2; ++j)
-	{
-		int index1 = j * width * channels;
-		int index2 = (height - 1 - j) * width * channels;
-
-		for (int i = width * channels; i > 0; --i)
-		{
-			unsigned char tmp = image[index1];
-			image[index1] = image[index2];
-			image[index2] = tmp;
-			++index1;
-			++index2;
-		}
-	}
-}
+	uint64_t sourceHash = UHashBytes(fragShaderSource, strlen(fragShaderSource), UHashBytes(vtxShaderSource, strlen(vtxShaderSource)));
+	if (geomShaderSource)
+		sourceHash = UHashBytes(geomShaderSource, strlen(geomShaderSource), sourceHash);
+	program = UAcquireResource(gResources, ResourceType::Program, sourceHash);
+	if (program.Valid())
+		return true;
 
-/*Generate and load the texture*/
-bool UCreateTexture(const char* filename, GLuint& textureId)
-{
-	int width, height, channels;
-	unsigned char* image = stbi_load(filename, &width, &height, &channels, 0);
-	if (image)
+	GLuint programId = 0;
+	if (!UCreateShaderProgram(vtxShaderSource, fragShaderSource, programId, geomShaderSource))
 	{
-		flipImageVertically(image, width, height, channels);
-		std::cout << textureId << std::endl;
-		glGenTextures(1, &textureId);
-		glBindTexture(GL_TEXTURE_2D, textureId);
-
-		// set the texture wrapping parameters
-		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_REPEAT);
-		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_REPEAT);
-		// set texture filtering parameters
-		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
-		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
-
-		if (channels == 3)
-			glTexImage2D(GL_TEXTURE_2D, 0, GL_RGB8, width, height, 0, GL_RGB, GL_UNSIGNED_BYTE, image);
-		else if (channels == 4)
-			glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA8, width, height, 0, GL_RGBA, GL_UNSIGNED_BYTE, image);
-		else
-		{
-			cout << "Not implemented to handle image with " << channels << " channels" << endl;
-			return false;
-		}
-
-		glGenerateMipmap(GL_TEXTURE_2D);
-
-		stbi_image_free(image);
-		glBindTexture(GL_TEXTURE_2D, 0); // Unbind the texture
-
-		return true;
+		glDeleteProgram(programId);
+		return false;
 	}
-
-	// Error loading the image
-	return false;
-}
-
-void UDestroyTexture(GLuint textureId)
-{
-	glGenTextures(1, &textureId);
+	GLint binarySize = 0;
+	glGetProgramiv(programId, GL_PROGRAM_BINARY_LENGTH, &binarySize);
+	program = URegisterResource(gResources, ResourceType::Program, programId, (size_t)binarySize, label, sourceHash);
+	return true;
 }
 
 void UDestroyShaderProgram(GLuint programId)
@@ -0,0 +1,374 @@
+///////////////////////////////////////////////////////////////////////////////
+// asyncio.cpp
+// ========
+// io_uring submission and completion, the blocking read fallback, and the
+// coroutine plumbing that resumes loads on the worker threads
+///////////////////////////////////////////////////////////////////////////////
+
+#include "asyncio.h"
+
+#include <algorithm>
+#include <cerrno>
+
+#ifdef _WIN32
+#define WIN32_LEAN_AND_MEAN
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+namespace
+{
+	// Reaper wake-up posted by the destructor
+	const uint64_t stopReaping = 0;
+
+	// Bytes a single read asks for: what is left of the range, at most a chunk
+	size_t URequestBytes(const AsyncReadRequest& request)
+	{
+		return std::min(request.range.size - request.done, asyncReadChunk);
+	}
+
+	// Blocking positioned read of whatever is left of the request
+	long UReadBlocking(AsyncReadRequest& request, void* osHandle, int fd)
+	{
+		const size_t size = URequestBytes(request);
+		const uint64_t offset = request.range.offset + request.done;
+#ifdef _WIN32
+		(void)fd;
+		OVERLAPPED overlapped = {};
+		overlapped.Offset = (DWORD)offset;
+		overlapped.OffsetHigh = (DWORD)(offset >> 32);
+		DWORD read = 0;
+		if (!ReadFile((HANDLE)osHandle, request.destination + request.done, (DWORD)size, &read, &overlapped))
+			return -1;
+		return (long)read;
+#else
+		(void)osHandle;
+		for (;;)
+		{
+			const ssize_t read = pread(fd, request.destination + request.done, size, (off_t)offset);
+			if (read >= 0 || errno != EINTR)
+				return read >= 0 ? (long)read : -errno;
+		}
+#endif
+	}
+}
+
+void AsyncTask::promise_type::FinalAwaiter::await_suspend(std::coroutine_handle<promise_type> handle) noexcept
+{
+	AsyncIO* io = handle.promise().io;
+	handle.destroy();
+	io->TaskFinished();
+}
+
+///////////////////////////////////////////////////
+//	AsyncFile::Open(const char*)
+//
+//	Opens a loose file for reading and records its size.
+//	The file is read through AsyncIO, never mapped.
+///////////////////////////////////////////////////
+bool AsyncFile::Open(const char* path)
+{
+	Close();
+#ifdef _WIN32
+	HANDLE file = CreateFileA(path, GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, nullptr);
+	if (file == INVALID_HANDLE_VALUE)
+		return false;
+	LARGE_INTEGER fileSize;
+	if (!GetFileSizeEx(file, &fileSize))
+	{
+		CloseHandle(file);
+		return false;
+	}
+	handle = file;
+	size = (uint64_t)fileSize.QuadPart;
+#else
+	fd = open(path, O_RDONLY | O_CLOEXEC);
+	if (fd < 0)
+		return false;
+	struct stat info;
+	if (fstat(fd, &info) != 0)
+	{
+		Close();
+		return false;
+	}
+	size = (uint64_t)info.st_size;
+#endif
+	return true;
+}
+
+void AsyncFile::Close()
+{
+#ifdef _WIN32
+	if (handle)
+		CloseHandle((HANDLE)handle);
+	handle = nullptr;
+#else
+	if (fd >= 0)
+		close(fd);
+	fd = -1;
+#endif
+	size = 0;
+}
+
+bool AsyncFile::IsOpen() const
+{
+#ifdef _WIN32
+	return handle != nullptr;
+#else
+	return fd >= 0;
+#endif
+}
+
+void AsyncReadBatch::await_suspend(std::coroutine_handle<> handle)
+{
+	waiter = handle;
+	remaining.store(requests.size(), std::memory_order_relaxed);
+	for (AsyncReadRequest& request : requests)
+		request.batch = this;
+	// completions may resume the coroutine (and free this batch) as soon as the last read is queued
+	io->Submit(requests.data(), requests.size());
+}
+
+bool AsyncReadBatch::await_resume() const
+{
+	for (const AsyncReadRequest& request : requests)
+	{
+		if (request.failed || request.done != request.range.size)
+			return false;
+	}
+	return true;
+}
+
+bool AsyncReadFile::await_ready()
+{
+	if (buffer.packed.OpenPacked(path))
+	{
+		ok = true;
+		return true;
+	}
+	if (!file.Open(path) || file.Size() > SIZE_MAX)
+		return true;
+
+	ok = true;
+	buffer.bytes.resize((size_t)file.Size());
+	for (size_t offset = 0; offset < buffer.bytes.size(); offset += asyncReadChunk)
+	{
+		AsyncReadRequest request;
+		request.file = &file;
+		request.range.offset = offset;
+		request.range.size = std::min(asyncReadChunk, buffer.bytes.size() - offset);
+		request.destination = buffer.bytes.data() + offset;
+		batch.requests.push_back(request);
+	}
+	return batch.await_ready();
+}
+
+void AsyncSchedule::await_suspend(std::coroutine_handle<> handle)
+{
+	io->Resume(handle);
+}
+
+///////////////////////////////////////////////////
+//	AsyncIO(unsigned, unsigned)
+//
+//	threadCount: workers that run the coroutines (and, with
+//	             no io_uring, perform the reads)
+//	queueDepth: io_uring submission queue entries
+///////////////////////////////////////////////////
+AsyncIO::AsyncIO(unsigned threadCount, unsigned queueDepth) : workers(threadCount)
+{
+#ifdef HAVE_LIBURING
+	// kernels without io_uring (or sandboxes that block it) use the fallback
+	ringReady = io_uring_queue_init(queueDepth, &ring, 0) == 0;
+	if (ringReady)
+		reaper = std::thread([this]() { Reap(); });
+#else
+	(void)queueDepth;
+#endif
+}
+
+AsyncIO::~AsyncIO()
+{
+	Wait();
+#ifdef HAVE_LIBURING
+	if (ringReady)
+	{
+		{
+			std::lock_guard<std::mutex> lock(submitMutex);
+			io_uring_sqe* sqe = io_uring_get_sqe(&ring);
+			while (!sqe)
+			{
+				io_uring_submit(&ring);
+				sqe = io_uring_get_sqe(&ring);
+			}
+			io_uring_prep_nop(sqe);
+			io_uring_sqe_set_data64(sqe, stopReaping);
+			io_uring_submit(&ring);
+		}
+		reaper.join();
+		io_uring_queue_exit(&ring);
+	}
+#endif
+}
+
+// Runs the task on a worker; Wait() returns once it and every other task has finished
+void AsyncIO::Start(AsyncTask task)
+{
+	std::coroutine_handle<AsyncTask::promise_type> handle = task.handle;
+	task.handle = nullptr;
+	handle.promise().io = this;
+	{
+		std::lock_guard<std::mutex> lock(taskMutex);
+		++tasks;
+	}
+	Resume(handle);
+}
+
+void AsyncIO::Wait()
+{
+	std::unique_lock<std::mutex> lock(taskMutex);
+	taskIdle.wait(lock, [this]() { return tasks == 0; });
+}
+
+AsyncReadBatch AsyncIO::Read(const AsyncFile& file, AsyncFileRange range, unsigned char* destination)
+{
+	AsyncReadRequest request;
+	request.file = &file;
+	request.range = range;
+	request.destination = destination;
+	return AsyncReadBatch(*this, { request });
+}
+
+void AsyncIO::Resume(std::coroutine_handle<> handle)
+{
+	workers.Submit([handle]() { handle.resume(); });
+}
+
+void AsyncIO::TaskFinished()
+{
+	std::lock_guard<std::mutex> lock(taskMutex);
+	if (--tasks == 0)
+		taskIdle.notify_all();
+}
+
+///////////////////////////////////////////////////
+//	Submit(AsyncReadRequest*, size_t)
+//
+//	Puts every request in flight: with io_uring as one
+//	batch of SQEs and a single submit, otherwise as one
+//	worker job each. Must not touch the requests after
+//	the last one is handed over.
+///////////////////////////////////////////////////
+void AsyncIO::Submit(AsyncReadRequest* requests, size_t count)
+{
+#ifdef HAVE_LIBURING
+	if (ringReady)
+	{
+		std::lock_guard<std::mutex> lock(submitMutex);
+		for (size_t i = 0; i < count; ++i)
+			Queue(requests[i]);
+		io_uring_submit(&ring);
+		return;
+	}
+#endif
+	for (size_t i = 0; i < count; ++i)
+	{
+		AsyncReadRequest* request = &requests[i];
+		workers.Submit([this, request]()
+		{
+			for (;;)
+			{
+#ifdef _WIN32
+				const long read = UReadBlocking(*request, request->file->handle, -1);
+#else
+				const long read = UReadBlocking(*request, nullptr, request->file->fd);
+#endif
+				if (read <= 0 || request->done + read >= request->range.size)
+				{
+					Complete(*request, read);
+					return;
+				}
+				request->done += read;
+			}
+		});
+	}
+}
+
+///////////////////////////////////////////////////
+//	Complete(AsyncReadRequest&, long)
+//
+//	result: bytes read by the latest read of the request,
+//	        0 at end of file, -errno on failure
+//
+//	Short reads are continued; once the last request of a
+//	batch is done its coroutine is resumed on a worker
+///////////////////////////////////////////////////
+void AsyncIO::Complete(AsyncReadRequest& request, long result)
+{
+	if (result > 0)
+		request.done += (size_t)result;
+	else if (request.range.size > request.done)
+		request.failed = true;
+
+#ifdef HAVE_LIBURING
+	if (ringReady && !request.failed && request.done < request.range.size)
+	{
+		std::lock_guard<std::mutex> lock(submitMutex);
+		Queue(request);
+		io_uring_submit(&ring);
+		return;
+	}
+#endif
+
+	AsyncReadBatch* batch = request.batch;
+	if (batch->remaining.fetch_sub(1, std::memory_order_acq_rel) == 1)
+		Resume(batch->waiter);
+}
+
+#ifdef HAVE_LIBURING
+// Prepares the SQE for the rest of the request; the caller holds submitMutex
+void AsyncIO::Queue(AsyncReadRequest& request)
+{
+	io_uring_sqe* sqe = io_uring_get_sqe(&ring);
+	while (!sqe)
+	{
+		io_uring_submit(&ring); // queue full: send what is there and take a fresh entry
+		sqe = io_uring_get_sqe(&ring);
+	}
+	io_uring_prep_read(sqe, request.file->fd, request.destination + request.done, (unsigned)URequestBytes(request), request.range.offset + request.done);
+	io_uring_sqe_set_data(sqe, &request);
+}
+
+// Completion thread: hands every finished read to Complete() until told to stop
+void AsyncIO::Reap()
+{
+	for (;;)
+	{
+		io_uring_cqe* cqe = nullptr;
+		const int waited = io_uring_wait_cqe(&ring, &cqe);
+		if (waited == -EINTR)
+			continue;
+		if (waited < 0)
+			return;
+
+		const uint64_t data = io_uring_cqe_get_data64(cqe);
+		const int result = cqe->res;
+		io_uring_cqe_seen(&ring, cqe);
+		if (data == stopReaping)
+			return;
+
+		AsyncReadRequest& request = *(AsyncReadRequest*)(uintptr_t)data;
+		if (result == -EINTR || result == -EAGAIN)
+		{
+			std::lock_guard<std::mutex> lock(submitMutex);
+			Queue(request);
+			io_uring_submit(&ring);
+			continue;
+		}
+		Complete(request, result);
+	}
+}
+#endif
@@ -0,0 +1,238 @@
+///////////////////////////////////////////////////////////////////////////////
+// asyncio.h
+// ========
+// asynchronous asset reads for C++20 coroutines. A load is written as an
+// AsyncTask that co_awaits its reads; the reads of one co_await are all in
+// flight together and the task resumes on a worker thread once they have
+// finished, ready to decode. Built with HAVE_LIBURING the reads go through
+// io_uring and one thread reaps the completions; otherwise workers perform
+// them with positioned blocking reads.
+///////////////////////////////////////////////////////////////////////////////
+
+#ifndef ASYNCIO_H
+#define ASYNCIO_H
+
+#include <atomic>
+#include <condition_variable>
+#include <coroutine>
+#include <cstddef>
+#include <cstdint>
+#include <exception>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#include "parallel.h"
+#include "packfile.h"
+
+#ifdef HAVE_LIBURING
+#include <liburing.h>
+#endif
+
+class AsyncIO;
+
+// Largest single read put in flight; bigger ranges are split
+const size_t asyncReadChunk = 1024 * 1024;
+
+///////////////////////////////////////////////////
+//	AsyncTask
+//
+//	Return type of a load coroutine. The coroutine does
+//	not run until AsyncIO::Start() hands it to a worker;
+//	its frame is freed when it finishes.
+///////////////////////////////////////////////////
+class AsyncTask
+{
+public:
+	struct promise_type
+	{
+		AsyncIO* io = nullptr;
+
+		struct FinalAwaiter
+		{
+			bool await_ready() const noexcept { return false; }
+			void await_suspend(std::coroutine_handle<promise_type> handle) noexcept;
+			void await_resume() const noexcept {}
+		};
+
+		AsyncTask get_return_object() { return AsyncTask(std::coroutine_handle<promise_type>::from_promise(*this)); }
+		std::suspend_always initial_suspend() const noexcept { return {}; }
+		FinalAwaiter final_suspend() const noexcept { return {}; }
+		void return_void() const {}
+		void unhandled_exception() const { std::terminate(); }
+	};
+
+	AsyncTask(AsyncTask&& other) noexcept : handle(other.handle) { other.handle = nullptr; }
+	AsyncTask(const AsyncTask&) = delete;
+	AsyncTask& operator=(const AsyncTask&) = delete;
+	~AsyncTask()
+	{
+		if (handle) // never started
+			handle.destroy();
+	}
+
+private:
+	explicit AsyncTask(std::coroutine_handle<promise_type> handle) : handle(handle) {}
+
+	std::coroutine_handle<promise_type> handle;
+	friend class AsyncIO;
+};
+
+// A file opened for positioned reads
+class AsyncFile
+{
+public:
+	AsyncFile() = default;
+	~AsyncFile() { Close(); }
+	AsyncFile(const AsyncFile&) = delete;
+	AsyncFile& operator=(const AsyncFile&) = delete;
+
+	bool Open(const char* path);
+	void Close();
+
+	bool IsOpen() const;
+	uint64_t Size() const { return size; }
+
+private:
+#ifdef _WIN32
+	void* handle = nullptr;
+#else
+	int fd = -1;
+#endif
+	uint64_t size = 0;
+	friend class AsyncIO;
+};
+
+struct AsyncFileRange
+{
+	uint64_t offset = 0;
+	size_t size = 0;
+};
+
+struct AsyncReadBatch;
+
+// One read of a batch; done counts the bytes read so far
+struct AsyncReadRequest
+{
+	const AsyncFile* file = nullptr;
+	AsyncFileRange range;
+	unsigned char* destination = nullptr;
+	size_t done = 0;
+	bool failed = false;
+	AsyncReadBatch* batch = nullptr;
+};
+
+///////////////////////////////////////////////////
+//	AsyncReadBatch
+//
+//	Awaitable for a group of reads. co_await puts them all
+//	in flight at once and yields true once every one has
+//	read its whole range, false if any failed.
+///////////////////////////////////////////////////
+struct AsyncReadBatch
+{
+	AsyncReadBatch(AsyncIO& io, std::vector<AsyncReadRequest> requests) : io(&io), requests(std::move(requests)) {}
+	AsyncReadBatch(const AsyncReadBatch&) = delete;
+
+	bool await_ready() const noexcept { return requests.empty(); }
+	void await_suspend(std::coroutine_handle<> handle);
+	bool await_resume() const;
+
+	AsyncIO* io;
+	std::vector<AsyncReadRequest> requests;
+	std::atomic<size_t> remaining{ 0 };
+	std::coroutine_handle<> waiter;
+};
+
+// Contents of a whole asset: the entry in a mounted pack, or bytes read
+// from the loose file
+struct AsyncBuffer
+{
+	AssetFile packed;
+	std::vector<unsigned char> bytes;
+
+	const unsigned char* Data() const { return packed.IsOpen() ? packed.Data() : bytes.data(); }
+	size_t Size() const { return packed.IsOpen() ? packed.Size() : bytes.size(); }
+};
+
+///////////////////////////////////////////////////
+//	AsyncReadFile
+//
+//	Awaitable reading a whole asset into an AsyncBuffer,
+//	in asyncReadChunk pieces that are in flight together.
+//	Assets in a mounted pack are already mapped and do not
+//	suspend. Yields false when the file cannot be read.
+///////////////////////////////////////////////////
+struct AsyncReadFile
+{
+	AsyncReadFile(AsyncIO& io, const char* path, AsyncBuffer& buffer) : path(path), buffer(buffer), batch(io, {}) {}
+
+	bool await_ready();
+	void await_suspend(std::coroutine_handle<> handle) { batch.await_suspend(handle); }
+	bool await_resume() const { return ok && batch.await_resume(); }
+
+	const char* path;
+	AsyncBuffer& buffer;
+	AsyncFile file;
+	AsyncReadBatch batch;
+	bool ok = false;
+};
+
+// Awaitable that continues the coroutine on a worker thread
+struct AsyncSchedule
+{
+	AsyncIO* io;
+
+	bool await_ready() const noexcept { return false; }
+	void await_suspend(std::coroutine_handle<> handle);
+	void await_resume() const noexcept {}
+};
+
+class AsyncIO
+{
+public:
+	explicit AsyncIO(unsigned threadCount = UWorkerCount(), unsigned queueDepth = 64);
+	~AsyncIO();
+
+	AsyncIO(const AsyncIO&) = delete;
+	AsyncIO& operator=(const AsyncIO&) = delete;
+
+	void Start(AsyncTask task);
+	void Wait();
+
+	AsyncSchedule Schedule() { return AsyncSchedule{ this }; }
+	AsyncReadBatch Read(const AsyncFile& file, AsyncFileRange range, unsigned char* destination);
+	AsyncReadBatch ReadAll(std::vector<AsyncReadRequest> requests) { return AsyncReadBatch(*this, std::move(requests)); }
+	AsyncReadFile ReadFile(const char* path, AsyncBuffer& buffer) { return AsyncReadFile(*this, path, buffer); }
+
+	bool UsingIoUring() const { return ringReady; }
+
+private:
+	friend struct AsyncReadBatch;
+	friend struct AsyncSchedule;
+	friend struct AsyncTask::promise_type::FinalAwaiter;
+
+	void Submit(AsyncReadRequest* requests, size_t count);
+	void Complete(AsyncReadRequest& request, long result);
+	void Resume(std::coroutine_handle<> handle);
+	void TaskFinished();
+
+	std::mutex taskMutex;
+	std::condition_variable taskIdle;
+	size_t tasks = 0;
+
+	bool ringReady = false;
+#ifdef HAVE_LIBURING
+	void Reap();
+	void Queue(AsyncReadRequest& request);
+
+	io_uring ring;
+	std::mutex submitMutex;
+	std::thread reaper;
+#endif
+
+	// last, so its threads are joined before anything above goes away
+	WorkerPool workers;
+};
+
+#endif
@@ -0,0 +1,723 @@
+///////////////////////////////////////////////////////////////////////////////
+// blockcompress.cpp
+// ========
+// BC1 / BC7 block encoders and decoders
+///////////////////////////////////////////////////////////////////////////////
+
+#include "blockcompress.h"
+#include "imagekernels.h"
+#include "parallel.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cfloat>
+#include <cmath>
+#include <cstdint>
+#include <cstring>
+#include <iostream>
+#include <limits>
+#include <vector>
+
+#include <stb_image.h>
+
+#if defined(__SSE4_1__) || defined(__AVX__)
+#include <smmintrin.h>
+#define BLOCK_COMPRESS_SSE4 1
+#endif
+
+namespace
+{
+	const int refineIterations = 2;
+
+	// BC7 4 bit index interpolation weights (out of 64)
+	const int bc7Weights[16] = { 0, 4, 9, 13, 17, 21, 26, 30, 34, 38, 43, 47, 51, 55, 60, 64 };
+
+	// A 4x4 block as floats, one array per channel so four pixels
+	// fit in one SSE register
+	struct BlockPixels
+	{
+		alignas(16) float c[4][16];
+	};
+
+	void UGatherBlock(const unsigned char* rgba, int channels, BlockPixels& px)
+	{
+		for (int i = 0; i < 16; ++i)
+			for (int c = 0; c < 4; ++c)
+				px.c[c][i] = c < channels ? float(rgba[i * 4 + c]) : 0.0f;
+	}
+
+	///////////////////////////////////////////////////
+	//	UFindIndices(const BlockPixels&, const float(*)[4], int, unsigned char*)
+	//
+	//	palette: paletteSize RGBA entries
+	//	indices: receives the nearest entry for every pixel
+	//
+	//	Returns the summed squared error of the block.
+	//	The SSE path tests four pixels against one palette
+	//	entry at a time.
+	///////////////////////////////////////////////////
+	float UFindIndices(const BlockPixels& px, const float (*palette)[4], int paletteSize, unsigned char* indices)
+	{
+		float total = 0.0f;
+#if BLOCK_COMPRESS_SSE4
+		for (int i = 0; i < 16; i += 4)
+		{
+			const __m128 r = _mm_load_ps(px.c[0] + i);
+			const __m128 g = _mm_load_ps(px.c[1] + i);
+			const __m128 b = _mm_load_ps(px.c[2] + i);
+			const __m128 a = _mm_load_ps(px.c[3] + i);
+			__m128 best = _mm_set1_ps(FLT_MAX);
+			__m128i bestIndex = _mm_setzero_si128();
+			for (int p = 0; p < paletteSize; ++p)
+			{
+				const __m128 dr = _mm_sub_ps(r, _mm_set1_ps(palette[p][0]));
+				const __m128 dg = _mm_sub_ps(g, _mm_set1_ps(palette[p][1]));
+				const __m128 db = _mm_sub_ps(b, _mm_set1_ps(palette[p][2]));
+				const __m128 da = _mm_sub_ps(a, _mm_set1_ps(palette[p][3]));
+				const __m128 error = _mm_add_ps(_mm_add_ps(_mm_mul_ps(dr, dr), _mm_mul_ps(dg, dg)),
+					_mm_add_ps(_mm_mul_ps(db, db), _mm_mul_ps(da, da)));
+				const __m128 closer = _mm_cmplt_ps(error, best);
+				best = _mm_min_ps(error, best);
+				bestIndex = _mm_blendv_epi8(bestIndex, _mm_set1_epi32(p), _mm_castps_si128(closer));
+			}
+			alignas(16) float errors[4];
+			alignas(16) int32_t chosen[4];
+			_mm_store_ps(errors, best);
+			_mm_store_si128((__m128i*)chosen, bestIndex);
+			for (int j = 0; j < 4; ++j)
+			{
+				total += errors[j];
+				indices[i + j] = (unsigned char)chosen[j];
+			}
+		}
+#else
+		for (int i = 0; i < 16; ++i)
+		{
+			float best = FLT_MAX;
+			int bestIndex = 0;
+			for (int p = 0; p < paletteSize; ++p)
+			{
+				float error = 0.0f;
+				for (int c = 0; c < 4; ++c)
+				{
+					const float d = px.c[c][i] - palette[p][c];
+					error += d * d;
+				}
+				if (error < best)
+				{
+					best = error;
+					bestIndex = p;
+				}
+			}
+			total += best;
+			indices[i] = (unsigned char)bestIndex;
+		}
+#endif
+		return total;
+	}
+
+	///////////////////////////////////////////////////
+	//	UPrincipalAxis(const BlockPixels&, int, float*, float*)
+	//
+	//	Fits a line through the block colours (mean plus
+	//	the dominant eigenvector of the covariance, by
+	//	power iteration) and returns the two extreme
+	//	projections as the starting endpoints
+	///////////////////////////////////////////////////
+	void UPrincipalAxis(const BlockPixels& px, int channels, float* start, float* end)
+	{
+		float mean[4] = {};
+		for (int c = 0; c < channels; ++c)
+		{
+			for (int i = 0; i < 16; ++i)
+				mean[c] += px.c[c][i];
+			mean[c] /= 16.0f;
+		}
+
+		float covariance[4][4] = {};
+		for (int i = 0; i < 16; ++i)
+			for (int c = 0; c < channels; ++c)
+				for (int d = c; d < channels; ++d)
+					covariance[c][d] += (px.c[c][i] - mean[c]) * (px.c[d][i] - mean[d]);
+		for (int c = 0; c < channels; ++c)
+			for (int d = 0; d < c; ++d)
+				covariance[c][d] = covariance[d][c];
+
+		// start from the row of the channel with the largest variance
+		int largest = 0;
+		for (int c = 1; c < channels; ++c)
+			if (covariance[c][c] > covariance[largest][largest])
+				largest = c;
+		float axis[4] = {};
+		for (int c = 0; c < channels; ++c)
+			axis[c] = covariance[largest][c];
+
+		for (int iteration = 0; iteration < 8; ++iteration)
+		{
+			float next[4] = {};
+			float length = 0.0f;
+			for (int c = 0; c < channels; ++c)
+			{
+				for (int d = 0; d < channels; ++d)
+					next[c] += covariance[c][d] * axis[d];
+				length = std::max(length, std::fabs(next[c]));
+			}
+			if (length < 1e-12f)
+				break;
+			for (int c = 0; c < channels; ++c)
+				axis[c] = next[c] / length;
+		}
+
+		float length = 0.0f;
+		for (int c = 0; c < channels; ++c)
+			length += axis[c] * axis[c];
+		length = std::sqrt(length);
+		if (length > 0.0f)
+			for (int c = 0; c < channels; ++c)
+				axis[c] /= length;
+
+		float lowest = 0.0f, highest = 0.0f;
+		for (int i = 0; i < 16; ++i)
+		{
+			float t = 0.0f;
+			for (int c = 0; c < channels; ++c)
+				t += (px.c[c][i] - mean[c]) * axis[c];
+			lowest = std::min(lowest, t);
+			highest = std::max(highest, t);
+		}
+		for (int c = 0; c < 4; ++c)
+		{
+			start[c] = c < channels ? mean[c] + axis[c] * lowest : 0.0f;
+			end[c] = c < channels ? mean[c] + axis[c] * highest : 0.0f;
+		}
+	}
+
+	///////////////////////////////////////////////////
+	//	URefineEndpoints(const BlockPixels&, int, const unsigned char*, const float*, float*, float*)
+	//
+	//	weights: position of every index between the two
+	//	         endpoints, 0 = start, 1 = end
+	//
+	//	Least squares fit of the endpoints for a fixed
+	//	index assignment. Leaves them untouched when the
+	//	system is singular (every pixel on one index).
+	///////////////////////////////////////////////////
+	void URefineEndpoints(const BlockPixels& px, int channels, const unsigned char* indices, const float* weights, float* start, float* end)
+	{
+		float aa = 0.0f, ab = 0.0f, bb = 0.0f;
+		float ax[4] = {}, bx[4] = {};
+		for (int i = 0; i < 16; ++i)
+		{
+			const float b = weights[indices[i]];
+			const float a = 1.0f - b;
+			aa += a * a;
+			ab += a * b;
+			bb += b * b;
+			for (int c = 0; c < channels; ++c)
+			{
+				ax[c] += a * px.c[c][i];
+				bx[c] += b * px.c[c][i];
+			}
+		}
+
+		const float determinant = aa * bb - ab * ab;
+		if (std::fabs(determinant) < 1e-6f)
+			return;
+		for (int c = 0; c < channels; ++c)
+		{
+			start[c] = std::min(std::max((bb * ax[c] - ab * bx[c]) / determinant, 0.0f), 255.0f);
+			end[c] = std::min(std::max((aa * bx[c] - ab * ax[c]) / determinant, 0.0f), 255.0f);
+		}
+	}
+
+	uint16_t UPack565(const float* color)
+	{
+		const int r = std::min(std::max(int(color[0] * 31.0f / 255.0f + 0.5f), 0), 31);
+		const int g = std::min(std::max(int(color[1] * 63.0f / 255.0f + 0.5f), 0), 63);
+		const int b = std::min(std::max(int(color[2] * 31.0f / 255.0f + 0.5f), 0), 31);
+		return uint16_t((r << 11) | (g << 5) | b);
+	}
+
+	void UUnpack565(uint16_t color, int* rgb)
+	{
+		const int r = (color >> 11) & 31, g = (color >> 5) & 63, b = color & 31;
+		rgb[0] = (r << 3) | (r >> 2);
+		rgb[1] = (g << 2) | (g >> 4);
+		rgb[2] = (b << 3) | (b >> 2);
+	}
+
+	// BC1 four colour palette in index order; the decoder builds the same one
+	void UBC1Palette(uint16_t color0, uint16_t color1, int (*palette)[4])
+	{
+		UUnpack565(color0, palette[0]);
+		UUnpack565(color1, palette[1]);
+		for (int c = 0; c < 3; ++c)
+		{
+			palette[2][c] = (2 * palette[0][c] + palette[1][c]) / 3;
+			palette[3][c] = (palette[0][c] + 2 * palette[1][c]) / 3;
+		}
+		for (int p = 0; p < 4; ++p)
+			palette[p][3] = 255;
+	}
+
+	// Packs values into a 128 bit BC7 block, least significant bit first
+	struct BitWriter
+	{
+		unsigned char* block;
+		int position = 0;
+
+		void Write(uint32_t value, int bits)
+		{
+			for (int i = 0; i < bits; ++i, ++position)
+				if (value & (1u << i))
+					block[position >> 3] |= (unsigned char)(1u << (position & 7));
+		}
+	};
+
+	struct BitReader
+	{
+		const unsigned char* block;
+		int position = 0;
+
+		uint32_t Read(int bits)
+		{
+			uint32_t value = 0;
+			for (int i = 0; i < bits; ++i, ++position)
+				value |= uint32_t((block[position >> 3] >> (position & 7)) & 1) << i;
+			return value;
+		}
+	};
+
+	// A 4x4 block read from the image, repeating the last row / column
+	// for blocks that hang over the edge
+	void UReadBlock(const unsigned char* rgba, int width, int height, int bx, int by, unsigned char* block)
+	{
+		for (int y = 0; y < 4; ++y)
+		{
+			const int sy = std::min(by * 4 + y, height - 1);
+			for (int x = 0; x < 4; ++x)
+			{
+				const int sx = std::min(bx * 4 + x, width - 1);
+				memcpy(block + (y * 4 + x) * 4, rgba + (size_t(sy) * width + sx) * 4, 4);
+			}
+		}
+	}
+
+	void UCompressBlockRow(const unsigned char* rgba, int width, int height, int by, BlockFormat format, unsigned char* blocks)
+	{
+		const int blocksWide = (width + 3) / 4;
+		const size_t blockBytes = UBlockBytes(format);
+		unsigned char pixels[64];
+		for (int bx = 0; bx < blocksWide; ++bx)
+		{
+			UReadBlock(rgba, width, height, bx, by, pixels);
+			unsigned char* block = blocks + (size_t(by) * blocksWide + bx) * blockBytes;
+			if (format == BlockFormat::BC1)
+				UEncodeBC1Block(pixels, block);
+			else
+				UEncodeBC7Block(pixels, block);
+		}
+	}
+}
+
+size_t UBlockBytes(BlockFormat format)
+{
+	return format == BlockFormat::BC1 ? 8 : 16;
+}
+
+size_t UCompressedSize(BlockFormat format, int width, int height)
+{
+	return size_t((width + 3) / 4) * ((height + 3) / 4) * UBlockBytes(format);
+}
+
+GLenum UBlockFormatGL(BlockFormat format)
+{
+	return format == BlockFormat::BC1 ? GL_COMPRESSED_RGB_S3TC_DXT1_EXT : GL_COMPRESSED_RGBA_BPTC_UNORM;
+}
+
+///////////////////////////////////////////////////
+//	UEncodeBC1Block(const unsigned char*, unsigned char*)
+//
+//	Endpoints start on the principal axis of the block
+//	colours and are refit by least squares against the
+//	chosen indices; the best quantized pair is kept.
+//	Always emits the four colour mode (color0 > color1),
+//	alpha is ignored.
+///////////////////////////////////////////////////
+void UEncodeBC1Block(const unsigned char* rgba, unsigned char* block)
+{
+	// weight of color1 for each index of the four colour palette
+	static const float weights[4] = { 0.0f, 1.0f, 1.0f / 3.0f, 2.0f / 3.0f };
+
+	BlockPixels px;
+	UGatherBlock(rgba, 3, px);
+
+	float start[4], end[4];
+	UPrincipalAxis(px, 3, start, end);
+
+	float bestError = FLT_MAX;
+	uint16_t bestColor0 = 0, bestColor1 = 0;
+	unsigned char bestIndices[16] = {};
+	for (int iteration = 0; iteration <= refineIterations; ++iteration)
+	{
+		// the brighter end goes first so color0 > color1 holds more often without a swap
+		uint16_t color0 = UPack565(end), color1 = UPack565(start);
+		const bool swapped = color0 < color1;
+		if (swapped)
+			std::swap(color0, color1);
+
+		int palette[4][4];
+		UBC1Palette(color0, color1, palette);
+		float paletteF[4][4];
+		for (int p = 0; p < 4; ++p)
+			for (int c = 0; c < 4; ++c)
+				paletteF[p][c] = c < 3 ? float(palette[p][c]) : 0.0f;
+
+		// equal endpoints would select the three colour mode, so only index 0 is usable
+		unsigned char indices[16];
+		const float error = UFindIndices(px, paletteF, color0 == color1 ? 1 : 4, indices);
+		if (error < bestError)
+		{
+			bestError = error;
+			bestColor0 = color0;
+			bestColor1 = color1;
+			memcpy(bestIndices, indices, sizeof(indices));
+		}
+		if (color0 == color1 || error == 0.0f || iteration == refineIterations)
+			break;
+
+		// refit in the unswapped orientation: start ~ color1, end ~ color0
+		float first[4] = {}, second[4] = {};
+		for (int c = 0; c < 3; ++c)
+		{
+			first[c] = float(palette[0][c]);
+			second[c] = float(palette[1][c]);
+		}
+		URefineEndpoints(px, 3, indices, weights, first, second);
+		for (int c = 0; c < 3; ++c)
+		{
+			end[c] = swapped ? second[c] : first[c];
+			start[c] = swapped ? first[c] : second[c];
+		}
+	}
+
+	uint32_t bits = 0;
+	for (int i = 0; i < 16; ++i)
+		bits |= uint32_t(bestIndices[i]) << (i * 2);
+	block[0] = (unsigned char)(bestColor0 & 0xFF);
+	block[1] = (unsigned char)(bestColor0 >> 8);
+	block[2] = (unsigned char)(bestColor1 & 0xFF);
+	block[3] = (unsigned char)(bestColor1 >> 8);
+	for (int i = 0; i < 4; ++i)
+		block[4 + i] = (unsigned char)(bits >> (i * 8));
+}
+
+///////////////////////////////////////////////////
+//	UEncodeBC7Block(const unsigned char*, unsigned char*)
+//
+//	Mode 6 only: one subset, RGBA endpoints with 7 bits
+//	per channel plus a shared low bit per endpoint, and
+//	4 bit indices. All four p-bit combinations are tried
+//	for every refit of the endpoints.
+///////////////////////////////////////////////////
+void UEncodeBC7Block(const unsigned char* rgba, unsigned char* block)
+{
+	static float weights[16];
+	static const bool weightsReady = []()
+	{
+		for (int i = 0; i < 16; ++i)
+			weights[i] = bc7Weights[i] / 64.0f;
+		return true;
+	}();
+	(void)weightsReady;
+
+	BlockPixels px;
+	UGatherBlock(rgba, 4, px);
+
+	float endpoints[2][4];
+	UPrincipalAxis(px, 4, endpoints[0], endpoints[1]);
+
+	float bestError = FLT_MAX;
+	int bestColors[2][4] = {};
+	int bestP[2] = {};
+	unsigned char bestIndices[16] = {};
+	for (int iteration = 0; iteration <= refineIterations; ++iteration)
+	{
+		float iterationError = FLT_MAX;
+		int colors[2][4] = {}, p[2] = {};
+		unsigned char indices[16] = {};
+		for (int combination = 0; combination < 4; ++combination)
+		{
+			int quantized[2][4], values[2][4];
+			const int bits[2] = { combination & 1, combination >> 1 };
+			for (int e = 0; e < 2; ++e)
+			{
+				for (int c = 0; c < 4; ++c)
+				{
+					quantized[e][c] = std::min(std::max(int((endpoints[e][c] - bits[e]) * 0.5f + 0.5f), 0), 127);
+					values[e][c] = (quantized[e][c] << 1) | bits[e];
+				}
+			}
+
+			float palette[16][4];
+			for (int i = 0; i < 16; ++i)
+				for (int c = 0; c < 4; ++c)
+					palette[i][c] = float(((64 - bc7Weights[i]) * values[0][c] + bc7Weights[i] * values[1][c] + 32) >> 6);
+
+			unsigned char candidate[16];
+			const float error = UFindIndices(px, palette, 16, candidate);
+			if (error < iterationError)
+			{
+				iterationError = error;
+				memcpy(colors, quantized, sizeof(colors));
+				p[0] = bits[0];
+				p[1] = bits[1];
+				memcpy(indices, candidate, sizeof(indices));
+			}
+		}
+
+		if (iterationError < bestError)
+		{
+			bestError = iterationError;
+			memcpy(bestColors, colors, sizeof(bestColors));
+			bestP[0] = p[0];
+			bestP[1] = p[1];
+			memcpy(bestIndices, indices, sizeof(bestIndices));
+		}
+		if (iterationError == 0.0f || iteration == refineIterations)
+			break;
+		URefineEndpoints(px, 4, indices, weights, endpoints[0], endpoints[1]);
+	}
+
+	// the anchor (first) index is stored without its top bit, so it must
+	// be below 8; swapping the endpoints mirrors every index
+	if (bestIndices[0] & 8)
+	{
+		for (int c = 0; c < 4; ++c)
+			std::swap(bestColors[0][c], bestColors[1][c]);
+		std::swap(bestP[0], bestP[1]);
+		for (int i = 0; i < 16; ++i)
+			bestIndices[i] = (unsigned char)(15 - bestIndices[i]);
+	}
+
+	memset(block, 0, 16);
+	BitWriter writer = { block };
+	writer.Write(1u << 6, 7);
+	for (int c = 0; c < 4; ++c)
+	{
+		writer.Write(bestColors[0][c], 7);
+		writer.Write(bestColors[1][c], 7);
+	}
+	writer.Write(bestP[0], 1);
+	writer.Write(bestP[1], 1);
+	writer.Write(bestIndices[0], 3);
+	for (int i = 1; i < 16; ++i)
+		writer.Write(bestIndices[i], 4);
+}
+
+///////////////////////////////////////////////////
+//	UDecodeBC1Block(const unsigned char*, unsigned char*)
+//
+//	Decodes both the four colour and the three colour
+//	plus transparent black modes
+///////////////////////////////////////////////////
+void UDecodeBC1Block(const unsigned char* block, unsigned char* rgba)
+{
+	const uint16_t color0 = uint16_t(block[0] | (block[1] << 8));
+	const uint16_t color1 = uint16_t(block[2] | (block[3] << 8));
+	const uint32_t bits = uint32_t(block[4]) | (uint32_t(block[5]) << 8) | (uint32_t(block[6]) << 16) | (uint32_t(block[7]) << 24);
+
+	int palette[4][4];
+	UBC1Palette(color0, color1, palette);
+	if (color0 <= color1)
+	{
+		for (int c = 0; c < 3; ++c)
+		{
+			palette[2][c] = (palette[0][c] + palette[1][c]) / 2;
+			palette[3][c] = 0;
+		}
+		palette[3][3] = 0;
+	}
+
+	for (int i = 0; i < 16; ++i)
+	{
+		const int* color = palette[(bits >> (i * 2)) & 3];
+		for (int c = 0; c < 4; ++c)
+			rgba[i * 4 + c] = (unsigned char)color[c];
+	}
+}
+
+///////////////////////////////////////////////////
+//	UDecodeBC7Block(const unsigned char*, unsigned char*)
+//
+//	Decodes mode 6 blocks, the only mode the encoder
+//	writes. Other modes decode to transparent black and
+//	return false.
+///////////////////////////////////////////////////
+bool UDecodeBC7Block(const unsigned char* block, unsigned char* rgba)
+{
+	if ((block[0] & 0x7F) != 0x40)
+	{
+		memset(rgba, 0, 64);
+		return false;
+	}
+
+	BitReader reader = { block, 7 };
+	int colors[2][4];
+	for (int c = 0; c < 4; ++c)
+	{
+		colors[0][c] = (int)reader.Read(7);
+		colors[1][c] = (int)reader.Read(7);
+	}
+	const int p0 = (int)reader.Read(1), p1 = (int)reader.Read(1);
+	for (int c = 0; c < 4; ++c)
+	{
+		colors[0][c] = (colors[0][c] << 1) | p0;
+		colors[1][c] = (colors[1][c] << 1) | p1;
+	}
+
+	for (int i = 0; i < 16; ++i)
+	{
+		const int w = bc7Weights[reader.Read(i == 0 ? 3 : 4)];
+		for (int c = 0; c < 4; ++c)
+			rgba[i * 4 + c] = (unsigned char)(((64 - w) * colors[0][c] + w * colors[1][c] + 32) >> 6);
+	}
+	return true;
+}
+
+///////////////////////////////////////////////////
+//	UCompressImage(const unsigned char*, int, int, BlockFormat, unsigned char*)
+//
+//	rgba: width x height RGBA pixels
+//	blocks: UCompressedSize(format, width, height) bytes
+//
+//	Rows of blocks are spread across the worker threads
+///////////////////////////////////////////////////
+void UCompressImage(const unsigned char* rgba, int width, int height, BlockFormat format, unsigned char* blocks)
+{
+	UParallelFor(size_t((height + 3) / 4), [&](size_t by)
+	{
+		UCompressBlockRow(rgba, width, height, int(by), format, blocks);
+	});
+}
+
+///////////////////////////////////////////////////
+//	UCompressMipChain(const std::vector<ImageLevel>&, BlockFormat, std::vector<std::vector<unsigned char>>&)
+//
+//	Compresses every RGBA level. The block rows of all
+//	levels go into one job list, so the small mips do
+//	not leave threads idle at the end of the chain.
+///////////////////////////////////////////////////
+void UCompressMipChain(const std::vector<ImageLevel>& levels, BlockFormat format, std::vector<std::vector<unsigned char>>& blocks)
+{
+	struct Job
+	{
+		size_t level;
+		int row;
+	};
+	std::vector<Job> jobs;
+	blocks.resize(levels.size());
+	for (size_t l = 0; l < levels.size(); ++l)
+	{
+		blocks[l].resize(UCompressedSize(format, levels[l].width, levels[l].height));
+		for (int by = 0; by < (levels[l].height + 3) / 4; ++by)
+			jobs.push_back({ l, by });
+	}
+
+	UParallelFor(jobs.size(), [&](size_t i)
+	{
+		const ImageLevel& level = levels[jobs[i].level];
+		UCompressBlockRow(level.pixels.data(), level.width, level.height, jobs[i].row, format, blocks[jobs[i].level].data());
+	});
+}
+
+void UDecompressImage(const unsigned char* blocks, int width, int height, BlockFormat format, unsigned char* rgba)
+{
+	const int blocksWide = (width + 3) / 4;
+	const size_t blockBytes = UBlockBytes(format);
+	UParallelFor(size_t((height + 3) / 4), [&](size_t by)
+	{
+		unsigned char pixels[64];
+		for (int bx = 0; bx < blocksWide; ++bx)
+		{
+			const unsigned char* block = blocks + (by * blocksWide + bx) * blockBytes;
+			if (format == BlockFormat::BC1)
+				UDecodeBC1Block(block, pixels);
+			else
+				UDecodeBC7Block(block, pixels);
+
+			for (int y = 0; y < 4 && int(by) * 4 + y < height; ++y)
+			{
+				const int count = std::min(4, width - bx * 4);
+				memcpy(rgba + ((by * 4 + y) * size_t(width) + bx * 4) * 4, pixels + y * 16, size_t(count) * 4);
+			}
+		}
+	});
+}
+
+///////////////////////////////////////////////////
+//	UComputePSNR(const unsigned char*, const unsigned char*, size_t, int)
+//
+//	a, b: RGBA images of pixelCount pixels
+//	channels: 3 compares colour only, 4 includes alpha
+//
+//	Peak signal to noise ratio in dB; infinite for
+//	identical images
+///////////////////////////////////////////////////
+double UComputePSNR(const unsigned char* a, const unsigned char* b, size_t pixelCount, int channels)
+{
+	double sum = 0.0;
+	for (size_t i = 0; i < pixelCount; ++i)
+	{
+		for (int c = 0; c < channels; ++c)
+		{
+			const double d = double(a[i * 4 + c]) - double(b[i * 4 + c]);
+			sum += d * d;
+		}
+	}
+	if (sum == 0.0)
+		return std::numeric_limits<double>::infinity();
+	const double mse = sum / (double(pixelCount) * channels);
+	return 10.0 * std::log10(255.0 * 255.0 / mse);
+}
+
+///////////////////////////////////////////////////
+//	UBenchmarkBlockCompression(const char*)
+//
+//	Compresses the image to BC1 and BC7, decodes it
+//	back and prints encode speed, size and PSNR
+///////////////////////////////////////////////////
+void UBenchmarkBlockCompression(const char* filename)
+{
+	int width, height, channels;
+	unsigned char* image = stbi_load(filename, &width, &height, &channels, 4);
+	if (!image)
+	{
+		std::cout << "Failed to load texture " << filename << std::endl;
+		return;
+	}
+
+	const size_t pixels = size_t(width) * height;
+	std::vector<unsigned char> decoded(pixels * 4);
+	std::cout << "INFO: Block compression of " << filename << " (" << width << "x" << height << ", "
+		<< channels << " channels, " << UWorkerCount() << " threads)" << std::endl;
+
+	for (BlockFormat format : { BlockFormat::BC1, BlockFormat::BC7 })
+	{
+		std::vector<unsigned char> blocks(UCompressedSize(format, width, height));
+		double best = 1e30;
+		for (int run = 0; run < 3; ++run)
+		{
+			auto start = std::chrono::steady_clock::now();
+			UCompressImage(image, width, height, format, blocks.data());
+			best = std::min(best, std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count());
+		}
+		UDecompressImage(blocks.data(), width, height, format, decoded.data());
+
+		const int compared = format == BlockFormat::BC1 ? 3 : 4;
+		std::cout << "INFO:   " << (format == BlockFormat::BC1 ? "BC1" : "BC7") << " " << pixels / best / 1e6 << " Mpix/s, "
+			<< blocks.size() / 1024 << " KB (" << double(pixels * 4) / blocks.size() << ":1 vs RGBA8), PSNR "
+			<< UComputePSNR(image, decoded.data(), pixels, compared) << " dB" << std::endl;
+	}
+	stbi_image_free(image);
+}
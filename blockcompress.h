@@ -0,0 +1,41 @@
+///////////////////////////////////////////////////////////////////////////////
+// blockcompress.h
+// ========
+// CPU block compression for textures: BC1 for opaque colour maps and BC7
+// (mode 6) where quality or alpha matters. Both come with decoders so the
+// result can be checked against the source on the CPU (PSNR).
+///////////////////////////////////////////////////////////////////////////////
+
+#ifndef BLOCKCOMPRESS_H
+#define BLOCKCOMPRESS_H
+
+#include <GL/glew.h>
+#include <cstddef>
+#include <vector>
+
+#include "imagekernels.h"
+
+enum class BlockFormat
+{
+	BC1,	// 4 bpp, RGB 5:6:5 endpoints, opaque
+	BC7		// 8 bpp, RGBA 7777.1 endpoints (mode 6)
+};
+
+size_t UBlockBytes(BlockFormat format);
+size_t UCompressedSize(BlockFormat format, int width, int height);
+GLenum UBlockFormatGL(BlockFormat format);
+
+// rgba: 4x4 pixels, 64 bytes, row major
+void UEncodeBC1Block(const unsigned char* rgba, unsigned char* block);
+void UEncodeBC7Block(const unsigned char* rgba, unsigned char* block);
+void UDecodeBC1Block(const unsigned char* block, unsigned char* rgba);
+bool UDecodeBC7Block(const unsigned char* block, unsigned char* rgba);
+
+void UCompressImage(const unsigned char* rgba, int width, int height, BlockFormat format, unsigned char* blocks);
+void UCompressMipChain(const std::vector<ImageLevel>& levels, BlockFormat format, std::vector<std::vector<unsigned char>>& blocks);
+void UDecompressImage(const unsigned char* blocks, int width, int height, BlockFormat format, unsigned char* rgba);
+double UComputePSNR(const unsigned char* a, const unsigned char* b, size_t pixelCount, int channels);
+
+void UBenchmarkBlockCompression(const char* filename);
+
+#endif
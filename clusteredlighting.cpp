@@ -0,0 +1,424 @@
+///////////////////////////////////////////////////////////////////////////////
+// clusteredlighting.cpp
+// ========
+// binning point lights into view frustum clusters and the matching shader code
+///////////////////////////////////////////////////////////////////////////////
+
+#include "clusteredlighting.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstring>
+#include <iostream>
+
+namespace
+{
+	// Layout of PointLight in the shader storage buffer (std430)
+	struct GpuPointLight
+	{
+		glm::vec4 positionRadius;
+		glm::vec4 colorSpecular;
+	};
+
+	GLsizeiptr UAlignUp(GLsizeiptr value, GLsizeiptr alignment)
+	{
+		return (value + alignment - 1) / alignment * alignment;
+	}
+
+	GLuint USliceOf(const LightClusterGrid& grid, float depth)
+	{
+		const float slice = std::log(std::max(depth, grid.nearPlane) / grid.nearPlane) / std::log(grid.farPlane / grid.nearPlane) * grid.slices;
+		return (GLuint)std::min(std::max(slice, 0.0f), float(grid.slices - 1));
+	}
+
+	// View depth where a slice starts; slice count is where the last one ends
+	float USliceDepth(const LightClusterGrid& grid, GLuint slice)
+	{
+		return grid.nearPlane * std::pow(grid.farPlane / grid.nearPlane, float(slice) / grid.slices);
+	}
+
+	///////////////////////////////////////////////////
+	//	UTileRange(const LightClusterGrid&, const glm::vec3&, float, float, float, const glm::mat4&, glm::uvec4&)
+	//
+	//	Tiles (x0, y0, x1, y1) covered by the view space box
+	//	center.xy +- extent between two depths. Projection is
+	//	monotonic in depth, so the box's extremes on screen
+	//	are among its corners. Returns false when the box is
+	//	off screen.
+	///////////////////////////////////////////////////
+	bool UTileRange(const LightClusterGrid& grid, const glm::vec3& center, float extent, float nearDepth, float farDepth, const glm::mat4& projection, glm::uvec4& tiles)
+	{
+		glm::vec2 low(1.0f), high(-1.0f);
+		for (int corner = 0; corner < 8; ++corner)
+		{
+			const float x = center.x + ((corner & 1) ? extent : -extent);
+			const float y = center.y + ((corner & 2) ? extent : -extent);
+			const float z = (corner & 4) ? farDepth : nearDepth;
+			const glm::vec4 clip = projection * glm::vec4(x, y, -z, 1.0f);
+			const glm::vec2 ndc = glm::vec2(clip.x, clip.y) / clip.w;
+			low = glm::min(low, ndc);
+			high = glm::max(high, ndc);
+		}
+		if (low.x > 1.0f || low.y > 1.0f || high.x < -1.0f || high.y < -1.0f)
+			return false;
+
+		auto tileOf = [&](float ndc, GLuint pixels, GLuint count)
+		{
+			const float tile = std::floor((std::min(std::max(ndc, -1.0f), 1.0f) * 0.5f + 0.5f) * pixels / grid.tileSize);
+			return (GLuint)std::min(tile, float(count - 1));
+		};
+		tiles = glm::uvec4(tileOf(low.x, grid.width, grid.tilesX), tileOf(low.y, grid.height, grid.tilesY),
+			tileOf(high.x, grid.width, grid.tilesX), tileOf(high.y, grid.height, grid.tilesY));
+		return true;
+	}
+
+	///////////////////////////////////////////////////
+	//	UAppendLightTiles(LightClusterGrid&, const PointLight&, const glm::mat4&, const glm::mat4&)
+	//
+	//	Appends, for each slice the light's sphere reaches,
+	//	the tiles it covers there to grid.tileRanges, with
+	//	the box shrunk to the sphere's widest cross section
+	//	inside that slice. Returns the first and last slice
+	//	with tiles; first > last when the light reaches no
+	//	cluster. The frustum widens with depth, so a light
+	//	off screen in one slice may still show in another:
+	//	slices between the two get an empty range.
+	///////////////////////////////////////////////////
+	glm::uvec2 UAppendLightTiles(LightClusterGrid& grid, const PointLight& light, const glm::mat4& view, const glm::mat4& projection)
+	{
+		const glm::uvec2 none(1, 0);
+		const glm::vec3 center = glm::vec3(view * glm::vec4(light.position, 1.0f));
+		const float depth = -center.z;
+		if (depth + light.radius < grid.nearPlane || depth - light.radius > grid.farPlane)
+			return none;
+
+		const glm::uvec2 reached(USliceOf(grid, depth - light.radius), USliceOf(grid, depth + light.radius));
+		const glm::uvec4 empty(1, 1, 0, 0);
+		const size_t first = grid.tileRanges.size();
+		glm::uvec2 slices = none;
+		for (GLuint slice = reached.x; slice <= reached.y; ++slice)
+		{
+			const float nearDepth = std::max(USliceDepth(grid, slice), depth - light.radius);
+			const float farDepth = std::min(USliceDepth(grid, slice + 1), depth + light.radius);
+			const float offset = std::min(std::max(depth, nearDepth), farDepth) - depth;
+			const float extent = std::sqrt(std::max(light.radius * light.radius - offset * offset, 0.0f));
+			glm::uvec4 tiles;
+			if (!UTileRange(grid, center, extent, nearDepth, farDepth, projection, tiles))
+			{
+				// off screen in this slice only; the ranges stay one per slice from the first with tiles
+				if (slices.x <= slices.y)
+					grid.tileRanges.push_back(empty);
+				continue;
+			}
+			if (slices.x > slices.y)
+				slices.x = slice;
+			slices.y = slice;
+			grid.tileRanges.push_back(tiles);
+		}
+		// drop the empty ranges after the last slice with tiles
+		grid.tileRanges.resize(slices.x <= slices.y ? first + (slices.y - slices.x + 1) : first);
+		return slices;
+	}
+}
+
+///////////////////////////////////////////////////
+//	UCreateLightClusterGrid(LightClusterGrid&, int, int, GLuint, GLuint, float, float, GLuint, GLuint)
+//
+//	width, height: framebuffer size in pixels
+//	tileSize: pixels per cluster side on screen
+//	slices: depth slices between the near and far planes,
+//	        exponentially spaced so clusters stay about as
+//	        deep as they are wide
+//	maxLights, maxIndices: storage per frame; lights and
+//	                       indices past these are dropped
+///////////////////////////////////////////////////
+bool UCreateLightClusterGrid(LightClusterGrid& grid, int width, int height, GLuint tileSize, GLuint slices, float nearPlane, float farPlane, GLuint maxLights, GLuint maxIndices)
+{
+	grid.width = GLuint(std::max(width, 1));
+	grid.height = GLuint(std::max(height, 1));
+	grid.tileSize = std::max(tileSize, 1u);
+	grid.tilesX = (grid.width + grid.tileSize - 1) / grid.tileSize;
+	grid.tilesY = (grid.height + grid.tileSize - 1) / grid.tileSize;
+	grid.slices = std::max(slices, 1u);
+	grid.nearPlane = nearPlane;
+	grid.farPlane = farPlane;
+	grid.maxLights = std::max(maxLights, 1u);
+	grid.maxIndices = std::max(maxIndices, 1u);
+
+	GLint alignment = 256;
+	glGetIntegerv(GL_SHADER_STORAGE_BUFFER_OFFSET_ALIGNMENT, &alignment);
+	const GLuint clusters = grid.tilesX * grid.tilesY * grid.slices;
+	grid.gridOffset = UAlignUp(sizeof(GpuPointLight) * GLsizeiptr(grid.maxLights), alignment);
+	grid.indexOffset = grid.gridOffset + UAlignUp(sizeof(GLuint) * 2 * GLsizeiptr(clusters), alignment);
+	grid.regionSize = UAlignUp(grid.indexOffset + sizeof(GLuint) * GLsizeiptr(grid.maxIndices), alignment);
+
+	const GLbitfield flags = GL_MAP_WRITE_BIT | GL_MAP_PERSISTENT_BIT | GL_MAP_COHERENT_BIT;
+	glGenBuffers(1, &grid.buffer);
+	glBindBuffer(GL_SHADER_STORAGE_BUFFER, grid.buffer);
+	glBufferStorage(GL_SHADER_STORAGE_BUFFER, grid.regionSize * 3, nullptr, flags);
+	grid.mapped = (unsigned char*)glMapBufferRange(GL_SHADER_STORAGE_BUFFER, 0, grid.regionSize * 3, flags);
+	glBindBuffer(GL_SHADER_STORAGE_BUFFER, 0);
+	if (!grid.mapped)
+	{
+		std::cout << "Failed to map the light cluster buffer" << std::endl;
+		UDestroyLightClusterGrid(grid);
+		return false;
+	}
+
+	grid.counts.assign(clusters, 0);
+	grid.grid.assign(size_t(clusters) * 2, 0);
+	grid.frame = 0;
+	grid.stats = LightClusterStats();
+	std::cout << "INFO: Clustered lighting: " << grid.tilesX << "x" << grid.tilesY << "x" << grid.slices << " clusters of "
+		<< grid.tileSize << " pixels, up to " << grid.maxLights << " lights" << std::endl;
+	return true;
+}
+
+void UDestroyLightClusterGrid(LightClusterGrid& grid)
+{
+	for (GLsync& fence : grid.fences)
+	{
+		if (fence)
+			glDeleteSync(fence);
+		fence = 0;
+	}
+	if (grid.buffer)
+	{
+		glBindBuffer(GL_SHADER_STORAGE_BUFFER, grid.buffer);
+		if (grid.mapped)
+			glUnmapBuffer(GL_SHADER_STORAGE_BUFFER);
+		glBindBuffer(GL_SHADER_STORAGE_BUFFER, 0);
+		glDeleteBuffers(1, &grid.buffer);
+	}
+	grid.buffer = 0;
+	grid.mapped = nullptr;
+}
+
+///////////////////////////////////////////////////
+//	UBuildLightClusters(LightClusterGrid&, const std::vector<PointLight>&, const glm::mat4&, const glm::mat4&)
+//
+//	lights: every light this frame
+//	view, projection: the camera the clusters follow
+//
+//	Bins each light into the clusters its bounds cover
+//	with a counting sort (count, prefix sum, fill), writes
+//	lights, grid and indices into the next ring region and
+//	binds that region to the shader storage bindings.
+//	Lights that reach everywhere skip the grid and are
+//	stored first for the shader to always apply.
+///////////////////////////////////////////////////
+void UBuildLightClusters(LightClusterGrid& grid, const std::vector<PointLight>& lights, const glm::mat4& view, const glm::mat4& projection)
+{
+	const auto start = std::chrono::steady_clock::now();
+
+	grid.frame = (grid.frame + 1) % 3;
+	GLsync& fence = grid.fences[grid.frame];
+	if (fence)
+	{
+		glClientWaitSync(fence, GL_SYNC_FLUSH_COMMANDS_BIT, 1000000000);
+		glDeleteSync(fence);
+		fence = 0;
+	}
+	unsigned char* region = grid.mapped + grid.regionSize * grid.frame;
+
+	// global lights first, then the ones binned into clusters
+	GpuPointLight* gpuLights = (GpuPointLight*)region;
+	GLuint stored = 0;
+	for (int pass = 0; pass < 2; ++pass)
+	{
+		for (const PointLight& light : lights)
+		{
+			if ((light.radius <= 0.0f) != (pass == 0) || stored == grid.maxLights)
+				continue;
+			gpuLights[stored++] = { glm::vec4(light.position, std::max(light.radius, 0.0f)), glm::vec4(light.color, light.specular) };
+		}
+		if (pass == 0)
+			grid.globalLights = stored;
+	}
+
+	std::fill(grid.counts.begin(), grid.counts.end(), 0);
+	// tile ranges of every light, slice by slice, in light order
+	grid.tileRanges.clear();
+	grid.sliceRanges.resize(stored);
+	for (GLuint i = grid.globalLights; i < stored; ++i)
+	{
+		PointLight light;
+		light.position = glm::vec3(gpuLights[i].positionRadius);
+		light.radius = gpuLights[i].positionRadius.w;
+		grid.sliceRanges[i] = UAppendLightTiles(grid, light, view, projection);
+	}
+
+	const glm::uvec4* tileRange = grid.tileRanges.data();
+	for (GLuint i = grid.globalLights; i < stored; ++i)
+	{
+		for (GLuint z = grid.sliceRanges[i].x; z <= grid.sliceRanges[i].y; ++z, ++tileRange)
+			for (GLuint y = tileRange->y; y <= tileRange->w; ++y)
+				for (GLuint x = tileRange->x; x <= tileRange->z; ++x)
+					++grid.counts[(z * grid.tilesY + y) * grid.tilesX + x];
+	}
+
+	// prefix sum into (offset, count); counts becomes the fill cursor
+	GLuint total = 0;
+	for (size_t cluster = 0; cluster < grid.counts.size(); ++cluster)
+	{
+		grid.grid[cluster * 2] = total;
+		grid.grid[cluster * 2 + 1] = grid.counts[cluster];
+		total += grid.counts[cluster];
+		grid.counts[cluster] = grid.grid[cluster * 2];
+	}
+
+	grid.indices.resize(total);
+	GLuint* cursors = grid.counts.data();
+	GLuint* indices = grid.indices.data();
+	tileRange = grid.tileRanges.data();
+	for (GLuint i = grid.globalLights; i < stored; ++i)
+	{
+		for (GLuint z = grid.sliceRanges[i].x; z <= grid.sliceRanges[i].y; ++z, ++tileRange)
+			for (GLuint y = tileRange->y; y <= tileRange->w; ++y)
+			{
+				GLuint* row = cursors + (z * grid.tilesY + y) * grid.tilesX;
+				for (GLuint x = tileRange->x; x <= tileRange->z; ++x)
+					indices[row[x]++] = i;
+			}
+	}
+
+	// past the storage, every cluster keeps what fits, front to back
+	const bool overflow = total > grid.maxIndices;
+	if (overflow)
+	{
+		GLuint kept = 0;
+		for (size_t cluster = 0; cluster < grid.counts.size(); ++cluster)
+		{
+			const GLuint count = std::min(grid.grid[cluster * 2 + 1], grid.maxIndices - kept);
+			memmove(indices + kept, indices + grid.grid[cluster * 2], count * sizeof(GLuint));
+			grid.grid[cluster * 2] = kept;
+			grid.grid[cluster * 2 + 1] = count;
+			kept += count;
+		}
+		total = kept;
+	}
+	for (size_t cluster = 0; cluster < grid.counts.size(); ++cluster)
+		grid.stats.maxPerCluster = std::max(grid.stats.maxPerCluster, grid.grid[cluster * 2 + 1]);
+
+	// the mapping may be write combined, so it is only written, in order
+	memcpy(region + grid.gridOffset, grid.grid.data(), grid.grid.size() * sizeof(GLuint));
+	memcpy(region + grid.indexOffset, indices, total * sizeof(GLuint));
+
+	const GLintptr base = grid.regionSize * grid.frame;
+	glBindBufferRange(GL_SHADER_STORAGE_BUFFER, lightBufferBinding, grid.buffer, base, std::max<GLsizeiptr>(sizeof(GpuPointLight) * stored, sizeof(GpuPointLight)));
+	glBindBufferRange(GL_SHADER_STORAGE_BUFFER, lightGridBinding, grid.buffer, base + grid.gridOffset, grid.grid.size() * sizeof(GLuint));
+	glBindBufferRange(GL_SHADER_STORAGE_BUFFER, lightIndexBinding, grid.buffer, base + grid.indexOffset, std::max<GLsizeiptr>(sizeof(GLuint) * total, sizeof(GLuint)));
+
+	++grid.stats.frames;
+	grid.stats.lights += stored;
+	grid.stats.indices += total;
+	grid.stats.overflows += overflow ? 1 : 0;
+	grid.stats.buildSeconds += std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+}
+
+// Marks the end of the GPU commands that read this frame's region
+void UEndLightClusterFrame(LightClusterGrid& grid)
+{
+	if (grid.fences[grid.frame])
+		glDeleteSync(grid.fences[grid.frame]);
+	grid.fences[grid.frame] = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+}
+
+// Grid shape and slicing for a program using ULightClusterShaderSource()
+void USetLightClusterUniforms(GLuint programId, const LightClusterGrid& grid)
+{
+	const float sliceScale = grid.slices / std::log(grid.farPlane / grid.nearPlane);
+	glUniform3ui(glGetUniformLocation(programId, "uClusterGrid"), grid.tilesX, grid.tilesY, grid.slices);
+	glUniform1ui(glGetUniformLocation(programId, "uClusterTileSize"), grid.tileSize);
+	glUniform2f(glGetUniformLocation(programId, "uClusterSlicing"), sliceScale, -std::log(grid.nearPlane) * sliceScale);
+	glUniform1ui(glGetUniformLocation(programId, "uGlobalLightCount"), grid.globalLights);
+}
+
+///////////////////////////////////////////////////
+//	ULightClusterShaderSource()
+//
+//	Defines vec3 shadeLights(vec3 position, vec3 normal,
+//	vec3 viewDir, float viewDepth, vec2 fragCoord): the
+//	diffuse plus specular Phong light reaching a point,
+//	summed over the global lights and the lights of the
+//	cluster at fragCoord and view depth viewDepth. The
+//	global lights are shadowed by globalLightShadow(),
+//	which UShadowMapShaderSource() defines. In variants
+//	with FEATURE_LIGHTMAP or FEATURE_SHADING_CACHE their
+//	diffuse part is left out, baked elsewhere instead,
+//	and with GLOBAL_LIGHT_COUNT their loop has a constant
+//	bound the compiler can unroll. Also defines
+//	vec3 shadeGlobalDiffuse(vec3 position, vec3 normal),
+//	that diffuse part alone, for texture space shading.
+///////////////////////////////////////////////////
+const char* ULightClusterShaderSource()
+{
+	return
+		"struct PointLight\n"
+		"{\n"
+		"	vec4 positionRadius;\n"
+		"	vec4 colorSpecular;\n"
+		"};\n"
+		"layout(std430, binding = 3) readonly buffer LightBuffer { PointLight uLights[]; };\n"
+		"layout(std430, binding = 4) readonly buffer LightGridBuffer { uvec2 uLightGrid[]; };\n"
+		"layout(std430, binding = 5) readonly buffer LightIndexBuffer { uint uLightIndices[]; };\n"
+		"uniform uvec3 uClusterGrid;\n"
+		"uniform uint uClusterTileSize;\n"
+		"uniform vec2 uClusterSlicing;\n"
+		"uniform uint uGlobalLightCount;\n"
+		"uint globalLightCount()\n"
+		"{\n"
+		"	return GLOBAL_LIGHT_COUNT > 0 ? uint(GLOBAL_LIGHT_COUNT) : uGlobalLightCount;\n"
+		"}\n"
+		"vec3 phongLight(PointLight light, vec3 position, vec3 normal, vec3 viewDir, float diffuse)\n"
+		"{\n"
+		"	vec3 toLight = light.positionRadius.xyz - position;\n"
+		"	float attenuation = 1.0;\n"
+		"	if (light.positionRadius.w > 0.0)\n"
+		"	{\n"
+		"		float fade = clamp(1.0 - dot(toLight, toLight) / (light.positionRadius.w * light.positionRadius.w), 0.0, 1.0);\n"
+		"		attenuation = fade * fade;\n"
+		"	}\n"
+		"	vec3 lightDirection = normalize(toLight);\n"
+		"	float impact = max(dot(normal, lightDirection), 0.0);\n"
+		"	float specularComponent = pow(max(dot(viewDir, reflect(-lightDirection, normal)), 0.0), 16.0);\n"
+		"	return attenuation * (diffuse * impact + light.colorSpecular.w * specularComponent) * light.colorSpecular.rgb;\n"
+		"}\n"
+		"float globalLightShadow(uint light, vec3 position, vec3 normal);\n"
+		"vec3 shadeLights(vec3 position, vec3 normal, vec3 viewDir, float viewDepth, vec2 fragCoord)\n"
+		"{\n"
+		"	vec3 light = vec3(0.0);\n"
+		"	float globalDiffuse = FEATURE_LIGHTMAP != 0 || FEATURE_SHADING_CACHE != 0 ? 0.0 : 1.0;\n"
+		"	for (uint i = 0u; i < globalLightCount(); ++i)\n"
+		"		light += globalLightShadow(i, position, normal) * phongLight(uLights[i], position, normal, viewDir, globalDiffuse);\n"
+		"	uvec2 tile = min(uvec2(fragCoord) / uClusterTileSize, uClusterGrid.xy - 1u);\n"
+		"	uint slice = uint(clamp(log(max(viewDepth, 1e-4)) * uClusterSlicing.x + uClusterSlicing.y, 0.0, float(uClusterGrid.z - 1u)));\n"
+		"	uvec2 cluster = uLightGrid[(slice * uClusterGrid.y + tile.y) * uClusterGrid.x + tile.x];\n"
+		"	for (uint i = 0u; i < cluster.y; ++i)\n"
+		"		light += phongLight(uLights[uLightIndices[cluster.x + i]], position, normal, viewDir, 1.0);\n"
+		"	return light;\n"
+		"}\n"
+		"vec3 shadeGlobalDiffuse(vec3 position, vec3 normal)\n"
+		"{\n"
+		"	vec3 light = vec3(0.0);\n"
+		"	for (uint i = 0u; i < globalLightCount(); ++i)\n"
+		"	{\n"
+		"		PointLight diffuseLight = uLights[i];\n"
+		"		diffuseLight.colorSpecular.w = 0.0;\n"
+		"		light += globalLightShadow(i, position, normal) * phongLight(diffuseLight, position, normal, normal, 1.0);\n"
+		"	}\n"
+		"	return light;\n"
+		"}\n";
+}
+
+void UPrintLightClusterStats(const LightClusterGrid& grid)
+{
+	const LightClusterStats& stats = grid.stats;
+	if (!stats.frames)
+		return;
+	const GLuint clusters = grid.tilesX * grid.tilesY * grid.slices;
+	std::cout << "INFO: Clustered lighting: " << stats.lights / stats.frames << " lights, " << double(stats.indices) / stats.frames / clusters
+		<< " per cluster on average, " << stats.maxPerCluster << " at most, binned in " << stats.buildSeconds / stats.frames * 1000.0
+		<< " ms per frame" << (stats.overflows ? ", index list overflowed in " + std::to_string(stats.overflows) + " frames" : std::string()) << std::endl;
+}
@@ -0,0 +1,78 @@
+///////////////////////////////////////////////////////////////////////////////
+// clusteredlighting.h
+// ========
+// clustered forward lighting: the view frustum is cut into screen tiles and
+// exponential depth slices, every frame each point light is binned into the
+// clusters its sphere of influence touches, and the fragment shader only
+// loops over the lights of its own cluster. Lights, the per-cluster (offset,
+// count) grid and the light index list are shader storage buffers written
+// through a persistently mapped ring, one region per frame in flight.
+///////////////////////////////////////////////////////////////////////////////
+
+#ifndef CLUSTEREDLIGHTING_H
+#define CLUSTEREDLIGHTING_H
+
+#include <GL/glew.h>
+#include <vector>
+
+#include <glm/glm.hpp>
+
+// Shader storage bindings used by ULightClusterShaderSource()
+const GLuint lightBufferBinding = 3;
+const GLuint lightGridBinding = 4;
+const GLuint lightIndexBinding = 5;
+
+// A point light. A radius of 0 lights everything, like the room's two
+// lamps; otherwise the light fades out to nothing at the radius.
+struct PointLight
+{
+	glm::vec3 position = glm::vec3(0.0f);
+	float radius = 0.0f;
+	glm::vec3 color = glm::vec3(1.0f);
+	float specular = 1.0f;	// strength of its highlight
+};
+
+struct LightClusterStats
+{
+	unsigned long long frames = 0;
+	unsigned long long lights = 0;		// summed over frames
+	unsigned long long indices = 0;		// light indices written, summed over frames
+	unsigned long long overflows = 0;	// frames that ran out of index space
+	GLuint maxPerCluster = 0;
+	double buildSeconds = 0.0;
+};
+
+struct LightClusterGrid
+{
+	GLuint width = 0, height = 0;	// framebuffer pixels
+	GLuint tilesX = 0, tilesY = 0, slices = 0;
+	GLuint tileSize = 0;		// pixels per tile side
+	float nearPlane = 0.1f, farPlane = 100.0f;
+	GLuint maxLights = 0, maxIndices = 0;
+
+	// ring of three regions, each: lights, grid, indices
+	GLuint buffer = 0;
+	unsigned char* mapped = nullptr;
+	GLsizeiptr regionSize = 0;
+	GLsizeiptr gridOffset = 0, indexOffset = 0;	// inside a region
+	int frame = 0;
+	GLsync fences[3] = {};
+	GLuint globalLights = 0;	// this frame's lights with radius 0, stored first
+
+	std::vector<GLuint> counts;		// scratch: per cluster
+	std::vector<GLuint> grid;		// scratch: offset, count per cluster
+	std::vector<GLuint> indices;	// scratch
+	std::vector<glm::uvec4> tileRanges;		// scratch: first and last tile per light and slice
+	std::vector<glm::uvec2> sliceRanges;	// scratch: first and last slice per light
+	LightClusterStats stats;
+};
+
+bool UCreateLightClusterGrid(LightClusterGrid& grid, int width, int height, GLuint tileSize, GLuint slices, float nearPlane, float farPlane, GLuint maxLights, GLuint maxIndices);
+void UDestroyLightClusterGrid(LightClusterGrid& grid);
+void UBuildLightClusters(LightClusterGrid& grid, const std::vector<PointLight>& lights, const glm::mat4& view, const glm::mat4& projection);
+void UEndLightClusterFrame(LightClusterGrid& grid);
+void USetLightClusterUniforms(GLuint programId, const LightClusterGrid& grid);
+const char* ULightClusterShaderSource();
+void UPrintLightClusterStats(const LightClusterGrid& grid);
+
+#endif
@@ -0,0 +1,165 @@
+///////////////////////////////////////////////////////////////////////////////
+// deferredshading.cpp
+// ========
+// G-buffer targets, the geometry and lighting pass state, and the shader
+// code that packs normals and rebuilds positions from depth
+///////////////////////////////////////////////////////////////////////////////
+
+#include "deferredshading.h"
+
+#include <iostream>
+
+namespace
+{
+	GLuint UCreateTarget(GLenum internalFormat, GLsizei width, GLsizei height)
+	{
+		GLuint texture = 0;
+		glGenTextures(1, &texture);
+		glBindTexture(GL_TEXTURE_2D, texture);
+		glTexStorage2D(GL_TEXTURE_2D, 1, internalFormat, width, height);
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+		glBindTexture(GL_TEXTURE_2D, 0);
+		return texture;
+	}
+}
+
+bool UCreateGBuffer(GLsizei width, GLsizei height, GBuffer& gbuffer)
+{
+	gbuffer.width = width;
+	gbuffer.height = height;
+	gbuffer.albedoTexture = UCreateTarget(GL_RGBA8, width, height);
+	gbuffer.normalTexture = UCreateTarget(GL_RG16_SNORM, width, height);
+	gbuffer.depthTexture = UCreateTarget(GL_DEPTH_COMPONENT32F, width, height);
+
+	glGenFramebuffers(1, &gbuffer.framebuffer);
+	glBindFramebuffer(GL_FRAMEBUFFER, gbuffer.framebuffer);
+	glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0 + gbufferAlbedoLocation, GL_TEXTURE_2D, gbuffer.albedoTexture, 0);
+	glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0 + gbufferNormalLocation, GL_TEXTURE_2D, gbuffer.normalTexture, 0);
+	glFramebufferTexture2D(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, GL_TEXTURE_2D, gbuffer.depthTexture, 0);
+	const GLenum drawBuffers[3] = { GL_COLOR_ATTACHMENT0 + gbufferAlbedoLocation, GL_NONE, GL_COLOR_ATTACHMENT0 + gbufferNormalLocation };
+	glDrawBuffers(3, drawBuffers);
+	const GLenum status = glCheckFramebufferStatus(GL_FRAMEBUFFER);
+	glBindFramebuffer(GL_FRAMEBUFFER, 0);
+	if (status != GL_FRAMEBUFFER_COMPLETE)
+	{
+		std::cout << "G-buffer framebuffer is incomplete (0x" << std::hex << status << std::dec << ")" << std::endl;
+		UDestroyGBuffer(gbuffer);
+		return false;
+	}
+
+	glGenVertexArrays(1, &gbuffer.emptyVertexArray);
+	std::cout << "INFO: Deferred shading with a " << width << "x" << height << " G-buffer, "
+		<< (12 * GLsizeiptr(width) * height) / 1024 << " KB" << std::endl;
+	return true;
+}
+
+void UDestroyGBuffer(GBuffer& gbuffer)
+{
+	if (gbuffer.framebuffer)
+		glDeleteFramebuffers(1, &gbuffer.framebuffer);
+	for (GLuint texture : { gbuffer.albedoTexture, gbuffer.normalTexture, gbuffer.depthTexture })
+	{
+		if (texture)
+			glDeleteTextures(1, &texture);
+	}
+	if (gbuffer.emptyVertexArray)
+		glDeleteVertexArrays(1, &gbuffer.emptyVertexArray);
+	gbuffer = GBuffer();
+}
+
+///////////////////////////////////////////////////
+//	UBeginGeometryPass(GBuffer&)
+//
+//	Binds and clears the G-buffer. Draw the scene with
+//	the geometry pass uniform set, which writes albedo
+//	and normal instead of lit colour, then call
+//	UEndGeometryPass().
+///////////////////////////////////////////////////
+void UBeginGeometryPass(GBuffer& gbuffer)
+{
+	glGetIntegerv(GL_VIEWPORT, gbuffer.viewport);
+	glBindFramebuffer(GL_FRAMEBUFFER, gbuffer.framebuffer);
+	glViewport(0, 0, gbuffer.width, gbuffer.height);
+	const GLfloat empty[4] = {};
+	glClearBufferfv(GL_COLOR, gbufferAlbedoLocation, empty);
+	glClearBufferfv(GL_COLOR, gbufferNormalLocation, empty);
+	glClear(GL_DEPTH_BUFFER_BIT);
+}
+
+// Back to the default framebuffer for the lighting pass
+void UEndGeometryPass(GBuffer& gbuffer)
+{
+	glBindFramebuffer(GL_FRAMEBUFFER, 0);
+	glViewport(gbuffer.viewport[0], gbuffer.viewport[1], gbuffer.viewport[2], gbuffer.viewport[3]);
+}
+
+// Binds the targets to the samplers of UGBufferShaderHeader()
+void UBindGBuffer(const GBuffer& gbuffer, GLuint programId)
+{
+	const GLuint textures[3] = { gbuffer.albedoTexture, gbuffer.normalTexture, gbuffer.depthTexture };
+	const char* const names[3] = { "uGBufferAlbedo", "uGBufferNormal", "uGBufferDepth" };
+	for (GLuint i = 0; i < 3; ++i)
+	{
+		glActiveTexture(GL_TEXTURE0 + gbufferFirstUnit + i);
+		glBindTexture(GL_TEXTURE_2D, textures[i]);
+		glUniform1i(glGetUniformLocation(programId, names[i]), GLint(gbufferFirstUnit + i));
+	}
+	glActiveTexture(GL_TEXTURE0);
+}
+
+// Covers the viewport with one triangle made from gl_VertexID
+void UDrawFullScreenTriangle(const GBuffer& gbuffer)
+{
+	glBindVertexArray(gbuffer.emptyVertexArray);
+	glDrawArrays(GL_TRIANGLES, 0, 3);
+	glBindVertexArray(0);
+}
+
+// Declarations for the top of a shader using UGBufferShaderSource()
+const char* UGBufferShaderHeader()
+{
+	return
+		"uniform sampler2D uGBufferAlbedo;\n"
+		"uniform sampler2D uGBufferNormal;\n"
+		"uniform sampler2D uGBufferDepth;\n"
+		"uniform mat4 uInverseViewProjection;\n";
+}
+
+///////////////////////////////////////////////////
+//	UGBufferShaderSource()
+//
+//	Defines vec2 encodeNormal(vec3) and vec3
+//	decodeNormal(vec2), the octahedral mapping of unit
+//	vectors to [-1, 1]^2, and vec3 gbufferPosition(ivec2
+//	pixel, float depth), the world position under a pixel
+//	from uInverseViewProjection
+///////////////////////////////////////////////////
+const char* UGBufferShaderSource()
+{
+	return
+		"vec2 signNotZero(vec2 v)\n"
+		"{\n"
+		"	return vec2(v.x >= 0.0 ? 1.0 : -1.0, v.y >= 0.0 ? 1.0 : -1.0);\n"
+		"}\n"
+		"vec2 encodeNormal(vec3 normal)\n"
+		"{\n"
+		"	normal /= abs(normal.x) + abs(normal.y) + abs(normal.z);\n"
+		"	return normal.z >= 0.0 ? normal.xy : (1.0 - abs(normal.yx)) * signNotZero(normal.xy);\n"
+		"}\n"
+		"vec3 decodeNormal(vec2 encoded)\n"
+		"{\n"
+		"	vec3 normal = vec3(encoded, 1.0 - abs(encoded.x) - abs(encoded.y));\n"
+		"	if (normal.z < 0.0)\n"
+		"		normal.xy = (1.0 - abs(normal.yx)) * signNotZero(normal.xy);\n"
+		"	return normalize(normal);\n"
+		"}\n"
+		"vec3 gbufferPosition(ivec2 pixel, float depth)\n"
+		"{\n"
+		"	vec2 ndc = (vec2(pixel) + 0.5) / vec2(textureSize(uGBufferDepth, 0)) * 2.0 - 1.0;\n"
+		"	vec4 position = uInverseViewProjection * vec4(ndc, depth * 2.0 - 1.0, 1.0);\n"
+		"	return position.xyz / position.w;\n"
+		"}\n";
+}
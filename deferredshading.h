@@ -0,0 +1,48 @@
+///////////////////////////////////////////////////////////////////////////////
+// deferredshading.h
+// ========
+// deferred shading: a geometry pass stores each pixel's albedo and an
+// octahedral encoded normal next to the depth buffer, and a full-screen
+// lighting pass rebuilds the position from depth and lights every pixel
+// once. Lighting then costs per lit pixel instead of per object and light.
+// 12 bytes a pixel: RGBA8 albedo, RG16 snorm normal, 32-bit float depth.
+///////////////////////////////////////////////////////////////////////////////
+
+#ifndef DEFERREDSHADING_H
+#define DEFERREDSHADING_H
+
+#include <GL/glew.h>
+
+// Colour attachments the geometry pass writes; its fragment shader's outputs
+// use the same locations
+const GLuint gbufferAlbedoLocation = 0;
+const GLuint gbufferNormalLocation = 2;
+
+// Texture units the lighting pass reads the G-buffer from, after the
+// texture arrays
+const GLuint gbufferFirstUnit = 4;
+
+struct GBuffer
+{
+	GLuint framebuffer = 0;
+	GLuint albedoTexture = 0;	// RGBA8
+	GLuint normalTexture = 0;	// RG16_SNORM, octahedral
+	GLuint depthTexture = 0;	// DEPTH_COMPONENT32F
+	GLuint emptyVertexArray = 0;	// the full-screen triangle has no attributes
+	GLsizei width = 0;
+	GLsizei height = 0;
+	GLint viewport[4] = {};		// restored after the geometry pass
+};
+
+bool UCreateGBuffer(GLsizei width, GLsizei height, GBuffer& gbuffer);
+void UDestroyGBuffer(GBuffer& gbuffer);
+
+void UBeginGeometryPass(GBuffer& gbuffer);
+void UEndGeometryPass(GBuffer& gbuffer);
+void UBindGBuffer(const GBuffer& gbuffer, GLuint programId);
+void UDrawFullScreenTriangle(const GBuffer& gbuffer);
+
+const char* UGBufferShaderHeader();
+const char* UGBufferShaderSource();
+
+#endif
@@ -0,0 +1,184 @@
+///////////////////////////////////////////////////////////////////////////////
+// depthprepass.cpp
+// ========
+// depth state of the two passes, the queries around them and the overdraw
+// heuristic
+///////////////////////////////////////////////////////////////////////////////
+
+#include "depthprepass.h"
+
+#include <iostream>
+
+namespace
+{
+	const char* UDepthPrepassModeName(DepthPrepassMode mode)
+	{
+		switch (mode)
+		{
+		case DepthPrepassMode::On: return "on";
+		case DepthPrepassMode::Auto: return "auto";
+		default: return "off";
+		}
+	}
+
+	// Adds a finished frame's results to the totals, waiting for them if the GPU is that far behind
+	void UCollectDepthPrepassQueries(DepthPrepass& prepass, DepthPrepassQueries& queries)
+	{
+		if (!queries.pending)
+			return;
+		queries.pending = false;
+
+		GLuint64 nanoseconds = 0;
+		glGetQueryObjectui64v(queries.timer, GL_QUERY_RESULT, &nanoseconds);
+		if (queries.prepass)
+		{
+			prepass.framesWith++;
+			prepass.msWith += nanoseconds * 1e-6;
+		}
+		else
+		{
+			prepass.framesWithout++;
+			prepass.msWithout += nanoseconds * 1e-6;
+		}
+
+		if (!queries.measured)
+			return;
+		GLuint64 depthSamples = 0, shadedSamples = 0;
+		glGetQueryObjectui64v(queries.depthSamples, GL_QUERY_RESULT, &depthSamples);
+		glGetQueryObjectui64v(queries.shadedSamples, GL_QUERY_RESULT, &shadedSamples);
+		if (shadedSamples == 0)
+			return;
+		prepass.overdraw = float(double(depthSamples) / double(shadedSamples));
+		prepass.measurements++;
+	}
+}
+
+///////////////////////////////////////////////////
+//	UCreateDepthPrepass(DepthPrepassMode, float, DepthPrepass&)
+//
+//	mode: whether the prepass runs; every mode measures
+//	threshold: overdraw at which Auto turns it on
+//
+//	Every interval frames one frame runs with the prepass
+//	to measure overdraw and the next without, so both
+//	frame times are known whichever way it is set
+///////////////////////////////////////////////////
+bool UCreateDepthPrepass(DepthPrepassMode mode, float threshold, DepthPrepass& prepass)
+{
+	prepass.mode = mode;
+	prepass.threshold = threshold;
+	prepass.enabled = mode == DepthPrepassMode::On;
+	for (DepthPrepassQueries& queries : prepass.queries)
+	{
+		glGenQueries(1, &queries.timer);
+		glGenQueries(1, &queries.depthSamples);
+		glGenQueries(1, &queries.shadedSamples);
+	}
+	std::cout << "INFO: Depth prepass " << UDepthPrepassModeName(mode);
+	if (mode == DepthPrepassMode::Auto)
+		std::cout << " above " << threshold << "x overdraw";
+	std::cout << std::endl;
+	return true;
+}
+
+void UDestroyDepthPrepass(DepthPrepass& prepass)
+{
+	for (DepthPrepassQueries& queries : prepass.queries)
+	{
+		for (GLuint query : { queries.timer, queries.depthSamples, queries.shadedSamples })
+		{
+			if (query)
+				glDeleteQueries(1, &query);
+		}
+	}
+	prepass = DepthPrepass();
+}
+
+///////////////////////////////////////////////////
+//	UBeginDepthPrepassFrame(DepthPrepass&)
+//
+//	Collects the queries of the frame whose slot this one
+//	reuses, decides whether the prepass runs and starts
+//	timing. Returns true when it runs: draw the scene
+//	between UBeginDepthPrepass() and UEndDepthPrepass(),
+//	then draw it shaded and call UEndDepthPrepassFrame().
+///////////////////////////////////////////////////
+bool UBeginDepthPrepassFrame(DepthPrepass& prepass)
+{
+	DepthPrepassQueries& queries = prepass.queries[prepass.next];
+	UCollectDepthPrepassQueries(prepass, queries);
+
+	const unsigned long long step = prepass.frame % prepass.interval;
+	if (step > 1)
+	{
+		const bool enabled = prepass.mode == DepthPrepassMode::On ||
+			(prepass.mode == DepthPrepassMode::Auto && prepass.overdraw > prepass.threshold);
+		if (enabled != prepass.enabled)
+			prepass.switches++;
+		prepass.enabled = enabled;
+	}
+	// the measuring frame needs the prepass, and the one after times the pass without it
+	const bool enabled = step == 0 || (step > 1 && prepass.enabled);
+
+	queries.prepass = enabled;
+	queries.measured = step == 0;
+	queries.pending = true;
+	glBeginQuery(GL_TIME_ELAPSED, queries.timer);
+	return enabled;
+}
+
+// Depth only: colour writes off, and the fragments that pass counted when measuring
+void UBeginDepthPrepass(DepthPrepass& prepass)
+{
+	const DepthPrepassQueries& queries = prepass.queries[prepass.next];
+	glColorMask(GL_FALSE, GL_FALSE, GL_FALSE, GL_FALSE);
+	if (queries.measured)
+		glBeginQuery(GL_SAMPLES_PASSED, queries.depthSamples);
+}
+
+// Shading pass next: only the fragments on the nearest surface pass, and depth is final
+void UEndDepthPrepass(DepthPrepass& prepass)
+{
+	const DepthPrepassQueries& queries = prepass.queries[prepass.next];
+	if (queries.measured)
+	{
+		glEndQuery(GL_SAMPLES_PASSED);
+		glBeginQuery(GL_SAMPLES_PASSED, queries.shadedSamples);
+	}
+	glColorMask(GL_TRUE, GL_TRUE, GL_TRUE, GL_TRUE);
+	glDepthFunc(GL_EQUAL);
+	glDepthMask(GL_FALSE);
+}
+
+// Ends the frame's queries and restores the usual depth state
+void UEndDepthPrepassFrame(DepthPrepass& prepass)
+{
+	const DepthPrepassQueries& queries = prepass.queries[prepass.next];
+	if (queries.prepass)
+	{
+		if (queries.measured)
+			glEndQuery(GL_SAMPLES_PASSED);
+		glDepthFunc(GL_LESS);
+		glDepthMask(GL_TRUE);
+	}
+	glEndQuery(GL_TIME_ELAPSED);
+	prepass.next = (prepass.next + 1) % depthPrepassFrames;
+	prepass.frame++;
+}
+
+void UPrintDepthPrepassStats(const DepthPrepass& prepass)
+{
+	if (prepass.framesWith + prepass.framesWithout == 0)
+		return;
+	std::cout << "INFO: Depth prepass " << UDepthPrepassModeName(prepass.mode) << ": overdraw " << prepass.overdraw << "x (last of "
+		<< prepass.measurements << " measurements); scene passes ";
+	if (prepass.framesWith > 0)
+		std::cout << prepass.msWith / prepass.framesWith << " ms with it over " << prepass.framesWith << " frames";
+	if (prepass.framesWith > 0 && prepass.framesWithout > 0)
+		std::cout << ", ";
+	if (prepass.framesWithout > 0)
+		std::cout << prepass.msWithout / prepass.framesWithout << " ms without over " << prepass.framesWithout << " frames";
+	if (prepass.mode == DepthPrepassMode::Auto)
+		std::cout << "; switched " << prepass.switches << " times";
+	std::cout << std::endl;
+}
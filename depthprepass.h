@@ -0,0 +1,67 @@
+///////////////////////////////////////////////////////////////////////////////
+// depthprepass.h
+// ========
+// optional depth prepass for the forward path: the scene is first drawn with
+// colour writes off by a position only program with an empty fragment
+// stage, then drawn again by the cube program with GL_EQUAL depth and depth
+// writes off, so the Phong shader runs once per visible pixel instead of once
+// per fragment that passes in submission order. Both programs declare an
+// invariant gl_Position, so the two passes compute the same depth. Occlusion queries count the fragments each pass lets through, whose
+// ratio is the overdraw the prepass removes; timer queries measure the scene
+// passes with and without it. In the automatic mode the prepass is on while
+// the measured overdraw is above a threshold.
+///////////////////////////////////////////////////////////////////////////////
+
+#ifndef DEPTHPREPASS_H
+#define DEPTHPREPASS_H
+
+#include <GL/glew.h>
+
+// Frames whose queries may be in flight at once
+const int depthPrepassFrames = 3;
+
+enum class DepthPrepassMode
+{
+	Off,	// only measured
+	On,
+	Auto	// on while overdraw is above the threshold
+};
+
+struct DepthPrepassQueries
+{
+	GLuint timer = 0;			// GL_TIME_ELAPSED over both scene passes
+	GLuint depthSamples = 0;	// fragments passing the prepass, as many as a plain pass would shade
+	GLuint shadedSamples = 0;	// fragments passing GL_EQUAL: the visible pixels
+	bool prepass = false;
+	bool measured = false;		// the samples queries ran
+	bool pending = false;
+};
+
+struct DepthPrepass
+{
+	DepthPrepassMode mode = DepthPrepassMode::Off;
+	float threshold = 1.5f;		// overdraw at which Auto turns the prepass on
+	int interval = 120;			// frames between overdraw measurements
+	bool enabled = false;		// this frame
+
+	DepthPrepassQueries queries[depthPrepassFrames];
+	int next = 0;
+	unsigned long long frame = 0;
+
+	float overdraw = 0.0f;		// last measured, 0 before the first
+	unsigned long long measurements = 0;
+	unsigned long long framesWith = 0, framesWithout = 0;
+	double msWith = 0.0, msWithout = 0.0;	// GPU time of the scene passes, summed
+	unsigned long long switches = 0;		// Auto turning the prepass on or off
+};
+
+bool UCreateDepthPrepass(DepthPrepassMode mode, float threshold, DepthPrepass& prepass);
+void UDestroyDepthPrepass(DepthPrepass& prepass);
+
+bool UBeginDepthPrepassFrame(DepthPrepass& prepass);
+void UBeginDepthPrepass(DepthPrepass& prepass);
+void UEndDepthPrepass(DepthPrepass& prepass);
+void UEndDepthPrepassFrame(DepthPrepass& prepass);
+void UPrintDepthPrepassStats(const DepthPrepass& prepass);
+
+#endif
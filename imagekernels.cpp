@@ -0,0 +1,567 @@
+///////////////////////////////////////////////////////////////////////////////
+// imagekernels.cpp
+// ========
+// SIMD and scalar image kernels
+///////////////////////////////////////////////////////////////////////////////
+
+#include "imagekernels.h"
+#include "parallel.h"
+
+#include <chrono>
+#include <cmath>
+#include <cstring>
+#include <iostream>
+#include <vector>
+
+#if defined(__AVX2__)
+#include <immintrin.h>
+#define IMAGE_KERNELS_AVX2 1
+#define IMAGE_KERNELS_SSE4 1
+#elif defined(__SSE4_1__) || defined(__AVX__)
+#include <smmintrin.h>
+#define IMAGE_KERNELS_SSE4 1
+#endif
+
+namespace
+{
+	const int rowsPerJob = 32;
+
+	// Splits rows into blocks and hands them to the worker threads
+	template <typename Func>
+	void UForRowBlocks(int rows, Func fn)
+	{
+		const size_t blocks = (size_t(rows) + rowsPerJob - 1) / rowsPerJob;
+		UParallelFor(blocks, [&](size_t block)
+		{
+			const int begin = int(block) * rowsPerJob;
+			fn(begin, std::min(rows, begin + rowsPerJob));
+		});
+	}
+
+	// sRGB <-> linear tables; the inverse table is indexed by linear * (size - 1)
+	struct SrgbTables
+	{
+		static const int linearSteps = 16384;
+		float toLinear[256];
+		unsigned char toSrgb[linearSteps + 1];
+
+		SrgbTables()
+		{
+			for (int i = 0; i < 256; ++i)
+			{
+				float c = i / 255.0f;
+				toLinear[i] = c <= 0.04045f ? c / 12.92f : std::pow((c + 0.055f) / 1.055f, 2.4f);
+			}
+			for (int i = 0; i <= linearSteps; ++i)
+			{
+				float l = float(i) / linearSteps;
+				float c = l <= 0.0031308f ? l * 12.92f : 1.055f * std::pow(l, 1.0f / 2.4f) - 0.055f;
+				toSrgb[i] = (unsigned char)std::lround(std::min(std::max(c, 0.0f), 1.0f) * 255.0f);
+			}
+		}
+
+		unsigned char Encode(float linear) const
+		{
+			linear = std::min(std::max(linear, 0.0f), 1.0f);
+			return toSrgb[int(linear * linearSteps + 0.5f)];
+		}
+	};
+
+	const SrgbTables& USrgb()
+	{
+		static const SrgbTables tables;
+		return tables;
+	}
+
+	void USwapBytes(unsigned char* a, unsigned char* b, size_t size)
+	{
+		size_t i = 0;
+#if IMAGE_KERNELS_AVX2
+		for (; i + 32 <= size; i += 32)
+		{
+			__m256i x = _mm256_loadu_si256((const __m256i*)(a + i));
+			__m256i y = _mm256_loadu_si256((const __m256i*)(b + i));
+			_mm256_storeu_si256((__m256i*)(a + i), y);
+			_mm256_storeu_si256((__m256i*)(b + i), x);
+		}
+#endif
+#if IMAGE_KERNELS_SSE4
+		for (; i + 16 <= size; i += 16)
+		{
+			__m128i x = _mm_loadu_si128((const __m128i*)(a + i));
+			__m128i y = _mm_loadu_si128((const __m128i*)(b + i));
+			_mm_storeu_si128((__m128i*)(a + i), y);
+			_mm_storeu_si128((__m128i*)(b + i), x);
+		}
+#endif
+		for (; i < size; ++i)
+		{
+			unsigned char tmp = a[i];
+			a[i] = b[i];
+			b[i] = tmp;
+		}
+	}
+
+	void UExpandRange(const unsigned char* rgb, unsigned char* rgba, size_t count)
+	{
+		size_t i = 0;
+#if IMAGE_KERNELS_SSE4
+		// 4 pixels per 16 byte shuffle; the last load reads 4 bytes past the 12 it uses
+		const __m128i shuffle = _mm_setr_epi8(0, 1, 2, -1, 3, 4, 5, -1, 6, 7, 8, -1, 9, 10, 11, -1);
+		const __m128i alpha = _mm_set1_epi32((int)0xFF000000);
+#if IMAGE_KERNELS_AVX2
+		const __m256i shuffle8 = _mm256_broadcastsi128_si256(shuffle);
+		const __m256i alpha8 = _mm256_set1_epi32((int)0xFF000000);
+		for (; i + 8 <= count && (i + 8) * 3 + 4 <= count * 3; i += 8)
+		{
+			__m256i source = _mm256_inserti128_si256(_mm256_castsi128_si256(_mm_loadu_si128((const __m128i*)(rgb + i * 3))),
+				_mm_loadu_si128((const __m128i*)(rgb + i * 3 + 12)), 1);
+			_mm256_storeu_si256((__m256i*)(rgba + i * 4), _mm256_or_si256(_mm256_shuffle_epi8(source, shuffle8), alpha8));
+		}
+#endif
+		for (; i + 4 <= count && (i + 4) * 3 + 4 <= count * 3; i += 4)
+		{
+			__m128i source = _mm_loadu_si128((const __m128i*)(rgb + i * 3));
+			_mm_storeu_si128((__m128i*)(rgba + i * 4), _mm_or_si128(_mm_shuffle_epi8(source, shuffle), alpha));
+		}
+#endif
+		for (; i < count; ++i)
+		{
+			rgba[i * 4 + 0] = rgb[i * 3 + 0];
+			rgba[i * 4 + 1] = rgb[i * 3 + 1];
+			rgba[i * 4 + 2] = rgb[i * 3 + 2];
+			rgba[i * 4 + 3] = 255;
+		}
+	}
+
+	// c * a / 255, rounded: (x + 128 + ((x + 128) >> 8)) >> 8
+	void UPremultiplyRange(unsigned char* rgba, size_t count)
+	{
+		size_t i = 0;
+#if IMAGE_KERNELS_AVX2
+		{
+			const __m256i zero = _mm256_setzero_si256();
+			const __m256i colorMask = _mm256_set1_epi64x(0x0000FFFFFFFFFFFFll);
+			const __m256i alphaOne = _mm256_set1_epi64x((long long)0x00FF000000000000ll);
+			const __m256i half = _mm256_set1_epi16(128);
+			for (; i + 8 <= count; i += 8)
+			{
+				__m256i pixels = _mm256_loadu_si256((const __m256i*)(rgba + i * 4));
+				__m256i result[2];
+				for (int h = 0; h < 2; ++h)
+				{
+					__m256i wide = h == 0 ? _mm256_unpacklo_epi8(pixels, zero) : _mm256_unpackhi_epi8(pixels, zero);
+					__m256i alpha = _mm256_shufflehi_epi16(_mm256_shufflelo_epi16(wide, _MM_SHUFFLE(3, 3, 3, 3)), _MM_SHUFFLE(3, 3, 3, 3));
+					alpha = _mm256_or_si256(_mm256_and_si256(alpha, colorMask), alphaOne); // alpha itself is multiplied by 255
+					__m256i x = _mm256_add_epi16(_mm256_mullo_epi16(wide, alpha), half);
+					result[h] = _mm256_srli_epi16(_mm256_add_epi16(x, _mm256_srli_epi16(x, 8)), 8);
+				}
+				_mm256_storeu_si256((__m256i*)(rgba + i * 4), _mm256_packus_epi16(result[0], result[1]));
+			}
+		}
+#endif
+#if IMAGE_KERNELS_SSE4
+		{
+			const __m128i zero = _mm_setzero_si128();
+			const __m128i colorMask = _mm_set1_epi64x(0x0000FFFFFFFFFFFFll);
+			const __m128i alphaOne = _mm_set1_epi64x((long long)0x00FF000000000000ll);
+			const __m128i half = _mm_set1_epi16(128);
+			for (; i + 4 <= count; i += 4)
+			{
+				__m128i pixels = _mm_loadu_si128((const __m128i*)(rgba + i * 4));
+				__m128i result[2];
+				for (int h = 0; h < 2; ++h)
+				{
+					__m128i wide = h == 0 ? _mm_unpacklo_epi8(pixels, zero) : _mm_unpackhi_epi8(pixels, zero);
+					__m128i alpha = _mm_shufflehi_epi16(_mm_shufflelo_epi16(wide, _MM_SHUFFLE(3, 3, 3, 3)), _MM_SHUFFLE(3, 3, 3, 3));
+					alpha = _mm_or_si128(_mm_and_si128(alpha, colorMask), alphaOne);
+					__m128i x = _mm_add_epi16(_mm_mullo_epi16(wide, alpha), half);
+					result[h] = _mm_srli_epi16(_mm_add_epi16(x, _mm_srli_epi16(x, 8)), 8);
+				}
+				_mm_storeu_si128((__m128i*)(rgba + i * 4), _mm_packus_epi16(result[0], result[1]));
+			}
+		}
+#endif
+		for (; i < count; ++i)
+		{
+			const unsigned a = rgba[i * 4 + 3];
+			for (int c = 0; c < 3; ++c)
+			{
+				unsigned x = rgba[i * 4 + c] * a + 128;
+				rgba[i * 4 + c] = (unsigned char)((x + (x >> 8)) >> 8);
+			}
+		}
+	}
+
+	// Linear 2x2 average of one target row of 4 channel pixels
+	void UBoxRowRGBA(const unsigned char* row0, const unsigned char* row1, int targetWidth, int sourceWidth, unsigned char* target)
+	{
+		int x = 0;
+#if IMAGE_KERNELS_SSE4
+		// 2 target pixels from 4 source pixels of each row
+		const __m128i zero = _mm_setzero_si128();
+		const __m128i two = _mm_set1_epi16(2);
+		for (; x + 2 <= targetWidth && x * 2 + 4 <= sourceWidth; x += 2)
+		{
+			__m128i a = _mm_loadu_si128((const __m128i*)(row0 + x * 8));
+			__m128i b = _mm_loadu_si128((const __m128i*)(row1 + x * 8));
+			__m128i low = _mm_add_epi16(_mm_unpacklo_epi8(a, zero), _mm_unpacklo_epi8(b, zero));
+			__m128i high = _mm_add_epi16(_mm_unpackhi_epi8(a, zero), _mm_unpackhi_epi8(b, zero));
+			low = _mm_add_epi16(low, _mm_srli_si128(low, 8));
+			high = _mm_add_epi16(high, _mm_srli_si128(high, 8));
+			__m128i sum = _mm_srli_epi16(_mm_add_epi16(_mm_unpacklo_epi64(low, high), two), 2);
+			_mm_storel_epi64((__m128i*)(target + x * 4), _mm_packus_epi16(sum, sum));
+		}
+#endif
+		for (; x < targetWidth; ++x)
+		{
+			const int x0 = std::min(x * 2, sourceWidth - 1), x1 = std::min(x * 2 + 1, sourceWidth - 1);
+			for (int c = 0; c < 4; ++c)
+				target[x * 4 + c] = (unsigned char)((row0[x0 * 4 + c] + row0[x1 * 4 + c] + row1[x0 * 4 + c] + row1[x1 * 4 + c] + 2) >> 2);
+		}
+	}
+
+	// Kaiser windowed sinc taps for a 2:1 reduction; tap k reads source pixel 2x - 2 + k
+	const int kaiserTaps = 6;
+
+	struct KaiserWeights
+	{
+		float weights[kaiserTaps];
+
+		KaiserWeights()
+		{
+			const double alpha = 4.0, radius = 3.0;
+			auto besselI0 = [](double x)
+			{
+				double sum = 1.0, term = 1.0;
+				for (int k = 1; k < 32; ++k)
+				{
+					term *= (x / (2.0 * k)) * (x / (2.0 * k));
+					sum += term;
+				}
+				return sum;
+			};
+
+			double total = 0.0;
+			double raw[kaiserTaps];
+			for (int k = 0; k < kaiserTaps; ++k)
+			{
+				const double distance = k - 2.5; // source pixels from the target pixel's centre
+				const double t = distance / radius;
+				const double window = besselI0(alpha * std::sqrt(std::max(0.0, 1.0 - t * t))) / besselI0(alpha);
+				const double x = 3.14159265358979 * distance * 0.5;
+				raw[k] = window * std::sin(x) / x;
+				total += raw[k];
+			}
+			for (int k = 0; k < kaiserTaps; ++k)
+				weights[k] = float(raw[k] / total);
+		}
+	};
+
+	const KaiserWeights& UKaiser()
+	{
+		static const KaiserWeights kaiser;
+		return kaiser;
+	}
+
+	inline unsigned char UEncodeChannel(float value, bool srgb, const SrgbTables& tables)
+	{
+		if (srgb)
+			return tables.Encode(value);
+		return (unsigned char)(std::min(std::max(value, 0.0f), 1.0f) * 255.0f + 0.5f);
+	}
+}
+
+const char* UImageKernelPath()
+{
+#if IMAGE_KERNELS_AVX2
+	return "AVX2";
+#elif IMAGE_KERNELS_SSE4
+	return "SSE4.1";
+#else
+	return "scalar";
+#endif
+}
+
+///////////////////////////////////////////////////
+//	UFlipRowsInPlace(unsigned char*, size_t, int)
+//
+//	Swaps row y with row height - 1 - y, 32 bytes at a time
+///////////////////////////////////////////////////
+void UFlipRowsInPlace(unsigned char* image, size_t rowSize, int height)
+{
+	UForRowBlocks(height / 2, [&](int begin, int end)
+	{
+		for (int y = begin; y < end; ++y)
+			USwapBytes(image + size_t(y) * rowSize, image + size_t(height - 1 - y) * rowSize, rowSize);
+	});
+}
+
+// Copies source into target upside down; one memcpy per row
+void UFlipRowsCopy(const unsigned char* source, unsigned char* target, size_t rowSize, int height)
+{
+	UForRowBlocks(height, [&](int begin, int end)
+	{
+		for (int y = begin; y < end; ++y)
+			memcpy(target + size_t(y) * rowSize, source + size_t(height - 1 - y) * rowSize, rowSize);
+	});
+}
+
+///////////////////////////////////////////////////
+//	UExpandRGBToRGBA(const unsigned char*, unsigned char*, size_t)
+//
+//	Widens tightly packed RGB to RGBA with opaque alpha
+//	using byte shuffles, 8 pixels per AVX2 step
+///////////////////////////////////////////////////
+void UExpandRGBToRGBA(const unsigned char* rgb, unsigned char* rgba, size_t pixelCount)
+{
+	const size_t chunk = 65536;
+	UParallelFor((pixelCount + chunk - 1) / chunk, [&](size_t block)
+	{
+		const size_t begin = block * chunk;
+		UExpandRange(rgb + begin * 3, rgba + begin * 4, std::min(chunk, pixelCount - begin));
+	});
+}
+
+///////////////////////////////////////////////////
+//	UPremultiplyAlpha(unsigned char*, size_t)
+//
+//	Multiplies RGB by A in place with exact rounding of
+//	c * a / 255, 8 pixels per AVX2 step
+///////////////////////////////////////////////////
+void UPremultiplyAlpha(unsigned char* rgba, size_t pixelCount)
+{
+	const size_t chunk = 65536;
+	UParallelFor((pixelCount + chunk - 1) / chunk, [&](size_t block)
+	{
+		const size_t begin = block * chunk;
+		UPremultiplyRange(rgba + begin * 4, std::min(chunk, pixelCount - begin));
+	});
+}
+
+///////////////////////////////////////////////////
+//	UDownsampleBox(const unsigned char*, int, int, int, bool, unsigned char*)
+//
+//	2x2 average. Linear RGBA data takes the SIMD path;
+//	sRGB colour goes through the lookup tables so the
+//	mip keeps the image's average brightness. Odd edges
+//	reuse the last row/column.
+///////////////////////////////////////////////////
+void UDownsampleBox(const unsigned char* source, int width, int height, int channels, bool srgb, unsigned char* target)
+{
+	const int targetWidth = std::max(1, width / 2), targetHeight = std::max(1, height / 2);
+	const size_t sourceRow = size_t(width) * channels, targetRow = size_t(targetWidth) * channels;
+	const SrgbTables& tables = USrgb();
+
+	UForRowBlocks(targetHeight, [&](int begin, int end)
+	{
+		for (int y = begin; y < end; ++y)
+		{
+			const unsigned char* row0 = source + size_t(std::min(y * 2, height - 1)) * sourceRow;
+			const unsigned char* row1 = source + size_t(std::min(y * 2 + 1, height - 1)) * sourceRow;
+			unsigned char* out = target + size_t(y) * targetRow;
+
+			if (!srgb && channels == 4)
+			{
+				UBoxRowRGBA(row0, row1, targetWidth, width, out);
+				continue;
+			}
+
+			for (int x = 0; x < targetWidth; ++x)
+			{
+				const int x0 = std::min(x * 2, width - 1) * channels, x1 = std::min(x * 2 + 1, width - 1) * channels;
+				for (int c = 0; c < channels; ++c)
+				{
+					if (srgb && c < 3)
+					{
+						float sum = tables.toLinear[row0[x0 + c]] + tables.toLinear[row0[x1 + c]] + tables.toLinear[row1[x0 + c]] + tables.toLinear[row1[x1 + c]];
+						out[x * channels + c] = tables.Encode(sum * 0.25f);
+					}
+					else
+					{
+						out[x * channels + c] = (unsigned char)((row0[x0 + c] + row0[x1 + c] + row1[x0 + c] + row1[x1 + c] + 2) >> 2);
+					}
+				}
+			}
+		}
+	});
+}
+
+///////////////////////////////////////////////////
+//	UDownsampleKaiser(const unsigned char*, int, int, int, bool, unsigned char*)
+//
+//	2:1 reduction with a 6 tap Kaiser windowed sinc
+//	(alpha 4), applied horizontally then vertically in
+//	linear light. Sharper than the box filter without
+//	its aliasing; ringing is clamped on the way out.
+///////////////////////////////////////////////////
+void UDownsampleKaiser(const unsigned char* source, int width, int height, int channels, bool srgb, unsigned char* target)
+{
+	const int targetWidth = std::max(1, width / 2), targetHeight = std::max(1, height / 2);
+	const size_t sourceRow = size_t(width) * channels, targetRow = size_t(targetWidth) * channels;
+	const SrgbTables& tables = USrgb();
+	const float* weights = UKaiser().weights;
+
+	// A 1 pixel wide/high source has nothing to filter along that axis
+	const int taps = width > 1 ? kaiserTaps : 1;
+	const int verticalTaps = height > 1 ? kaiserTaps : 1;
+	const float single[1] = { 1.0f };
+	const float* horizontalWeights = width > 1 ? weights : single;
+	const float* verticalWeights = height > 1 ? weights : single;
+
+	// per channel byte -> filtering space tables, so the inner loops don't branch
+	float decode[4][256];
+	for (int c = 0; c < channels; ++c)
+		for (int v = 0; v < 256; ++v)
+			decode[c][v] = srgb && c < 3 ? tables.toLinear[v] : v * (1.0f / 255.0f);
+
+	UForRowBlocks(targetHeight, [&](int begin, int end)
+	{
+		// horizontally filtered source rows this block needs, in linear light
+		const int firstRow = height > 1 ? begin * 2 - 2 : 0;
+		const int lastRow = height > 1 ? (end - 1) * 2 + 3 : 0;
+		std::vector<float> filtered(size_t(lastRow - firstRow + 1) * targetRow);
+		std::vector<float> decoded(sourceRow);
+
+		for (int r = firstRow; r <= lastRow; ++r)
+		{
+			const unsigned char* row = source + size_t(std::min(std::max(r, 0), height - 1)) * sourceRow;
+			for (int x = 0; x < width; ++x)
+				for (int c = 0; c < channels; ++c)
+					decoded[size_t(x) * channels + c] = decode[c][row[size_t(x) * channels + c]];
+
+			float* out = &filtered[size_t(r - firstRow) * targetRow];
+			int x = 0;
+#if IMAGE_KERNELS_SSE4
+			// one RGBA pixel per register
+			if (channels == 4 && taps == kaiserTaps)
+			{
+				for (; x < targetWidth; ++x)
+				{
+					__m128 sum = _mm_setzero_ps();
+					for (int k = 0; k < kaiserTaps; ++k)
+					{
+						const int sx = std::min(std::max(x * 2 - 2 + k, 0), width - 1);
+						sum = _mm_add_ps(sum, _mm_mul_ps(_mm_set1_ps(weights[k]), _mm_loadu_ps(&decoded[size_t(sx) * 4])));
+					}
+					_mm_storeu_ps(&out[size_t(x) * 4], sum);
+				}
+			}
+#endif
+			for (; x < targetWidth; ++x)
+			{
+				float sum[4] = {};
+				for (int k = 0; k < taps; ++k)
+				{
+					const int sx = width > 1 ? std::min(std::max(x * 2 - 2 + k, 0), width - 1) : 0;
+					for (int c = 0; c < channels; ++c)
+						sum[c] += horizontalWeights[k] * decoded[size_t(sx) * channels + c];
+				}
+				for (int c = 0; c < channels; ++c)
+					out[size_t(x) * channels + c] = sum[c];
+			}
+		}
+
+		for (int y = begin; y < end; ++y)
+		{
+			unsigned char* out = target + size_t(y) * targetRow;
+			const float* rows[kaiserTaps];
+			for (int k = 0; k < verticalTaps; ++k)
+				rows[k] = &filtered[size_t((height > 1 ? y * 2 - 2 + k : 0) - firstRow) * targetRow];
+
+			int x = 0;
+#if IMAGE_KERNELS_SSE4
+			if (channels == 4)
+			{
+				for (; x < targetWidth; ++x)
+				{
+					__m128 sum = _mm_setzero_ps();
+					for (int k = 0; k < verticalTaps; ++k)
+						sum = _mm_add_ps(sum, _mm_mul_ps(_mm_set1_ps(verticalWeights[k]), _mm_loadu_ps(rows[k] + size_t(x) * 4)));
+					float values[4];
+					_mm_storeu_ps(values, sum);
+					for (int c = 0; c < 4; ++c)
+						out[x * 4 + c] = UEncodeChannel(values[c], srgb && c < 3, tables);
+				}
+			}
+#endif
+			for (; x < targetWidth; ++x)
+			{
+				for (int c = 0; c < channels; ++c)
+				{
+					const size_t i = size_t(x) * channels + c;
+					float sum = 0.0f;
+					for (int k = 0; k < verticalTaps; ++k)
+						sum += verticalWeights[k] * rows[k][i];
+					out[i] = UEncodeChannel(sum, srgb && c < 3, tables);
+				}
+			}
+		}
+	});
+}
+
+///////////////////////////////////////////////////
+//	UBuildMipChain(int, bool, std::vector<ImageLevel>&)
+//
+//	levels: holds level 0 on entry; every smaller level
+//	down to 1x1 is appended, each Kaiser filtered from
+//	the one before
+///////////////////////////////////////////////////
+void UBuildMipChain(int channels, bool srgb, std::vector<ImageLevel>& levels)
+{
+	levels.resize(1);
+	while (levels.back().width > 1 || levels.back().height > 1)
+	{
+		const ImageLevel& source = levels.back();
+		ImageLevel next;
+		next.width = std::max(1, source.width / 2);
+		next.height = std::max(1, source.height / 2);
+		next.pixels.resize(size_t(next.width) * next.height * channels);
+		UDownsampleKaiser(source.pixels.data(), source.width, source.height, channels, srgb, next.pixels.data());
+		levels.push_back(std::move(next));
+	}
+}
+
+///////////////////////////////////////////////////
+//	UBenchmarkImageKernels()
+//
+//	Runs every kernel over a 4096x4096 image (best of
+//	three) and prints the source bytes processed per second
+///////////////////////////////////////////////////
+void UBenchmarkImageKernels()
+{
+	const int size = 4096;
+	const size_t pixels = size_t(size) * size;
+	std::vector<unsigned char> rgb(pixels * 3), rgba(pixels * 4), scratch(pixels * 4);
+
+	// a smooth gradient with noise, so nothing is trivially constant
+	unsigned seed = 12345;
+	for (size_t i = 0; i < rgb.size(); ++i)
+	{
+		seed = seed * 1664525u + 1013904223u;
+		rgb[i] = (unsigned char)((i / 3 % size) / 32 + (seed >> 28));
+	}
+	UExpandRGBToRGBA(rgb.data(), rgba.data(), pixels);
+
+	auto measure = [](const char* name, size_t bytes, auto kernel)
+	{
+		double best = 1e30;
+		for (int run = 0; run < 3; ++run)
+		{
+			auto start = std::chrono::steady_clock::now();
+			kernel();
+			best = std::min(best, std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count());
+		}
+		std::cout << "INFO:   " << name << " " << bytes / best / 1e9 << " GB/s (" << best * 1000.0 << " ms)" << std::endl;
+	};
+
+	std::cout << "INFO: Image kernels (" << UImageKernelPath() << ", " << UWorkerCount() << " threads) on "
+		<< size << "x" << size << " RGBA" << std::endl;
+	measure("flip in place      ", rgba.size(), [&]() { UFlipRowsInPlace(rgba.data(), size_t(size) * 4, size); });
+	measure("flip copy          ", rgba.size(), [&]() { UFlipRowsCopy(rgba.data(), scratch.data(), size_t(size) * 4, size); });
+	measure("RGB -> RGBA        ", rgb.size(), [&]() { UExpandRGBToRGBA(rgb.data(), rgba.data(), pixels); });
+	measure("premultiply        ", rgba.size(), [&]() { UPremultiplyAlpha(rgba.data(), pixels); });
+	measure("box 2x2 linear     ", rgba.size(), [&]() { UDownsampleBox(rgba.data(), size, size, 4, false, scratch.data()); });
+	measure("box 2x2 sRGB       ", rgba.size(), [&]() { UDownsampleBox(rgba.data(), size, size, 4, true, scratch.data()); });
+	measure("Kaiser sRGB        ", rgba.size(), [&]() { UDownsampleKaiser(rgba.data(), size, size, 4, true, scratch.data()); });
+}
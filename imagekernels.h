@@ -0,0 +1,43 @@
+///////////////////////////////////////////////////////////////////////////////
+// imagekernels.h
+// ========
+// 8 bit image kernels for the texture pipeline: row flips, RGB to RGBA
+// expansion, mip downsampling and alpha premultiplication. Each kernel has
+// an AVX2 or SSE4.1 path (picked at compile time from the target flags)
+// and a scalar fallback, and splits large images across the worker threads
+// by rows.
+///////////////////////////////////////////////////////////////////////////////
+
+#ifndef IMAGEKERNELS_H
+#define IMAGEKERNELS_H
+
+#include <cstddef>
+#include <vector>
+
+// One level of a mip chain built on the CPU
+struct ImageLevel
+{
+	int width;
+	int height;
+	std::vector<unsigned char> pixels;
+};
+
+// Name of the instruction set the kernels were compiled for
+const char* UImageKernelPath();
+
+void UFlipRowsInPlace(unsigned char* image, size_t rowSize, int height);
+void UFlipRowsCopy(const unsigned char* source, unsigned char* target, size_t rowSize, int height);
+void UExpandRGBToRGBA(const unsigned char* rgb, unsigned char* rgba, size_t pixelCount);
+void UPremultiplyAlpha(unsigned char* rgba, size_t pixelCount);
+
+// Mip downsampling from width x height to max(1, width / 2) x max(1, height / 2).
+// srgb: colour channels hold sRGB values and are averaged in linear light;
+// the fourth channel, if present, is always treated as linear alpha
+void UDownsampleBox(const unsigned char* source, int width, int height, int channels, bool srgb, unsigned char* target);
+void UDownsampleKaiser(const unsigned char* source, int width, int height, int channels, bool srgb, unsigned char* target);
+
+void UBuildMipChain(int channels, bool srgb, std::vector<ImageLevel>& levels);
+
+void UBenchmarkImageKernels();
+
+#endif
@@ -0,0 +1,384 @@
+///////////////////////////////////////////////////////////////////////////////
+// irradianceprobes.cpp
+// ========
+// probe tracing and SH projection, the time sliced relight, the texture and
+// the GLSL that evaluates it
+///////////////////////////////////////////////////////////////////////////////
+
+#include "irradianceprobes.h"
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cmath>
+#include <iostream>
+
+#include "parallel.h"
+#include "resourceregistry.h"
+
+namespace
+{
+	// How far rays start off a surface, against hitting it again
+	const float probeRayOffset = 0.002f;
+
+	// Share of rays hitting back faces above which a probe is taken to be inside geometry
+	const float probeInsideShare = 0.25f;
+
+	// Real L2 SH basis at unit direction d
+	void USHBasis(const glm::vec3& d, float basis[9])
+	{
+		basis[0] = 0.282095f;
+		basis[1] = 0.488603f * d.y;
+		basis[2] = 0.488603f * d.z;
+		basis[3] = 0.488603f * d.x;
+		basis[4] = 1.092548f * d.x * d.y;
+		basis[5] = 1.092548f * d.y * d.z;
+		basis[6] = 0.315392f * (3.0f * d.z * d.z - 1.0f);
+		basis[7] = 1.092548f * d.x * d.z;
+		basis[8] = 0.546274f * (d.x * d.x - d.y * d.y);
+	}
+
+	glm::vec3 UProbePosition(const IrradianceProbeGrid& grid, size_t probe)
+	{
+		const glm::ivec3 cell(int(probe % grid.counts.x), int(probe / grid.counts.x % grid.counts.y), int(probe / (size_t(grid.counts.x) * grid.counts.y)));
+		return grid.boundsMin + (glm::vec3(cell) + 0.5f) * (grid.boundsMax - grid.boundsMin) / glm::vec3(grid.counts);
+	}
+
+	uint64_t ULightSignature(const std::vector<PointLight>& lights)
+	{
+		return UHashBytes(lights.data(), lights.size() * sizeof(PointLight), lights.size());
+	}
+
+	///////////////////////////////////////////////////
+	//	UTraceProbe(IrradianceProbeGrid&, const std::vector<PointLight>&, size_t, unsigned long long&)
+	//
+	//	Casts the probe's rays over a spherical Fibonacci set
+	//	and projects what they see onto the SH basis: the sky
+	//	when they leave the scene, else the light the surface
+	//	hit reflects (its direct light plus the sky's, times
+	//	its albedo). The coefficients are then convolved with
+	//	the cosine lobe and divided by pi, so evaluating them
+	//	for a normal gives irradiance in the units of the
+	//	flat ambient term. Writes only this probe's entries.
+	///////////////////////////////////////////////////
+	void UTraceProbe(IrradianceProbeGrid& grid, const std::vector<PointLight>& lights, size_t probe, unsigned long long& rays)
+	{
+		const IrradianceProbeOptions& options = grid.options;
+		const StaticBatchData& scene = grid.scene;
+		const glm::vec3 origin = UProbePosition(grid, probe);
+		glm::vec3 sums[9] = {};
+		int backFaces = 0;
+		for (int s = 0; s < options.samples; ++s)
+		{
+			const float z = 1.0f - 2.0f * (s + 0.5f) / options.samples;
+			const float radius = std::sqrt(std::max(0.0f, 1.0f - z * z));
+			const float angle = 2.39996323f * s;
+			const glm::vec3 direction(radius * std::cos(angle), radius * std::sin(angle), z);
+
+			glm::vec3 radiance = options.skyRadiance;
+			RayHit hit;
+			rays++;
+			if (UTraceRay(grid.bvh, origin, direction, 1e30f, hit))
+			{
+				const GLuint* corners = &scene.indices[size_t(hit.triangle) * 3];
+				const glm::vec3 normal = glm::normalize(scene.Normal(corners[0]) + hit.u * (scene.Normal(corners[1]) - scene.Normal(corners[0]))
+					+ hit.v * (scene.Normal(corners[2]) - scene.Normal(corners[0])));
+				radiance = glm::vec3(0.0f);
+				if (glm::dot(normal, direction) >= 0.0f)
+					backFaces++;
+				else
+				{
+					const int material = scene.triangleMaterials[hit.triangle];
+					const glm::vec3 albedo = material >= 0 && size_t(material) < options.albedo.size() ? options.albedo[material] : glm::vec3(0.5f);
+					const glm::vec3 position = origin + direction * hit.distance + normal * probeRayOffset;
+					radiance = albedo * (UDirectLight(grid.bvh, lights, position, normal, true, probeRayOffset, rays) + options.skyRadiance);
+				}
+			}
+
+			float basis[9];
+			USHBasis(direction, basis);
+			for (int i = 0; i < 9; ++i)
+				sums[i] += radiance * basis[i];
+		}
+
+		// 4 pi / samples per ray, then the cosine lobe per band (pi, 2 pi / 3, pi / 4) over pi
+		const float bandScale[3] = { 1.0f, 2.0f / 3.0f, 0.25f };
+		const float weight = 4.0f * 3.14159265f / options.samples;
+		for (int i = 0; i < 9; ++i)
+			grid.coefficients[probe * 9 + i] = sums[i] * (weight * bandScale[i == 0 ? 0 : i < 4 ? 1 : 2]);
+		grid.inside[probe] = backFaces > probeInsideShare * options.samples;
+	}
+
+	// Copies a probe's coefficients into its seven texels of the staging texture
+	void UWriteProbeTexels(IrradianceProbeGrid& grid, size_t probe)
+	{
+		const size_t x = probe % grid.counts.x, row = probe / grid.counts.x;
+		const size_t width = size_t(grid.counts.x) * probeTexelsPerProbe;
+		const float* values = &grid.coefficients[probe * 9].x;
+		for (int k = 0; k < probeTexelsPerProbe; ++k)
+		{
+			GLfloat* texel = &grid.texels[(row * width + k * grid.counts.x + x) * 4];
+			for (int c = 0; c < 4; ++c)
+				texel[c] = k * 4 + c < 27 ? values[k * 4 + c] : 0.0f;
+		}
+	}
+
+	// Probes inside geometry see mostly its back faces; they take the average of their outside neighbours instead
+	void UFillInsideProbes(IrradianceProbeGrid& grid)
+	{
+		const glm::ivec3 counts = grid.counts;
+		std::vector<uint8_t> filled(grid.ProbeCount());
+		for (size_t p = 0; p < filled.size(); ++p)
+			filled[p] = !grid.inside[p];
+		grid.stats.inside = size_t(std::count(filled.begin(), filled.end(), uint8_t(0)));
+
+		bool changed = true;
+		while (changed)
+		{
+			changed = false;
+			std::vector<uint8_t> next = filled;
+			for (size_t p = 0; p < filled.size(); ++p)
+			{
+				if (filled[p])
+					continue;
+				const glm::ivec3 cell(int(p % counts.x), int(p / counts.x % counts.y), int(p / (size_t(counts.x) * counts.y)));
+				const glm::ivec3 steps[6] = { { 1, 0, 0 }, { -1, 0, 0 }, { 0, 1, 0 }, { 0, -1, 0 }, { 0, 0, 1 }, { 0, 0, -1 } };
+				glm::vec3 sums[9] = {};
+				int found = 0;
+				for (const glm::ivec3& step : steps)
+				{
+					const glm::ivec3 neighbour = cell + step;
+					if (glm::any(glm::lessThan(neighbour, glm::ivec3(0))) || glm::any(glm::greaterThanEqual(neighbour, counts)))
+						continue;
+					const size_t n = (size_t(neighbour.z) * counts.y + neighbour.y) * counts.x + neighbour.x;
+					if (!filled[n])
+						continue;
+					for (int i = 0; i < 9; ++i)
+						sums[i] += grid.coefficients[n * 9 + i];
+					found++;
+				}
+				if (found == 0)
+					continue;
+				for (int i = 0; i < 9; ++i)
+					grid.coefficients[p * 9 + i] = sums[i] / float(found);
+				next[p] = 1;
+				changed = true;
+			}
+			filled.swap(next);
+		}
+	}
+
+	void UUploadProbeRows(const IrradianceProbeGrid& grid, size_t firstRow, size_t lastRow)
+	{
+		const GLsizei width = grid.counts.x * probeTexelsPerProbe;
+		glBindTexture(GL_TEXTURE_3D, grid.texture);
+		for (size_t row = firstRow; row < lastRow; ++row)
+			glTexSubImage3D(GL_TEXTURE_3D, 0, 0, GLint(row % grid.counts.y), GLint(row / grid.counts.y), width, 1, 1, GL_RGBA, GL_FLOAT, &grid.texels[row * width * 4]);
+		glBindTexture(GL_TEXTURE_3D, 0);
+	}
+
+	double USecondsSince(std::chrono::steady_clock::time_point start)
+	{
+		return std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+	}
+}
+
+///////////////////////////////////////////////////
+//	UCreateIrradianceProbes(const StaticBatchData&, const SceneBVH&, const std::vector<PointLight>&, const IrradianceProbeOptions&, IrradianceProbeGrid&)
+//
+//	scene, bvh: the static batch and a BVH of it, kept
+//	            for tracing the probes again later
+//
+//	Spreads probes at about options.spacing over the
+//	bounds of the scene, one at the centre of every cell,
+//	traces all of them across the hardware threads and
+//	uploads the texture. Fails on an empty scene.
+///////////////////////////////////////////////////
+bool UCreateIrradianceProbes(const StaticBatchData& scene, const SceneBVH& bvh, const std::vector<PointLight>& lights, const IrradianceProbeOptions& options, IrradianceProbeGrid& grid)
+{
+	if (bvh.nodes.empty())
+		return false;
+	const auto start = std::chrono::steady_clock::now();
+	grid.scene = scene;
+	grid.bvh = bvh;
+	grid.options = options;
+	grid.options.samples = std::max(grid.options.samples, 16);
+	grid.options.probesPerFrame = std::max(grid.options.probesPerFrame, 1);
+	grid.boundsMin = bvh.nodes[0].boundsMin;
+	grid.boundsMax = bvh.nodes[0].boundsMax;
+	grid.counts = glm::clamp(glm::ivec3(glm::round((grid.boundsMax - grid.boundsMin) / std::max(options.spacing, 0.1f))), glm::ivec3(1), glm::ivec3(64));
+
+	const size_t count = grid.ProbeCount();
+	grid.coefficients.assign(count * 9, glm::vec3(0.0f));
+	grid.inside.assign(count, 0);
+	grid.texels.assign(count * probeTexelsPerProbe * 4, 0.0f);
+	std::atomic<unsigned long long> rays(0);
+	UParallelFor(count, [&](size_t probe)
+	{
+		unsigned long long traced = 0;
+		UTraceProbe(grid, lights, probe, traced);
+		rays += traced;
+	});
+	UFillInsideProbes(grid);
+	for (size_t probe = 0; probe < count; ++probe)
+		UWriteProbeTexels(grid, probe);
+
+	glGenTextures(1, &grid.texture);
+	glBindTexture(GL_TEXTURE_3D, grid.texture);
+	glTexStorage3D(GL_TEXTURE_3D, 1, GL_RGBA16F, grid.counts.x * probeTexelsPerProbe, grid.counts.y, grid.counts.z);
+	glTexParameteri(GL_TEXTURE_3D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+	glTexParameteri(GL_TEXTURE_3D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+	glTexParameteri(GL_TEXTURE_3D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+	glTexParameteri(GL_TEXTURE_3D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+	glTexParameteri(GL_TEXTURE_3D, GL_TEXTURE_WRAP_R, GL_CLAMP_TO_EDGE);
+	glBindTexture(GL_TEXTURE_3D, 0);
+	UUploadProbeRows(grid, 0, size_t(grid.counts.y) * grid.counts.z);
+
+	grid.lightSignature = ULightSignature(lights);
+	grid.nextProbe = count;
+	grid.stats.probes = count;
+	grid.stats.rays = rays;
+	grid.stats.bakeSeconds = USecondsSince(start);
+	return true;
+}
+
+void UDestroyIrradianceProbes(IrradianceProbeGrid& grid)
+{
+	if (grid.texture)
+		glDeleteTextures(1, &grid.texture);
+	grid.texture = 0;
+}
+
+///////////////////////////////////////////////////
+//	UUpdateIrradianceProbes(IrradianceProbeGrid&, const std::vector<PointLight>&)
+//
+//	Call once a frame. A change to the lights starts a
+//	sweep over the grid (restarting one under way); each
+//	frame then traces the next probesPerFrame probes in
+//	parallel and uploads the texture rows they sit in.
+//	Probes inside geometry keep their old light until the
+//	sweep ends and their neighbours fill them again.
+///////////////////////////////////////////////////
+void UUpdateIrradianceProbes(IrradianceProbeGrid& grid, const std::vector<PointLight>& lights)
+{
+	if (grid.texture == 0)
+		return;
+	const uint64_t signature = ULightSignature(lights);
+	if (signature != grid.lightSignature)
+	{
+		grid.lightSignature = signature;
+		grid.nextProbe = 0;
+		grid.stats.relights++;
+	}
+	const size_t count = grid.ProbeCount();
+	if (grid.nextProbe >= count)
+		return;
+
+	const auto start = std::chrono::steady_clock::now();
+	const size_t first = grid.nextProbe, last = std::min(count, first + size_t(grid.options.probesPerFrame));
+	std::atomic<unsigned long long> rays(0);
+	UParallelFor(last - first, [&](size_t i)
+	{
+		unsigned long long traced = 0;
+		UTraceProbe(grid, lights, first + i, traced);
+		rays += traced;
+	});
+	grid.nextProbe = last;
+	if (last == count)
+	{
+		UFillInsideProbes(grid);
+		for (size_t probe = 0; probe < count; ++probe)
+			UWriteProbeTexels(grid, probe);
+		UUploadProbeRows(grid, 0, size_t(grid.counts.y) * grid.counts.z);
+	}
+	else
+	{
+		for (size_t probe = first; probe < last; ++probe)
+		{
+			if (!grid.inside[probe])
+				UWriteProbeTexels(grid, probe);
+		}
+		UUploadProbeRows(grid, first / grid.counts.x, (last - 1) / grid.counts.x + 1);
+	}
+	grid.stats.rays += rays;
+	grid.stats.sliceProbes += last - first;
+	grid.stats.sliceSeconds += USecondsSince(start);
+}
+
+// Binds the grid for programId, which must be in use; without a grid the shader keeps the flat ambient term
+// but its sampler still needs a unit of its own
+void UBindIrradianceProbes(const IrradianceProbeGrid& grid, GLuint programId)
+{
+	glUniform1i(glGetUniformLocation(programId, "uProbeGrid"), probeTextureUnit);
+	glActiveTexture(GL_TEXTURE0 + probeTextureUnit);
+	glBindTexture(GL_TEXTURE_3D, grid.texture);
+	glActiveTexture(GL_TEXTURE0);
+	const glm::vec3 size = grid.boundsMax - grid.boundsMin;
+	glUniform1i(glGetUniformLocation(programId, "uProbeGridEnabled"), grid.texture != 0);
+	glUniform3f(glGetUniformLocation(programId, "uProbeGridMin"), grid.boundsMin.x, grid.boundsMin.y, grid.boundsMin.z);
+	glUniform3f(glGetUniformLocation(programId, "uProbeGridSize"), size.x, size.y, size.z);
+	glUniform3f(glGetUniformLocation(programId, "uProbeGridCounts"), float(grid.counts.x), float(grid.counts.y), float(grid.counts.z));
+}
+
+///////////////////////////////////////////////////
+//	UIrradianceProbeShaderSource()
+//
+//	GLSL defining
+//
+//	vec3 ambientLight(vec3 ambient, vec3 position, vec3 normal)
+//
+//	which returns ambient unchanged without a grid or in
+//	variants without FEATURE_PROBES, else
+//	the irradiance of the probes around position for a
+//	surface facing normal. Each of the seven fetches is
+//	clamped to the texel centres of its block, so the
+//	trilinear filter never blends two blocks.
+///////////////////////////////////////////////////
+const char* UIrradianceProbeShaderSource()
+{
+	return
+		"uniform bool uProbeGridEnabled;\n"
+		"uniform sampler3D uProbeGrid;\n"
+		"uniform vec3 uProbeGridMin;\n"
+		"uniform vec3 uProbeGridSize;\n"
+		"uniform vec3 uProbeGridCounts;\n"
+		"vec3 ambientLight(vec3 ambient, vec3 position, vec3 normal)\n"
+		"{\n"
+		"#if FEATURE_PROBES\n"
+		"	if (!uProbeGridEnabled)\n"
+		"		return ambient;\n"
+		"	vec3 cell = clamp((position - uProbeGridMin) / uProbeGridSize * uProbeGridCounts, vec3(0.5), uProbeGridCounts - 0.5);\n"
+		"	vec3 scale = 1.0 / vec3(uProbeGridCounts.x * 7.0, uProbeGridCounts.yz);\n"
+		"	float c[28];\n"
+		"	for (int k = 0; k < 7; ++k)\n"
+		"	{\n"
+		"		vec4 texel = texture(uProbeGrid, (cell + vec3(uProbeGridCounts.x * float(k), 0.0, 0.0)) * scale);\n"
+		"		c[k * 4] = texel.x;\n"
+		"		c[k * 4 + 1] = texel.y;\n"
+		"		c[k * 4 + 2] = texel.z;\n"
+		"		c[k * 4 + 3] = texel.w;\n"
+		"	}\n"
+		"	vec3 n = normal;\n"
+		"	float basis[9] = float[9](0.282095, 0.488603 * n.y, 0.488603 * n.z, 0.488603 * n.x, 1.092548 * n.x * n.y,\n"
+		"		1.092548 * n.y * n.z, 0.315392 * (3.0 * n.z * n.z - 1.0), 1.092548 * n.x * n.z, 0.546274 * (n.x * n.x - n.y * n.y));\n"
+		"	vec3 irradiance = vec3(0.0);\n"
+		"	for (int i = 0; i < 9; ++i)\n"
+		"		irradiance += basis[i] * vec3(c[i * 3], c[i * 3 + 1], c[i * 3 + 2]);\n"
+		"	return max(irradiance, vec3(0.0));\n"
+		"#else\n"
+		"	return ambient;\n"
+		"#endif\n"
+		"}\n";
+}
+
+void UPrintIrradianceProbeStats(const IrradianceProbeGrid& grid)
+{
+	if (grid.texture == 0)
+		return;
+	const IrradianceProbeStats& stats = grid.stats;
+	std::cout << "INFO: Irradiance probes " << grid.counts.x << "x" << grid.counts.y << "x" << grid.counts.z << " (" << stats.probes << ", "
+		<< stats.inside << " inside geometry) baked in " << stats.bakeSeconds * 1000.0 << " ms on " << UWorkerCount() << " threads; "
+		<< stats.relights << " relights traced " << stats.sliceProbes << " probes in " << stats.sliceSeconds * 1000.0 << " ms ("
+		<< (stats.sliceProbes ? stats.sliceSeconds * 1000.0 / stats.sliceProbes * grid.options.probesPerFrame : 0.0) << " ms per frame), "
+		<< stats.rays << " rays" << std::endl;
+}
@@ -0,0 +1,80 @@
+///////////////////////////////////////////////////////////////////////////////
+// irradianceprobes.h
+// ========
+// a 3D grid of irradiance probes over the static scene, each holding the
+// light arriving at its point as L2 spherical harmonics (9 RGB coefficients)
+// traced on the CPU against the scene BVH. The runtime samples the grid with
+// trilinear filtering in place of the flat ambient term, so every surface,
+// static or dynamic, gets bounce light tinted by what is around it for a few
+// texture fetches and one SH evaluation. When the lights change the probes
+// are traced again a few per frame, so a relight never stalls a frame.
+//
+// Texture: one RGBA16F 3D texture, counts.x * 7 texels wide: block k of
+// counts.x columns holds floats 4k..4k+3 of every probe's 27 coefficients.
+///////////////////////////////////////////////////////////////////////////////
+
+#ifndef IRRADIANCEPROBES_H
+#define IRRADIANCEPROBES_H
+
+#include <GL/glew.h>
+#include <cstdint>
+#include <vector>
+
+#include <glm/glm.hpp>
+
+#include "clusteredlighting.h"
+#include "scenebvh.h"
+#include "staticbatch.h"
+
+// Texture unit of the probe grid, after the lightmap's
+const GLuint probeTextureUnit = 12;
+
+// RGBA texels holding one probe's 27 coefficients
+const int probeTexelsPerProbe = 7;
+
+struct IrradianceProbeOptions
+{
+	float spacing = 2.0f;			// world units between probes, per axis, within the scene bounds
+	int samples = 256;				// rays per probe
+	int probesPerFrame = 16;		// traced each frame while a relight is under way
+	glm::vec3 skyRadiance = glm::vec3(0.0f);	// seen by rays that leave the scene; the flat ambient it replaces
+	std::vector<glm::vec3> albedo;	// per material, what surfaces reflect; 0.5 grey when missing
+};
+
+struct IrradianceProbeStats
+{
+	size_t probes = 0;
+	size_t inside = 0;					// in geometry, filled from their neighbours
+	unsigned long long rays = 0;
+	double bakeSeconds = 0.0;			// the bake at load
+	unsigned long long relights = 0;	// light changes that started a sweep
+	unsigned long long sliceProbes = 0;	// probes traced in those sweeps
+	double sliceSeconds = 0.0;
+};
+
+struct IrradianceProbeGrid
+{
+	glm::vec3 boundsMin = glm::vec3(0.0f), boundsMax = glm::vec3(0.0f);
+	glm::ivec3 counts = glm::ivec3(0);
+	IrradianceProbeOptions options;
+	StaticBatchData scene;				// what the rays hit: normals and materials
+	SceneBVH bvh;
+	std::vector<glm::vec3> coefficients;	// 9 per probe, scaled so evaluating them gives the ambient term
+	std::vector<uint8_t> inside;			// per probe
+	std::vector<GLfloat> texels;			// staging copy of the texture, converted to half floats on upload
+	GLuint texture = 0;
+	uint64_t lightSignature = 0;		// lights the probes were traced with
+	size_t nextProbe = 0;				// sweep position, the probe count when none is under way
+	IrradianceProbeStats stats;
+
+	size_t ProbeCount() const { return size_t(counts.x) * counts.y * counts.z; }
+};
+
+bool UCreateIrradianceProbes(const StaticBatchData& scene, const SceneBVH& bvh, const std::vector<PointLight>& lights, const IrradianceProbeOptions& options, IrradianceProbeGrid& grid);
+void UDestroyIrradianceProbes(IrradianceProbeGrid& grid);
+void UUpdateIrradianceProbes(IrradianceProbeGrid& grid, const std::vector<PointLight>& lights);
+void UBindIrradianceProbes(const IrradianceProbeGrid& grid, GLuint programId);
+const char* UIrradianceProbeShaderSource();
+void UPrintIrradianceProbeStats(const IrradianceProbeGrid& grid);
+
+#endif
@@ -0,0 +1,247 @@
+///////////////////////////////////////////////////////////////////////////////
+// lightmapbaker.cpp
+// ========
+// atlas layout, direct and bounce light passes over the texels, and the
+// texture array the runtime samples
+///////////////////////////////////////////////////////////////////////////////
+
+#include "lightmapbaker.h"
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cmath>
+#include <iostream>
+
+#include "parallel.h"
+
+namespace
+{
+	// How far rays start off a surface, against hitting it again
+	const float lightmapRayOffset = 0.002f;
+
+	// A texel's point on its triangle
+	struct LightmapSample
+	{
+		glm::vec3 position;		// pushed off the surface along its face normal
+		glm::vec3 normal;		// interpolated
+	};
+
+	// Point of triangle (corners a, b, c) at weights (1 - u - v, u, v)
+	glm::vec3 UInterpolate(const glm::vec3& a, const glm::vec3& b, const glm::vec3& c, float u, float v)
+	{
+		return a + u * (b - a) + v * (c - a);
+	}
+
+	// The surface under texel (x, y) of its triangle's atlas; padding texels take the triangle's nearest point
+	LightmapSample USampleTexel(const StaticBatchData& batch, const Lightmap& lightmap, uint32_t triangle, int x, int y)
+	{
+		const GLuint* corners = &batch.indices[size_t(triangle) * 3];
+		glm::vec2 texelCorners[3];
+		for (int c = 0; c < 3; ++c)
+		{
+			const GLfloat* coords = &batch.vertices[size_t(corners[c]) * floatsPerBatchVertex + batchLightmapOffset];
+			texelCorners[c] = glm::vec2(coords[0] * lightmap.atlas.width, coords[1] * lightmap.atlas.height);
+		}
+		const glm::vec2 weights = UClosestTriangleWeights(texelCorners[0], texelCorners[1], texelCorners[2], glm::vec2(x + 0.5f, y + 0.5f));
+		const float u = weights.x, v = weights.y;
+
+		const glm::vec3 a = batch.Position(corners[0]), b = batch.Position(corners[1]), c = batch.Position(corners[2]);
+		LightmapSample sample;
+		sample.normal = glm::normalize(UInterpolate(batch.Normal(corners[0]), batch.Normal(corners[1]), batch.Normal(corners[2]), u, v));
+		glm::vec3 faceNormal = glm::cross(b - a, c - a);
+		const float faceLength = glm::length(faceNormal);
+		faceNormal = faceLength > 0.0f ? faceNormal / faceLength : sample.normal;
+		if (glm::dot(faceNormal, sample.normal) < 0.0f)
+			faceNormal = -faceNormal;
+		sample.position = UInterpolate(a, b, c, u, v) + faceNormal * lightmapRayOffset;
+		return sample;
+	}
+
+	// Small counter based generator: the same texel and pass always draw the same numbers, whatever thread runs them
+	struct LightmapRandom
+	{
+		uint32_t state;
+
+		float Next()
+		{
+			state = state * 747796405u + 2891336453u;
+			uint32_t word = ((state >> ((state >> 28) + 4)) ^ state) * 277803737u;
+			word = (word >> 22) ^ word;
+			return (word >> 8) * (1.0f / 16777216.0f);
+		}
+	};
+
+	// Cosine weighted direction about normal
+	glm::vec3 UCosineDirection(const glm::vec3& normal, LightmapRandom& random)
+	{
+		const glm::vec3 tangent = glm::normalize(std::abs(normal.x) > 0.5f ? glm::cross(normal, glm::vec3(0.0f, 1.0f, 0.0f)) : glm::cross(normal, glm::vec3(1.0f, 0.0f, 0.0f)));
+		const glm::vec3 bitangent = glm::cross(normal, tangent);
+		const float radius = std::sqrt(random.Next());
+		const float angle = 6.28318531f * random.Next();
+		const float height = std::sqrt(std::max(0.0f, 1.0f - radius * radius));
+		return tangent * (radius * std::cos(angle)) + bitangent * (radius * std::sin(angle)) + normal * height;
+	}
+
+	double USecondsSince(std::chrono::steady_clock::time_point start)
+	{
+		return std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+	}
+}
+
+///////////////////////////////////////////////////
+//	ULayoutLightmap(StaticBatchData&, const LightmapBakeOptions&, Lightmap&)
+//
+//	Unwraps the batch into atlases of atlasSize at about
+//	texelsPerUnit; see UUnwrapLightmapUVs(). Fails on an
+//	empty batch or when the charts fit at no density.
+///////////////////////////////////////////////////
+bool ULayoutLightmap(StaticBatchData& batch, const LightmapBakeOptions& options, Lightmap& lightmap)
+{
+	if (!UUnwrapLightmapUVs(batch, options.texelsPerUnit, options.atlasSize, lightmap.atlas))
+		return false;
+	lightmap.stats.triangles = batch.TriangleCount();
+	lightmap.stats.texels = size_t(std::count_if(lightmap.atlas.texelTriangles.begin(), lightmap.atlas.texelTriangles.end(), [](uint32_t t) { return t != 0; }));
+	return true;
+}
+
+///////////////////////////////////////////////////
+//	UBakeLightmap(const StaticBatchData&, const SceneBVH&, const std::vector<PointLight>&, const LightmapBakeOptions&, Lightmap&)
+//
+//	batch: laid out by ULayoutLightmap()
+//	bvh: built from UStaticBatchTriangles(batch), so hit
+//	     triangles index the batch
+//	lights: only the global (radius 0) ones are baked
+//
+//	Direct light: one shadow ray per light and texel.
+//	Bounce: passes of bounceSamples cosine weighted rays
+//	per texel; a hit adds the direct light there times its
+//	material's albedo, so the average over the rays is
+//	the bounce light in the units the runtime adds the
+//	diffuse term in. Passes stop at maxPasses or when the
+//	average moved less than tolerance in the last one.
+///////////////////////////////////////////////////
+void UBakeLightmap(const StaticBatchData& batch, const SceneBVH& bvh, const std::vector<PointLight>& lights, const LightmapBakeOptions& options, Lightmap& lightmap)
+{
+	LightmapBakeStats& stats = lightmap.stats;
+	const LightmapAtlasLayout& atlas = lightmap.atlas;
+	std::vector<uint32_t> texels;	// the used ones, in atlas order
+	for (size_t i = 0; i < atlas.texelTriangles.size(); ++i)
+	{
+		if (atlas.texelTriangles[i] != 0)
+			texels.push_back(uint32_t(i));
+	}
+	lightmap.texels.assign(atlas.texelTriangles.size(), glm::vec3(0.0f));
+	std::atomic<unsigned long long> rays(0);
+
+	// direct light and shadows
+	auto start = std::chrono::steady_clock::now();
+	stats.steals += UParallelForStealing(texels.size(), 64, [&](size_t i)
+	{
+		const uint32_t texel = texels[i];
+		const LightmapSample sample = USampleTexel(batch, lightmap, atlas.texelTriangles[texel] - 1, int(texel % atlas.width), int(texel / atlas.width % atlas.height));
+		unsigned long long traced = 0;
+		lightmap.texels[texel] = UDirectLight(bvh, lights, sample.position, sample.normal, false, lightmapRayOffset, traced);
+		rays += traced;
+	});
+	stats.directSeconds = USecondsSince(start);
+	if (!options.bounce)
+	{
+		stats.rays = rays;
+		return;
+	}
+
+	// one bounce, refined pass by pass until it settles
+	start = std::chrono::steady_clock::now();
+	std::vector<glm::vec3> bounceSums(texels.size(), glm::vec3(0.0f));
+	std::vector<glm::vec3> previous(texels.size(), glm::vec3(0.0f));
+	for (int pass = 0; pass < options.maxPasses; ++pass)
+	{
+		stats.steals += UParallelForStealing(texels.size(), 16, [&](size_t i)
+		{
+			const uint32_t texel = texels[i];
+			const LightmapSample sample = USampleTexel(batch, lightmap, atlas.texelTriangles[texel] - 1, int(texel % atlas.width), int(texel / atlas.width % atlas.height));
+			LightmapRandom random = { texel * 9781u + uint32_t(pass) * 6271u + 1u };
+			unsigned long long traced = 0;
+			glm::vec3 sum(0.0f);
+			for (int s = 0; s < options.bounceSamples; ++s)
+			{
+				const glm::vec3 direction = UCosineDirection(sample.normal, random);
+				RayHit hit;
+				traced++;
+				if (!UTraceRay(bvh, sample.position, direction, 1e30f, hit))
+					continue;
+
+				// light leaving the surface hit, when its front faces the texel
+				const GLuint* corners = &batch.indices[size_t(hit.triangle) * 3];
+				const glm::vec3 a = batch.Position(corners[0]), b = batch.Position(corners[1]), c = batch.Position(corners[2]);
+				const glm::vec3 normal = glm::normalize(UInterpolate(batch.Normal(corners[0]), batch.Normal(corners[1]), batch.Normal(corners[2]), hit.u, hit.v));
+				if (glm::dot(normal, direction) >= 0.0f)
+					continue;
+				const int material = batch.triangleMaterials[hit.triangle];
+				const glm::vec3 albedo = material >= 0 && size_t(material) < options.albedo.size() ? options.albedo[material] : glm::vec3(0.5f);
+				const glm::vec3 position = UInterpolate(a, b, c, hit.u, hit.v) + normal * lightmapRayOffset;
+				sum += albedo * UDirectLight(bvh, lights, position, normal, false, lightmapRayOffset, traced);
+			}
+			bounceSums[i] += sum;
+			rays += traced;
+		});
+
+		// how far this pass moved the average: RMS change over RMS value
+		const float samples = float((pass + 1) * options.bounceSamples);
+		double change = 0.0, value = 0.0;
+		for (size_t i = 0; i < texels.size(); ++i)
+		{
+			const glm::vec3 average = bounceSums[i] / samples;
+			const glm::vec3 delta = average - previous[i];
+			change += glm::dot(delta, delta);
+			value += glm::dot(average, average);
+			previous[i] = average;
+		}
+		stats.passChanges.push_back(value > 0.0 ? float(std::sqrt(change / value)) : 0.0f);
+		if (pass > 0 && stats.passChanges.back() < options.tolerance)
+			break;
+	}
+	for (size_t i = 0; i < texels.size(); ++i)
+		lightmap.texels[texels[i]] += previous[i];
+	stats.bounceSeconds = USecondsSince(start);
+	stats.rays = rays;
+}
+
+// Half float RGB texture array, one layer per atlas, with bilinear filtering; the padding keeps lookups inside a chart
+void UCreateLightmapTexture(Lightmap& lightmap)
+{
+	const LightmapAtlasLayout& atlas = lightmap.atlas;
+	glGenTextures(1, &lightmap.texture);
+	glBindTexture(GL_TEXTURE_2D_ARRAY, lightmap.texture);
+	glTexStorage3D(GL_TEXTURE_2D_ARRAY, 1, GL_RGB16F, atlas.width, atlas.height, atlas.layers);
+	glTexSubImage3D(GL_TEXTURE_2D_ARRAY, 0, 0, 0, 0, atlas.width, atlas.height, atlas.layers, GL_RGB, GL_FLOAT, lightmap.texels.data());
+	glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+	glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+	glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+	glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+	glBindTexture(GL_TEXTURE_2D_ARRAY, 0);
+}
+
+void UPrintLightmapStats(const Lightmap& lightmap)
+{
+	const LightmapBakeStats& stats = lightmap.stats;
+	const LightmapAtlasLayout& atlas = lightmap.atlas;
+	const double seconds = stats.directSeconds + stats.bounceSeconds;
+	std::cout << "INFO: Lightmap " << atlas.layers << " x " << atlas.width << "x" << atlas.height << ", " << stats.texels << " texels for "
+		<< stats.triangles << " triangles in " << atlas.charts << " charts at " << atlas.texelsPerUnit << " texels per unit, unwrapped in "
+		<< atlas.unwrapSeconds * 1000.0 << " ms, packed in " << atlas.packSeconds * 1000.0 << " ms" << std::endl;
+	std::cout << "INFO: Lightmap atlas utilization";
+	for (float utilization : atlas.utilization)
+		std::cout << " " << 100.0f * utilization << "%";
+	std::cout << std::endl;
+	std::cout << "INFO: Lightmap baked in " << seconds << " s (direct " << stats.directSeconds << " s, bounce " << stats.bounceSeconds << " s) on "
+		<< UWorkerCount() << " threads: " << (seconds > 0.0 ? stats.texels / seconds / 1000.0 : 0.0) << "k texels/s, "
+		<< (seconds > 0.0 ? stats.rays / seconds / 1e6 : 0.0) << " Mrays/s, " << stats.steals << " steals" << std::endl;
+	if (stats.passChanges.empty())
+		return;
+	std::cout << "INFO: Lightmap bounce passes changed the light by";
+	for (float change : stats.passChanges)
+		std::cout << " " << 100.0f * change << "%";
+	std::cout << std::endl;
+}
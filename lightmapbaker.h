@@ -0,0 +1,68 @@
+///////////////////////////////////////////////////////////////////////////////
+// lightmapbaker.h
+// ========
+// bakes the diffuse light of the global (radius 0) point lights on the
+// static batch into a lightmap at load: direct light with ray traced
+// shadows, and optionally one bounce of indirect light, traced on the CPU
+// against the scene BVH with the texels spread over every hardware thread
+// by a work stealing loop. The runtime samples the lightmap in place of the
+// lights' diffuse term; their specular highlights stay per pixel.
+//
+// Layout: the batch is unwrapped into charts packed into the layers of a
+// texture array by lightmapuv.h, with a texel of padding around each chart
+// so bilinear lookups never reach another one.
+///////////////////////////////////////////////////////////////////////////////
+
+#ifndef LIGHTMAPBAKER_H
+#define LIGHTMAPBAKER_H
+
+#include <GL/glew.h>
+#include <cstdint>
+#include <vector>
+
+#include <glm/glm.hpp>
+
+#include "clusteredlighting.h"
+#include "lightmapuv.h"
+#include "scenebvh.h"
+#include "staticbatch.h"
+
+// Texture unit the lightmap is bound to, after the shadow maps'
+const GLuint lightmapTextureUnit = 11;
+
+struct LightmapBakeOptions
+{
+	float texelsPerUnit = 8.0f;		// lightmap resolution in world space
+	GLsizei atlasSize = 2048;		// atlas side limit; more atlases, then a lower density, when the charts do not fit
+	bool bounce = false;			// add one bounce of indirect light
+	int bounceSamples = 16;			// rays per texel in each bounce pass
+	int maxPasses = 8;
+	float tolerance = 0.01f;		// passes stop once one changes the bounce light by less (relative RMS)
+	std::vector<glm::vec3> albedo;	// per material, what the bounce reflects; 0.5 grey when missing
+};
+
+struct LightmapBakeStats
+{
+	size_t texels = 0;				// baked, padding included
+	size_t triangles = 0;
+	unsigned long long rays = 0;	// shadow and bounce rays
+	double directSeconds = 0.0;
+	double bounceSeconds = 0.0;
+	size_t steals = 0;
+	std::vector<float> passChanges;	// relative RMS change of the bounce light in each pass
+};
+
+struct Lightmap
+{
+	LightmapAtlasLayout atlas;			// size, layers and the triangle under each texel
+	std::vector<glm::vec3> texels;		// baked light per texel of atlas, rows bottom up as GL stores them
+	GLuint texture = 0;
+	LightmapBakeStats stats;
+};
+
+bool ULayoutLightmap(StaticBatchData& batch, const LightmapBakeOptions& options, Lightmap& lightmap);
+void UBakeLightmap(const StaticBatchData& batch, const SceneBVH& bvh, const std::vector<PointLight>& lights, const LightmapBakeOptions& options, Lightmap& lightmap);
+void UCreateLightmapTexture(Lightmap& lightmap);
+void UPrintLightmapStats(const Lightmap& lightmap);
+
+#endif
@@ -0,0 +1,489 @@
+///////////////////////////////////////////////////////////////////////////////
+// lightmapuv.cpp
+// ========
+// chart segmentation, planar parameterization, skyline packing of the charts
+// into atlases and the texel coverage the baker works from
+///////////////////////////////////////////////////////////////////////////////
+
+#include "lightmapuv.h"
+
+#include <algorithm>
+#include <cfloat>
+#include <chrono>
+#include <climits>
+#include <cmath>
+#include <iterator>
+#include <numeric>
+
+#include "parallel.h"
+
+namespace
+{
+	// Connected triangles of one instance flattened onto a plane
+	struct LightmapChart
+	{
+		std::vector<uint32_t> triangles;	// batch triangles
+		std::vector<GLuint> vertices;		// batch vertices they use, sorted, each once
+		std::vector<glm::vec2> coords;		// per entry of vertices, world units from the lower left of the bounds
+		glm::vec2 extent = glm::vec2(0.0f);
+		int width = 0, height = 0;			// texels, padding included
+		int atlas = -1, x = 0, y = 0;		// where it was packed
+	};
+
+	// Index of vertex in sorted, which holds it
+	size_t UFindSorted(const std::vector<GLuint>& sorted, GLuint vertex)
+	{
+		return size_t(std::lower_bound(sorted.begin(), sorted.end(), vertex) - sorted.begin());
+	}
+
+	///////////////////////////////////////////////////
+	//	UChartInstance(const StaticBatchData&, const std::vector<uint32_t>&, std::vector<LightmapChart>&)
+	//
+	//	Welds the instance's vertices by position so texture
+	//	and normal seams do not cut it, then grows charts from
+	//	the largest unassigned triangle over shared edges,
+	//	taking neighbours that face within lightmapChartCosine
+	//	of the seed. Each chart is projected along its seed's
+	//	normal, which every triangle of it faces, so none can
+	//	fold over, and turned so its longest axis runs along u.
+	///////////////////////////////////////////////////
+	void UChartInstance(const StaticBatchData& batch, const std::vector<uint32_t>& triangles, std::vector<LightmapChart>& charts)
+	{
+		// one id per distinct position
+		std::vector<GLuint> vertices;
+		for (uint32_t t : triangles)
+			vertices.insert(vertices.end(), &batch.indices[size_t(t) * 3], &batch.indices[size_t(t) * 3] + 3);
+		std::sort(vertices.begin(), vertices.end());
+		vertices.erase(std::unique(vertices.begin(), vertices.end()), vertices.end());
+		std::vector<uint32_t> byPosition(vertices.size()), welded(vertices.size());
+		std::iota(byPosition.begin(), byPosition.end(), 0u);
+		auto less = [&](uint32_t a, uint32_t b)
+		{
+			const glm::vec3 p = batch.Position(vertices[a]), q = batch.Position(vertices[b]);
+			return p.x != q.x ? p.x < q.x : p.y != q.y ? p.y < q.y : p.z < q.z;
+		};
+		std::sort(byPosition.begin(), byPosition.end(), less);
+		for (size_t i = 0; i < byPosition.size(); ++i)
+			welded[byPosition[i]] = i > 0 && !less(byPosition[i - 1], byPosition[i]) ? welded[byPosition[i - 1]] : uint32_t(i);
+
+		// neighbours across the welded edges
+		struct Edge
+		{
+			uint32_t a, b, triangle;
+		};
+		std::vector<Edge> edges;
+		edges.reserve(triangles.size() * 3);
+		std::vector<glm::vec3> faceNormals(triangles.size());
+		std::vector<float> areas(triangles.size());
+		for (uint32_t local = 0; local < triangles.size(); ++local)
+		{
+			const GLuint* corners = &batch.indices[size_t(triangles[local]) * 3];
+			uint32_t ids[3];
+			for (int c = 0; c < 3; ++c)
+				ids[c] = welded[UFindSorted(vertices, corners[c])];
+			for (int c = 0; c < 3; ++c)
+			{
+				if (ids[c] != ids[(c + 1) % 3])
+					edges.push_back({ std::min(ids[c], ids[(c + 1) % 3]), std::max(ids[c], ids[(c + 1) % 3]), local });
+			}
+			const glm::vec3 a = batch.Position(corners[0]);
+			const glm::vec3 cross = glm::cross(batch.Position(corners[1]) - a, batch.Position(corners[2]) - a);
+			const float length = glm::length(cross);
+			areas[local] = 0.5f * length;
+			faceNormals[local] = length > 0.0f ? cross / length : glm::vec3(0.0f);
+		}
+		std::sort(edges.begin(), edges.end(), [](const Edge& p, const Edge& q) { return p.a != q.a ? p.a < q.a : p.b < q.b; });
+		std::vector<std::vector<uint32_t>> neighbours(triangles.size());
+		for (size_t first = 0, last = 0; first < edges.size(); first = last)
+		{
+			for (last = first + 1; last < edges.size() && edges[last].a == edges[first].a && edges[last].b == edges[first].b; ++last)
+			{
+			}
+			for (size_t i = first; i < last; ++i)
+			{
+				for (size_t j = first; j < last; ++j)
+				{
+					if (i != j)
+						neighbours[edges[i].triangle].push_back(edges[j].triangle);
+				}
+			}
+		}
+
+		// grow the charts, largest seeds first
+		std::vector<uint32_t> seeds(triangles.size());
+		std::iota(seeds.begin(), seeds.end(), 0u);
+		std::stable_sort(seeds.begin(), seeds.end(), [&](uint32_t a, uint32_t b) { return areas[a] > areas[b]; });
+		std::vector<bool> assigned(triangles.size(), false);
+		for (uint32_t seed : seeds)
+		{
+			if (assigned[seed])
+				continue;
+			const glm::vec3 normal = faceNormals[seed] != glm::vec3(0.0f) ? faceNormals[seed] : glm::vec3(0.0f, 0.0f, 1.0f);
+			std::vector<uint32_t> members = { seed };
+			assigned[seed] = true;
+			for (size_t m = 0; m < members.size(); ++m)
+			{
+				for (uint32_t next : neighbours[members[m]])
+				{
+					if (!assigned[next] && glm::dot(faceNormals[next], normal) > lightmapChartCosine)
+					{
+						assigned[next] = true;
+						members.push_back(next);
+					}
+				}
+			}
+
+			LightmapChart chart;
+			for (uint32_t local : members)
+			{
+				chart.triangles.push_back(triangles[local]);
+				chart.vertices.insert(chart.vertices.end(), &batch.indices[size_t(triangles[local]) * 3], &batch.indices[size_t(triangles[local]) * 3] + 3);
+			}
+			std::sort(chart.vertices.begin(), chart.vertices.end());
+			chart.vertices.erase(std::unique(chart.vertices.begin(), chart.vertices.end()), chart.vertices.end());
+
+			// onto the seed's plane, then along the principal axis
+			const glm::vec3 tangent = glm::normalize(std::abs(normal.x) > 0.5f ? glm::cross(normal, glm::vec3(0.0f, 1.0f, 0.0f)) : glm::cross(normal, glm::vec3(1.0f, 0.0f, 0.0f)));
+			const glm::vec3 bitangent = glm::cross(normal, tangent);
+			glm::vec2 mean(0.0f);
+			for (GLuint vertex : chart.vertices)
+			{
+				const glm::vec3 position = batch.Position(vertex);
+				chart.coords.push_back(glm::vec2(glm::dot(position, tangent), glm::dot(position, bitangent)));
+				mean += chart.coords.back();
+			}
+			mean = mean / float(chart.coords.size());
+			float xx = 0.0f, xy = 0.0f, yy = 0.0f;
+			for (const glm::vec2& coord : chart.coords)
+			{
+				const glm::vec2 offset = coord - mean;
+				xx += offset.x * offset.x;
+				xy += offset.x * offset.y;
+				yy += offset.y * offset.y;
+			}
+			const float angle = 0.5f * std::atan2(2.0f * xy, xx - yy);
+			const float cosine = std::cos(angle), sine = std::sin(angle);
+			glm::vec2 low(FLT_MAX), high(-FLT_MAX);
+			for (glm::vec2& coord : chart.coords)
+			{
+				coord = glm::vec2(cosine * coord.x + sine * coord.y, cosine * coord.y - sine * coord.x);
+				low = glm::min(low, coord);
+				high = glm::max(high, coord);
+			}
+			for (glm::vec2& coord : chart.coords)
+				coord -= low;
+			chart.extent = high - low;
+			charts.push_back(std::move(chart));
+		}
+	}
+
+	///////////////////////////////////////////////////
+	//	UPackAtlas(std::vector<LightmapChart>&, const std::vector<uint32_t>&, int, int)
+	//
+	//	Bottom left skyline packing of members, in the order
+	//	given, into a side squared atlas. Each chart goes
+	//	where its top ends lowest; those that fit nowhere
+	//	keep atlas -1 for the next round.
+	///////////////////////////////////////////////////
+	void UPackAtlas(std::vector<LightmapChart>& charts, const std::vector<uint32_t>& members, int atlas, int side)
+	{
+		struct Segment
+		{
+			int x, y, width;
+		};
+		std::vector<Segment> skyline = { { 0, 0, side } };
+		std::vector<Segment> raised;
+		for (uint32_t index : members)
+		{
+			LightmapChart& chart = charts[index];
+			int bestTop = INT_MAX, bestX = 0, bestY = 0;
+			for (size_t s = 0; s < skyline.size() && skyline[s].x + chart.width <= side; ++s)
+			{
+				int y = 0;
+				for (size_t r = s; r < skyline.size() && skyline[r].x < skyline[s].x + chart.width; ++r)
+					y = std::max(y, skyline[r].y);
+				if (y + chart.height <= side && y + chart.height < bestTop)
+				{
+					bestTop = y + chart.height;
+					bestX = skyline[s].x;
+					bestY = y;
+				}
+			}
+			if (bestTop == INT_MAX)
+				continue;
+			chart.atlas = atlas;
+			chart.x = bestX;
+			chart.y = bestY;
+
+			// the chart's top replaces the skyline under it
+			const int left = bestX, right = bestX + chart.width;
+			raised.clear();
+			bool placed = false;
+			for (const Segment& segment : skyline)
+			{
+				const int end = segment.x + segment.width;
+				if (segment.x < left)
+					raised.push_back({ segment.x, segment.y, std::min(end, left) - segment.x });
+				if (end > left && !placed)
+				{
+					raised.push_back({ left, bestTop, chart.width });
+					placed = true;
+				}
+				if (end > right)
+				{
+					const int start = std::max(segment.x, right);
+					raised.push_back({ start, segment.y, end - start });
+				}
+			}
+			skyline.clear();
+			for (const Segment& segment : raised)
+			{
+				if (!skyline.empty() && skyline.back().y == segment.y)
+					skyline.back().width += segment.width;
+				else
+					skyline.push_back(segment);
+			}
+		}
+	}
+
+	// Marks the texels of chart's rectangle that one of its triangles covers, or that a bilinear lookup inside one reaches
+	void URasterizeChart(const StaticBatchData& batch, const LightmapChart& chart, float density, GLsizei width, uint32_t* texels, float* distances)
+	{
+		const glm::vec2 origin(chart.x + 1, chart.y + 1);
+		for (uint32_t triangle : chart.triangles)
+		{
+			glm::vec2 corners[3];
+			glm::vec2 low(FLT_MAX), high(-FLT_MAX);
+			for (int c = 0; c < 3; ++c)
+			{
+				corners[c] = origin + chart.coords[UFindSorted(chart.vertices, batch.indices[size_t(triangle) * 3 + c])] * density;
+				low = glm::min(low, corners[c]);
+				high = glm::max(high, corners[c]);
+			}
+			const int left = std::max(chart.x, int(std::floor(low.x - 1.5f))), right = std::min(chart.x + chart.width, int(std::ceil(high.x + 1.5f)));
+			const int bottom = std::max(chart.y, int(std::floor(low.y - 1.5f))), top = std::min(chart.y + chart.height, int(std::ceil(high.y + 1.5f)));
+			for (int j = bottom; j < top; ++j)
+			{
+				for (int i = left; i < right; ++i)
+				{
+					// inside texels have distance 0, so they always keep the triangle covering them
+					const glm::vec2 center(i + 0.5f, j + 0.5f);
+					const glm::vec2 weights = UClosestTriangleWeights(corners[0], corners[1], corners[2], center);
+					const float distance = glm::length(center - (corners[0] + weights.x * (corners[1] - corners[0]) + weights.y * (corners[2] - corners[0])));
+					const size_t texel = size_t(j) * width + i;
+					if (distance < 1.5f && distance < distances[texel])
+					{
+						distances[texel] = distance;
+						texels[texel] = triangle + 1;
+					}
+				}
+			}
+		}
+	}
+
+	double USecondsSince(std::chrono::steady_clock::time_point start)
+	{
+		return std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+	}
+}
+
+///////////////////////////////////////////////////
+//	UUnwrapLightmapUVs(StaticBatchData&, float, GLsizei, LightmapAtlasLayout&)
+//
+//	texelsPerUnit: wanted lightmap resolution in world space
+//	atlasSize: largest side of an atlas
+//
+//	Charts every instance of the batch in parallel, then
+//	packs the charts tallest first. A round deals the
+//	remaining charts, each to the least filled, over as
+//	many new atlases as they should fill and packs those
+//	atlases in parallel;
+//	what did not fit goes on to the next round. When a
+//	chart is larger than an atlas or lightmapMaxAtlases
+//	are not enough, the density is lowered and the packing
+//	tried again. Every chart gets vertices of its own with
+//	its lightmap coords and atlas. Fails on an empty batch
+//	or when nothing fits.
+///////////////////////////////////////////////////
+bool UUnwrapLightmapUVs(StaticBatchData& batch, float texelsPerUnit, GLsizei atlasSize, LightmapAtlasLayout& layout)
+{
+	layout = LightmapAtlasLayout();
+	if (batch.TriangleCount() == 0 || atlasSize < 4)
+		return false;
+
+	auto start = std::chrono::steady_clock::now();
+	std::vector<std::vector<uint32_t>> instanceTriangles(batch.instances);
+	for (size_t t = 0; t < batch.TriangleCount(); ++t)
+		instanceTriangles[batch.triangleInstances[t]].push_back(uint32_t(t));
+	std::vector<std::vector<LightmapChart>> instanceCharts(batch.instances);
+	UParallelFor(batch.instances, [&](size_t i) { UChartInstance(batch, instanceTriangles[i], instanceCharts[i]); });
+	std::vector<LightmapChart> charts;
+	for (std::vector<LightmapChart>& list : instanceCharts)
+		std::move(list.begin(), list.end(), std::back_inserter(charts));
+	layout.charts = charts.size();
+	layout.unwrapSeconds = USecondsSince(start);
+
+	start = std::chrono::steady_clock::now();
+	float density = texelsPerUnit;
+	int atlases = 0;
+	bool packed = false;
+	for (int attempt = 0; attempt < 16; ++attempt, density *= 0.8f)
+	{
+		double area = 0.0;
+		int largest = 0;
+		for (LightmapChart& chart : charts)
+		{
+			chart.width = std::max(1, int(std::ceil(chart.extent.x * density))) + 2;
+			chart.height = std::max(1, int(std::ceil(chart.extent.y * density))) + 2;
+			chart.atlas = -1;
+			area += double(chart.width) * chart.height;
+			largest = std::max(largest, std::max(chart.width, chart.height));
+		}
+		if (largest > atlasSize)
+			continue;
+
+		// square atlases the charts fill to about three quarters
+		const double fill = 0.75;
+		const int estimate = std::max(1, int(std::ceil(area / (fill * atlasSize * atlasSize))));
+		const int side = std::min(int(atlasSize), std::max(largest, (int(std::ceil(std::sqrt(area / estimate / fill))) + 3) & ~3));
+		std::vector<uint32_t> pending(charts.size());
+		std::iota(pending.begin(), pending.end(), 0u);
+		std::sort(pending.begin(), pending.end(), [&](uint32_t a, uint32_t b)
+		{
+			return charts[a].height != charts[b].height ? charts[a].height > charts[b].height : charts[a].width > charts[b].width;
+		});
+
+		atlases = 0;
+		while (!pending.empty() && atlases < lightmapMaxAtlases)
+		{
+			double remaining = 0.0;
+			for (uint32_t c : pending)
+				remaining += double(charts[c].width) * charts[c].height;
+			const int round = std::min(int(lightmapMaxAtlases) - atlases, std::max(1, int(std::ceil(remaining / (fill * side * side)))));
+			std::vector<std::vector<uint32_t>> members(round);
+			std::vector<double> dealt(round, 0.0);
+			for (uint32_t c : pending)
+			{
+				const size_t least = size_t(std::min_element(dealt.begin(), dealt.end()) - dealt.begin());
+				members[least].push_back(c);
+				dealt[least] += double(charts[c].width) * charts[c].height;
+			}
+			UParallelFor(size_t(round), [&](size_t a) { UPackAtlas(charts, members[a], atlases + int(a), side); });
+			atlases += round;
+
+			std::vector<uint32_t> unplaced;
+			for (uint32_t c : pending)
+			{
+				if (charts[c].atlas < 0)
+					unplaced.push_back(c);
+			}
+			pending.swap(unplaced);
+		}
+		packed = pending.empty();
+		if (packed)
+			break;
+	}
+	if (!packed)
+		return false;
+
+	// every atlas cropped to the largest extent any of them used
+	int width = 0, height = 0;
+	std::vector<std::vector<uint32_t>> atlasCharts(atlases);
+	for (uint32_t c = 0; c < charts.size(); ++c)
+	{
+		width = std::max(width, charts[c].x + charts[c].width);
+		height = std::max(height, charts[c].y + charts[c].height);
+		atlasCharts[charts[c].atlas].push_back(c);
+	}
+	layout.width = (width + 3) & ~3;
+	layout.height = (height + 3) & ~3;
+	layout.layers = atlases;
+	layout.texelsPerUnit = density;
+
+	// coverage, one atlas per job, while the batch indices still name the charts' vertices
+	const size_t atlasTexels = size_t(layout.width) * layout.height;
+	layout.texelTriangles.assign(atlasTexels * atlases, 0);
+	layout.utilization.assign(atlases, 0.0f);
+	UParallelFor(size_t(atlases), [&](size_t a)
+	{
+		uint32_t* texels = &layout.texelTriangles[a * atlasTexels];
+		std::vector<float> distances(atlasTexels, FLT_MAX);
+		for (uint32_t c : atlasCharts[a])
+			URasterizeChart(batch, charts[c], density, layout.width, texels, distances.data());
+		layout.utilization[a] = float(std::count_if(texels, texels + atlasTexels, [](uint32_t t) { return t != 0; })) / atlasTexels;
+	});
+
+	// vertices of its own per chart, carrying the packed coords
+	std::vector<GLfloat> vertices;
+	vertices.reserve(batch.vertices.size());
+	for (const LightmapChart& chart : charts)
+	{
+		const GLuint first = GLuint(vertices.size() / floatsPerBatchVertex);
+		for (size_t i = 0; i < chart.vertices.size(); ++i)
+		{
+			const GLfloat* source = &batch.vertices[size_t(chart.vertices[i]) * floatsPerBatchVertex];
+			vertices.insert(vertices.end(), source, source + floatsPerBatchVertex);
+			const glm::vec2 texel = glm::vec2(chart.x + 1, chart.y + 1) + chart.coords[i] * density;
+			GLfloat* vertex = &vertices[vertices.size() - floatsPerBatchVertex];
+			vertex[batchLightmapOffset] = texel.x / layout.width;
+			vertex[batchLightmapOffset + 1] = texel.y / layout.height;
+			vertex[batchLightmapOffset + 2] = float(chart.atlas);
+		}
+		for (uint32_t triangle : chart.triangles)
+		{
+			for (int c = 0; c < 3; ++c)
+			{
+				GLuint& index = batch.indices[size_t(triangle) * 3 + c];
+				index = first + GLuint(UFindSorted(chart.vertices, index));
+			}
+		}
+	}
+	batch.vertices.swap(vertices);
+	layout.packSeconds = USecondsSince(start);
+	return true;
+}
+
+///////////////////////////////////////////////////
+//	UClosestTriangleWeights(const glm::vec2&, const glm::vec2&, const glm::vec2&, const glm::vec2&)
+//
+//	Weights (u, v) of corners b and c for the point of
+//	triangle abc nearest to point: point's own barycentric
+//	coords when it lies inside, else those of the nearest
+//	point on an edge. Padding texels sample their triangle
+//	through it.
+///////////////////////////////////////////////////
+glm::vec2 UClosestTriangleWeights(const glm::vec2& a, const glm::vec2& b, const glm::vec2& c, const glm::vec2& point)
+{
+	const glm::vec2 ab = b - a, ac = c - a, ap = point - a;
+	const float determinant = ab.x * ac.y - ab.y * ac.x;
+	if (std::abs(determinant) > 1e-12f)
+	{
+		const float u = (ap.x * ac.y - ap.y * ac.x) / determinant;
+		const float v = (ab.x * ap.y - ab.y * ap.x) / determinant;
+		if (u >= 0.0f && v >= 0.0f && u + v <= 1.0f)
+			return glm::vec2(u, v);
+	}
+
+	// how far along from..to the nearest point lies
+	auto along = [&](const glm::vec2& from, const glm::vec2& to)
+	{
+		const glm::vec2 edge = to - from;
+		const float length = glm::dot(edge, edge);
+		return length > 0.0f ? std::clamp(glm::dot(point - from, edge) / length, 0.0f, 1.0f) : 0.0f;
+	};
+	const float alongBC = along(b, c);
+	const glm::vec2 candidates[3] = { glm::vec2(along(a, b), 0.0f), glm::vec2(0.0f, along(a, c)), glm::vec2(1.0f - alongBC, alongBC) };
+	glm::vec2 best = candidates[0];
+	float bestDistance = FLT_MAX;
+	for (const glm::vec2& weights : candidates)
+	{
+		const glm::vec2 offset = point - (a + weights.x * ab + weights.y * ac);
+		const float distance = glm::dot(offset, offset);
+		if (distance < bestDistance)
+		{
+			bestDistance = distance;
+			best = weights;
+		}
+	}
+	return best;
+}
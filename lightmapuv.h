@@ -0,0 +1,43 @@
+///////////////////////////////////////////////////////////////////////////////
+// lightmapuv.h
+// ========
+// generates the static batch's lightmap coords: each instance is split into
+// charts of connected triangles facing about the same way, every chart is
+// flattened onto its average plane at a texel density proportional to its
+// world space size, and the charts of all instances are packed into one or
+// more square atlases (the layers of a texture array) with a texel of padding
+// around each. Atlases are packed and rasterized in parallel.
+///////////////////////////////////////////////////////////////////////////////
+
+#ifndef LIGHTMAPUV_H
+#define LIGHTMAPUV_H
+
+#include <GL/glew.h>
+#include <cstdint>
+#include <vector>
+
+#include <glm/glm.hpp>
+
+#include "staticbatch.h"
+
+// Charts grow over neighbours whose face normal is within this cosine of the seed's
+const float lightmapChartCosine = 0.7f;
+
+// Atlases one batch may spread over before its density is lowered
+const GLsizei lightmapMaxAtlases = 16;
+
+struct LightmapAtlasLayout
+{
+	GLsizei width = 0, height = 0, layers = 0;	// one size for every atlas, cropped to what was used
+	std::vector<uint32_t> texelTriangles;		// per texel of each layer in turn, batch triangle + 1, 0 where unused
+	size_t charts = 0;
+	float texelsPerUnit = 0.0f;					// after fitting the atlases
+	std::vector<float> utilization;				// per atlas, share of its texels a chart covers
+	double unwrapSeconds = 0.0;
+	double packSeconds = 0.0;
+};
+
+bool UUnwrapLightmapUVs(StaticBatchData& batch, float texelsPerUnit, GLsizei atlasSize, LightmapAtlasLayout& layout);
+glm::vec2 UClosestTriangleWeights(const glm::vec2& a, const glm::vec2& b, const glm::vec2& c, const glm::vec2& point);
+
+#endif
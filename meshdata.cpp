@@ -0,0 +1,260 @@
+///////////////////////////////////////////////////////////////////////////////
+// meshdata.cpp
+// ========
+// move mesh geometry between OpenGL buffers and system memory
+///////////////////////////////////////////////////////////////////////////////
+
+#include "meshdata.h"
+
+#include <cstring>
+#include <unordered_map>
+
+namespace
+{
+	// Hashes the raw bits of one interleaved vertex so exact duplicates can be found
+	struct VertexKey
+	{
+		const GLfloat* data;
+
+		bool operator==(const VertexKey& other) const
+		{
+			return memcmp(data, other.data, sizeof(GLfloat) * floatsPerMeshVertex) == 0;
+		}
+	};
+
+	struct VertexKeyHash
+	{
+		size_t operator()(const VertexKey& key) const
+		{
+			// FNV-1a over the vertex bytes
+			const unsigned char* bytes = reinterpret_cast<const unsigned char*>(key.data);
+			size_t hash = 2166136261u;
+			for (size_t i = 0; i < sizeof(GLfloat) * floatsPerMeshVertex; ++i)
+			{
+				hash ^= bytes[i];
+				hash *= 16777619u;
+			}
+			return hash;
+		}
+	};
+}
+
+///////////////////////////////////////////////////
+//	UTriangulateRange(const DrawRange&, std::vector<GLuint>&)
+//
+//	range: one glDrawArrays call
+//	indices: triangle list the range is appended to
+//
+//	Converts strips and fans into a plain triangle
+//	list, dropping the degenerate triangles strips
+//	use to stitch rows together
+///////////////////////////////////////////////////
+void UTriangulateRange(const DrawRange& range, std::vector<GLuint>& indices)
+{
+	for (GLsizei i = 2; i < range.count; ++i)
+	{
+		GLuint a, b, c;
+		switch (range.mode)
+		{
+		case GL_TRIANGLES:
+			if (i % 3 != 2)
+				continue;
+			a = range.first + i - 2; b = range.first + i - 1; c = range.first + i;
+			break;
+		case GL_TRIANGLE_STRIP:
+			// every other strip triangle has its winding flipped
+			a = range.first + i - 2;
+			b = range.first + ((i & 1) ? i : i - 1);
+			c = range.first + ((i & 1) ? i - 1 : i);
+			break;
+		case GL_TRIANGLE_FAN:
+			a = range.first; b = range.first + i - 1; c = range.first + i;
+			break;
+		default:
+			return;
+		}
+
+		if (a == b || b == c || a == c)
+			continue;
+
+		indices.push_back(a);
+		indices.push_back(b);
+		indices.push_back(c);
+	}
+}
+
+///////////////////////////////////////////////////
+//	UShapeDrawRanges(const Meshes&, const GLMesh&)
+//
+//	meshes: the shape meshes
+//	mesh: one of the meshes in meshes
+//
+//	Returns the draw calls documented in meshes.cpp for
+//	the shapes that have no index buffer (empty for the
+//	indexed ones)
+///////////////////////////////////////////////////
+std::vector<DrawRange> UShapeDrawRanges(const Meshes& meshes, const Meshes::GLMesh& mesh)
+{
+	if (&mesh == &meshes.gCylinderMesh || &mesh == &meshes.gTaperedCylinderMesh)
+		return { { GL_TRIANGLE_FAN, 0, 36 }, { GL_TRIANGLE_FAN, 36, 36 }, { GL_TRIANGLE_STRIP, 72, 146 } };
+	if (&mesh == &meshes.gConeMesh)
+		return { { GL_TRIANGLE_FAN, 0, 36 }, { GL_TRIANGLE_STRIP, 36, 108 } };
+	if (&mesh == &meshes.gPyramid3Mesh || &mesh == &meshes.gPyramid4Mesh || &mesh == &meshes.gPrismMesh)
+		return { { GL_TRIANGLE_STRIP, 0, (GLsizei)mesh.nVertices } };
+	if (&mesh == &meshes.gTorusMesh)
+		return { { GL_TRIANGLES, 0, (GLsizei)mesh.nVertices } };
+	return {};
+}
+
+///////////////////////////////////////////////////
+//	UReadbackMesh(const GLMesh&, const std::vector<DrawRange>&, MeshData&)
+//
+//	mesh: mesh created by meshes.cpp or UCreateMeshFromData
+//	ranges: draw calls for meshes without an index buffer (ignored otherwise)
+//	data: receives the vertices and a triangle list
+//
+//	Copies the vertex (and index) buffer back from the
+//	GPU. The buffer size is used for the vertex count
+//	since nVertices is not reliable for every shape.
+///////////////////////////////////////////////////
+bool UReadbackMesh(const Meshes::GLMesh& mesh, const std::vector<DrawRange>& ranges, MeshData& data)
+{
+	GLint vertexBytes = 0;
+	glBindBuffer(GL_COPY_READ_BUFFER, mesh.vbos[0]);
+	glGetBufferParameteriv(GL_COPY_READ_BUFFER, GL_BUFFER_SIZE, &vertexBytes);
+	if (vertexBytes <= 0)
+	{
+		glBindBuffer(GL_COPY_READ_BUFFER, 0);
+		return false;
+	}
+
+	data.vertices.resize(vertexBytes / sizeof(GLfloat));
+	glGetBufferSubData(GL_COPY_READ_BUFFER, 0, data.vertices.size() * sizeof(GLfloat), data.vertices.data());
+	data.vertices.resize(data.VertexCount() * floatsPerMeshVertex);
+
+	data.indices.clear();
+	if (mesh.nIndices > 0)
+	{
+		data.indices.resize(mesh.nIndices);
+		glBindBuffer(GL_COPY_READ_BUFFER, mesh.vbos[1]);
+		glGetBufferSubData(GL_COPY_READ_BUFFER, 0, sizeof(GLuint) * data.indices.size(), data.indices.data());
+	}
+	else
+	{
+		for (const DrawRange& range : ranges)
+			UTriangulateRange(range, data.indices);
+	}
+	glBindBuffer(GL_COPY_READ_BUFFER, 0);
+
+	// drop anything pointing past the end of the vertex buffer
+	const GLuint vertexCount = (GLuint)data.VertexCount();
+	size_t kept = 0;
+	for (size_t i = 0; i + 2 < data.indices.size(); i += 3)
+	{
+		if (data.indices[i] >= vertexCount || data.indices[i + 1] >= vertexCount || data.indices[i + 2] >= vertexCount)
+			continue;
+		data.indices[kept++] = data.indices[i];
+		data.indices[kept++] = data.indices[i + 1];
+		data.indices[kept++] = data.indices[i + 2];
+	}
+	data.indices.resize(kept);
+
+	return true;
+}
+
+///////////////////////////////////////////////////
+//	UWeldVertices(MeshData&)
+//
+//	data: mesh to weld in place
+//
+//	Merges vertices whose position, normal and texture
+//	coords are bit-for-bit identical and drops the
+//	vertices no triangle uses. Non-indexed meshes
+//	repeat a vertex for every triangle that touches it,
+//	which hides the connectivity the mesh tools need.
+///////////////////////////////////////////////////
+void UWeldVertices(MeshData& data)
+{
+	const size_t vertexCount = data.VertexCount();
+	std::vector<GLuint> remap(vertexCount, ~0u);
+	std::unordered_map<VertexKey, GLuint, VertexKeyHash> unique;
+	unique.reserve(vertexCount);
+
+	std::vector<GLfloat> welded;
+	welded.reserve(data.vertices.size());
+
+	for (GLuint& index : data.indices)
+	{
+		if (remap[index] == ~0u)
+		{
+			VertexKey key = { &data.vertices[index * floatsPerMeshVertex] };
+			auto found = unique.find(key);
+			if (found != unique.end())
+			{
+				remap[index] = found->second;
+			}
+			else
+			{
+				GLuint newIndex = (GLuint)(welded.size() / floatsPerMeshVertex);
+				welded.insert(welded.end(), key.data, key.data + floatsPerMeshVertex);
+				unique.emplace(key, newIndex);
+				remap[index] = newIndex;
+			}
+		}
+		index = remap[index];
+	}
+
+	data.vertices.swap(welded);
+}
+
+///////////////////////////////////////////////////
+//	UCreateMeshFromData(const MeshData&, GLMesh&)
+//
+//	data: indexed triangle list to upload
+//	mesh: reference to mesh structure for storing data
+//
+//	Store a MeshData in a VAO/VBO with the same
+//	attribute layout as the meshes in meshes.cpp
+//
+//  Correct triangle drawing command:
+//
+//	glDrawElements(GL_TRIANGLES, mesh.nIndices, GL_UNSIGNED_INT, (void*)0);
+///////////////////////////////////////////////////
+void UCreateMeshFromData(const MeshData& data, Meshes::GLMesh& mesh)
+{
+	// total float values per each type
+	const GLuint floatsPerVertex = 3;
+	const GLuint floatsPerNormal = 3;
+	const GLuint floatsPerUV = 2;
+
+	// store vertex and index count
+	mesh.nVertices = (GLuint)data.VertexCount();
+	mesh.nIndices = (GLuint)data.indices.size();
+
+	// Create VAO
+	glGenVertexArrays(1, &mesh.vao);
+	glBindVertexArray(mesh.vao);
+
+	// Create VBOs
+	glGenBuffers(2, mesh.vbos);
+	glBindBuffer(GL_ARRAY_BUFFER, mesh.vbos[0]); // Activates the vertex buffer
+	glBufferData(GL_ARRAY_BUFFER, sizeof(GLfloat) * data.vertices.size(), data.vertices.data(), GL_STATIC_DRAW);
+
+	glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, mesh.vbos[1]); // Activates the index buffer
+	glBufferData(GL_ELEMENT_ARRAY_BUFFER, sizeof(GLuint) * data.indices.size(), data.indices.data(), GL_STATIC_DRAW);
+
+	// Strides between vertex coordinates
+	GLint stride = sizeof(float) * (floatsPerVertex + floatsPerNormal + floatsPerUV);
+
+	// Create Vertex Attribute Pointers
+	glVertexAttribPointer(0, floatsPerVertex, GL_FLOAT, GL_FALSE, stride, 0);
+	glEnableVertexAttribArray(0);
+
+	glVertexAttribPointer(1, floatsPerNormal, GL_FLOAT, GL_FALSE, stride, (void*)(sizeof(float) * floatsPerVertex));
+	glEnableVertexAttribArray(1);
+
+	glVertexAttribPointer(2, floatsPerUV, GL_FLOAT, GL_FALSE, stride, (void*)(sizeof(float) * (floatsPerVertex + floatsPerNormal)));
+	glEnableVertexAttribArray(2);
+
+	glBindVertexArray(0);
+}
@@ -0,0 +1,46 @@
+///////////////////////////////////////////////////////////////////////////////
+// meshdata.h
+// ========
+// CPU side copy of mesh geometry, used by the mesh processing tools
+// (simplification, clustering, importing) before the result is handed
+// back to OpenGL as a GLMesh
+///////////////////////////////////////////////////////////////////////////////
+
+#ifndef MESHDATA_H
+#define MESHDATA_H
+
+#include <GL/glew.h>
+#include <vector>
+
+#include "meshes.h"
+
+// Interleaved vertex layout shared by every mesh in meshes.cpp:
+// position (3), normal (3), texture coords (2)
+const GLuint floatsPerMeshVertex = 8;
+
+// Indexed triangle list kept in system memory
+struct MeshData
+{
+	std::vector<GLfloat> vertices;	// interleaved vertex attributes, floatsPerMeshVertex per vertex
+	std::vector<GLuint> indices;	// three indices per triangle
+
+	size_t VertexCount() const { return vertices.size() / floatsPerMeshVertex; }
+	size_t TriangleCount() const { return indices.size() / 3; }
+};
+
+// One glDrawArrays call of a non-indexed mesh, e.g. the cylinder's
+// bottom fan, top fan and side strip
+struct DrawRange
+{
+	GLenum mode;	// GL_TRIANGLES, GL_TRIANGLE_STRIP or GL_TRIANGLE_FAN
+	GLint first;
+	GLsizei count;
+};
+
+std::vector<DrawRange> UShapeDrawRanges(const Meshes& meshes, const Meshes::GLMesh& mesh);
+bool UReadbackMesh(const Meshes::GLMesh& mesh, const std::vector<DrawRange>& ranges, MeshData& data);
+void UTriangulateRange(const DrawRange& range, std::vector<GLuint>& indices);
+void UWeldVertices(MeshData& data);
+void UCreateMeshFromData(const MeshData& data, Meshes::GLMesh& mesh);
+
+#endif
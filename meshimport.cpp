@@ -0,0 +1,1004 @@
+///////////////////////////////////////////////////////////////////////////////
+// meshimport.cpp
+// ========
+// OBJ and binary glTF 2.0 importers. Files are memory mapped and parsed in
+// place with a number parser that never allocates; several files can be
+// loaded at once on the worker threads.
+///////////////////////////////////////////////////////////////////////////////
+
+#include "meshimport.h"
+#include "mappedfile.h"
+#include "packfile.h"
+#include "parallel.h"
+
+#include <algorithm>
+#include <cctype>
+#include <chrono>
+#include <cmath>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <sstream>
+#include <unordered_map>
+
+#include <glm/glm.hpp>
+
+namespace
+{
+	const double powersOfTen[] = {
+		1e0, 1e1, 1e2, 1e3, 1e4, 1e5, 1e6, 1e7, 1e8, 1e9, 1e10, 1e11,
+		1e12, 1e13, 1e14, 1e15, 1e16, 1e17, 1e18, 1e19, 1e20, 1e21, 1e22
+	};
+
+	bool UIsDigit(char c)
+	{
+		return c >= '0' && c <= '9';
+	}
+
+	const char* USkipSpaces(const char* p, const char* end)
+	{
+		while (p < end && (*p == ' ' || *p == '\t' || *p == '\r'))
+			++p;
+		return p;
+	}
+
+	const char* UNextLine(const char* p, const char* end)
+	{
+		const char* newline = (const char*)memchr(p, '\n', end - p);
+		return newline ? newline + 1 : end;
+	}
+
+	///////////////////////////////////////////////////
+	//	UParseDouble(const char*, const char*, double&)
+	//
+	//	Parses a decimal number in place: up to 19
+	//	significant digits go into an integer mantissa
+	//	which is scaled by an exact power of ten. Returns
+	//	the first character after the number, or p if
+	//	there was no number.
+	///////////////////////////////////////////////////
+	const char* UParseDouble(const char* p, const char* end, double& out)
+	{
+		const char* start = p;
+		bool negative = false;
+		if (p < end && (*p == '-' || *p == '+'))
+		{
+			negative = *p == '-';
+			++p;
+		}
+
+		unsigned long long mantissa = 0;
+		int significant = 0;
+		int exponent = 0;
+		bool anyDigits = false;
+
+		for (; p < end && UIsDigit(*p); ++p)
+		{
+			anyDigits = true;
+			if (significant < 19)
+			{
+				mantissa = mantissa * 10 + (*p - '0');
+				significant += mantissa != 0;
+			}
+			else
+			{
+				++exponent;
+			}
+		}
+		if (p < end && *p == '.')
+		{
+			for (++p; p < end && UIsDigit(*p); ++p)
+			{
+				anyDigits = true;
+				if (significant < 19)
+				{
+					mantissa = mantissa * 10 + (*p - '0');
+					significant += mantissa != 0;
+					--exponent;
+				}
+			}
+		}
+		if (!anyDigits)
+			return start;
+
+		if (p < end && (*p == 'e' || *p == 'E'))
+		{
+			const char* e = p + 1;
+			bool negativeExponent = false;
+			if (e < end && (*e == '-' || *e == '+'))
+			{
+				negativeExponent = *e == '-';
+				++e;
+			}
+			if (e < end && UIsDigit(*e))
+			{
+				int value = 0;
+				for (; e < end && UIsDigit(*e); ++e)
+					value = value < 10000 ? value * 10 + (*e - '0') : value;
+				exponent += negativeExponent ? -value : value;
+				p = e;
+			}
+		}
+
+		double value = (double)mantissa;
+		if (exponent < 0)
+			value = -exponent <= 22 ? value / powersOfTen[-exponent] : value * pow(10.0, exponent);
+		else if (exponent > 0)
+			value = exponent <= 22 ? value * powersOfTen[exponent] : value * pow(10.0, exponent);
+
+		out = negative ? -value : value;
+		return p;
+	}
+
+	const char* UParseFloat(const char* p, const char* end, float& out)
+	{
+		double value = 0.0;
+		const char* next = UParseDouble(USkipSpaces(p, end), end, value);
+		out = (float)value;
+		return next;
+	}
+
+	const char* UParseInt(const char* p, const char* end, int& out)
+	{
+		bool negative = false;
+		if (p < end && (*p == '-' || *p == '+'))
+		{
+			negative = *p == '-';
+			++p;
+		}
+		int value = 0;
+		const char* digits = p;
+		for (; p < end && UIsDigit(*p); ++p)
+			value = value * 10 + (*p - '0');
+		if (p == digits)
+			return digits;
+		out = negative ? -value : value;
+		return p;
+	}
+
+	// One OBJ face corner, as the raw 1-based (or negative, relative) indices
+	struct ObjCorner
+	{
+		int v, vt, vn;
+
+		bool operator==(const ObjCorner& other) const
+		{
+			return v == other.v && vt == other.vt && vn == other.vn;
+		}
+	};
+
+	struct ObjCornerHash
+	{
+		size_t operator()(const ObjCorner& c) const
+		{
+			return size_t(c.v) * 73856093u ^ size_t(c.vt) * 19349663u ^ size_t(c.vn) * 83492791u;
+		}
+	};
+
+	// Turns OBJ positions, texture coords, normals and face corners into an
+	// indexed MeshData; shared by the fast and the naive reader so both do the
+	// same work after tokenizing
+	class ObjBuilder
+	{
+	public:
+		explicit ObjBuilder(MeshData& output) : data(output)
+		{
+			data.vertices.clear();
+			data.indices.clear();
+		}
+
+		void AddPosition(float x, float y, float z) { positions.push_back(glm::vec3(x, y, z)); }
+		void AddTexcoord(float u, float v) { texcoords.push_back(glm::vec2(u, v)); }
+		void AddNormal(float x, float y, float z) { normals.push_back(glm::vec3(x, y, z)); }
+
+		// Starts a new polygon; corners are fanned into triangles as they arrive
+		void BeginFace() { faceCorners = 0; }
+
+		bool AddCorner(ObjCorner corner)
+		{
+			// negative indices count back from the newest element
+			if (corner.v < 0) corner.v += (int)positions.size() + 1;
+			if (corner.vt < 0) corner.vt += (int)texcoords.size() + 1;
+			if (corner.vn < 0) corner.vn += (int)normals.size() + 1;
+			if (corner.v <= 0 || corner.v > (int)positions.size() || corner.vt > (int)texcoords.size() || corner.vn > (int)normals.size())
+				return false;
+
+			GLuint index;
+			auto found = cache.find(corner);
+			if (found != cache.end())
+			{
+				index = found->second;
+			}
+			else
+			{
+				index = (GLuint)data.VertexCount();
+				glm::vec3 p = positions[corner.v - 1];
+				glm::vec3 n = corner.vn > 0 ? normals[corner.vn - 1] : glm::vec3(0.0f);
+				glm::vec2 uv = corner.vt > 0 ? texcoords[corner.vt - 1] : glm::vec2(0.0f);
+				GLfloat vertex[floatsPerMeshVertex] = { p.x, p.y, p.z, n.x, n.y, n.z, uv.x, uv.y };
+				data.vertices.insert(data.vertices.end(), vertex, vertex + floatsPerMeshVertex);
+				missingNormal.push_back(corner.vn <= 0);
+				cache.emplace(corner, index);
+			}
+
+			if (faceCorners == 0)
+				firstCorner = index;
+			else if (faceCorners >= 2)
+			{
+				data.indices.push_back(firstCorner);
+				data.indices.push_back(previousCorner);
+				data.indices.push_back(index);
+			}
+			previousCorner = index;
+			++faceCorners;
+			return true;
+		}
+
+		// Fills in smooth normals for the vertices the file gave none
+		void Finish()
+		{
+			bool anyMissing = false;
+			for (bool missing : missingNormal)
+				anyMissing = anyMissing || missing;
+			if (!anyMissing)
+				return;
+
+			std::vector<glm::vec3> accumulated(data.VertexCount(), glm::vec3(0.0f));
+			for (size_t i = 0; i + 2 < data.indices.size(); i += 3)
+			{
+				GLuint a = data.indices[i], b = data.indices[i + 1], c = data.indices[i + 2];
+				glm::vec3 pa(data.vertices[a * floatsPerMeshVertex], data.vertices[a * floatsPerMeshVertex + 1], data.vertices[a * floatsPerMeshVertex + 2]);
+				glm::vec3 pb(data.vertices[b * floatsPerMeshVertex], data.vertices[b * floatsPerMeshVertex + 1], data.vertices[b * floatsPerMeshVertex + 2]);
+				glm::vec3 pc(data.vertices[c * floatsPerMeshVertex], data.vertices[c * floatsPerMeshVertex + 1], data.vertices[c * floatsPerMeshVertex + 2]);
+				glm::vec3 faceNormal = glm::cross(pb - pa, pc - pa); // area weighted
+				accumulated[a] += faceNormal;
+				accumulated[b] += faceNormal;
+				accumulated[c] += faceNormal;
+			}
+			for (size_t v = 0; v < accumulated.size(); ++v)
+			{
+				if (!missingNormal[v])
+					continue;
+				float length = glm::length(accumulated[v]);
+				glm::vec3 n = length > 0.0f ? accumulated[v] / length : glm::vec3(0.0f, 1.0f, 0.0f);
+				data.vertices[v * floatsPerMeshVertex + 3] = n.x;
+				data.vertices[v * floatsPerMeshVertex + 4] = n.y;
+				data.vertices[v * floatsPerMeshVertex + 5] = n.z;
+			}
+		}
+
+	private:
+		MeshData& data;
+		std::vector<glm::vec3> positions;
+		std::vector<glm::vec2> texcoords;
+		std::vector<glm::vec3> normals;
+		std::vector<bool> missingNormal;
+		std::unordered_map<ObjCorner, GLuint, ObjCornerHash> cache;
+		int faceCorners = 0;
+		GLuint firstCorner = 0;
+		GLuint previousCorner = 0;
+	};
+
+	// Minimal JSON document for the glTF header chunk
+	struct JsonValue
+	{
+		enum Type { NUL, BOOLEAN, NUMBER, STRING, ARRAY, OBJECT } type = NUL;
+		double number = 0.0;
+		std::string string;
+		std::vector<JsonValue> items;
+		std::vector<std::pair<std::string, JsonValue>> members;
+
+		const JsonValue* Find(const char* key) const
+		{
+			for (const auto& member : members)
+			{
+				if (member.first == key)
+					return &member.second;
+			}
+			return nullptr;
+		}
+
+		double Number(const char* key, double fallback) const
+		{
+			const JsonValue* value = Find(key);
+			return value && value->type == NUMBER ? value->number : fallback;
+		}
+
+		const JsonValue* Item(const char* key, int index) const
+		{
+			const JsonValue* array = Find(key);
+			if (!array || array->type != ARRAY || index < 0 || index >= (int)array->items.size())
+				return nullptr;
+			return &array->items[index];
+		}
+	};
+
+	const char* USkipJsonSpace(const char* p, const char* end)
+	{
+		while (p < end && (*p == ' ' || *p == '\t' || *p == '\r' || *p == '\n'))
+			++p;
+		return p;
+	}
+
+	const char* UParseJsonString(const char* p, const char* end, std::string& out)
+	{
+		// p points at the opening quote
+		out.clear();
+		for (++p; p < end && *p != '"'; ++p)
+		{
+			if (*p == '\\' && p + 1 < end)
+			{
+				++p;
+				switch (*p)
+				{
+				case 'n': out += '\n'; break;
+				case 't': out += '\t'; break;
+				case 'r': out += '\r'; break;
+				case 'b': out += '\b'; break;
+				case 'f': out += '\f'; break;
+				case 'u': out += '?'; p = std::min(p + 4, end - 1); break; // names glTF cares about are ASCII
+				default: out += *p; break;
+				}
+			}
+			else
+			{
+				out += *p;
+			}
+		}
+		return p < end ? p + 1 : nullptr;
+	}
+
+	const char* UParseJson(const char* p, const char* end, JsonValue& out, int depth)
+	{
+		p = USkipJsonSpace(p, end);
+		if (p >= end || depth > 64)
+			return nullptr;
+
+		switch (*p)
+		{
+		case '{':
+			out.type = JsonValue::OBJECT;
+			p = USkipJsonSpace(p + 1, end);
+			if (p < end && *p == '}')
+				return p + 1;
+			while (p && p < end)
+			{
+				p = USkipJsonSpace(p, end);
+				if (p >= end || *p != '"')
+					return nullptr;
+				out.members.emplace_back();
+				p = UParseJsonString(p, end, out.members.back().first);
+				if (!p)
+					return nullptr;
+				p = USkipJsonSpace(p, end);
+				if (p >= end || *p != ':')
+					return nullptr;
+				p = UParseJson(p + 1, end, out.members.back().second, depth + 1);
+				if (!p)
+					return nullptr;
+				p = USkipJsonSpace(p, end);
+				if (p < end && *p == ',')
+					++p;
+				else if (p < end && *p == '}')
+					return p + 1;
+				else
+					return nullptr;
+			}
+			return nullptr;
+		case '[':
+			out.type = JsonValue::ARRAY;
+			p = USkipJsonSpace(p + 1, end);
+			if (p < end && *p == ']')
+				return p + 1;
+			while (p && p < end)
+			{
+				out.items.emplace_back();
+				p = UParseJson(p, end, out.items.back(), depth + 1);
+				if (!p)
+					return nullptr;
+				p = USkipJsonSpace(p, end);
+				if (p < end && *p == ',')
+					++p;
+				else if (p < end && *p == ']')
+					return p + 1;
+				else
+					return nullptr;
+			}
+			return nullptr;
+		case '"':
+			out.type = JsonValue::STRING;
+			return UParseJsonString(p, end, out.string);
+		case 't':
+			out.type = JsonValue::BOOLEAN;
+			out.number = 1.0;
+			return end - p >= 4 ? p + 4 : nullptr;
+		case 'f':
+			out.type = JsonValue::BOOLEAN;
+			return end - p >= 5 ? p + 5 : nullptr;
+		case 'n':
+			out.type = JsonValue::NUL;
+			return end - p >= 4 ? p + 4 : nullptr;
+		default:
+		{
+			out.type = JsonValue::NUMBER;
+			const char* next = UParseDouble(p, end, out.number);
+			return next == p ? nullptr : next;
+		}
+		}
+	}
+
+	// A typed view of a glTF accessor inside the binary chunk
+	struct AccessorView
+	{
+		const unsigned char* data;
+		size_t count;
+		size_t stride;
+		int componentType;
+		int components;
+		bool normalized;
+	};
+
+	int UComponentSize(int componentType)
+	{
+		switch (componentType)
+		{
+		case 5120: case 5121: return 1;	// BYTE, UNSIGNED_BYTE
+		case 5122: case 5123: return 2;	// SHORT, UNSIGNED_SHORT
+		case 5125: case 5126: return 4;	// UNSIGNED_INT, FLOAT
+		default: return 0;
+		}
+	}
+
+	bool UGetAccessor(const JsonValue& gltf, const unsigned char* bin, size_t binSize, int index, AccessorView& view)
+	{
+		const JsonValue* accessor = gltf.Item("accessors", index);
+		if (!accessor)
+			return false;
+		const JsonValue* bufferView = gltf.Item("bufferViews", (int)accessor->Number("bufferView", -1));
+		if (!bufferView || bufferView->Number("buffer", 0) != 0)
+			return false;
+
+		const JsonValue* type = accessor->Find("type");
+		if (!type || type->type != JsonValue::STRING)
+			return false;
+		view.components = type->string == "SCALAR" ? 1 : type->string == "VEC2" ? 2 : type->string == "VEC3" ? 3 : type->string == "VEC4" ? 4 : 0;
+		view.componentType = (int)accessor->Number("componentType", 0);
+		view.count = (size_t)accessor->Number("count", 0);
+		const JsonValue* normalized = accessor->Find("normalized");
+		view.normalized = normalized && normalized->number != 0.0;
+
+		const size_t elementSize = size_t(UComponentSize(view.componentType)) * view.components;
+		if (elementSize == 0)
+			return false;
+		view.stride = (size_t)bufferView->Number("byteStride", 0);
+		if (view.stride == 0)
+			view.stride = elementSize;
+
+		const size_t offset = (size_t)bufferView->Number("byteOffset", 0) + (size_t)accessor->Number("byteOffset", 0);
+		if (view.count > 0 && offset + (view.count - 1) * view.stride + elementSize > binSize)
+			return false;
+		view.data = bin + offset;
+		return true;
+	}
+
+	// Reads one component as a float, honouring normalized integer types
+	float UReadComponent(const AccessorView& view, size_t element, int component)
+	{
+		const unsigned char* p = view.data + element * view.stride + component * UComponentSize(view.componentType);
+		switch (view.componentType)
+		{
+		case 5126: { float f; memcpy(&f, p, 4); return f; }
+		case 5121: return view.normalized ? *p / 255.0f : *p;
+		case 5123: { unsigned short s; memcpy(&s, p, 2); return view.normalized ? s / 65535.0f : s; }
+		case 5120: return view.normalized ? std::max(*(const signed char*)p / 127.0f, -1.0f) : *(const signed char*)p;
+		case 5122: { short s; memcpy(&s, p, 2); return view.normalized ? std::max(s / 32767.0f, -1.0f) : s; }
+		default: return 0.0f;
+		}
+	}
+
+	GLuint UReadIndex(const AccessorView& view, size_t element)
+	{
+		const unsigned char* p = view.data + element * view.stride;
+		switch (view.componentType)
+		{
+		case 5121: return *p;
+		case 5123: { unsigned short s; memcpy(&s, p, 2); return s; }
+		case 5125: { GLuint i; memcpy(&i, p, 4); return i; }
+		default: return 0;
+		}
+	}
+
+	// Local transform of a glTF node: matrix, or translation * rotation * scale
+	glm::mat4 UNodeMatrix(const JsonValue& node)
+	{
+		glm::mat4 local(1.0f);
+		const JsonValue* matrix = node.Find("matrix");
+		if (matrix && matrix->items.size() == 16)
+		{
+			for (int i = 0; i < 16; ++i)
+				local[i / 4][i % 4] = (float)matrix->items[i].number;
+			return local;
+		}
+
+		const JsonValue* t = node.Find("translation");
+		const JsonValue* r = node.Find("rotation");
+		const JsonValue* s = node.Find("scale");
+		if (r && r->items.size() == 4)
+		{
+			float x = (float)r->items[0].number, y = (float)r->items[1].number, z = (float)r->items[2].number, w = (float)r->items[3].number;
+			local[0] = glm::vec4(1 - 2 * (y * y + z * z), 2 * (x * y + w * z), 2 * (x * z - w * y), 0.0f);
+			local[1] = glm::vec4(2 * (x * y - w * z), 1 - 2 * (x * x + z * z), 2 * (y * z + w * x), 0.0f);
+			local[2] = glm::vec4(2 * (x * z + w * y), 2 * (y * z - w * x), 1 - 2 * (x * x + y * y), 0.0f);
+		}
+		if (s && s->items.size() == 3)
+		{
+			for (int i = 0; i < 3; ++i)
+				local[i] = local[i] * (float)s->items[i].number;
+		}
+		if (t && t->items.size() == 3)
+			local[3] = glm::vec4((float)t->items[0].number, (float)t->items[1].number, (float)t->items[2].number, 1.0f);
+		return local;
+	}
+
+	// Appends every triangle primitive of a glTF mesh, transformed to world space
+	bool UAppendGltfMesh(const JsonValue& gltf, const unsigned char* bin, size_t binSize, const JsonValue& mesh, const glm::mat4& world, MeshData& data)
+	{
+		const glm::mat3 normalMatrix = glm::transpose(glm::inverse(glm::mat3(world)));
+		const JsonValue* primitives = mesh.Find("primitives");
+		if (!primitives)
+			return true;
+
+		for (const JsonValue& primitive : primitives->items)
+		{
+			if (primitive.Number("mode", 4) != 4) // triangles only
+				continue;
+			const JsonValue* attributes = primitive.Find("attributes");
+			if (!attributes)
+				continue;
+
+			AccessorView positions, normals, texcoords, indices;
+			if (!UGetAccessor(gltf, bin, binSize, (int)attributes->Number("POSITION", -1), positions) || positions.components != 3)
+				return false;
+			bool hasNormals = UGetAccessor(gltf, bin, binSize, (int)attributes->Number("NORMAL", -1), normals) && normals.components == 3 && normals.count == positions.count;
+			bool hasTexcoords = UGetAccessor(gltf, bin, binSize, (int)attributes->Number("TEXCOORD_0", -1), texcoords) && texcoords.components == 2 && texcoords.count == positions.count;
+			bool hasIndices = UGetAccessor(gltf, bin, binSize, (int)primitive.Number("indices", -1), indices) && indices.components == 1;
+
+			const GLuint base = (GLuint)data.VertexCount();
+			data.vertices.reserve(data.vertices.size() + positions.count * floatsPerMeshVertex);
+			for (size_t v = 0; v < positions.count; ++v)
+			{
+				glm::vec3 p = glm::vec3(world * glm::vec4(UReadComponent(positions, v, 0), UReadComponent(positions, v, 1), UReadComponent(positions, v, 2), 1.0f));
+				glm::vec3 n(0.0f, 1.0f, 0.0f);
+				if (hasNormals)
+					n = glm::normalize(normalMatrix * glm::vec3(UReadComponent(normals, v, 0), UReadComponent(normals, v, 1), UReadComponent(normals, v, 2)));
+				glm::vec2 uv(0.0f);
+				if (hasTexcoords)
+					uv = glm::vec2(UReadComponent(texcoords, v, 0), 1.0f - UReadComponent(texcoords, v, 1)); // glTF puts v = 0 at the top
+				GLfloat vertex[floatsPerMeshVertex] = { p.x, p.y, p.z, n.x, n.y, n.z, uv.x, uv.y };
+				data.vertices.insert(data.vertices.end(), vertex, vertex + floatsPerMeshVertex);
+			}
+
+			const size_t indexCount = hasIndices ? indices.count : positions.count;
+			for (size_t i = 0; i + 2 < indexCount; i += 3)
+			{
+				GLuint tri[3];
+				for (int c = 0; c < 3; ++c)
+					tri[c] = hasIndices ? UReadIndex(indices, i + c) : GLuint(i + c);
+				if (tri[0] >= positions.count || tri[1] >= positions.count || tri[2] >= positions.count)
+					return false;
+				for (int c = 0; c < 3; ++c)
+					data.indices.push_back(base + tri[c]);
+			}
+		}
+		return true;
+	}
+
+	bool UAppendGltfNode(const JsonValue& gltf, const unsigned char* bin, size_t binSize, int nodeIndex, const glm::mat4& parent, MeshData& data, int depth)
+	{
+		const JsonValue* node = gltf.Item("nodes", nodeIndex);
+		if (!node || depth > 64)
+			return false;
+
+		glm::mat4 world = parent * UNodeMatrix(*node);
+		const JsonValue* mesh = gltf.Item("meshes", (int)node->Number("mesh", -1));
+		if (mesh && !UAppendGltfMesh(gltf, bin, binSize, *mesh, world, data))
+			return false;
+
+		const JsonValue* children = node->Find("children");
+		if (children)
+		{
+			for (const JsonValue& child : children->items)
+			{
+				if (!UAppendGltfNode(gltf, bin, binSize, (int)child.number, world, data, depth + 1))
+					return false;
+			}
+		}
+		return true;
+	}
+
+	unsigned int UReadU32(const unsigned char* p)
+	{
+		return p[0] | (p[1] << 8) | (p[2] << 16) | ((unsigned int)p[3] << 24);
+	}
+}
+
+///////////////////////////////////////////////////
+//	UMeshFormatFromPath(const char*)
+//
+//	Picks the importer from the file extension
+///////////////////////////////////////////////////
+MeshFormat UMeshFormatFromPath(const char* path)
+{
+	const char* dot = strrchr(path, '.');
+	if (!dot)
+		return MeshFormat::UNKNOWN;
+
+	char extension[8] = {};
+	for (int i = 0; i < 7 && dot[i + 1]; ++i)
+		extension[i] = (char)tolower(dot[i + 1]);
+
+	if (strcmp(extension, "obj") == 0)
+		return MeshFormat::OBJ;
+	if (strcmp(extension, "glb") == 0)
+		return MeshFormat::GLB;
+	return MeshFormat::UNKNOWN;
+}
+
+///////////////////////////////////////////////////
+//	UParseObj(const char*, size_t, MeshData&)
+//
+//	text: OBJ file contents (need not be null terminated)
+//	size: length of text
+//	data: receives the indexed mesh
+//
+//	Reads v, vt, vn and f lines; polygons are fanned into
+//	triangles and each distinct v/vt/vn corner becomes one
+//	vertex. Groups, smoothing groups and materials are
+//	ignored.
+///////////////////////////////////////////////////
+bool UParseObj(const char* text, size_t size, MeshData& data)
+{
+	ObjBuilder builder(data);
+	const char* p = text;
+	const char* end = text + size;
+
+	while (p < end)
+	{
+		p = USkipSpaces(p, end);
+		if (p + 1 >= end)
+			break;
+
+		if (p[0] == 'v' && p[1] == ' ')
+		{
+			float x = 0.0f, y = 0.0f, z = 0.0f;
+			p = UParseFloat(p + 2, end, x);
+			p = UParseFloat(p, end, y);
+			p = UParseFloat(p, end, z);
+			builder.AddPosition(x, y, z);
+		}
+		else if (p[0] == 'v' && p[1] == 't')
+		{
+			float u = 0.0f, v = 0.0f;
+			p = UParseFloat(p + 2, end, u);
+			p = UParseFloat(p, end, v);
+			builder.AddTexcoord(u, v);
+		}
+		else if (p[0] == 'v' && p[1] == 'n')
+		{
+			float x = 0.0f, y = 0.0f, z = 0.0f;
+			p = UParseFloat(p + 2, end, x);
+			p = UParseFloat(p, end, y);
+			p = UParseFloat(p, end, z);
+			builder.AddNormal(x, y, z);
+		}
+		else if (p[0] == 'f' && (p[1] == ' ' || p[1] == '\t'))
+		{
+			builder.BeginFace();
+			p += 2;
+			while (true)
+			{
+				p = USkipSpaces(p, end);
+				if (p >= end || *p == '\n' || *p == '#')
+					break;
+
+				ObjCorner corner = { 0, 0, 0 };
+				const char* next = UParseInt(p, end, corner.v);
+				if (next == p)
+					return false;
+				p = next;
+				if (p < end && *p == '/')
+				{
+					p = UParseInt(p + 1, end, corner.vt);
+					if (p < end && *p == '/')
+						p = UParseInt(p + 1, end, corner.vn);
+				}
+				if (!builder.AddCorner(corner))
+					return false;
+			}
+		}
+
+		p = UNextLine(p, end);
+	}
+
+	builder.Finish();
+	return !data.indices.empty();
+}
+
+///////////////////////////////////////////////////
+//	UParseGlb(const unsigned char*, size_t, MeshData&)
+//
+//	bytes: binary glTF 2.0 file contents
+//	size: length of bytes
+//	data: receives every triangle primitive of the default scene
+//
+//	Node transforms are applied so the result is in the
+//	scene's world space. Only the embedded BIN chunk is
+//	supported as a buffer.
+///////////////////////////////////////////////////
+bool UParseGlb(const unsigned char* bytes, size_t size, MeshData& data)
+{
+	data.vertices.clear();
+	data.indices.clear();
+
+	// 12 byte header, then chunks of (length, type, payload)
+	if (size < 20 || UReadU32(bytes) != 0x46546C67 || UReadU32(bytes + 4) != 2) // "glTF", version 2
+		return false;
+
+	const unsigned char* json = nullptr;
+	const unsigned char* bin = nullptr;
+	size_t jsonSize = 0, binSize = 0;
+	size_t offset = 12;
+	const size_t total = std::min<size_t>(UReadU32(bytes + 8), size);
+	while (offset + 8 <= total)
+	{
+		size_t chunkSize = UReadU32(bytes + offset);
+		unsigned int chunkType = UReadU32(bytes + offset + 4);
+		if (offset + 8 + chunkSize > total)
+			return false;
+		if (chunkType == 0x4E4F534A) // "JSON"
+		{
+			json = bytes + offset + 8;
+			jsonSize = chunkSize;
+		}
+		else if (chunkType == 0x004E4942) // "BIN\0"
+		{
+			bin = bytes + offset + 8;
+			binSize = chunkSize;
+		}
+		offset += 8 + ((chunkSize + 3) & ~size_t(3));
+	}
+	if (!json)
+		return false;
+
+	JsonValue gltf;
+	if (!UParseJson((const char*)json, (const char*)json + jsonSize, gltf, 0) || gltf.type != JsonValue::OBJECT)
+		return false;
+
+	// Root nodes of the default scene, or every node nobody claims as a child
+	std::vector<int> roots;
+	const JsonValue* scene = gltf.Item("scenes", (int)gltf.Number("scene", 0));
+	if (scene && scene->Find("nodes"))
+	{
+		for (const JsonValue& node : scene->Find("nodes")->items)
+			roots.push_back((int)node.number);
+	}
+	else if (const JsonValue* nodes = gltf.Find("nodes"))
+	{
+		std::vector<bool> isChild(nodes->items.size(), false);
+		for (const JsonValue& node : nodes->items)
+		{
+			if (const JsonValue* children = node.Find("children"))
+				for (const JsonValue& child : children->items)
+					if (child.number >= 0 && child.number < isChild.size())
+						isChild[(size_t)child.number] = true;
+		}
+		for (size_t i = 0; i < isChild.size(); ++i)
+			if (!isChild[i])
+				roots.push_back((int)i);
+	}
+
+	for (int root : roots)
+	{
+		if (!UAppendGltfNode(gltf, bin, binSize, root, glm::mat4(1.0f), data, 0))
+			return false;
+	}
+	return !data.indices.empty();
+}
+
+///////////////////////////////////////////////////
+//	UImportMesh(const char*, MeshData&)
+//
+//	path: .obj or .glb file
+//	data: receives the indexed mesh
+//
+//	Maps the file (or finds it in a mounted pack) and hands
+//	it to the matching parser
+///////////////////////////////////////////////////
+bool UImportMesh(const char* path, MeshData& data)
+{
+	AssetFile file;
+	if (!file.Open(path))
+		return false;
+
+	switch (UMeshFormatFromPath(path))
+	{
+	case MeshFormat::OBJ: return UParseObj((const char*)file.Data(), file.Size(), data);
+	case MeshFormat::GLB: return UParseGlb(file.Data(), file.Size(), data);
+	default: return false;
+	}
+}
+
+///////////////////////////////////////////////////
+//	UImportMeshes(const std::vector<std::string>&, std::vector<MeshImport>&)
+//
+//	paths: files to load
+//	imports: receives one entry per path, in the same order
+//
+//	Loads the files in parallel on the worker threads and
+//	reports the combined parse throughput. Uploading to
+//	OpenGL is left to the caller on the GL thread.
+///////////////////////////////////////////////////
+void UImportMeshes(const std::vector<std::string>& paths, std::vector<MeshImport>& imports)
+{
+	imports.clear();
+	imports.resize(paths.size());
+
+	auto start = std::chrono::steady_clock::now();
+	UParallelFor(paths.size(), [&](size_t i)
+	{
+		MeshImport& import = imports[i];
+		auto fileStart = std::chrono::steady_clock::now();
+		import.path = paths[i];
+
+		AssetFile file;
+		if (file.Open(import.path.c_str()))
+		{
+			import.bytes = file.Size();
+			switch (UMeshFormatFromPath(import.path.c_str()))
+			{
+			case MeshFormat::OBJ: import.ok = UParseObj((const char*)file.Data(), file.Size(), import.data); break;
+			case MeshFormat::GLB: import.ok = UParseGlb(file.Data(), file.Size(), import.data); break;
+			default: break;
+			}
+		}
+		import.seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - fileStart).count();
+	});
+	double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+	size_t bytes = 0;
+	for (const MeshImport& import : imports)
+	{
+		if (!import.ok)
+		{
+			std::cout << "Failed to import mesh " << import.path << std::endl;
+			continue;
+		}
+		bytes += import.bytes;
+		std::cout << "INFO: Imported " << import.path << ": " << import.data.VertexCount() << " vertices, "
+			<< import.data.TriangleCount() << " triangles, " << import.bytes / (1024.0 * 1024.0) / import.seconds << " MB/s" << std::endl;
+	}
+	std::cout << "INFO: Imported " << paths.size() << " meshes (" << bytes / (1024.0 * 1024.0) << " MB) in "
+		<< seconds * 1000.0 << " ms, " << (seconds > 0.0 ? bytes / (1024.0 * 1024.0) / seconds : 0.0) << " MB/s" << std::endl;
+}
+
+///////////////////////////////////////////////////
+//	UImportObjNaive(const char*, MeshData&)
+//
+//	Reference OBJ reader: std::ifstream, one getline and
+//	one std::istringstream per line, strtof / strtol for
+//	numbers. Produces the same mesh as UParseObj, a missing
+//	number reading as 0 and a face corner without a
+//	position failing the file; only kept to measure the
+//	fast path against.
+///////////////////////////////////////////////////
+bool UImportObjNaive(const char* path, MeshData& data)
+{
+	std::ifstream file(path);
+	if (!file)
+		return false;
+
+	auto toFloat = [](const std::string& text)
+	{
+		char* end = nullptr;
+		const float value = strtof(text.c_str(), &end);
+		return end == text.c_str() ? 0.0f : value;
+	};
+	auto toIndex = [](const std::string& text, int& index)
+	{
+		char* end = nullptr;
+		const long value = strtol(text.c_str(), &end, 10);
+		if (end == text.c_str())
+			return false;
+		index = (int)value;
+		return true;
+	};
+
+	ObjBuilder builder(data);
+	std::string line, token;
+	while (std::getline(file, line))
+	{
+		std::istringstream stream(line);
+		if (!(stream >> token))
+			continue;
+
+		if (token == "v" || token == "vn")
+		{
+			std::string x, y, z;
+			stream >> x >> y >> z;
+			if (token == "v")
+				builder.AddPosition(toFloat(x), toFloat(y), toFloat(z));
+			else
+				builder.AddNormal(toFloat(x), toFloat(y), toFloat(z));
+		}
+		else if (token == "vt")
+		{
+			std::string u, v;
+			stream >> u >> v;
+			builder.AddTexcoord(toFloat(u), toFloat(v));
+		}
+		else if (token == "f")
+		{
+			builder.BeginFace();
+			while (stream >> token)
+			{
+				if (token[0] == '#')
+					break;
+				ObjCorner corner = { 0, 0, 0 };
+				size_t slash1 = token.find('/');
+				if (!toIndex(token.substr(0, slash1), corner.v))
+					return false;
+				if (slash1 != std::string::npos)
+				{
+					// an empty slot leaves its index at 0
+					size_t slash2 = token.find('/', slash1 + 1);
+					toIndex(token.substr(slash1 + 1, slash2 == std::string::npos ? std::string::npos : slash2 - slash1 - 1), corner.vt);
+					if (slash2 != std::string::npos)
+						toIndex(token.substr(slash2 + 1), corner.vn);
+				}
+				if (!builder.AddCorner(corner))
+					return false;
+			}
+		}
+	}
+
+	builder.Finish();
+	return !data.indices.empty();
+}
+
+///////////////////////////////////////////////////
+//	UBenchmarkObjImport(const char*)
+//
+//	Parses the same OBJ file with the mapped fast path
+//	and the naive std::ifstream reader (best of three
+//	runs each) and prints both throughputs
+///////////////////////////////////////////////////
+void UBenchmarkObjImport(const char* path)
+{
+	MappedFile probe;
+	if (!probe.Open(path))
+	{
+		std::cout << "Failed to open " << path << std::endl;
+		return;
+	}
+	const double megabytes = probe.Size() / (1024.0 * 1024.0);
+	probe.Close();
+
+	double fastBest = 1e30, naiveBest = 1e30;
+	MeshData fast, naive;
+	for (int run = 0; run < 3; ++run)
+	{
+		auto start = std::chrono::steady_clock::now();
+		UImportMesh(path, fast);
+		fastBest = std::min(fastBest, std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count());
+
+		start = std::chrono::steady_clock::now();
+		UImportObjNaive(path, naive);
+		naiveBest = std::min(naiveBest, std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count());
+	}
+
+	std::cout << "INFO: " << path << " (" << megabytes << " MB, " << fast.TriangleCount() << " triangles)" << std::endl;
+	std::cout << "INFO:   mapped parser   " << megabytes / fastBest << " MB/s" << std::endl;
+	std::cout << "INFO:   ifstream reader " << megabytes / naiveBest << " MB/s" << std::endl;
+	std::cout << "INFO:   speedup " << naiveBest / fastBest << "x" << (fast.indices == naive.indices ? "" : " (MESHES DIFFER)") << std::endl;
+}
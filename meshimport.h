@@ -0,0 +1,42 @@
+///////////////////////////////////////////////////////////////////////////////
+// meshimport.h
+// ========
+// load meshes authored in DCC tools (Wavefront OBJ and binary glTF 2.0) into
+// the same indexed MeshData layout the rest of the mesh code uses
+///////////////////////////////////////////////////////////////////////////////
+
+#ifndef MESHIMPORT_H
+#define MESHIMPORT_H
+
+#include <string>
+#include <vector>
+
+#include "meshdata.h"
+
+enum class MeshFormat
+{
+	OBJ,
+	GLB,
+	UNKNOWN
+};
+
+// One file loaded by UImportMeshes
+struct MeshImport
+{
+	std::string path;
+	MeshData data;
+	size_t bytes = 0;		// size of the source file
+	double seconds = 0.0;	// time spent mapping and parsing it
+	bool ok = false;
+};
+
+MeshFormat UMeshFormatFromPath(const char* path);
+bool UParseObj(const char* text, size_t size, MeshData& data);
+bool UParseGlb(const unsigned char* bytes, size_t size, MeshData& data);
+bool UImportMesh(const char* path, MeshData& data);
+void UImportMeshes(const std::vector<std::string>& paths, std::vector<MeshImport>& imports);
+
+bool UImportObjNaive(const char* path, MeshData& data);
+void UBenchmarkObjImport(const char* path);
+
+#endif
@@ -0,0 +1,430 @@
+///////////////////////////////////////////////////////////////////////////////
+// meshlets.cpp
+// ========
+// cluster building, cluster bounds and per-draw cluster culling
+///////////////////////////////////////////////////////////////////////////////
+
+#include "meshlets.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+
+namespace
+{
+	glm::vec3 UVertexPosition(const MeshData& data, GLuint v)
+	{
+		const GLfloat* p = &data.vertices[v * floatsPerMeshVertex];
+		return glm::vec3(p[0], p[1], p[2]);
+	}
+
+	glm::vec3 UVertexNormal(const MeshData& data, GLuint v)
+	{
+		const GLfloat* p = &data.vertices[v * floatsPerMeshVertex + 3];
+		return glm::vec3(p[0], p[1], p[2]);
+	}
+
+	// Geometric normal of a triangle, flipped to agree with its vertex normals.
+	// The hand built meshes do not wind every triangle the same way, so the
+	// vertex normals are the only reliable idea of which side is outside.
+	glm::vec3 UOutwardNormal(const MeshData& data, const GLuint* tri)
+	{
+		glm::vec3 p0 = UVertexPosition(data, tri[0]);
+		glm::vec3 p1 = UVertexPosition(data, tri[1]);
+		glm::vec3 p2 = UVertexPosition(data, tri[2]);
+		glm::vec3 normal = glm::cross(p1 - p0, p2 - p0);
+		float length = glm::length(normal);
+		if (length <= 0.0f)
+			return glm::vec3(0.0f);
+		normal /= length;
+
+		glm::vec3 shading = UVertexNormal(data, tri[0]) + UVertexNormal(data, tri[1]) + UVertexNormal(data, tri[2]);
+		return glm::dot(normal, shading) < 0.0f ? -normal : normal;
+	}
+
+	// Fills in the bounding sphere and normal cone of a finished meshlet
+	void UComputeMeshletBounds(const MeshData& data, const std::vector<GLuint>& indices, Meshlet& meshlet)
+	{
+		const GLuint* tris = &indices[meshlet.firstIndex];
+		const GLuint triCount = meshlet.nIndices / 3;
+
+		// Sphere around the box of the cluster's corners
+		glm::vec3 minPos = UVertexPosition(data, tris[0]);
+		glm::vec3 maxPos = minPos;
+		for (GLuint i = 0; i < meshlet.nIndices; ++i)
+		{
+			minPos = glm::min(minPos, UVertexPosition(data, tris[i]));
+			maxPos = glm::max(maxPos, UVertexPosition(data, tris[i]));
+		}
+		meshlet.center = (minPos + maxPos) * 0.5f;
+		meshlet.radius = 0.0f;
+		for (GLuint i = 0; i < meshlet.nIndices; ++i)
+			meshlet.radius = std::max(meshlet.radius, glm::length(UVertexPosition(data, tris[i]) - meshlet.center));
+
+		// Cone around the triangle normals
+		std::vector<glm::vec3> normals(triCount);
+		glm::vec3 axis(0.0f);
+		for (GLuint t = 0; t < triCount; ++t)
+		{
+			normals[t] = UOutwardNormal(data, &tris[t * 3]);
+			axis += normals[t];
+		}
+
+		meshlet.coneAxis = glm::vec3(0.0f, 1.0f, 0.0f);
+		meshlet.coneApex = meshlet.center;
+		meshlet.coneCutoff = 1.0f;
+
+		float axisLength = glm::length(axis);
+		if (axisLength <= 0.0f)
+			return;
+		axis /= axisLength;
+
+		float minDot = 1.0f;
+		for (GLuint t = 0; t < triCount; ++t)
+		{
+			if (normals[t] != glm::vec3(0.0f))
+				minDot = std::min(minDot, glm::dot(axis, normals[t]));
+		}
+
+		// Normals spread over more than a hemisphere (or close to it): no cone
+		if (minDot <= 0.1f)
+			return;
+
+		// Slide the apex back along the axis until it is behind every triangle's plane
+		float maxT = 0.0f;
+		for (GLuint t = 0; t < triCount; ++t)
+		{
+			if (normals[t] == glm::vec3(0.0f))
+				continue;
+			float dc = glm::dot(meshlet.center - UVertexPosition(data, tris[t * 3]), normals[t]);
+			float dn = glm::dot(axis, normals[t]);
+			maxT = std::max(maxT, dc / dn);
+		}
+
+		meshlet.coneAxis = axis;
+		meshlet.coneApex = meshlet.center - axis * maxT;
+		meshlet.coneCutoff = sqrtf(1.0f - minDot * minDot);
+	}
+}
+
+///////////////////////////////////////////////////
+//	UBuildMeshlets(const MeshData&, std::vector<Meshlet>&, std::vector<GLuint>&)
+//
+//	data: welded, indexed mesh
+//	meshlets: receives the clusters
+//	indices: receives the index buffer reordered so each cluster is contiguous
+//
+//	Grows each cluster from a seed triangle, always taking
+//	the neighbouring triangle that adds the fewest new
+//	vertices, until the vertex or triangle limit is hit
+///////////////////////////////////////////////////
+void UBuildMeshlets(const MeshData& data, std::vector<Meshlet>& meshlets, std::vector<GLuint>& indices)
+{
+	const size_t vertexCount = data.VertexCount();
+	const size_t triCount = data.TriangleCount();
+	meshlets.clear();
+	indices.clear();
+	indices.reserve(data.indices.size());
+
+	// Triangles around each vertex
+	std::vector<GLuint> adjacencyStart(vertexCount + 1, 0);
+	for (GLuint v : data.indices)
+		adjacencyStart[v + 1]++;
+	for (size_t v = 0; v < vertexCount; ++v)
+		adjacencyStart[v + 1] += adjacencyStart[v];
+	std::vector<GLuint> adjacency(data.indices.size());
+	{
+		std::vector<GLuint> fill(adjacencyStart.begin(), adjacencyStart.end() - 1);
+		for (size_t i = 0; i < data.indices.size(); ++i)
+			adjacency[fill[data.indices[i]]++] = GLuint(i / 3);
+	}
+
+	std::vector<bool> triUsed(triCount, false);
+	std::vector<GLuint> vertexMeshlet(vertexCount, ~0u);	// which meshlet last took each vertex
+	std::vector<GLuint> meshletVertices;
+	size_t nextSeed = 0;
+
+	while (true)
+	{
+		while (nextSeed < triCount && triUsed[nextSeed])
+			++nextSeed;
+		if (nextSeed == triCount)
+			break;
+
+		Meshlet meshlet = {};
+		meshlet.firstIndex = (GLuint)indices.size();
+		const GLuint meshletId = (GLuint)meshlets.size();
+		meshletVertices.clear();
+
+		size_t tri = nextSeed;
+		while (true)
+		{
+			// Take the triangle
+			triUsed[tri] = true;
+			for (int e = 0; e < 3; ++e)
+			{
+				GLuint v = data.indices[tri * 3 + e];
+				indices.push_back(v);
+				if (vertexMeshlet[v] != meshletId)
+				{
+					vertexMeshlet[v] = meshletId;
+					meshletVertices.push_back(v);
+				}
+			}
+			meshlet.nIndices += 3;
+
+			if (meshlet.nIndices / 3 >= maxMeshletTriangles)
+				break;
+
+			// Find the unused neighbour that adds the fewest vertices
+			size_t best = triCount;
+			int bestNew = 3;
+			for (GLuint v : meshletVertices)
+			{
+				for (GLuint a = adjacencyStart[v]; a < adjacencyStart[v + 1]; ++a)
+				{
+					GLuint candidate = adjacency[a];
+					if (triUsed[candidate])
+						continue;
+					int newVertices = 0;
+					for (int e = 0; e < 3; ++e)
+						newVertices += vertexMeshlet[data.indices[candidate * 3 + e]] != meshletId;
+					if (newVertices < bestNew || (newVertices == bestNew && candidate < best))
+					{
+						best = candidate;
+						bestNew = newVertices;
+					}
+				}
+			}
+
+			// No connected triangle left: start the next cluster from a fresh seed
+			if (best == triCount || meshletVertices.size() + bestNew > maxMeshletVertices)
+				break;
+			tri = best;
+		}
+
+		meshlet.nVertices = (GLuint)meshletVertices.size();
+		UComputeMeshletBounds(data, indices, meshlet);
+		meshlets.push_back(meshlet);
+	}
+}
+
+///////////////////////////////////////////////////
+//	UCreateClusterMesh(const MeshData&, ClusterMesh&)
+//
+//	data: welded, indexed mesh
+//	cluster: receives the GL mesh and its clusters
+//
+//	Builds the clusters and uploads the mesh with the
+//	reordered index buffer. The static index buffer is
+//	only drawn from when the frame's index ring is full.
+///////////////////////////////////////////////////
+void UCreateClusterMesh(const MeshData& data, ClusterMesh& cluster)
+{
+	MeshData reordered;
+	reordered.vertices = data.vertices;
+	UBuildMeshlets(data, cluster.meshlets, reordered.indices);
+	UCreateMeshFromData(reordered, cluster.mesh);
+	cluster.indices.swap(reordered.indices);
+}
+
+void UDestroyClusterMesh(ClusterMesh& cluster)
+{
+	glDeleteVertexArrays(1, &cluster.mesh.vao);
+	glDeleteBuffers(2, cluster.mesh.vbos);
+	cluster.meshlets.clear();
+	cluster.indices.clear();
+}
+
+///////////////////////////////////////////////////
+//	UCreateClusterIndexRing(ClusterIndexRing&, GLuint)
+//
+//	ring: ring to create
+//	indicesPerFrame: room for compacted indices in one frame
+//
+//	Allocates a persistently mapped index buffer with
+//	one region for each of three frames in flight
+///////////////////////////////////////////////////
+void UCreateClusterIndexRing(ClusterIndexRing& ring, GLuint indicesPerFrame)
+{
+	const GLbitfield flags = GL_MAP_WRITE_BIT | GL_MAP_PERSISTENT_BIT | GL_MAP_COHERENT_BIT;
+	const GLsizeiptr bytes = sizeof(GLuint) * GLsizeiptr(indicesPerFrame) * 3;
+
+	glGenBuffers(1, &ring.buffer);
+	glBindBuffer(GL_COPY_WRITE_BUFFER, ring.buffer);
+	glBufferStorage(GL_COPY_WRITE_BUFFER, bytes, nullptr, flags);
+	ring.mapped = (GLuint*)glMapBufferRange(GL_COPY_WRITE_BUFFER, 0, bytes, flags);
+	glBindBuffer(GL_COPY_WRITE_BUFFER, 0);
+
+	ring.regionSize = indicesPerFrame;
+	ring.head = 0;
+	ring.frame = 0;
+}
+
+void UDestroyClusterIndexRing(ClusterIndexRing& ring)
+{
+	for (GLsync& fence : ring.fences)
+	{
+		if (fence)
+			glDeleteSync(fence);
+		fence = 0;
+	}
+	glBindBuffer(GL_COPY_WRITE_BUFFER, ring.buffer);
+	glUnmapBuffer(GL_COPY_WRITE_BUFFER);
+	glBindBuffer(GL_COPY_WRITE_BUFFER, 0);
+	glDeleteBuffers(1, &ring.buffer);
+	ring.buffer = 0;
+	ring.mapped = nullptr;
+}
+
+// Moves to the next frame's region, waiting for the GPU if it is still reading it
+void UBeginClusterFrame(ClusterIndexRing& ring)
+{
+	ring.frame = (ring.frame + 1) % 3;
+	GLsync& fence = ring.fences[ring.frame];
+	if (fence)
+	{
+		glClientWaitSync(fence, GL_SYNC_FLUSH_COMMANDS_BIT, 1000000000);
+		glDeleteSync(fence);
+		fence = 0;
+	}
+	ring.head = ring.frame * ring.regionSize;
+}
+
+// Marks the end of the GPU commands that read the current region
+void UEndClusterFrame(ClusterIndexRing& ring)
+{
+	ring.fences[ring.frame] = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+}
+
+///////////////////////////////////////////////////
+//	UMakeClusterCullView(const glm::mat4&, const glm::mat4&, const glm::vec3&, const glm::vec3&, bool)
+//
+//	Extracts the world space frustum planes from the
+//	view and projection matrices (Gribb & Hartmann)
+///////////////////////////////////////////////////
+ClusterCullView UMakeClusterCullView(const glm::mat4& view, const glm::mat4& projection, const glm::vec3& cameraPosition, const glm::vec3& cameraFront, bool perspective)
+{
+	ClusterCullView cull;
+	glm::mat4 m = projection * view;
+	glm::vec4 row[4];
+	for (int i = 0; i < 4; ++i)
+		row[i] = glm::vec4(m[0][i], m[1][i], m[2][i], m[3][i]);
+
+	cull.frustumPlanes[0] = row[3] + row[0];	// left
+	cull.frustumPlanes[1] = row[3] - row[0];	// right
+	cull.frustumPlanes[2] = row[3] + row[1];	// bottom
+	cull.frustumPlanes[3] = row[3] - row[1];	// top
+	cull.frustumPlanes[4] = row[3] + row[2];	// near
+	cull.frustumPlanes[5] = row[3] - row[2];	// far
+	for (glm::vec4& plane : cull.frustumPlanes)
+		plane = plane / glm::length(glm::vec3(plane));
+
+	cull.cameraPosition = cameraPosition;
+	cull.viewDirection = cameraFront;
+	cull.perspective = perspective;
+	return cull;
+}
+
+///////////////////////////////////////////////////
+//	UDrawClusterMesh(const ClusterMesh&, const glm::mat4&, const ClusterCullView&, ClusterIndexRing&, ClusterCullStats&)
+//
+//	cluster: mesh to draw
+//	model: model matrix already set on the program
+//	view: frustum and camera for this frame
+//	ring: index ring the surviving clusters are copied into
+//	stats: running culling totals
+//
+//	Tests every cluster against the frustum (world space)
+//	and its normal cone (object space, where the camera is
+//	moved by the inverse model matrix so non-uniform scale
+//	does not bend the cone), then draws the survivors with
+//	one glDrawElements call
+///////////////////////////////////////////////////
+void UDrawClusterMesh(const ClusterMesh& cluster, const glm::mat4& model, const ClusterCullView& view, ClusterIndexRing& ring, ClusterCullStats& stats)
+{
+	const glm::mat4 inverseModel = glm::inverse(model);
+	const glm::vec3 objectCamera = glm::vec3(inverseModel * glm::vec4(view.cameraPosition, 1.0f));
+	const glm::vec3 objectDirection = glm::normalize(glm::vec3(inverseModel * glm::vec4(view.viewDirection, 0.0f)));
+	const float maxScale = std::max(glm::length(glm::vec3(model[0])), std::max(glm::length(glm::vec3(model[1])), glm::length(glm::vec3(model[2]))));
+
+	const GLuint regionEnd = (ring.frame + 1) * ring.regionSize;
+	const GLuint start = ring.head;
+	GLuint runStart = 0, runEnd = 0;
+	bool overflow = false;
+
+	auto flushRun = [&]()
+	{
+		GLuint count = runEnd - runStart;
+		if (count == 0)
+			return;
+		if (ring.head + count > regionEnd)
+		{
+			overflow = true;
+			return;
+		}
+		memcpy(ring.mapped + ring.head, &cluster.indices[runStart], sizeof(GLuint) * count);
+		ring.head += count;
+	};
+
+	for (const Meshlet& meshlet : cluster.meshlets)
+	{
+		stats.meshlets++;
+		stats.triangles += meshlet.nIndices / 3;
+
+		// Frustum: the sphere must not be fully behind any plane
+		glm::vec3 center = glm::vec3(model * glm::vec4(meshlet.center, 1.0f));
+		float radius = meshlet.radius * maxScale;
+		bool visible = true;
+		for (const glm::vec4& plane : view.frustumPlanes)
+		{
+			if (glm::dot(glm::vec3(plane), center) + plane.w < -radius)
+			{
+				visible = false;
+				break;
+			}
+		}
+		if (!visible)
+		{
+			stats.frustumCulled++;
+			continue;
+		}
+
+		// Backface cone: the camera sits where every triangle faces away
+		if (meshlet.coneCutoff < 1.0f)
+		{
+			glm::vec3 toApex = view.perspective ? glm::normalize(meshlet.coneApex - objectCamera) : objectDirection;
+			if (glm::dot(toApex, meshlet.coneAxis) >= meshlet.coneCutoff)
+			{
+				stats.backfaceCulled++;
+				continue;
+			}
+		}
+
+		// Neighbouring survivors are copied as one run
+		if (meshlet.firstIndex != runEnd)
+		{
+			flushRun();
+			runStart = meshlet.firstIndex;
+		}
+		runEnd = meshlet.firstIndex + meshlet.nIndices;
+	}
+	flushRun();
+
+	glBindVertexArray(cluster.mesh.vao);
+	if (overflow)
+	{
+		// Out of ring space this frame: draw everything from the static index buffer
+		ring.head = start;
+		glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, cluster.mesh.vbos[1]);
+		glDrawElements(GL_TRIANGLES, cluster.mesh.nIndices, GL_UNSIGNED_INT, (void*)0);
+		stats.trianglesDrawn += cluster.mesh.nIndices / 3;
+	}
+	else if (ring.head > start)
+	{
+		glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, ring.buffer);
+		glDrawElements(GL_TRIANGLES, ring.head - start, GL_UNSIGNED_INT, (void*)(sizeof(GLuint) * start));
+		stats.trianglesDrawn += (ring.head - start) / 3;
+	}
+	glBindVertexArray(0);
+}
@@ -0,0 +1,86 @@
+///////////////////////////////////////////////////////////////////////////////
+// meshlets.h
+// ========
+// split meshes into small clusters with bounding spheres and normal cones so
+// clusters outside the view or facing away can be skipped before drawing
+///////////////////////////////////////////////////////////////////////////////
+
+#ifndef MESHLETS_H
+#define MESHLETS_H
+
+#include <vector>
+
+#include <glm/glm.hpp>
+
+#include "meshdata.h"
+
+// Cluster size limits
+const GLuint maxMeshletVertices = 64;
+const GLuint maxMeshletTriangles = 124;
+
+// A run of triangles in the cluster mesh's index buffer plus its bounds
+struct Meshlet
+{
+	GLuint firstIndex;		// offset into the index buffer, in indices
+	GLuint nIndices;		// three per triangle
+	GLuint nVertices;		// distinct vertices the triangles use
+	glm::vec3 center;		// bounding sphere, object space
+	float radius;
+	glm::vec3 coneApex;		// normal cone: every triangle faces away from a camera
+	glm::vec3 coneAxis;		// inside the cone at the apex opening along the axis
+	float coneCutoff;		// sin of the cone spread, 1 when the cone cannot cull
+};
+
+// A mesh whose index buffer has been reordered so every meshlet is contiguous
+struct ClusterMesh
+{
+	Meshes::GLMesh mesh;
+	std::vector<Meshlet> meshlets;
+	std::vector<GLuint> indices;	// system memory copy of the reordered index buffer
+};
+
+// View information the cull test needs, in world space
+struct ClusterCullView
+{
+	glm::vec4 frustumPlanes[6];	// inward facing planes, xyz normal and w offset
+	glm::vec3 cameraPosition;
+	glm::vec3 viewDirection;	// used instead of the position for orthographic views
+	bool perspective;
+};
+
+// Persistently mapped index buffer the surviving clusters are compacted into;
+// split into one region per frame in flight so the CPU never writes indices
+// the GPU is still reading
+struct ClusterIndexRing
+{
+	GLuint buffer = 0;
+	GLuint* mapped = nullptr;
+	GLuint regionSize = 0;		// indices per frame region
+	GLuint head = 0;			// next free index in the current region
+	int frame = 0;
+	GLsync fences[3] = {};
+};
+
+// Running totals for reporting how much work culling saved
+struct ClusterCullStats
+{
+	unsigned long long meshlets = 0;
+	unsigned long long frustumCulled = 0;
+	unsigned long long backfaceCulled = 0;
+	unsigned long long triangles = 0;
+	unsigned long long trianglesDrawn = 0;
+};
+
+void UBuildMeshlets(const MeshData& data, std::vector<Meshlet>& meshlets, std::vector<GLuint>& indices);
+void UCreateClusterMesh(const MeshData& data, ClusterMesh& cluster);
+void UDestroyClusterMesh(ClusterMesh& cluster);
+
+void UCreateClusterIndexRing(ClusterIndexRing& ring, GLuint indicesPerFrame);
+void UDestroyClusterIndexRing(ClusterIndexRing& ring);
+void UBeginClusterFrame(ClusterIndexRing& ring);
+void UEndClusterFrame(ClusterIndexRing& ring);
+
+ClusterCullView UMakeClusterCullView(const glm::mat4& view, const glm::mat4& projection, const glm::vec3& cameraPosition, const glm::vec3& cameraFront, bool perspective);
+void UDrawClusterMesh(const ClusterMesh& cluster, const glm::mat4& model, const ClusterCullView& view, ClusterIndexRing& ring, ClusterCullStats& stats);
+
+#endif
@@ -0,0 +1,599 @@
+///////////////////////////////////////////////////////////////////////////////
+// meshsimplify.cpp
+// ========
+// quadric error mesh simplification (Garland & Heckbert) with normals and
+// texture coords folded into the quadrics, used to build LOD chains for any
+// mesh that can be read back into a MeshData
+///////////////////////////////////////////////////////////////////////////////
+
+#include "meshsimplify.h"
+#include "parallel.h"
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cmath>
+#include <cstring>
+#include <iostream>
+#include <queue>
+#include <unordered_map>
+
+#include <glm/glm.hpp>
+
+namespace
+{
+	// Quadrics live in an extended space: position (3), weighted normal (3), weighted texture coords (2)
+	const int quadricDims = 8;
+	const int quadricTerms = quadricDims * (quadricDims + 1) / 2;
+
+	// Border edges get this much more weight than the surface they sit on
+	const double borderWeight = 10.0;
+
+	// Symmetric quadric Q(x) = x'Ax + 2b'x + c, only the upper triangle of A is stored.
+	// weight is the triangle area summed into it, which evaluation divides by
+	struct Quadric
+	{
+		double a[quadricTerms];
+		double b[quadricDims];
+		double c;
+		double weight;
+	};
+
+	enum class VertexKind
+	{
+		MANIFOLD,	// interior vertex with one set of attributes, free to move
+		BORDER,		// on an open edge, may only slide along it
+		LOCKED		// on a texture/normal seam or non-manifold edge, never moves
+	};
+
+	// One possible collapse of vertex u onto vertex v
+	struct Collapse
+	{
+		double cost;
+		GLuint u;
+		GLuint v;
+		GLuint stamp;	// version of u when the cost was computed
+
+		bool operator>(const Collapse& other) const { return cost > other.cost; }
+	};
+
+	void UClearQuadric(Quadric& q)
+	{
+		memset(&q, 0, sizeof(q));
+	}
+
+	void UAddQuadric(Quadric& q, const Quadric& other, double weight)
+	{
+		for (int i = 0; i < quadricTerms; ++i)
+			q.a[i] += other.a[i] * weight;
+		for (int i = 0; i < quadricDims; ++i)
+			q.b[i] += other.b[i] * weight;
+		q.c += other.c * weight;
+		q.weight += other.weight * weight;
+	}
+
+	// Area weighted squared distance, so the cost scales with length squared whatever the mesh size
+	double UEvaluateQuadric(const Quadric& q, const double* x)
+	{
+		double result = q.c;
+		int term = 0;
+		for (int i = 0; i < quadricDims; ++i)
+		{
+			result += q.a[term++] * x[i] * x[i];
+			for (int j = i + 1; j < quadricDims; ++j)
+				result += 2.0 * q.a[term++] * x[i] * x[j];
+			result += 2.0 * q.b[i] * x[i];
+		}
+		if (q.weight > 0.0)
+			result /= q.weight;
+		return result > 0.0 ? result : 0.0;
+	}
+
+	// Quadric measuring squared distance to the plane spanned by three points in the extended space
+	bool UTriangleQuadric(const double* p0, const double* p1, const double* p2, Quadric& q)
+	{
+		double e1[quadricDims], e2[quadricDims];
+		double len1 = 0.0, proj = 0.0, len2 = 0.0;
+
+		for (int i = 0; i < quadricDims; ++i)
+		{
+			e1[i] = p1[i] - p0[i];
+			len1 += e1[i] * e1[i];
+		}
+		if (len1 < 1e-20)
+			return false;
+		len1 = sqrt(len1);
+		for (int i = 0; i < quadricDims; ++i)
+		{
+			e1[i] /= len1;
+			proj += e1[i] * (p2[i] - p0[i]);
+		}
+		for (int i = 0; i < quadricDims; ++i)
+		{
+			e2[i] = (p2[i] - p0[i]) - proj * e1[i];
+			len2 += e2[i] * e2[i];
+		}
+		if (len2 < 1e-20)
+			return false;
+		len2 = sqrt(len2);
+		for (int i = 0; i < quadricDims; ++i)
+			e2[i] /= len2;
+
+		double pe1 = 0.0, pe2 = 0.0, pp = 0.0;
+		for (int i = 0; i < quadricDims; ++i)
+		{
+			pe1 += p0[i] * e1[i];
+			pe2 += p0[i] * e2[i];
+			pp += p0[i] * p0[i];
+		}
+
+		// A = I - e1e1' - e2e2', b = (p.e1)e1 + (p.e2)e2 - p, c = p.p - (p.e1)^2 - (p.e2)^2
+		int term = 0;
+		for (int i = 0; i < quadricDims; ++i)
+		{
+			for (int j = i; j < quadricDims; ++j)
+				q.a[term++] = (i == j ? 1.0 : 0.0) - e1[i] * e1[j] - e2[i] * e2[j];
+			q.b[i] = pe1 * e1[i] + pe2 * e2[i] - p0[i];
+		}
+		q.c = pp - pe1 * pe1 - pe2 * pe2;
+		q.weight = 1.0;
+		return true;
+	}
+
+	// Quadric for a plane that only involves the position part of the extended space;
+	// it adds no weight, so it is a penalty on top of the surface's average distance
+	void UPlaneQuadric(const glm::vec3& normal, float offset, Quadric& q)
+	{
+		UClearQuadric(q);
+		int term = 0;
+		for (int i = 0; i < quadricDims; ++i)
+		{
+			for (int j = i; j < quadricDims; ++j)
+				q.a[term++] = (i < 3 && j < 3) ? normal[i] * normal[j] : 0.0;
+			q.b[i] = i < 3 ? normal[i] * offset : 0.0;
+		}
+		q.c = double(offset) * offset;
+	}
+
+	glm::vec3 UVertexPosition(const MeshData& data, GLuint v)
+	{
+		const GLfloat* p = &data.vertices[v * floatsPerMeshVertex];
+		return glm::vec3(p[0], p[1], p[2]);
+	}
+
+	struct PositionHash
+	{
+		size_t operator()(const glm::vec3& p) const
+		{
+			GLuint bits[3];
+			memcpy(bits, &p.x, sizeof(bits));
+			return (bits[0] * 73856093u) ^ (bits[1] * 19349663u) ^ (bits[2] * 83492791u);
+		}
+	};
+
+	struct PositionEqual
+	{
+		bool operator()(const glm::vec3& a, const glm::vec3& b) const
+		{
+			return a.x == b.x && a.y == b.y && a.z == b.z;
+		}
+	};
+
+	unsigned long long UEdgeKey(GLuint a, GLuint b)
+	{
+		if (a > b)
+			std::swap(a, b);
+		return ((unsigned long long)a << 32) | b;
+	}
+}
+
+///////////////////////////////////////////////////
+//	USimplifyMesh(const MeshData&, const std::vector<GLuint>&, const SimplifyOptions&, std::vector<GLuint>&)
+//
+//	data: vertex buffer the indices point into
+//	indices: triangle list to simplify (usually the previous detail level)
+//	options: target size, error and attribute weights
+//	result: receives the simplified triangle list, still indexing data.vertices
+//
+//	Collapses edges cheapest first until the target size
+//	or error is reached. Each collapse moves one vertex
+//	onto a neighbour (half edge collapse) so no new
+//	vertices are created and every level can share the
+//	original vertex buffer. Returns the object space
+//	error of the result.
+///////////////////////////////////////////////////
+float USimplifyMesh(const MeshData& data, const std::vector<GLuint>& indices, const SimplifyOptions& options, std::vector<GLuint>& result)
+{
+	const size_t vertexCount = data.VertexCount();
+	std::vector<GLuint> tris(indices);
+	const size_t triCount = tris.size() / 3;
+	result.clear();
+
+	if (triCount == 0 || vertexCount == 0)
+		return 0.0f;
+
+	// Mesh extent, so the error target does not depend on the mesh's units
+	glm::vec3 minPos = UVertexPosition(data, tris[0]);
+	glm::vec3 maxPos = minPos;
+	for (GLuint v : tris)
+	{
+		minPos = glm::min(minPos, UVertexPosition(data, v));
+		maxPos = glm::max(maxPos, UVertexPosition(data, v));
+	}
+	const float radius = glm::length(maxPos - minPos) * 0.5f;
+	const double maxCost = double(options.targetError * radius) * double(options.targetError * radius);
+
+	// Extended space coordinates for every vertex
+	std::vector<double> extended(vertexCount * quadricDims);
+	for (size_t v = 0; v < vertexCount; ++v)
+	{
+		const GLfloat* src = &data.vertices[v * floatsPerMeshVertex];
+		double* dst = &extended[v * quadricDims];
+		for (int i = 0; i < 3; ++i)
+			dst[i] = src[i];
+		for (int i = 3; i < 6; ++i)
+			dst[i] = src[i] * options.normalWeight * radius;
+		for (int i = 6; i < 8; ++i)
+			dst[i] = src[i] * options.uvWeight * radius;
+	}
+
+	// Group vertices that share a position; a group with more than one member is a seam
+	std::vector<GLuint> positionGroup(vertexCount);
+	{
+		std::unordered_map<glm::vec3, GLuint, PositionHash, PositionEqual> groups;
+		for (GLuint v = 0; v < vertexCount; ++v)
+		{
+			auto inserted = groups.emplace(UVertexPosition(data, v), v);
+			positionGroup[v] = inserted.first->second;
+		}
+	}
+
+	// Count how many triangles use each edge, by position, to find open edges
+	std::unordered_map<unsigned long long, GLuint> edgeUse;
+	for (size_t t = 0; t < triCount; ++t)
+		for (int e = 0; e < 3; ++e)
+			edgeUse[UEdgeKey(positionGroup[tris[t * 3 + e]], positionGroup[tris[t * 3 + (e + 1) % 3]])]++;
+
+	// Vertex adjacency: the triangles around each vertex
+	std::vector<std::vector<GLuint>> vertexTris(vertexCount);
+	for (size_t t = 0; t < triCount; ++t)
+		for (int e = 0; e < 3; ++e)
+			vertexTris[tris[t * 3 + e]].push_back((GLuint)t);
+
+	// Classify vertices
+	std::vector<VertexKind> kind(vertexCount, VertexKind::MANIFOLD);
+	std::vector<GLuint> wedgesUsed(vertexCount, 0);
+	for (GLuint v = 0; v < vertexCount; ++v)
+		if (!vertexTris[v].empty())
+			wedgesUsed[positionGroup[v]]++;
+	for (GLuint v = 0; v < vertexCount; ++v)
+		if (wedgesUsed[positionGroup[v]] > 1)
+			kind[v] = VertexKind::LOCKED;
+	for (size_t t = 0; t < triCount; ++t)
+	{
+		for (int e = 0; e < 3; ++e)
+		{
+			GLuint a = tris[t * 3 + e], b = tris[t * 3 + (e + 1) % 3];
+			GLuint uses = edgeUse[UEdgeKey(positionGroup[a], positionGroup[b])];
+			VertexKind edgeKind = uses == 1 ? (options.lockBorder ? VertexKind::LOCKED : VertexKind::BORDER) :
+				uses > 2 ? VertexKind::LOCKED : VertexKind::MANIFOLD;
+			if (edgeKind > kind[a]) kind[a] = edgeKind;
+			if (edgeKind > kind[b]) kind[b] = edgeKind;
+		}
+	}
+
+	// Accumulate the quadrics, weighted by triangle area
+	std::vector<Quadric> quadrics(vertexCount);
+	for (Quadric& q : quadrics)
+		UClearQuadric(q);
+	for (size_t t = 0; t < triCount; ++t)
+	{
+		GLuint v0 = tris[t * 3], v1 = tris[t * 3 + 1], v2 = tris[t * 3 + 2];
+		glm::vec3 p0 = UVertexPosition(data, v0), p1 = UVertexPosition(data, v1), p2 = UVertexPosition(data, v2);
+		glm::vec3 faceNormal = glm::cross(p1 - p0, p2 - p0);
+		double area = glm::length(faceNormal) * 0.5;
+		if (area <= 0.0)
+			continue;
+
+		Quadric q;
+		if (UTriangleQuadric(&extended[v0 * quadricDims], &extended[v1 * quadricDims], &extended[v2 * quadricDims], q))
+		{
+			UAddQuadric(quadrics[v0], q, area);
+			UAddQuadric(quadrics[v1], q, area);
+			UAddQuadric(quadrics[v2], q, area);
+		}
+
+		// Open edges get a plane standing up along the edge so the outline keeps its shape
+		for (int e = 0; e < 3; ++e)
+		{
+			GLuint a = tris[t * 3 + e], b = tris[t * 3 + (e + 1) % 3];
+			if (edgeUse[UEdgeKey(positionGroup[a], positionGroup[b])] != 1)
+				continue;
+			glm::vec3 pa = UVertexPosition(data, a), pb = UVertexPosition(data, b);
+			glm::vec3 edge = pb - pa;
+			glm::vec3 planeNormal = glm::cross(edge, faceNormal);
+			float length = glm::length(planeNormal);
+			if (length <= 0.0f)
+				continue;
+			planeNormal /= length;
+
+			Quadric border;
+			UPlaneQuadric(planeNormal, -glm::dot(planeNormal, pa), border);
+			double weight = borderWeight * glm::dot(edge, edge);
+			UAddQuadric(quadrics[a], border, weight);
+			UAddQuadric(quadrics[b], border, weight);
+		}
+	}
+
+	std::vector<GLuint> version(vertexCount, 0);
+	std::vector<bool> triAlive(triCount, true);
+	std::vector<bool> vertexAlive(vertexCount, true);
+	std::priority_queue<Collapse, std::vector<Collapse>, std::greater<Collapse>> heap;
+
+	auto isBorderEdge = [&](GLuint a, GLuint b)
+	{
+		return edgeUse[UEdgeKey(positionGroup[a], positionGroup[b])] == 1;
+	};
+
+	// Queue the collapse of u onto v if the vertex kinds allow it
+	auto pushCollapse = [&](GLuint u, GLuint v)
+	{
+		if (kind[u] == VertexKind::LOCKED)
+			return;
+		if (kind[u] == VertexKind::BORDER && (kind[v] != VertexKind::BORDER || !isBorderEdge(u, v)))
+			return;
+		Collapse collapse;
+		collapse.cost = UEvaluateQuadric(quadrics[u], &extended[v * quadricDims]);
+		collapse.u = u;
+		collapse.v = v;
+		collapse.stamp = version[u];
+		heap.push(collapse);
+	};
+
+	// Queue every legal collapse leaving vertex u
+	auto pushCollapses = [&](GLuint u)
+	{
+		for (GLuint t : vertexTris[u])
+		{
+			if (!triAlive[t])
+				continue;
+			for (int e = 0; e < 3; ++e)
+			{
+				if (tris[t * 3 + e] != u)
+					pushCollapse(u, tris[t * 3 + e]);
+			}
+		}
+	};
+
+	for (GLuint v = 0; v < vertexCount; ++v)
+		if (!vertexTris[v].empty())
+			pushCollapses(v);
+
+	size_t liveTris = triCount;
+	const size_t targetTris = options.targetIndexCount / 3;
+	double worstCost = 0.0;
+
+	while (!heap.empty() && liveTris > targetTris)
+	{
+		Collapse collapse = heap.top();
+		heap.pop();
+
+		const GLuint u = collapse.u, v = collapse.v;
+		if (!vertexAlive[u] || !vertexAlive[v] || collapse.stamp != version[u])
+			continue;
+		if (collapse.cost > maxCost)
+			break;
+
+		// u must touch exactly one attribute set of v's position, or it would drag
+		// triangles across a texture seam; triangles must not flip over
+		const glm::vec3 target = UVertexPosition(data, v);
+		bool legal = true;
+		for (GLuint t : vertexTris[u])
+		{
+			if (!triAlive[t])
+				continue;
+			GLuint corners[3] = { tris[t * 3], tris[t * 3 + 1], tris[t * 3 + 2] };
+			bool touchesV = false;
+			for (GLuint c : corners)
+			{
+				if (c != v && c != u && positionGroup[c] == positionGroup[v])
+					legal = false;
+				if (c == v)
+					touchesV = true;
+			}
+			if (!legal)
+				break;
+			if (touchesV)
+				continue;
+
+			glm::vec3 p[3], q[3];
+			for (int i = 0; i < 3; ++i)
+			{
+				p[i] = UVertexPosition(data, corners[i]);
+				q[i] = corners[i] == u ? target : p[i];
+			}
+			glm::vec3 before = glm::cross(p[1] - p[0], p[2] - p[0]);
+			glm::vec3 after = glm::cross(q[1] - q[0], q[2] - q[0]);
+			if (glm::dot(before, after) < 0.2f * glm::length(before) * glm::length(after))
+			{
+				legal = false;
+				break;
+			}
+		}
+		if (!legal)
+			continue;
+
+		// Perform the collapse
+		for (GLuint t : vertexTris[u])
+		{
+			if (!triAlive[t])
+				continue;
+			bool degenerate = false;
+			for (int e = 0; e < 3; ++e)
+			{
+				if (tris[t * 3 + e] == u)
+					tris[t * 3 + e] = v;
+			}
+			GLuint a = tris[t * 3], b = tris[t * 3 + 1], c = tris[t * 3 + 2];
+			degenerate = positionGroup[a] == positionGroup[b] || positionGroup[b] == positionGroup[c] || positionGroup[a] == positionGroup[c];
+			if (degenerate)
+			{
+				triAlive[t] = false;
+				--liveTris;
+			}
+			else
+			{
+				vertexTris[v].push_back(t);
+			}
+		}
+		vertexAlive[u] = false;
+		vertexTris[u].clear();
+		UAddQuadric(quadrics[v], quadrics[u], 1.0);
+		worstCost = std::max(worstCost, collapse.cost);
+
+		// v has a new quadric, so all of its collapses are re-costed; the old
+		// neighbours of u only gain an edge to v (their costs did not change)
+		version[v]++;
+		pushCollapses(v);
+		for (GLuint t : vertexTris[v])
+		{
+			if (!triAlive[t])
+				continue;
+			for (int e = 0; e < 3; ++e)
+			{
+				if (tris[t * 3 + e] != v)
+					pushCollapse(tris[t * 3 + e], v);
+			}
+		}
+	}
+
+	result.reserve(liveTris * 3);
+	for (size_t t = 0; t < triCount; ++t)
+	{
+		if (!triAlive[t])
+			continue;
+		result.push_back(tris[t * 3]);
+		result.push_back(tris[t * 3 + 1]);
+		result.push_back(tris[t * 3 + 2]);
+	}
+
+	return (float)sqrt(worstCost);
+}
+
+///////////////////////////////////////////////////
+//	UBuildLodChain(const MeshData&, const LodChainOptions&, MeshLodChain&)
+//
+//	data: welded, indexed mesh to build the chain for
+//	options: number of levels, reduction per level and simplify settings
+//	chain: receives the shared vertex buffer and the levels
+//
+//	Each level is simplified from the one before it.
+//	Building stops early when a level no longer shrinks
+//	(everything left is seams or borders).
+///////////////////////////////////////////////////
+void UBuildLodChain(const MeshData& data, const LodChainOptions& options, MeshLodChain& chain)
+{
+	chain.data.vertices = data.vertices;
+	chain.data.indices = data.indices;
+	chain.lods.clear();
+
+	MeshLod base;
+	base.firstIndex = 0;
+	base.nIndices = (GLuint)data.indices.size();
+	base.error = 0.0f;
+	chain.lods.push_back(base);
+
+	std::vector<GLuint> source(data.indices);
+	std::vector<GLuint> simplified;
+	float error = 0.0f;
+
+	for (int level = 1; level < options.maxLods; ++level)
+	{
+		SimplifyOptions simplify = options.simplify;
+		simplify.targetIndexCount = size_t(source.size() / 3 * options.reduction) * 3;
+
+		float levelError = USimplifyMesh(data, source, simplify, simplified);
+
+		// give up when the level is barely smaller than the last one
+		if (simplified.empty() || simplified.size() > source.size() * 0.95f)
+			break;
+
+		// errors add up because each level is built from the previous one
+		error += levelError;
+
+		MeshLod lod;
+		lod.firstIndex = (GLuint)chain.data.indices.size();
+		lod.nIndices = (GLuint)simplified.size();
+		lod.error = error;
+		chain.lods.push_back(lod);
+		chain.data.indices.insert(chain.data.indices.end(), simplified.begin(), simplified.end());
+
+		source.swap(simplified);
+	}
+}
+
+///////////////////////////////////////////////////
+//	UBuildLodChains(const std::vector<MeshData>&, const LodChainOptions&, std::vector<MeshLodChain>&)
+//
+//	meshes: welded, indexed meshes
+//	options: settings shared by every chain
+//	chains: receives one chain per mesh, in the same order
+//
+//	Builds the chains on all hardware threads, one mesh
+//	per job, and reports simplification throughput
+///////////////////////////////////////////////////
+void UBuildLodChains(const std::vector<MeshData>& meshes, const LodChainOptions& options, std::vector<MeshLodChain>& chains)
+{
+	chains.resize(meshes.size());
+	std::atomic<size_t> trianglesIn(0);
+
+	auto start = std::chrono::steady_clock::now();
+	UParallelFor(meshes.size(), [&](size_t i)
+	{
+		UBuildLodChain(meshes[i], options, chains[i]);
+
+		// count every triangle that went through the simplifier
+		size_t processed = 0;
+		for (size_t lod = 0; lod + 1 < chains[i].lods.size(); ++lod)
+			processed += chains[i].lods[lod].nIndices / 3;
+		if (chains[i].lods.size() == 1)
+			processed = meshes[i].TriangleCount();
+		trianglesIn += processed;
+	});
+	double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+	size_t levels = 0;
+	for (const MeshLodChain& chain : chains)
+		levels += chain.lods.size();
+
+	std::cout << "INFO: Simplified " << trianglesIn.load() << " triangles into " << levels << " LODs across "
+		<< meshes.size() << " meshes on " << UWorkerCount() << " threads in " << seconds * 1000.0 << " ms ("
+		<< (seconds > 0.0 ? trianglesIn.load() / seconds : 0.0) << " triangles/s)" << std::endl;
+}
+
+///////////////////////////////////////////////////
+//	USelectLod(const MeshLodChain&, float, float, float, float, float)
+//
+//	chain: chain to pick a level from
+//	objectScale: largest axis of the model matrix scale
+//	distance: distance from the camera to the object
+//	viewportHeight: framebuffer height in pixels
+//	fovY: vertical field of view in radians
+//	maxPixelError: largest error allowed on screen
+//
+//	Returns the coarsest level whose error projects to
+//	less than maxPixelError pixels
+///////////////////////////////////////////////////
+int USelectLod(const MeshLodChain& chain, float objectScale, float distance, float viewportHeight, float fovY, float maxPixelError)
+{
+	const float pixelsPerUnit = viewportHeight / (2.0f * tanf(fovY * 0.5f) * std::max(distance, 1e-4f));
+
+	int selected = 0;
+	for (int lod = 1; lod < (int)chain.lods.size(); ++lod)
+	{
+		if (chain.lods[lod].error * objectScale * pixelsPerUnit > maxPixelError)
+			break;
+		selected = lod;
+	}
+	return selected;
+}
@@ -0,0 +1,53 @@
+///////////////////////////////////////////////////////////////////////////////
+// meshsimplify.h
+// ========
+// quadric error mesh simplification and level of detail chains
+///////////////////////////////////////////////////////////////////////////////
+
+#ifndef MESHSIMPLIFY_H
+#define MESHSIMPLIFY_H
+
+#include <vector>
+
+#include "meshdata.h"
+
+// Controls for a single simplification pass
+struct SimplifyOptions
+{
+	size_t targetIndexCount = 0;	// stop once the triangle list is this small
+	float targetError = 0.01f;		// stop before the error passes this, relative to the mesh radius
+	float normalWeight = 0.5f;		// how much a change in normal costs compared to a change in position
+	float uvWeight = 1.0f;			// how much a change in texture coords costs
+	bool lockBorder = false;		// keep open edges (plane outline, cylinder rims) exactly in place
+};
+
+// A range of the shared index buffer drawn for one detail level
+struct MeshLod
+{
+	GLuint firstIndex;	// offset into the index buffer, in indices
+	GLuint nIndices;	// number of indices in the level
+	float error;		// object space error of the level compared to level 0
+};
+
+// Every level shares the vertex buffer of the original mesh; data.indices
+// holds all the levels back to back, finest first
+struct MeshLodChain
+{
+	MeshData data;
+	std::vector<MeshLod> lods;
+};
+
+// Controls for building a whole chain
+struct LodChainOptions
+{
+	int maxLods = 4;				// including the original mesh
+	float reduction = 0.5f;			// fraction of triangles kept from one level to the next
+	SimplifyOptions simplify;
+};
+
+float USimplifyMesh(const MeshData& data, const std::vector<GLuint>& indices, const SimplifyOptions& options, std::vector<GLuint>& result);
+void UBuildLodChain(const MeshData& data, const LodChainOptions& options, MeshLodChain& chain);
+void UBuildLodChains(const std::vector<MeshData>& meshes, const LodChainOptions& options, std::vector<MeshLodChain>& chains);
+int USelectLod(const MeshLodChain& chain, float objectScale, float distance, float viewportHeight, float fovY, float maxPixelError = 1.0f);
+
+#endif
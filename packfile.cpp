@@ -0,0 +1,434 @@
+///////////////////////////////////////////////////////////////////////////////
+// packfile.cpp
+// ========
+// pack archive writing, mapping, lookup and the AssetFile loader path
+///////////////////////////////////////////////////////////////////////////////
+
+#include "packfile.h"
+
+#include <algorithm>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <memory>
+
+#ifdef HAVE_LZ4
+#include <lz4.h>
+#include <lz4hc.h>
+#endif
+#ifdef HAVE_ZSTD
+#include <zstd.h>
+#endif
+
+namespace
+{
+	// Packs searched by AssetFile, most recently mounted first. Only
+	// changed before loading starts, so worker threads read it freely.
+	std::vector<std::unique_ptr<PackFile>> gMountedPacks;
+
+	// Compressed entries must save at least this fraction to be kept compressed
+	const double minimumSaving = 1.0 / 16.0;
+
+	const char* UCompressionName(PackCompression compression)
+	{
+		switch (compression)
+		{
+		case PackCompression::LZ4: return "LZ4";
+		case PackCompression::Zstd: return "zstd";
+		default: return "none";
+		}
+	}
+
+	bool UCodecAvailable(PackCompression compression)
+	{
+		switch (compression)
+		{
+		case PackCompression::None: return true;
+#ifdef HAVE_LZ4
+		case PackCompression::LZ4: return true;
+#endif
+#ifdef HAVE_ZSTD
+		case PackCompression::Zstd: return true;
+#endif
+		default: return false;
+		}
+	}
+
+	// Returns false when the codec is not built in or fails
+	bool UCompress(PackCompression compression, const unsigned char* data, size_t size, std::vector<unsigned char>& out)
+	{
+		switch (compression)
+		{
+#ifdef HAVE_LZ4
+		case PackCompression::LZ4:
+		{
+			if (size > (size_t)LZ4_MAX_INPUT_SIZE)
+				return false;
+			out.resize(LZ4_compressBound((int)size));
+			const int written = LZ4_compress_HC((const char*)data, (char*)out.data(), (int)size, (int)out.size(), LZ4HC_CLEVEL_MAX);
+			out.resize(std::max(written, 0));
+			return written > 0;
+		}
+#endif
+#ifdef HAVE_ZSTD
+		case PackCompression::Zstd:
+		{
+			out.resize(ZSTD_compressBound(size));
+			const size_t written = ZSTD_compress(out.data(), out.size(), data, size, 19);
+			if (ZSTD_isError(written))
+				return false;
+			out.resize(written);
+			return true;
+		}
+#endif
+		default:
+			// without a codec built in nothing reads the buffers
+			(void)data;
+			(void)size;
+			(void)out;
+			return false;
+		}
+	}
+
+	bool UDecompress(PackCompression compression, const unsigned char* data, size_t storedSize, unsigned char* out, size_t size)
+	{
+		switch (compression)
+		{
+#ifdef HAVE_LZ4
+		case PackCompression::LZ4:
+			return LZ4_decompress_safe((const char*)data, (char*)out, (int)storedSize, (int)size) == (int)size;
+#endif
+#ifdef HAVE_ZSTD
+		case PackCompression::Zstd:
+			return ZSTD_decompress(out, size, data, storedSize) == size;
+#endif
+		default:
+			(void)data;
+			(void)storedSize;
+			(void)out;
+			(void)size;
+			return false;
+		}
+	}
+
+	bool UEntryBefore(const PackEntry& entry, uint64_t hash)
+	{
+		return entry.pathHash < hash;
+	}
+
+	void UWritePadding(std::ofstream& file, uint64_t offset)
+	{
+		static const char padding[packAlignment] = {};
+		file.write(padding, (offset + packAlignment - 1) / packAlignment * packAlignment - offset);
+	}
+}
+
+///////////////////////////////////////////////////
+//	UPackEntryName(const char*)
+//
+//	The name a path is stored under: forward slashes and
+//	no leading "./", so "./resources\a.jpg" and
+//	"resources/a.jpg" find the same entry
+///////////////////////////////////////////////////
+std::string UPackEntryName(const char* path)
+{
+	std::string name = path;
+	std::replace(name.begin(), name.end(), '\\', '/');
+	while (name.compare(0, 2, "./") == 0)
+		name.erase(0, 2);
+	return name;
+}
+
+// 64-bit FNV-1a; part of the file format, so it must never change
+uint64_t UPackPathHash(const std::string& name)
+{
+	uint64_t hash = 0xCBF29CE484222325ull;
+	for (unsigned char c : name)
+	{
+		hash ^= c;
+		hash *= 0x100000001B3ull;
+	}
+	return hash;
+}
+
+///////////////////////////////////////////////////
+//	UOpenPack(const char*, PackFile&)
+//
+//	Maps a pack and checks that the directory, the names
+//	and every entry lie inside the file
+///////////////////////////////////////////////////
+bool UOpenPack(const char* path, PackFile& pack)
+{
+	if (!pack.file.Open(path))
+		return false;
+
+	const size_t size = pack.file.Size();
+	const PackHeader* header = (const PackHeader*)pack.file.Data();
+	bool valid = size >= sizeof(PackHeader) && memcmp(header->magic, "PACK", 4) == 0 && header->version == packVersion
+		&& header->directoryOffset <= size && header->entryCount <= (size - header->directoryOffset) / sizeof(PackEntry)
+		&& header->namesOffset <= size && header->namesSize <= size - header->namesOffset;
+
+	const PackEntry* entries = valid ? (const PackEntry*)(pack.file.Data() + header->directoryOffset) : nullptr;
+	for (uint32_t i = 0; valid && i < header->entryCount; ++i)
+	{
+		const PackEntry& entry = entries[i];
+		// a stored entry is read straight out of the mapping, so it may not claim more bytes than it stores
+		valid = entry.offset <= size && entry.storedSize <= size - entry.offset
+			&& (entry.compression != (uint32_t)PackCompression::None || entry.size == entry.storedSize)
+			&& (uint64_t)entry.nameOffset + entry.nameLength <= header->namesSize
+			&& (i == 0 || entries[i - 1].pathHash <= entry.pathHash);
+	}
+	if (!valid)
+	{
+		std::cout << "Invalid pack " << path << std::endl;
+		pack.file.Close();
+		return false;
+	}
+
+	pack.header = header;
+	pack.entries = entries;
+	pack.names = (const char*)pack.file.Data() + header->namesOffset;
+	return true;
+}
+
+///////////////////////////////////////////////////
+//	UFindPackEntry(const PackFile&, const char*)
+//
+//	Binary search of the directory by path hash, then a
+//	name compare among entries sharing the hash. Returns
+//	null when the pack does not have the path.
+///////////////////////////////////////////////////
+const PackEntry* UFindPackEntry(const PackFile& pack, const char* path)
+{
+	const std::string name = UPackEntryName(path);
+	const uint64_t hash = UPackPathHash(name);
+	const PackEntry* end = pack.entries + pack.header->entryCount;
+	for (const PackEntry* entry = std::lower_bound(pack.entries, end, hash, UEntryBefore); entry != end && entry->pathHash == hash; ++entry)
+	{
+		if (entry->nameLength == name.size() && memcmp(pack.names + entry->nameOffset, name.data(), name.size()) == 0)
+			return entry;
+	}
+	return nullptr;
+}
+
+// Copies or decompresses an entry into bytes
+bool UReadPackEntry(const PackFile& pack, const PackEntry& entry, std::vector<unsigned char>& bytes)
+{
+	const unsigned char* stored = pack.file.Data() + entry.offset;
+	const PackCompression compression = (PackCompression)entry.compression;
+	if (compression == PackCompression::None)
+	{
+		bytes.assign(stored, stored + entry.storedSize);
+		return true;
+	}
+	bytes.resize(entry.size);
+	return UDecompress(compression, stored, entry.storedSize, bytes.data(), bytes.size());
+}
+
+///////////////////////////////////////////////////
+//	UWritePack(const char*, const std::vector<std::string>&, PackCompression)
+//
+//	path: pack to write
+//	files: loose files to put in it, stored under
+//	       UPackEntryName of their path
+//	compression: codec to try on every entry; entries it
+//	             does not shrink (already compressed images)
+//	             are stored as they are
+///////////////////////////////////////////////////
+bool UWritePack(const char* path, const std::vector<std::string>& files, PackCompression compression)
+{
+	struct Pending
+	{
+		std::string name;
+		PackEntry entry;
+		std::vector<unsigned char> compressed;
+	};
+	if (!UCodecAvailable(compression))
+	{
+		std::cout << "Built without " << UCompressionName(compression) << " support, storing the files uncompressed" << std::endl;
+		compression = PackCompression::None;
+	}
+
+	std::vector<Pending> pending;
+	std::vector<MappedFile> sources(files.size());
+	for (size_t i = 0; i < files.size(); ++i)
+	{
+		if (!sources[i].Open(files[i].c_str()))
+		{
+			std::cout << "Failed to open " << files[i] << std::endl;
+			return false;
+		}
+		Pending item;
+		item.name = UPackEntryName(files[i].c_str());
+		item.entry = PackEntry();
+		item.entry.pathHash = UPackPathHash(item.name);
+		item.entry.size = sources[i].Size();
+		item.entry.storedSize = sources[i].Size();
+		item.entry.reserved = (uint32_t)i; // source index until written
+		if (compression != PackCompression::None && UCompress(compression, sources[i].Data(), sources[i].Size(), item.compressed)
+			&& item.compressed.size() <= sources[i].Size() * (1.0 - minimumSaving))
+		{
+			item.entry.compression = (uint32_t)compression;
+			item.entry.storedSize = item.compressed.size();
+		}
+		else
+		{
+			item.compressed.clear();
+		}
+		pending.push_back(std::move(item));
+	}
+	std::sort(pending.begin(), pending.end(), [](const Pending& a, const Pending& b)
+	{
+		return a.entry.pathHash != b.entry.pathHash ? a.entry.pathHash < b.entry.pathHash : a.name < b.name;
+	});
+	for (size_t i = 1; i < pending.size(); ++i)
+	{
+		if (pending[i].name == pending[i - 1].name)
+		{
+			std::cout << "Duplicate pack entry " << pending[i].name << std::endl;
+			return false;
+		}
+	}
+
+	std::ofstream file(path, std::ios::binary);
+	if (!file)
+	{
+		std::cout << "Failed to write " << path << std::endl;
+		return false;
+	}
+
+	PackHeader header = {};
+	memcpy(header.magic, "PACK", 4);
+	header.version = packVersion;
+	header.entryCount = (uint32_t)pending.size();
+	file.write((const char*)&header, sizeof(header));
+
+	uint64_t offset = sizeof(header);
+	uint64_t rawBytes = 0;
+	std::string names;
+	for (Pending& item : pending)
+	{
+		UWritePadding(file, offset);
+		offset = (uint64_t)file.tellp();
+		const MappedFile& source = sources[item.entry.reserved];
+		if (item.entry.compression != (uint32_t)PackCompression::None)
+			file.write((const char*)item.compressed.data(), item.compressed.size());
+		else
+			file.write((const char*)source.Data(), source.Size());
+		item.entry.offset = offset;
+		item.entry.nameOffset = (uint32_t)names.size();
+		item.entry.nameLength = (uint32_t)item.name.size();
+		item.entry.reserved = 0;
+		names += item.name;
+		offset += item.entry.storedSize;
+		rawBytes += item.entry.size;
+	}
+
+	UWritePadding(file, offset);
+	header.directoryOffset = (uint64_t)file.tellp();
+	for (const Pending& item : pending)
+		file.write((const char*)&item.entry, sizeof(PackEntry));
+	header.namesOffset = (uint64_t)file.tellp();
+	header.namesSize = names.size();
+	file.write(names.data(), names.size());
+	const uint64_t packBytes = (uint64_t)file.tellp();
+
+	file.seekp(0);
+	file.write((const char*)&header, sizeof(header));
+	if (!file)
+	{
+		std::cout << "Failed to write " << path << std::endl;
+		return false;
+	}
+
+	std::cout << "INFO: Packed " << pending.size() << " files (" << rawBytes / 1024 << " KB) into " << path << " ("
+		<< packBytes / 1024 << " KB, compression " << UCompressionName(compression) << ")" << std::endl;
+	return true;
+}
+
+///////////////////////////////////////////////////
+//	UMountPack(const char*)
+//
+//	Makes AssetFile look in the pack before the loose files.
+//	Packs mounted later take precedence. Mount before any
+//	loading starts; the mount list is not locked.
+///////////////////////////////////////////////////
+bool UMountPack(const char* path)
+{
+	std::unique_ptr<PackFile> pack(new PackFile);
+	if (!UOpenPack(path, *pack))
+	{
+		std::cout << "Failed to mount pack " << path << std::endl;
+		return false;
+	}
+	std::cout << "INFO: Mounted " << path << " (" << pack->header->entryCount << " files)" << std::endl;
+	gMountedPacks.insert(gMountedPacks.begin(), std::move(pack));
+	return true;
+}
+
+void UUnmountPacks()
+{
+	gMountedPacks.clear();
+}
+
+///////////////////////////////////////////////////
+//	AssetFile::Open(const char*)
+//
+//	path: asset path as the loose file would be named
+//
+//	Stored pack entries are used in place, compressed ones
+//	are decompressed into memory the AssetFile owns, and
+//	paths no pack has are mapped from disk
+///////////////////////////////////////////////////
+bool AssetFile::Open(const char* path)
+{
+	if (OpenPacked(path))
+		return true;
+	if (!file.Open(path))
+		return false;
+	data = file.Data();
+	size = file.Size();
+	return true;
+}
+
+// Like Open() but only looks in the mounted packs, for loaders that read
+// loose files themselves
+bool AssetFile::OpenPacked(const char* path)
+{
+	Close();
+	for (const std::unique_ptr<PackFile>& pack : gMountedPacks)
+	{
+		const PackEntry* entry = UFindPackEntry(*pack, path);
+		if (!entry || entry->size == 0)
+			continue;
+
+		if ((PackCompression)entry->compression == PackCompression::None)
+		{
+			data = pack->file.Data() + entry->offset;
+		}
+		else
+		{
+			decompressed.resize(entry->size);
+			if (!UDecompress((PackCompression)entry->compression, pack->file.Data() + entry->offset, entry->storedSize, decompressed.data(), decompressed.size()))
+			{
+				decompressed.clear();
+				continue;
+			}
+			data = decompressed.data();
+		}
+		size = entry->size;
+		fromPack = true;
+		return true;
+	}
+	return false;
+}
+
+void AssetFile::Close()
+{
+	file.Close();
+	decompressed.clear();
+	decompressed.shrink_to_fit();
+	data = nullptr;
+	size = 0;
+	fromPack = false;
+}
@@ -0,0 +1,105 @@
+///////////////////////////////////////////////////////////////////////////////
+// packfile.h
+// ========
+// asset pack archives: many files in one, found through a directory sorted
+// by path hash that is read straight out of a memory mapping. Stored entries
+// are handed out as pointers into the mapping without a copy; entries packed
+// with LZ4 or zstd (when built with HAVE_LZ4 / HAVE_ZSTD) are decompressed
+// on open. AssetFile looks in the mounted packs first and falls back to the
+// loose file, so loaders work the same either way.
+///////////////////////////////////////////////////////////////////////////////
+
+#ifndef PACKFILE_H
+#define PACKFILE_H
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+#include "mappedfile.h"
+
+// File layout: header, entry data (each entry starting on a packAlignment
+// boundary), the directory of PackEntry sorted by (pathHash, name), then the
+// names, not null terminated
+const uint32_t packVersion = 1;
+const uint32_t packAlignment = 64;
+
+enum class PackCompression : uint32_t
+{
+	None = 0,
+	LZ4 = 1,
+	Zstd = 2
+};
+
+struct PackHeader
+{
+	char magic[4];				// "PACK"
+	uint32_t version;
+	uint32_t entryCount;
+	uint32_t reserved;
+	uint64_t directoryOffset;	// from the start of the file
+	uint64_t namesOffset;
+	uint64_t namesSize;
+};
+
+struct PackEntry
+{
+	uint64_t pathHash;		// UPackPathHash of the name
+	uint64_t offset;		// of the stored bytes, from the start of the file
+	uint64_t storedSize;
+	uint64_t size;			// after decompression
+	uint32_t nameOffset;	// into the names
+	uint32_t nameLength;
+	uint32_t compression;	// PackCompression
+	uint32_t reserved;
+};
+
+// A pack mapped into memory; entries point into the mapping
+struct PackFile
+{
+	MappedFile file;
+	const PackHeader* header = nullptr;
+	const PackEntry* entries = nullptr;
+	const char* names = nullptr;
+};
+
+// The bytes of one asset, from a mounted pack if one has it, else from the
+// loose file. Data() stays valid until Close(), and for stored pack entries
+// for as long as the pack is mounted.
+class AssetFile
+{
+public:
+	AssetFile() = default;
+	AssetFile(const AssetFile&) = delete;
+	AssetFile& operator=(const AssetFile&) = delete;
+
+	bool Open(const char* path);
+	bool OpenPacked(const char* path);
+	void Close();
+
+	const unsigned char* Data() const { return data; }
+	size_t Size() const { return size; }
+	bool IsOpen() const { return data != nullptr; }
+	bool FromPack() const { return fromPack; }
+
+private:
+	MappedFile file;
+	std::vector<unsigned char> decompressed;
+	const unsigned char* data = nullptr;
+	size_t size = 0;
+	bool fromPack = false;
+};
+
+std::string UPackEntryName(const char* path);
+uint64_t UPackPathHash(const std::string& name);
+
+bool UOpenPack(const char* path, PackFile& pack);
+const PackEntry* UFindPackEntry(const PackFile& pack, const char* path);
+bool UReadPackEntry(const PackFile& pack, const PackEntry& entry, std::vector<unsigned char>& bytes);
+bool UWritePack(const char* path, const std::vector<std::string>& files, PackCompression compression);
+
+bool UMountPack(const char* path);
+void UUnmountPacks();
+
+#endif
@@ -0,0 +1,247 @@
+///////////////////////////////////////////////////////////////////////////////
+// parallel.h
+// ========
+// small helpers for spreading CPU work (mesh processing, image kernels,
+// lightmap baking) across the hardware threads
+///////////////////////////////////////////////////////////////////////////////
+
+#ifndef PARALLEL_H
+#define PARALLEL_H
+
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <cstddef>
+#include <deque>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+///////////////////////////////////////////////////
+//	UWorkerCount()
+//
+//	Number of worker threads to use for CPU jobs,
+//	never less than one
+///////////////////////////////////////////////////
+inline unsigned UWorkerCount()
+{
+	unsigned count = std::thread::hardware_concurrency();
+	return count == 0 ? 1 : count;
+}
+
+///////////////////////////////////////////////////
+//	UParallelFor(size_t, Func)
+//
+//	count: number of work items
+//	fn: called once as fn(i) for every i in [0, count)
+//
+//	Items are handed out one at a time from a shared
+//	counter so uneven jobs (big and small meshes)
+//	still balance across the threads. Runs inline
+//	when there is only one item or one thread.
+///////////////////////////////////////////////////
+template <typename Func>
+void UParallelFor(size_t count, Func fn)
+{
+	size_t threadCount = std::min<size_t>(UWorkerCount(), count);
+	if (threadCount <= 1)
+	{
+		for (size_t i = 0; i < count; ++i)
+			fn(i);
+		return;
+	}
+
+	std::atomic<size_t> next(0);
+	auto worker = [&]()
+	{
+		for (size_t i = next++; i < count; i = next++)
+			fn(i);
+	};
+
+	std::vector<std::thread> threads;
+	for (size_t t = 1; t < threadCount; ++t)
+		threads.emplace_back(worker);
+	worker(); // the calling thread takes a share too
+
+	for (std::thread& thread : threads)
+		thread.join();
+}
+
+///////////////////////////////////////////////////
+//	UParallelForStealing(size_t, size_t, Func)
+//
+//	count: number of work items
+//	grain: items a thread takes from its range at a time
+//	fn: called once as fn(i) for every i in [0, count)
+//
+//	Each thread starts on an equal slice of the items
+//	and takes them grain at a time from the front; a
+//	thread that runs dry steals the back half of the
+//	largest slice left. Costly items then stay spread
+//	out without every item touching one shared counter
+//	(lightmap texels). Returns the number of steals.
+///////////////////////////////////////////////////
+template <typename Func>
+size_t UParallelForStealing(size_t count, size_t grain, Func fn)
+{
+	grain = std::max<size_t>(grain, 1);
+	size_t threadCount = std::min<size_t>(UWorkerCount(), (count + grain - 1) / grain);
+	if (threadCount <= 1)
+	{
+		for (size_t i = 0; i < count; ++i)
+			fn(i);
+		return 0;
+	}
+
+	// the items a thread has left: [begin, end)
+	struct alignas(64) Slice
+	{
+		std::mutex mutex;
+		size_t begin = 0;
+		size_t end = 0;
+	};
+	std::vector<Slice> slices(threadCount);
+	for (size_t t = 0; t < threadCount; ++t)
+	{
+		slices[t].begin = count * t / threadCount;
+		slices[t].end = count * (t + 1) / threadCount;
+	}
+	std::atomic<size_t> steals(0);
+
+	auto worker = [&](size_t self)
+	{
+		Slice& own = slices[self];
+		for (;;)
+		{
+			size_t first, last;
+			{
+				std::lock_guard<std::mutex> lock(own.mutex);
+				first = own.begin;
+				last = std::min(own.end, first + grain);
+				own.begin = last;
+			}
+			if (first < last)
+			{
+				for (size_t i = first; i < last; ++i)
+					fn(i);
+				continue;
+			}
+
+			// out of work: take half of the largest slice left, or finish when none is
+			size_t victim = threadCount, largest = 0;
+			for (size_t t = 0; t < threadCount; ++t)
+			{
+				std::lock_guard<std::mutex> lock(slices[t].mutex);
+				const size_t left = slices[t].end - slices[t].begin;
+				if (t != self && left > largest)
+				{
+					largest = left;
+					victim = t;
+				}
+			}
+			if (victim == threadCount)
+				return;
+			std::scoped_lock lock(own.mutex, slices[victim].mutex);
+			Slice& other = slices[victim];
+			const size_t left = other.end - other.begin;
+			if (left == 0)
+				continue;
+			const size_t taken = left > grain ? left / 2 : left;
+			own.begin = other.end - taken;
+			own.end = other.end;
+			other.end -= taken;
+			steals++;
+		}
+	};
+
+	std::vector<std::thread> threads;
+	for (size_t t = 1; t < threadCount; ++t)
+		threads.emplace_back(worker, t);
+	worker(0); // the calling thread takes a share too
+
+	for (std::thread& thread : threads)
+		thread.join();
+	return steals;
+}
+
+///////////////////////////////////////////////////
+//	WorkerPool
+//
+//	Persistent background threads for work that must
+//	not block the render loop (texture decoding).
+//	Submit() queues a job and returns immediately;
+//	Wait() blocks until the queue has drained. The
+//	destructor finishes queued jobs before joining.
+///////////////////////////////////////////////////
+class WorkerPool
+{
+public:
+	explicit WorkerPool(unsigned threadCount = UWorkerCount())
+	{
+		for (unsigned t = 0; t < std::max(threadCount, 1u); ++t)
+			threads.emplace_back([this]() { Run(); });
+	}
+
+	~WorkerPool()
+	{
+		{
+			std::lock_guard<std::mutex> lock(mutex);
+			stopping = true;
+		}
+		wake.notify_all();
+		for (std::thread& thread : threads)
+			thread.join();
+	}
+
+	WorkerPool(const WorkerPool&) = delete;
+	WorkerPool& operator=(const WorkerPool&) = delete;
+
+	void Submit(std::function<void()> job)
+	{
+		{
+			std::lock_guard<std::mutex> lock(mutex);
+			jobs.push_back(std::move(job));
+			++pending;
+		}
+		wake.notify_one();
+	}
+
+	void Wait()
+	{
+		std::unique_lock<std::mutex> lock(mutex);
+		idle.wait(lock, [this]() { return pending == 0; });
+	}
+
+private:
+	void Run()
+	{
+		for (;;)
+		{
+			std::function<void()> job;
+			{
+				std::unique_lock<std::mutex> lock(mutex);
+				wake.wait(lock, [this]() { return stopping || !jobs.empty(); });
+				if (jobs.empty())
+					return;
+				job = std::move(jobs.front());
+				jobs.pop_front();
+			}
+			job();
+
+			std::lock_guard<std::mutex> lock(mutex);
+			if (--pending == 0)
+				idle.notify_all();
+		}
+	}
+
+	std::vector<std::thread> threads;
+	std::deque<std::function<void()>> jobs;
+	std::mutex mutex;
+	std::condition_variable wake;
+	std::condition_variable idle;
+	size_t pending = 0;
+	bool stopping = false;
+};
+
+#endif
@@ -0,0 +1,230 @@
+///////////////////////////////////////////////////////////////////////////////
+// resourceregistry.cpp
+// ========
+// generational handles, content sharing and fenced deletion of GL objects
+///////////////////////////////////////////////////////////////////////////////
+
+#include "resourceregistry.h"
+
+#include <algorithm>
+#include <cstring>
+#include <iostream>
+
+namespace
+{
+	// Longest UDestroyResourceRegistry waits on a fence before deleting anyway
+	const GLuint64 shutdownWaitNanoseconds = 1000000000;
+
+	const char* const resourceTypeNames[resourceTypeCount] = { "texture", "buffer", "vertex array", "program" };
+
+	// 64-bit finaliser from MurmurHash3
+	uint64_t UMix(uint64_t x)
+	{
+		x ^= x >> 33;
+		x *= 0xFF51AFD7ED558CCDull;
+		x ^= x >> 33;
+		x *= 0xC4CEB9FE1A85EC53ull;
+		x ^= x >> 33;
+		return x;
+	}
+
+	void UDeleteObject(ResourceType type, GLuint name)
+	{
+		switch (type)
+		{
+		case ResourceType::Texture: glDeleteTextures(1, &name); break;
+		case ResourceType::Buffer: glDeleteBuffers(1, &name); break;
+		case ResourceType::VertexArray: glDeleteVertexArrays(1, &name); break;
+		case ResourceType::Program: glDeleteProgram(name); break;
+		}
+	}
+
+	ResourceEntry* UFindEntry(ResourceRegistry& registry, ResourceHandle handle)
+	{
+		if (!handle.Valid() || handle.index >= registry.entries.size())
+			return nullptr;
+		ResourceEntry& entry = registry.entries[handle.index];
+		return entry.generation == handle.generation && entry.name ? &entry : nullptr;
+	}
+}
+
+///////////////////////////////////////////////////
+//	UHashBytes(const void*, size_t, uint64_t)
+//
+//	data, size: the content to hash
+//	seed: a previous hash, to hash several pieces as one
+//
+//	Never returns 0, which handles use for "not shared"
+///////////////////////////////////////////////////
+uint64_t UHashBytes(const void* data, size_t size, uint64_t seed)
+{
+	const unsigned char* bytes = (const unsigned char*)data;
+	uint64_t hash = UMix(seed ^ (size * 0x9E3779B97F4A7C15ull));
+	size_t i = 0;
+	for (; i + 8 <= size; i += 8)
+	{
+		uint64_t word;
+		memcpy(&word, bytes + i, 8);
+		hash = UMix(hash ^ word);
+	}
+	uint64_t tail = 0;
+	memcpy(&tail, bytes + i, size - i);
+	hash = UMix(hash ^ tail);
+	return hash ? hash : 1;
+}
+
+///////////////////////////////////////////////////
+//	URegisterResource(ResourceRegistry&, ResourceType, GLuint, size_t, const char*, uint64_t)
+//
+//	name: the GL object, which the registry now owns
+//	bytes: its GPU memory, for the leak report
+//	label: shown in the leak report
+//	contentHash: hash of what the object was created from,
+//	             so UAcquireResource can share it; 0 for none
+//
+//	Returns a handle holding the first reference
+///////////////////////////////////////////////////
+ResourceHandle URegisterResource(ResourceRegistry& registry, ResourceType type, GLuint name, size_t bytes, const char* label, uint64_t contentHash)
+{
+	uint32_t index;
+	if (!registry.freeSlots.empty())
+	{
+		index = registry.freeSlots.back();
+		registry.freeSlots.pop_back();
+	}
+	else
+	{
+		index = (uint32_t)registry.entries.size();
+		registry.entries.emplace_back();
+	}
+
+	ResourceEntry& entry = registry.entries[index];
+	entry.type = type;
+	entry.name = name;
+	entry.bytes = bytes;
+	entry.contentHash = contentHash;
+	entry.label = label ? label : "";
+	entry.refs = 1;
+	if (contentHash)
+		registry.byContent[(int)type][contentHash] = index;
+
+	registry.liveBytes += bytes;
+	registry.peakBytes = std::max(registry.peakBytes, registry.liveBytes);
+
+	ResourceHandle handle;
+	handle.index = index;
+	handle.generation = entry.generation;
+	return handle;
+}
+
+///////////////////////////////////////////////////
+//	UAcquireResource(ResourceRegistry&, ResourceType, uint64_t)
+//
+//	Looks for a live object created from the same content.
+//	If there is one, it gains a reference and its handle is
+//	returned; otherwise the handle is invalid and the caller
+//	creates and registers the object itself.
+///////////////////////////////////////////////////
+ResourceHandle UAcquireResource(ResourceRegistry& registry, ResourceType type, uint64_t contentHash)
+{
+	ResourceHandle handle;
+	if (!contentHash)
+		return handle;
+	auto found = registry.byContent[(int)type].find(contentHash);
+	if (found == registry.byContent[(int)type].end())
+		return handle;
+
+	ResourceEntry& entry = registry.entries[found->second];
+	++entry.refs;
+	++registry.shared;
+	handle.index = found->second;
+	handle.generation = entry.generation;
+	return handle;
+}
+
+// The GL name behind a handle, 0 once it has been released
+GLuint UResourceName(const ResourceRegistry& registry, ResourceHandle handle)
+{
+	if (!handle.Valid() || handle.index >= registry.entries.size())
+		return 0;
+	const ResourceEntry& entry = registry.entries[handle.index];
+	return entry.generation == handle.generation ? entry.name : 0;
+}
+
+///////////////////////////////////////////////////
+//	UReleaseResource(ResourceRegistry&, ResourceHandle&)
+//
+//	Drops one reference and clears the handle. The last
+//	reference retires the slot (bumping its generation, so
+//	copies of the handle go stale) and queues the object
+//	for deletion once the GPU has finished the commands
+//	issued so far; see UCollectResources.
+///////////////////////////////////////////////////
+void UReleaseResource(ResourceRegistry& registry, ResourceHandle& handle)
+{
+	ResourceEntry* entry = UFindEntry(registry, handle);
+	handle = ResourceHandle();
+	if (!entry || --entry->refs > 0)
+		return;
+
+	if (entry->contentHash)
+		registry.byContent[(int)entry->type].erase(entry->contentHash);
+	registry.pending.push_back({ entry->type, entry->name, glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0) });
+	registry.liveBytes -= entry->bytes;
+
+	const uint32_t index = uint32_t(entry - registry.entries.data());
+	const uint32_t generation = entry->generation + 1;
+	*entry = ResourceEntry();
+	entry->generation = generation ? generation : 1;
+	registry.freeSlots.push_back(index);
+}
+
+// Once per frame: deletes the released objects whose fence has passed
+void UCollectResources(ResourceRegistry& registry)
+{
+	size_t kept = 0;
+	for (ResourceRegistry::PendingDelete& pending : registry.pending)
+	{
+		if (glClientWaitSync(pending.fence, 0, 0) == GL_TIMEOUT_EXPIRED)
+		{
+			registry.pending[kept++] = pending;
+			continue;
+		}
+		glDeleteSync(pending.fence);
+		UDeleteObject(pending.type, pending.name);
+	}
+	registry.pending.resize(kept);
+}
+
+///////////////////////////////////////////////////
+//	UDestroyResourceRegistry(ResourceRegistry&)
+//
+//	Call at exit, after everything has been released.
+//	Reports every object still referenced (a leak) with
+//	its size, then deletes all objects the registry holds.
+///////////////////////////////////////////////////
+void UDestroyResourceRegistry(ResourceRegistry& registry)
+{
+	size_t leaks = 0, leakedBytes = 0;
+	for (const ResourceEntry& entry : registry.entries)
+	{
+		if (!entry.name)
+			continue;
+		std::cout << "Leaked " << resourceTypeNames[(int)entry.type] << " " << entry.name << " \"" << entry.label << "\": "
+			<< entry.bytes << " bytes, " << entry.refs << (entry.refs == 1 ? " reference" : " references") << std::endl;
+		++leaks;
+		leakedBytes += entry.bytes;
+		UDeleteObject(entry.type, entry.name);
+	}
+
+	for (ResourceRegistry::PendingDelete& pending : registry.pending)
+	{
+		glClientWaitSync(pending.fence, GL_SYNC_FLUSH_COMMANDS_BIT, shutdownWaitNanoseconds);
+		glDeleteSync(pending.fence);
+		UDeleteObject(pending.type, pending.name);
+	}
+
+	std::cout << "INFO: Resources peaked at " << registry.peakBytes / 1024 << " KB, " << registry.shared << " loads shared an existing object, "
+		<< leaks << " leaked (" << leakedBytes << " bytes)" << std::endl;
+	registry = ResourceRegistry();
+}
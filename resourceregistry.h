@@ -0,0 +1,81 @@
+///////////////////////////////////////////////////////////////////////////////
+// resourceregistry.h
+// ========
+// ownership of GL textures, buffers, vertex arrays and programs. Each object
+// is registered once and referred to by a generational handle, so a handle
+// kept past its object's destruction resolves to 0 instead of to whatever
+// reused the slot. Objects created from the same content can be found by
+// its hash and shared, are reference counted, and are only deleted once the
+// GPU has passed a fence inserted when the last reference went away. At
+// exit the registry reports every object that was never released.
+///////////////////////////////////////////////////////////////////////////////
+
+#ifndef RESOURCEREGISTRY_H
+#define RESOURCEREGISTRY_H
+
+#include <GL/glew.h>
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+enum class ResourceType
+{
+	Texture,
+	Buffer,
+	VertexArray,
+	Program
+};
+const int resourceTypeCount = 4;
+
+// Slot and generation of a registered object; generation 0 is never issued
+struct ResourceHandle
+{
+	uint32_t index = 0;
+	uint32_t generation = 0;
+
+	bool Valid() const { return generation != 0; }
+};
+
+struct ResourceEntry
+{
+	ResourceType type = ResourceType::Texture;
+	GLuint name = 0;			// 0 while the slot is free
+	size_t bytes = 0;			// GPU memory, as reported at registration
+	uint64_t contentHash = 0;	// 0: not shared
+	std::string label;
+	uint32_t generation = 1;
+	int refs = 0;
+};
+
+struct ResourceRegistry
+{
+	std::vector<ResourceEntry> entries;
+	std::vector<uint32_t> freeSlots;
+	std::unordered_map<uint64_t, uint32_t> byContent[resourceTypeCount];
+
+	// Released objects the GPU may still be using
+	struct PendingDelete
+	{
+		ResourceType type;
+		GLuint name;
+		GLsync fence;
+	};
+	std::vector<PendingDelete> pending;
+
+	size_t liveBytes = 0;
+	size_t peakBytes = 0;
+	size_t shared = 0;			// acquisitions satisfied by an existing object
+};
+
+uint64_t UHashBytes(const void* data, size_t size, uint64_t seed = 0);
+
+ResourceHandle URegisterResource(ResourceRegistry& registry, ResourceType type, GLuint name, size_t bytes, const char* label, uint64_t contentHash = 0);
+ResourceHandle UAcquireResource(ResourceRegistry& registry, ResourceType type, uint64_t contentHash);
+GLuint UResourceName(const ResourceRegistry& registry, ResourceHandle handle);
+void UReleaseResource(ResourceRegistry& registry, ResourceHandle& handle);
+void UCollectResources(ResourceRegistry& registry);
+void UDestroyResourceRegistry(ResourceRegistry& registry);
+
+#endif
@@ -0,0 +1,405 @@
+///////////////////////////////////////////////////////////////////////////////
+// scenebvh.cpp
+// ========
+// binned SAH build, closest / any hit traversal and the four ray SSE packet
+///////////////////////////////////////////////////////////////////////////////
+
+#include "scenebvh.h"
+#include "clusteredlighting.h"
+
+#include <algorithm>
+#include <cfloat>
+#include <cmath>
+#include <utility>
+
+#if defined(__SSE4_1__) || defined(__AVX__)
+#include <smmintrin.h>
+#define SCENE_BVH_SSE4 1
+#endif
+
+namespace
+{
+	// Split candidates per axis
+	const int bvhBins = 12;
+
+	struct Bounds
+	{
+		glm::vec3 min = glm::vec3(FLT_MAX);
+		glm::vec3 max = glm::vec3(-FLT_MAX);
+
+		void Grow(const glm::vec3& point)
+		{
+			min = glm::min(min, point);
+			max = glm::max(max, point);
+		}
+		void Grow(const Bounds& other)
+		{
+			min = glm::min(min, other.min);
+			max = glm::max(max, other.max);
+		}
+		float Area() const
+		{
+			const glm::vec3 extent = max - min;
+			return extent.x < 0.0f ? 0.0f : extent.x * extent.y + extent.y * extent.z + extent.z * extent.x;
+		}
+	};
+
+	// Cost of the best binned split of node's triangles, and where it is; FLT_MAX when none helps
+	float UFindSplit(const std::vector<glm::vec3>& centroids, const std::vector<uint32_t>& order, const std::vector<Bounds>& triangleBounds,
+		const BVHNode& node, int& axis, float& position)
+	{
+		Bounds centroidBounds;
+		for (uint32_t i = node.first; i < node.first + node.count; ++i)
+			centroidBounds.Grow(centroids[order[i]]);
+
+		float bestCost = FLT_MAX;
+		for (int a = 0; a < 3; ++a)
+		{
+			const float low = centroidBounds.min[a], high = centroidBounds.max[a];
+			if (high <= low)
+				continue;
+			Bounds bins[bvhBins];
+			uint32_t counts[bvhBins] = {};
+			const float scale = bvhBins / (high - low);
+			for (uint32_t i = node.first; i < node.first + node.count; ++i)
+			{
+				const uint32_t t = order[i];
+				const int bin = std::min(bvhBins - 1, int((centroids[t][a] - low) * scale));
+				bins[bin].Grow(triangleBounds[t]);
+				counts[bin]++;
+			}
+
+			// areas and counts left of each plane, then sweep back from the right
+			float leftArea[bvhBins - 1];
+			uint32_t leftCount[bvhBins - 1];
+			Bounds left;
+			uint32_t leftSum = 0;
+			for (int i = 0; i < bvhBins - 1; ++i)
+			{
+				left.Grow(bins[i]);
+				leftSum += counts[i];
+				leftArea[i] = left.Area();
+				leftCount[i] = leftSum;
+			}
+			Bounds right;
+			uint32_t rightSum = 0;
+			for (int i = bvhBins - 1; i > 0; --i)
+			{
+				right.Grow(bins[i]);
+				rightSum += counts[i];
+				const float cost = leftCount[i - 1] * leftArea[i - 1] + rightSum * right.Area();
+				if (leftCount[i - 1] > 0 && rightSum > 0 && cost < bestCost)
+				{
+					bestCost = cost;
+					axis = a;
+					position = low + i / scale;
+				}
+			}
+		}
+		return bestCost;
+	}
+
+	// Slab test; the distance the ray enters the box, FLT_MAX on a miss
+	float UIntersectBounds(const BVHNode& node, const glm::vec3& origin, const glm::vec3& inverseDirection, float maxDistance)
+	{
+		const glm::vec3 t0 = (node.boundsMin - origin) * inverseDirection;
+		const glm::vec3 t1 = (node.boundsMax - origin) * inverseDirection;
+		const glm::vec3 near = glm::min(t0, t1), far = glm::max(t0, t1);
+		const float enter = std::max(std::max(near.x, near.y), std::max(near.z, 0.0f));
+		const float exit = std::min(std::min(far.x, far.y), std::min(far.z, maxDistance));
+		return enter <= exit ? enter : FLT_MAX;
+	}
+
+	// Moller-Trumbore, both faces
+	bool UIntersectTriangle(const glm::vec3* corners, const glm::vec3& origin, const glm::vec3& direction, float maxDistance, float& distance, float& u, float& v)
+	{
+		const glm::vec3 edge1 = corners[1] - corners[0], edge2 = corners[2] - corners[0];
+		const glm::vec3 p = glm::cross(direction, edge2);
+		const float determinant = glm::dot(edge1, p);
+		if (std::abs(determinant) < 1e-12f)
+			return false;
+		const float inverse = 1.0f / determinant;
+		const glm::vec3 toOrigin = origin - corners[0];
+		u = glm::dot(toOrigin, p) * inverse;
+		if (u < 0.0f || u > 1.0f)
+			return false;
+		const glm::vec3 q = glm::cross(toOrigin, edge1);
+		v = glm::dot(direction, q) * inverse;
+		if (v < 0.0f || u + v > 1.0f)
+			return false;
+		distance = glm::dot(edge2, q) * inverse;
+		return distance > 0.0f && distance < maxDistance;
+	}
+
+	// Shared traversal: nearer child first, stopping at the first hit when anyHit is set
+	bool UTraverse(const SceneBVH& bvh, const glm::vec3& origin, const glm::vec3& direction, float maxDistance, bool anyHit, RayHit* hit)
+	{
+		if (bvh.nodes.empty())
+			return false;
+		const glm::vec3 inverseDirection = 1.0f / direction;
+		bool found = false;
+		uint32_t stack[64];
+		int top = 0;
+		stack[top++] = 0;
+		while (top > 0)
+		{
+			const BVHNode& node = bvh.nodes[stack[--top]];
+			if (UIntersectBounds(node, origin, inverseDirection, maxDistance) == FLT_MAX)
+				continue;
+			if (node.count > 0)
+			{
+				for (uint32_t i = node.first; i < node.first + node.count; ++i)
+				{
+					float distance, u, v;
+					if (!UIntersectTriangle(&bvh.triangles[size_t(i) * 3], origin, direction, maxDistance, distance, u, v))
+						continue;
+					if (anyHit)
+						return true;
+					found = true;
+					maxDistance = distance;
+					*hit = { distance, bvh.triangleIds[i], u, v };
+				}
+				continue;
+			}
+
+			uint32_t nearChild = node.first, farChild = node.first + 1;
+			const float nearEnter = UIntersectBounds(bvh.nodes[nearChild], origin, inverseDirection, maxDistance);
+			const float farEnter = UIntersectBounds(bvh.nodes[farChild], origin, inverseDirection, maxDistance);
+			if (farEnter < nearEnter)
+				std::swap(nearChild, farChild);
+			if (std::max(nearEnter, farEnter) != FLT_MAX)
+				stack[top++] = farChild;
+			if (std::min(nearEnter, farEnter) != FLT_MAX)
+				stack[top++] = nearChild;
+		}
+		return found;
+	}
+}
+
+///////////////////////////////////////////////////
+//	UBuildSceneBVH(const std::vector<glm::vec3>&, SceneBVH&)
+//
+//	triangles: three world space corners per triangle
+//
+//	Splits each node on the plane with the lowest surface
+//	area cost over 12 bins per axis, and stops at
+//	bvhMaxLeafTriangles or when no split is cheaper than
+//	testing the triangles.
+///////////////////////////////////////////////////
+void UBuildSceneBVH(const std::vector<glm::vec3>& triangles, SceneBVH& bvh)
+{
+	const uint32_t count = uint32_t(triangles.size() / 3);
+	bvh = SceneBVH();
+	if (count == 0)
+		return;
+
+	std::vector<Bounds> triangleBounds(count);
+	std::vector<glm::vec3> centroids(count);
+	std::vector<uint32_t> order(count);
+	for (uint32_t t = 0; t < count; ++t)
+	{
+		for (int c = 0; c < 3; ++c)
+			triangleBounds[t].Grow(triangles[size_t(t) * 3 + c]);
+		centroids[t] = (triangleBounds[t].min + triangleBounds[t].max) * 0.5f;
+		order[t] = t;
+	}
+
+	bvh.nodes.reserve(size_t(count) * 2);
+	bvh.nodes.push_back({ glm::vec3(0.0f), 0, glm::vec3(0.0f), count });
+	std::vector<std::pair<uint32_t, uint32_t>> pending = { { 0u, 1u } };	// node, depth
+	while (!pending.empty())
+	{
+		const uint32_t index = pending.back().first, depth = pending.back().second;
+		pending.pop_back();
+		bvh.depth = std::max(bvh.depth, depth);
+
+		Bounds bounds;
+		for (uint32_t i = bvh.nodes[index].first; i < bvh.nodes[index].first + bvh.nodes[index].count; ++i)
+			bounds.Grow(triangleBounds[order[i]]);
+		BVHNode& node = bvh.nodes[index];
+		node.boundsMin = bounds.min;
+		node.boundsMax = bounds.max;
+		if (node.count <= bvhMaxLeafTriangles || depth >= 60)
+			continue;
+
+		int axis = 0;
+		float position = 0.0f;
+		const float cost = UFindSplit(centroids, order, triangleBounds, node, axis, position);
+		if (cost >= node.count * bounds.Area())
+			continue;
+
+		uint32_t* begin = order.data() + node.first;
+		uint32_t* middle = std::partition(begin, begin + node.count, [&](uint32_t t) { return centroids[t][axis] < position; });
+		const uint32_t leftCount = uint32_t(middle - begin);
+		if (leftCount == 0 || leftCount == node.count)
+			continue;
+
+		const uint32_t first = node.first, total = node.count;
+		const uint32_t child = uint32_t(bvh.nodes.size());
+		node.first = child;
+		node.count = 0;
+		bvh.nodes.push_back({ glm::vec3(0.0f), first, glm::vec3(0.0f), leftCount });
+		bvh.nodes.push_back({ glm::vec3(0.0f), first + leftCount, glm::vec3(0.0f), total - leftCount });
+		pending.push_back({ child, depth + 1 });
+		pending.push_back({ child + 1, depth + 1 });
+	}
+
+	bvh.triangles.resize(size_t(count) * 3);
+	bvh.triangleIds = order;
+	for (uint32_t i = 0; i < count; ++i)
+	{
+		for (int c = 0; c < 3; ++c)
+			bvh.triangles[size_t(i) * 3 + c] = triangles[size_t(order[i]) * 3 + c];
+	}
+}
+
+// Closest triangle the ray hits before maxDistance; direction need not be unit length
+bool UTraceRay(const SceneBVH& bvh, const glm::vec3& origin, const glm::vec3& direction, float maxDistance, RayHit& hit)
+{
+	return UTraverse(bvh, origin, direction, maxDistance, false, &hit);
+}
+
+// Whether anything lies on the ray before maxDistance, e.g. between a surface and a light
+bool UOccluded(const SceneBVH& bvh, const glm::vec3& origin, const glm::vec3& direction, float maxDistance)
+{
+	return UTraverse(bvh, origin, direction, maxDistance, true, nullptr);
+}
+
+///////////////////////////////////////////////////
+//	UOccluded4(const SceneBVH&, const RayPacket4&)
+//
+//	UOccluded() for four rays at once; bit i of the
+//	result is set when ray i is blocked. The SSE path
+//	walks the tree once for the packet, testing a box or
+//	triangle against all four rays in one go, and drops
+//	rays from the packet as they are found blocked. Rays
+//	that start together and point about the same way
+//	(ambient occlusion around one vertex) share most of
+//	their nodes, which is where it pays off.
+///////////////////////////////////////////////////
+int UOccluded4(const SceneBVH& bvh, const RayPacket4& packet)
+{
+#if SCENE_BVH_SSE4
+	if (bvh.nodes.empty())
+		return 0;
+	const __m128 originX = _mm_load_ps(packet.originX), originY = _mm_load_ps(packet.originY), originZ = _mm_load_ps(packet.originZ);
+	const __m128 directionX = _mm_load_ps(packet.directionX), directionY = _mm_load_ps(packet.directionY), directionZ = _mm_load_ps(packet.directionZ);
+	const __m128 maxDistance = _mm_load_ps(packet.maxDistance);
+	const __m128 one = _mm_set1_ps(1.0f), zero = _mm_setzero_ps();
+	const __m128 inverseX = _mm_div_ps(one, directionX), inverseY = _mm_div_ps(one, directionY), inverseZ = _mm_div_ps(one, directionZ);
+	const __m128 absMask = _mm_castsi128_ps(_mm_set1_epi32(0x7fffffff));
+	const __m128 epsilon = _mm_set1_ps(1e-12f);
+
+	int active = 0xf, occluded = 0;
+	uint32_t stack[64];
+	int top = 0;
+	stack[top++] = 0;
+	while (top > 0)
+	{
+		const BVHNode& node = bvh.nodes[stack[--top]];
+
+		// slab test of the box against every ray still looking
+		const __m128 x0 = _mm_mul_ps(_mm_sub_ps(_mm_set1_ps(node.boundsMin.x), originX), inverseX);
+		const __m128 x1 = _mm_mul_ps(_mm_sub_ps(_mm_set1_ps(node.boundsMax.x), originX), inverseX);
+		const __m128 y0 = _mm_mul_ps(_mm_sub_ps(_mm_set1_ps(node.boundsMin.y), originY), inverseY);
+		const __m128 y1 = _mm_mul_ps(_mm_sub_ps(_mm_set1_ps(node.boundsMax.y), originY), inverseY);
+		const __m128 z0 = _mm_mul_ps(_mm_sub_ps(_mm_set1_ps(node.boundsMin.z), originZ), inverseZ);
+		const __m128 z1 = _mm_mul_ps(_mm_sub_ps(_mm_set1_ps(node.boundsMax.z), originZ), inverseZ);
+		const __m128 enter = _mm_max_ps(_mm_max_ps(_mm_min_ps(x0, x1), _mm_min_ps(y0, y1)), _mm_max_ps(_mm_min_ps(z0, z1), zero));
+		const __m128 exit = _mm_min_ps(_mm_min_ps(_mm_max_ps(x0, x1), _mm_max_ps(y0, y1)), _mm_min_ps(_mm_max_ps(z0, z1), maxDistance));
+		const int entering = _mm_movemask_ps(_mm_cmple_ps(enter, exit)) & active;
+		if (entering == 0)
+			continue;
+
+		if (node.count == 0)
+		{
+			stack[top++] = node.first + 1;
+			stack[top++] = node.first;
+			continue;
+		}
+
+		// Moller-Trumbore, both faces, one triangle against the four rays
+		for (uint32_t i = node.first; i < node.first + node.count && (active & entering) != 0; ++i)
+		{
+			const glm::vec3* corners = &bvh.triangles[size_t(i) * 3];
+			const glm::vec3 edge1 = corners[1] - corners[0], edge2 = corners[2] - corners[0];
+			const __m128 e1x = _mm_set1_ps(edge1.x), e1y = _mm_set1_ps(edge1.y), e1z = _mm_set1_ps(edge1.z);
+			const __m128 e2x = _mm_set1_ps(edge2.x), e2y = _mm_set1_ps(edge2.y), e2z = _mm_set1_ps(edge2.z);
+			const __m128 px = _mm_sub_ps(_mm_mul_ps(directionY, e2z), _mm_mul_ps(directionZ, e2y));
+			const __m128 py = _mm_sub_ps(_mm_mul_ps(directionZ, e2x), _mm_mul_ps(directionX, e2z));
+			const __m128 pz = _mm_sub_ps(_mm_mul_ps(directionX, e2y), _mm_mul_ps(directionY, e2x));
+			const __m128 determinant = _mm_add_ps(_mm_add_ps(_mm_mul_ps(e1x, px), _mm_mul_ps(e1y, py)), _mm_mul_ps(e1z, pz));
+			const __m128 inverse = _mm_div_ps(one, determinant);
+			const __m128 sx = _mm_sub_ps(originX, _mm_set1_ps(corners[0].x));
+			const __m128 sy = _mm_sub_ps(originY, _mm_set1_ps(corners[0].y));
+			const __m128 sz = _mm_sub_ps(originZ, _mm_set1_ps(corners[0].z));
+			const __m128 u = _mm_mul_ps(_mm_add_ps(_mm_add_ps(_mm_mul_ps(sx, px), _mm_mul_ps(sy, py)), _mm_mul_ps(sz, pz)), inverse);
+			const __m128 qx = _mm_sub_ps(_mm_mul_ps(sy, e1z), _mm_mul_ps(sz, e1y));
+			const __m128 qy = _mm_sub_ps(_mm_mul_ps(sz, e1x), _mm_mul_ps(sx, e1z));
+			const __m128 qz = _mm_sub_ps(_mm_mul_ps(sx, e1y), _mm_mul_ps(sy, e1x));
+			const __m128 v = _mm_mul_ps(_mm_add_ps(_mm_add_ps(_mm_mul_ps(directionX, qx), _mm_mul_ps(directionY, qy)), _mm_mul_ps(directionZ, qz)), inverse);
+			const __m128 distance = _mm_mul_ps(_mm_add_ps(_mm_add_ps(_mm_mul_ps(e2x, qx), _mm_mul_ps(e2y, qy)), _mm_mul_ps(e2z, qz)), inverse);
+
+			__m128 hit = _mm_cmpge_ps(_mm_and_ps(determinant, absMask), epsilon);
+			hit = _mm_and_ps(hit, _mm_and_ps(_mm_cmpge_ps(u, zero), _mm_cmple_ps(u, one)));
+			hit = _mm_and_ps(hit, _mm_and_ps(_mm_cmpge_ps(v, zero), _mm_cmple_ps(_mm_add_ps(u, v), one)));
+			hit = _mm_and_ps(hit, _mm_and_ps(_mm_cmpgt_ps(distance, zero), _mm_cmplt_ps(distance, maxDistance)));
+			const int blocked = _mm_movemask_ps(hit) & active;
+			occluded |= blocked;
+			active &= ~blocked;
+		}
+		if (active == 0)
+			break;
+	}
+	return occluded;
+#else
+	int occluded = 0;
+	for (int i = 0; i < 4; ++i)
+	{
+		const glm::vec3 origin(packet.originX[i], packet.originY[i], packet.originZ[i]);
+		const glm::vec3 direction(packet.directionX[i], packet.directionY[i], packet.directionZ[i]);
+		if (UOccluded(bvh, origin, direction, packet.maxDistance[i]))
+			occluded |= 1 << i;
+	}
+	return occluded;
+#endif
+}
+
+///////////////////////////////////////////////////
+//	UDirectLight(const SceneBVH&, const std::vector<PointLight>&, const glm::vec3&, const glm::vec3&, bool, float, unsigned long long&)
+//
+//	Lambert light at a surface point from every light
+//	that sees it, as phongLight() of clusteredlighting.cpp
+//	adds it. Lights with a radius are skipped unless
+//	radiusLights is set, and then fade out as in the
+//	shader. The shadow rays stop rayOffset short of the
+//	light; rays counts them.
+///////////////////////////////////////////////////
+glm::vec3 UDirectLight(const SceneBVH& bvh, const std::vector<PointLight>& lights, const glm::vec3& position, const glm::vec3& normal,
+	bool radiusLights, float rayOffset, unsigned long long& rays)
+{
+	glm::vec3 light(0.0f);
+	for (const PointLight& point : lights)
+	{
+		if (point.radius > 0.0f && !radiusLights)
+			continue;
+		const glm::vec3 toLight = point.position - position;
+		const float distanceSquared = glm::dot(toLight, toLight);
+		float attenuation = 1.0f;
+		if (point.radius > 0.0f)
+		{
+			const float fade = 1.0f - distanceSquared / (point.radius * point.radius);
+			if (fade <= 0.0f)
+				continue;
+			attenuation = fade * fade;
+		}
+		const float distance = std::sqrt(distanceSquared);
+		const float impact = distance > 0.0f ? glm::dot(normal, toLight) / distance : 0.0f;
+		if (impact <= 0.0f)
+			continue;
+		rays++;
+		if (!UOccluded(bvh, position, toLight / distance, distance - rayOffset))
+			light += attenuation * impact * point.color;
+	}
+	return light;
+}
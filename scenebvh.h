@@ -0,0 +1,66 @@
+///////////////////////////////////////////////////////////////////////////////
+// scenebvh.h
+// ========
+// bounding volume hierarchy over the world space triangles of the static
+// scene, for ray casting on the CPU (lightmap and occlusion baking). Built top
+// down with binned surface area heuristic splits; the triangles are reordered
+// so every leaf is a contiguous run and keep their original index for the
+// caller. Shadow style queries can also go four rays at a time with SSE.
+// The bakers share the direct light at a surface point built on them.
+///////////////////////////////////////////////////////////////////////////////
+
+#ifndef SCENEBVH_H
+#define SCENEBVH_H
+
+#include <cstdint>
+#include <vector>
+
+#include <glm/glm.hpp>
+
+struct PointLight;
+
+// Triangles a leaf may hold before it is split
+const uint32_t bvhMaxLeafTriangles = 4;
+
+// An inner node's children are nodes first and first + 1; a leaf holds
+// triangles [first, first + count)
+struct BVHNode
+{
+	glm::vec3 boundsMin;
+	uint32_t first;
+	glm::vec3 boundsMax;
+	uint32_t count;		// 0 for inner nodes
+};
+
+struct SceneBVH
+{
+	std::vector<BVHNode> nodes;				// root first
+	std::vector<glm::vec3> triangles;		// three corners per triangle, leaf order
+	std::vector<uint32_t> triangleIds;		// index each triangle had in UBuildSceneBVH()
+	uint32_t depth = 0;
+};
+
+// Closest hit of a ray: corner weights (1 - u - v, u, v)
+struct RayHit
+{
+	float distance;
+	uint32_t triangle;	// as given to UBuildSceneBVH()
+	float u, v;
+};
+
+// Four rays for UOccluded4(), one per lane, stored by component so each loads as one SSE register
+struct RayPacket4
+{
+	alignas(16) float originX[4], originY[4], originZ[4];
+	alignas(16) float directionX[4], directionY[4], directionZ[4];
+	alignas(16) float maxDistance[4];
+};
+
+void UBuildSceneBVH(const std::vector<glm::vec3>& triangles, SceneBVH& bvh);
+bool UTraceRay(const SceneBVH& bvh, const glm::vec3& origin, const glm::vec3& direction, float maxDistance, RayHit& hit);
+bool UOccluded(const SceneBVH& bvh, const glm::vec3& origin, const glm::vec3& direction, float maxDistance);
+int UOccluded4(const SceneBVH& bvh, const RayPacket4& packet);
+glm::vec3 UDirectLight(const SceneBVH& bvh, const std::vector<PointLight>& lights, const glm::vec3& position, const glm::vec3& normal,
+	bool radiusLights, float rayOffset, unsigned long long& rays);
+
+#endif
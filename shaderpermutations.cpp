@@ -0,0 +1,56 @@
+///////////////////////////////////////////////////////////////////////////////
+// shaderpermutations.cpp
+// ========
+// the #define lines of a variant and its name for the log
+///////////////////////////////////////////////////////////////////////////////
+
+#include "shaderpermutations.h"
+
+namespace
+{
+	struct ShaderFeatureName
+	{
+		ShaderFeatures feature;
+		const char* define;
+		const char* name;
+	};
+
+	const ShaderFeatureName shaderFeatureNames[] = {
+		{ shaderShadows, "FEATURE_SHADOWS", "shadows" },
+		{ shaderLightmap, "FEATURE_LIGHTMAP", "lightmap" },
+		{ shaderVertexOcclusion, "FEATURE_VERTEX_OCCLUSION", "vertex occlusion" },
+		{ shaderShadingCache, "FEATURE_SHADING_CACHE", "shading cache" },
+		{ shaderProbes, "FEATURE_PROBES", "probes" },
+	};
+}
+
+///////////////////////////////////////////////////
+//	UShaderFeatureDefines(ShaderFeatures)
+//
+//	Every switch defined to 1 or 0, so the shaders can
+//	test them in #if and in plain conditions alike, and
+//	GLOBAL_LIGHT_COUNT to the unrolled count or 0. Put it
+//	first in the header of UComposeShaderSource().
+///////////////////////////////////////////////////
+std::string UShaderFeatureDefines(ShaderFeatures features)
+{
+	std::string defines;
+	for (const ShaderFeatureName& entry : shaderFeatureNames)
+		defines += std::string("#define ") + entry.define + (UHasShaderFeatures(features, entry.feature) ? " 1\n" : " 0\n");
+	defines += "#define GLOBAL_LIGHT_COUNT " + std::to_string(UShaderGlobalLightCount(features)) + "\n";
+	return defines;
+}
+
+// "shadows, probes, 2 lights", or "no features"
+std::string UShaderFeatureName(ShaderFeatures features)
+{
+	std::string name;
+	for (const ShaderFeatureName& entry : shaderFeatureNames)
+	{
+		if (UHasShaderFeatures(features, entry.feature))
+			name += (name.empty() ? "" : ", ") + std::string(entry.name);
+	}
+	if (UShaderGlobalLightCount(features) > 0)
+		name += (name.empty() ? "" : ", ") + std::to_string(UShaderGlobalLightCount(features)) + " lights";
+	return name.empty() ? "no features" : name;
+}
@@ -0,0 +1,56 @@
+///////////////////////////////////////////////////////////////////////////////
+// shaderpermutations.h
+// ========
+// compile time feature switches for the lighting shaders. A variant is named
+// by a ShaderFeatures bitmask, turned into #define lines injected after the
+// #version line with the rest of a program's header. The module sources test
+// them with #if, and the GLSL() sources (which cannot hold directives) with
+// constant conditions the GLSL compiler folds away, so a feature that is off
+// costs neither instructions nor uniforms. The mask is chosen once the scene
+// is known, and every program the scene draws with is compiled at load. The
+// texture feedback, G-buffer and depth prepass passes are not switches but
+// programs of their own, so no variant branches on the pass.
+///////////////////////////////////////////////////////////////////////////////
+
+#ifndef SHADERPERMUTATIONS_H
+#define SHADERPERMUTATIONS_H
+
+#include <GL/glew.h>
+#include <cstdint>
+#include <string>
+
+using ShaderFeatures = uint32_t;
+
+// One bit per switch; the global light count sits in the top byte
+constexpr ShaderFeatures shaderShadows = 1u << 0;			// globalLightShadow() reads the shadow maps, else returns 1
+constexpr ShaderFeatures shaderLightmap = 1u << 1;			// the static batch's lightmap replaces the lamps' diffuse term
+constexpr ShaderFeatures shaderVertexOcclusion = 1u << 2;	// the static batch's baked occlusion scales the ambient term
+constexpr ShaderFeatures shaderShadingCache = 1u << 3;		// the static batch reads ambient and diffuse light from the shading cache
+constexpr ShaderFeatures shaderProbes = 1u << 4;			// ambientLight() evaluates the irradiance probes, else returns the flat term
+constexpr int shaderLightCountShift = 24;
+
+// Switches only the static batch's vertices and textures can feed
+constexpr ShaderFeatures shaderBakedFeatures = shaderLightmap | shaderVertexOcclusion | shaderShadingCache;
+
+// Global light loops unrolled for count lights; 0 (or more than a byte holds) reads the count from a uniform
+constexpr ShaderFeatures UShaderGlobalLights(GLuint count)
+{
+	return count < 256 ? ShaderFeatures(count) << shaderLightCountShift : 0;
+}
+
+constexpr GLuint UShaderGlobalLightCount(ShaderFeatures features)
+{
+	return features >> shaderLightCountShift;
+}
+
+constexpr bool UHasShaderFeatures(ShaderFeatures features, ShaderFeatures wanted)
+{
+	return (features & wanted) == wanted;
+}
+
+static_assert(UShaderGlobalLightCount(UShaderGlobalLights(2) | shaderShadows) == 2, "light count and switches overlap");
+
+std::string UShaderFeatureDefines(ShaderFeatures features);
+std::string UShaderFeatureName(ShaderFeatures features);
+
+#endif
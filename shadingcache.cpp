@@ -0,0 +1,283 @@
+///////////////////////////////////////////////////////////////////////////////
+// shadingcache.cpp
+// ========
+// the texel surfaces, the atlas and its framebuffer, the budgeted sweep and
+// the shader code that reads a texel's surface
+///////////////////////////////////////////////////////////////////////////////
+
+#include "shadingcache.h"
+
+#include <algorithm>
+#include <chrono>
+#include <iostream>
+#include <vector>
+
+#include "parallel.h"
+
+namespace
+{
+	GLuint UCreateAtlasArray(GLenum internalFormat, const LightmapAtlasLayout& atlas, GLenum filter)
+	{
+		GLuint texture = 0;
+		glGenTextures(1, &texture);
+		glBindTexture(GL_TEXTURE_2D_ARRAY, texture);
+		glTexStorage3D(GL_TEXTURE_2D_ARRAY, 1, internalFormat, atlas.width, atlas.height, atlas.layers);
+		glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MIN_FILTER, filter);
+		glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MAG_FILTER, filter);
+		glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+		glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+		return texture;
+	}
+
+	// Shades rows [firstRow, lastRow) of one layer with the program in use
+	void UShadeRows(ShadingCache& cache, GLuint programId, GLsizei layer, GLsizei firstRow, GLsizei lastRow)
+	{
+		glFramebufferTextureLayer(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, cache.shading, 0, layer);
+		glUniform1i(glGetUniformLocation(programId, "uShadingCacheLayer"), layer);
+		glScissor(0, firstRow, cache.atlas.width, lastRow - firstRow);
+		glDrawArrays(GL_TRIANGLES, 0, 3);
+		cache.stats.shadedTexels += (unsigned long long)cache.atlas.width * (lastRow - firstRow);
+	}
+}
+
+///////////////////////////////////////////////////
+//	ULayoutShadingCache(StaticBatchData&, const ShadingCacheOptions&, ShadingCache&)
+//
+//	Unwraps the batch into atlases at about
+//	texelsPerUnit, as ULayoutLightmap() does; with a
+//	lightmap, copy its layout into cache.atlas instead,
+//	the batch holding only one set of coordinates.
+///////////////////////////////////////////////////
+bool ULayoutShadingCache(StaticBatchData& batch, const ShadingCacheOptions& options, ShadingCache& cache)
+{
+	return UUnwrapLightmapUVs(batch, options.texelsPerUnit, options.atlasSize, cache.atlas);
+}
+
+///////////////////////////////////////////////////
+//	UCreateShadingCache(const StaticBatchData&, const ShadingCacheOptions&, ShadingCache&)
+//
+//	batch: unwrapped into cache.atlas, with its baked
+//	       occlusion if any
+//
+//	Finds the surface under every covered texel (the
+//	nearest point of its triangle for padding texels,
+//	as the lightmap baker does), uploads the surfaces
+//	and makes the atlas the shading pass renders into.
+//	Nothing is shaded until the first update.
+///////////////////////////////////////////////////
+bool UCreateShadingCache(const StaticBatchData& batch, const ShadingCacheOptions& options, ShadingCache& cache)
+{
+	const LightmapAtlasLayout& atlas = cache.atlas;
+	if (atlas.texelTriangles.empty())
+		return false;
+	cache.options = options;
+	cache.options.texelsPerFrame = std::max<size_t>(options.texelsPerFrame, 1);
+
+	// rows bottom up as GL stores them, in parallel by row
+	const size_t layerTexels = size_t(atlas.width) * atlas.height;
+	std::vector<GLfloat> positions(atlas.texelTriangles.size() * 4, 0.0f);
+	std::vector<GLfloat> normals(atlas.texelTriangles.size() * 4, 0.0f);
+	UParallelFor(size_t(atlas.layers) * atlas.height, [&](size_t row)
+	{
+		for (GLsizei x = 0; x < atlas.width; ++x)
+		{
+			const size_t texel = row * atlas.width + x;
+			const uint32_t triangle = atlas.texelTriangles[texel];
+			if (triangle == 0)
+				continue;
+			const GLuint* corners = &batch.indices[size_t(triangle - 1) * 3];
+			glm::vec2 texelCorners[3];
+			for (int c = 0; c < 3; ++c)
+			{
+				const GLfloat* coords = &batch.vertices[size_t(corners[c]) * floatsPerBatchVertex + batchLightmapOffset];
+				texelCorners[c] = glm::vec2(coords[0] * atlas.width, coords[1] * atlas.height);
+			}
+			const glm::vec2 weights = UClosestTriangleWeights(texelCorners[0], texelCorners[1], texelCorners[2],
+				glm::vec2(x + 0.5f, float(texel % layerTexels / atlas.width) + 0.5f));
+			const float w[3] = { 1.0f - weights.x - weights.y, weights.x, weights.y };
+			glm::vec3 position(0.0f), normal(0.0f);
+			float occlusion = 0.0f;
+			for (int c = 0; c < 3; ++c)
+			{
+				position += w[c] * batch.Position(corners[c]);
+				normal += w[c] * batch.Normal(corners[c]);
+				occlusion += w[c] * batch.vertices[size_t(corners[c]) * floatsPerBatchVertex + batchOcclusionOffset];
+			}
+			const float length = glm::length(normal);
+			if (length > 0.0f)
+				normal /= length;
+			const GLfloat surfacePosition[4] = { position.x, position.y, position.z, occlusion };
+			const GLfloat surfaceNormal[4] = { normal.x, normal.y, normal.z, 1.0f };
+			std::copy(surfacePosition, surfacePosition + 4, &positions[texel * 4]);
+			std::copy(surfaceNormal, surfaceNormal + 4, &normals[texel * 4]);
+		}
+	});
+	cache.stats.texels = size_t(std::count_if(atlas.texelTriangles.begin(), atlas.texelTriangles.end(), [](uint32_t t) { return t != 0; }));
+
+	cache.surfacePositions = UCreateAtlasArray(GL_RGBA32F, atlas, GL_NEAREST);
+	glTexSubImage3D(GL_TEXTURE_2D_ARRAY, 0, 0, 0, 0, atlas.width, atlas.height, atlas.layers, GL_RGBA, GL_FLOAT, positions.data());
+	cache.surfaceNormals = UCreateAtlasArray(GL_RGBA16F, atlas, GL_NEAREST);
+	glTexSubImage3D(GL_TEXTURE_2D_ARRAY, 0, 0, 0, 0, atlas.width, atlas.height, atlas.layers, GL_RGBA, GL_FLOAT, normals.data());
+	cache.shading = UCreateAtlasArray(GL_RGBA16F, atlas, GL_LINEAR);
+	glBindTexture(GL_TEXTURE_2D_ARRAY, 0);
+
+	glGenFramebuffers(1, &cache.framebuffer);
+	glBindFramebuffer(GL_FRAMEBUFFER, cache.framebuffer);
+	glFramebufferTextureLayer(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, cache.shading, 0, 0);
+	const GLenum status = glCheckFramebufferStatus(GL_FRAMEBUFFER);
+	glBindFramebuffer(GL_FRAMEBUFFER, 0);
+	if (status != GL_FRAMEBUFFER_COMPLETE)
+	{
+		std::cout << "Shading cache framebuffer is incomplete (0x" << std::hex << status << std::dec << ")" << std::endl;
+		UDestroyShadingCache(cache);
+		return false;
+	}
+	glGenVertexArrays(1, &cache.emptyVertexArray);
+	return true;
+}
+
+void UDestroyShadingCache(ShadingCache& cache)
+{
+	if (cache.framebuffer)
+		glDeleteFramebuffers(1, &cache.framebuffer);
+	for (GLuint texture : { cache.shading, cache.surfacePositions, cache.surfaceNormals })
+	{
+		if (texture)
+			glDeleteTextures(1, &texture);
+	}
+	if (cache.emptyVertexArray)
+		glDeleteVertexArrays(1, &cache.emptyVertexArray);
+	cache = ShadingCache();
+}
+
+///////////////////////////////////////////////////
+//	UUpdateShadingCache(ShadingCache&, GLuint)
+//
+//	programId: the shading pass, in use, with its light
+//	           uniforms set; a full-screen triangle
+//	           program using UShadingCacheShaderSource()
+//
+//	Call once a frame. Shades the next texelsPerFrame
+//	texels of the atlas, in whole rows scissored out of
+//	full-screen triangles, and moves on to the next layer
+//	at the end of one. The first update shades all of it.
+///////////////////////////////////////////////////
+void UUpdateShadingCache(ShadingCache& cache, GLuint programId)
+{
+	if (cache.shading == 0)
+		return;
+	const auto start = std::chrono::steady_clock::now();
+	const LightmapAtlasLayout& atlas = cache.atlas;
+	glGetIntegerv(GL_VIEWPORT, cache.viewport);
+	glBindFramebuffer(GL_FRAMEBUFFER, cache.framebuffer);
+	glViewport(0, 0, atlas.width, atlas.height);
+	glEnable(GL_SCISSOR_TEST);
+	glDisable(GL_DEPTH_TEST);
+	for (GLuint i = 0; i < 2; ++i)
+	{
+		glActiveTexture(GL_TEXTURE0 + shadingSurfaceFirstUnit + i);
+		glBindTexture(GL_TEXTURE_2D_ARRAY, i == 0 ? cache.surfacePositions : cache.surfaceNormals);
+	}
+	glActiveTexture(GL_TEXTURE0);
+	glUniform1i(glGetUniformLocation(programId, "uShadingSurfacePositions"), GLint(shadingSurfaceFirstUnit));
+	glUniform1i(glGetUniformLocation(programId, "uShadingSurfaceNormals"), GLint(shadingSurfaceFirstUnit + 1));
+	glBindVertexArray(cache.emptyVertexArray);
+
+	if (!cache.primed)
+	{
+		for (GLsizei layer = 0; layer < atlas.layers; ++layer)
+			UShadeRows(cache, programId, layer, 0, atlas.height);
+		cache.primed = true;
+		cache.stats.sweeps++;
+	}
+	else
+	{
+		size_t rows = (cache.options.texelsPerFrame + atlas.width - 1) / atlas.width;
+		while (rows > 0)
+		{
+			const GLsizei lastRow = GLsizei(std::min<size_t>(atlas.height, cache.nextRow + rows));
+			UShadeRows(cache, programId, cache.nextLayer, cache.nextRow, lastRow);
+			rows -= lastRow - cache.nextRow;
+			cache.nextRow = lastRow;
+			if (cache.nextRow == atlas.height)
+			{
+				cache.nextRow = 0;
+				if (++cache.nextLayer == atlas.layers)
+				{
+					cache.nextLayer = 0;
+					cache.stats.sweeps++;
+					break; // never shade a texel twice in one frame
+				}
+			}
+		}
+	}
+
+	glBindVertexArray(0);
+	glEnable(GL_DEPTH_TEST);
+	glDisable(GL_SCISSOR_TEST);
+	glBindFramebuffer(GL_FRAMEBUFFER, 0);
+	glViewport(cache.viewport[0], cache.viewport[1], cache.viewport[2], cache.viewport[3]);
+	cache.stats.frames++;
+	cache.stats.seconds += std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+}
+
+// Binds the cached light for the forward pass, which reads it at the lightmap coordinate
+void UBindShadingCache(const ShadingCache& cache, GLuint programId)
+{
+	glActiveTexture(GL_TEXTURE0 + shadingCacheTextureUnit);
+	glBindTexture(GL_TEXTURE_2D_ARRAY, cache.shading);
+	glActiveTexture(GL_TEXTURE0);
+	glUniform1i(glGetUniformLocation(programId, "uShadingCache"), GLint(shadingCacheTextureUnit));
+}
+
+// Declarations for the top of the shading pass
+const char* UShadingCacheShaderHeader()
+{
+	return
+		"uniform sampler2DArray uShadingSurfacePositions;\n"
+		"uniform sampler2DArray uShadingSurfaceNormals;\n"
+		"uniform int uShadingCacheLayer;\n";
+}
+
+///////////////////////////////////////////////////
+//	UShadingCacheShaderSource()
+//
+//	GLSL defining
+//
+//	bool shadingCacheSurface(ivec2 texel, out vec3
+//	    position, out vec3 normal, out float occlusion)
+//
+//	which reads the surface under a texel of the layer
+//	being shaded, false where no triangle covers it.
+///////////////////////////////////////////////////
+const char* UShadingCacheShaderSource()
+{
+	return
+		"bool shadingCacheSurface(ivec2 texel, out vec3 position, out vec3 normal, out float occlusion)\n"
+		"{\n"
+		"	vec4 surfacePosition = texelFetch(uShadingSurfacePositions, ivec3(texel, uShadingCacheLayer), 0);\n"
+		"	vec4 surfaceNormal = texelFetch(uShadingSurfaceNormals, ivec3(texel, uShadingCacheLayer), 0);\n"
+		"	position = surfacePosition.xyz;\n"
+		"	normal = surfaceNormal.xyz;\n"
+		"	occlusion = surfacePosition.w;\n"
+		"	return surfaceNormal.w > 0.0;\n"
+		"}\n";
+}
+
+void UPrintShadingCacheStats(const ShadingCache& cache)
+{
+	if (cache.shading == 0)
+		return;
+	const ShadingCacheStats& stats = cache.stats;
+	const LightmapAtlasLayout& atlas = cache.atlas;
+	const size_t atlasTexels = atlas.texelTriangles.size();
+	const size_t rows = size_t(atlas.layers) * atlas.height;
+	const size_t rowsPerFrame = std::min(rows, (cache.options.texelsPerFrame + atlas.width - 1) / atlas.width);
+	std::cout << "INFO: Shading cache " << atlas.layers << " x " << atlas.width << "x" << atlas.height << ", " << stats.texels << " texels covered ("
+		<< (atlasTexels ? 100.0 * stats.texels / atlasTexels : 0.0) << "%), " << rowsPerFrame * atlas.width << " shaded a frame, a sweep every "
+		<< (rows + rowsPerFrame - 1) / rowsPerFrame << " frames" << std::endl;
+	if (!stats.frames)
+		return;
+	std::cout << "INFO: Shading cache updated " << stats.frames << " times, " << stats.sweeps << " sweeps, " << double(stats.shadedTexels) / stats.frames
+		<< " texels and " << stats.seconds / stats.frames * 1000.0 << " ms CPU a frame" << std::endl;
+}
@@ -0,0 +1,74 @@
+///////////////////////////////////////////////////////////////////////////////
+// shadingcache.h
+// ========
+// texture space shading for the static batch: the part of its lighting that
+// does not depend on the view (the ambient or probe light times the baked
+// occlusion, plus the shadowed diffuse light of the global lamps) is shaded
+// into an atlas laid out like the lightmap and reused across frames. Only
+// so many texels are shaded again each frame, sweeping the atlas row by
+// row, and the forward pass reads the result with one fetch; specular and
+// the clustered (dynamic) lights stay per pixel. A moved lamp shows up
+// within one sweep, texels / budget frames.
+//
+// The surface under each texel (position, normal and occlusion) is found
+// on the CPU once and kept in two float texture arrays, which the shading
+// pass reads at full screen like a G-buffer.
+///////////////////////////////////////////////////////////////////////////////
+
+#ifndef SHADINGCACHE_H
+#define SHADINGCACHE_H
+
+#include <GL/glew.h>
+#include <cstddef>
+
+#include "lightmapuv.h"
+#include "staticbatch.h"
+
+// Texture unit the forward pass reads the cache from, and the two the
+// shading pass reads the texel surfaces from, after the probe grid's
+const GLuint shadingCacheTextureUnit = 13;
+const GLuint shadingSurfaceFirstUnit = 14;
+
+struct ShadingCacheOptions
+{
+	float texelsPerUnit = 8.0f;		// atlas resolution in world space, unless the lightmap's layout is shared
+	GLsizei atlasSize = 2048;		// atlas side limit, as for the lightmap
+	size_t texelsPerFrame = 65536;	// shading budget, rounded up to whole rows
+};
+
+struct ShadingCacheStats
+{
+	size_t texels = 0;					// covered by a triangle, padding included
+	unsigned long long frames = 0;		// updates
+	unsigned long long shadedTexels = 0;	// rows shaded in those updates, empty texels included
+	unsigned long long sweeps = 0;		// passes over the whole atlas, the first one included
+	double seconds = 0.0;				// CPU time issuing the updates
+};
+
+struct ShadingCache
+{
+	LightmapAtlasLayout atlas;			// size, layers and the triangle under each texel
+	ShadingCacheOptions options;
+	GLuint shading = 0;					// RGBA16F array, the cached light
+	GLuint surfacePositions = 0;		// RGBA32F array: position, occlusion
+	GLuint surfaceNormals = 0;			// RGBA16F array: normal, 1 where a triangle covers the texel
+	GLuint framebuffer = 0;
+	GLuint emptyVertexArray = 0;		// the full-screen triangle has no attributes
+	GLsizei nextLayer = 0, nextRow = 0;	// where the sweep resumes
+	bool primed = false;				// the whole atlas was shaded once
+	GLint viewport[4] = {};				// restored after shading
+	ShadingCacheStats stats;
+};
+
+bool ULayoutShadingCache(StaticBatchData& batch, const ShadingCacheOptions& options, ShadingCache& cache);
+bool UCreateShadingCache(const StaticBatchData& batch, const ShadingCacheOptions& options, ShadingCache& cache);
+void UDestroyShadingCache(ShadingCache& cache);
+
+void UUpdateShadingCache(ShadingCache& cache, GLuint programId);
+void UBindShadingCache(const ShadingCache& cache, GLuint programId);
+
+const char* UShadingCacheShaderHeader();
+const char* UShadingCacheShaderSource();
+void UPrintShadingCacheStats(const ShadingCache& cache);
+
+#endif
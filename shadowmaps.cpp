@@ -0,0 +1,346 @@
+///////////////////////////////////////////////////////////////////////////////
+// shadowmaps.cpp
+// ========
+// cube map targets, caster culling per face, cache invalidation and the
+// shader code that looks a surface up in its light's cube
+///////////////////////////////////////////////////////////////////////////////
+
+#include "shadowmaps.h"
+
+#include <algorithm>
+#include <cmath>
+#include <iostream>
+
+#include <glm/gtx/transform.hpp>
+#include <glm/gtc/type_ptr.hpp>
+
+#include "resourceregistry.h"
+
+namespace
+{
+	GLuint UCreateShadowCube(GLsizei size)
+	{
+		GLuint texture = 0;
+		glGenTextures(1, &texture);
+		glBindTexture(GL_TEXTURE_CUBE_MAP, texture);
+		glTexStorage2D(GL_TEXTURE_CUBE_MAP, 1, GL_DEPTH_COMPONENT32F, size, size);
+		// linear filtering of a comparison gives 2x2 percentage closer filtering
+		glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+		glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+		glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+		glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+		glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_WRAP_R, GL_CLAMP_TO_EDGE);
+		glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_COMPARE_MODE, GL_COMPARE_REF_TO_TEXTURE);
+		glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_COMPARE_FUNC, GL_LEQUAL);
+		glBindTexture(GL_TEXTURE_CUBE_MAP, 0);
+		return texture;
+	}
+
+	// Faces of a light's cube the sphere reaches, bit i for GL_TEXTURE_CUBE_MAP_POSITIVE_X + i; 0 when out of range
+	GLuint UShadowFaceMask(const glm::vec3& light, float range, const ShadowCaster& caster)
+	{
+		const glm::vec3 center = caster.center - light;
+		if (glm::length(center) - caster.radius >= range)
+			return 0;
+
+		// a face sees the pyramid where its axis coordinate is at least the other two;
+		// the sphere reaches it unless it lies fully outside one of the four side planes
+		const float slack = caster.radius * 1.41421356f;
+		GLuint mask = 0;
+		for (int face = 0; face < 6; ++face)
+		{
+			const int axis = face / 2;
+			const float along = (face & 1) ? -center[axis] : center[axis];
+			if (along - std::abs(center[(axis + 1) % 3]) >= -slack && along - std::abs(center[(axis + 2) % 3]) >= -slack)
+				mask |= 1u << face;
+		}
+		return mask;
+	}
+
+	// Draws the casters of one kind into target, each only to the faces it touches
+	void UDrawShadowCasters(ShadowMaps& maps, const ShadowLight& light, GLuint target, const std::vector<ShadowCaster>& casters, bool dynamic, GLuint programId)
+	{
+		glFramebufferTexture(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, target, 0);
+		if (!dynamic)
+			glClear(GL_DEPTH_BUFFER_BIT);
+
+		// the six views in cube map face order, looking out from the light
+		const glm::vec3 directions[6] = { { 1, 0, 0 }, { -1, 0, 0 }, { 0, 1, 0 }, { 0, -1, 0 }, { 0, 0, 1 }, { 0, 0, -1 } };
+		const glm::vec3 ups[6] = { { 0, -1, 0 }, { 0, -1, 0 }, { 0, 0, 1 }, { 0, 0, -1 }, { 0, -1, 0 }, { 0, -1, 0 } };
+		const glm::mat4 projection = glm::perspective(glm::radians(90.0f), 1.0f, 0.05f, maps.range);
+		glm::mat4 faces[6];
+		for (int face = 0; face < 6; ++face)
+			faces[face] = projection * glm::lookAt(light.position, light.position + directions[face], ups[face]);
+		glUniformMatrix4fv(glGetUniformLocation(programId, "uShadowFaces"), 6, GL_FALSE, glm::value_ptr(faces[0]));
+		glUniform3f(glGetUniformLocation(programId, "uShadowLight"), light.position.x, light.position.y, light.position.z);
+		glUniform1f(glGetUniformLocation(programId, "uShadowRange"), maps.range);
+		const GLint modelLoc = glGetUniformLocation(programId, "model");
+		const GLint faceMaskLoc = glGetUniformLocation(programId, "uShadowFaceMask");
+
+		for (const ShadowCaster& caster : casters)
+		{
+			if (caster.dynamic != dynamic || !caster.vao)
+				continue;
+			const GLuint mask = UShadowFaceMask(light.position, maps.range, caster);
+			if (!mask)
+				continue;
+			maps.stats.casters++;
+			for (int face = 0; face < 6; ++face)
+				maps.stats.facesSkipped += (mask >> face & 1u) ? 0 : 1;
+
+			glUniformMatrix4fv(modelLoc, 1, GL_FALSE, glm::value_ptr(caster.model));
+			glUniform1i(faceMaskLoc, GLint(mask));
+			glBindVertexArray(caster.vao);
+			if (caster.indexCount > 0)
+				glDrawElements(GL_TRIANGLES, caster.indexCount, GL_UNSIGNED_INT, nullptr);
+			else if (caster.ranges)
+			{
+				for (const DrawRange& range : *caster.ranges)
+					glDrawArrays(range.mode, range.first, range.count);
+			}
+		}
+		glBindVertexArray(0);
+	}
+}
+
+///////////////////////////////////////////////////
+//	UCreateShadowMaps(GLsizei, float, GLuint, ShadowMaps&)
+//
+//	size: texels per cube face side
+//	range: distance from a light at which shadows end
+//	lightCount: shadowed lights, at most maxShadowLights
+///////////////////////////////////////////////////
+bool UCreateShadowMaps(GLsizei size, float range, GLuint lightCount, ShadowMaps& maps)
+{
+	maps.size = size;
+	maps.range = range;
+	maps.lights.resize(std::min(lightCount, maxShadowLights));
+	for (ShadowLight& light : maps.lights)
+		light.staticCube = UCreateShadowCube(size);
+	glEnable(GL_TEXTURE_CUBE_MAP_SEAMLESS);
+
+	// depth only, every face at once through a layered attachment
+	glGenFramebuffers(1, &maps.framebuffer);
+	glBindFramebuffer(GL_FRAMEBUFFER, maps.framebuffer);
+	glDrawBuffer(GL_NONE);
+	glReadBuffer(GL_NONE);
+	GLenum status = GL_FRAMEBUFFER_COMPLETE;
+	if (!maps.lights.empty())
+	{
+		glFramebufferTexture(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, maps.lights[0].staticCube, 0);
+		status = glCheckFramebufferStatus(GL_FRAMEBUFFER);
+	}
+	glBindFramebuffer(GL_FRAMEBUFFER, 0);
+	if (status != GL_FRAMEBUFFER_COMPLETE)
+	{
+		std::cout << "Shadow map framebuffer is incomplete (0x" << std::hex << status << std::dec << ")" << std::endl;
+		UDestroyShadowMaps(maps);
+		return false;
+	}
+
+	std::cout << "INFO: Shadow maps for " << maps.lights.size() << " lights, " << size << "x" << size << " per cube face, range " << range << std::endl;
+	return true;
+}
+
+void UDestroyShadowMaps(ShadowMaps& maps)
+{
+	for (ShadowLight& light : maps.lights)
+	{
+		for (GLuint texture : { light.staticCube, light.dynamicCube })
+		{
+			if (texture)
+				glDeleteTextures(1, &texture);
+		}
+	}
+	if (maps.framebuffer)
+		glDeleteFramebuffers(1, &maps.framebuffer);
+	maps = ShadowMaps();
+}
+
+// Reads the mesh back once for the radius of its bounding sphere about the origin
+bool UCreateShadowMesh(const Meshes::GLMesh& mesh, const std::vector<DrawRange>& ranges, ShadowMesh& shadowMesh)
+{
+	MeshData data;
+	if (!UReadbackMesh(mesh, ranges, data))
+		return false;
+	shadowMesh.vao = mesh.vao;
+	shadowMesh.indexCount = ranges.empty() ? GLsizei(mesh.nIndices) : 0;
+	shadowMesh.ranges = ranges;
+	shadowMesh.radius = 0.0f;
+	for (size_t i = 0; i < data.vertices.size(); i += floatsPerMeshVertex)
+		shadowMesh.radius = std::max(shadowMesh.radius, glm::length(glm::vec3(data.vertices[i], data.vertices[i + 1], data.vertices[i + 2])));
+	return true;
+}
+
+// A caster drawing mesh with model, its bounding sphere moved and scaled along
+ShadowCaster UMakeShadowCaster(const ShadowMesh& mesh, const glm::mat4& model, bool dynamic)
+{
+	ShadowCaster caster;
+	caster.vao = mesh.vao;
+	caster.indexCount = mesh.indexCount;
+	caster.ranges = &mesh.ranges;
+	caster.model = model;
+	caster.center = glm::vec3(model[3]);
+	caster.radius = mesh.radius * std::max(glm::length(glm::vec3(model[0])), std::max(glm::length(glm::vec3(model[1])), glm::length(glm::vec3(model[2]))));
+	caster.dynamic = dynamic;
+	return caster;
+}
+
+///////////////////////////////////////////////////
+//	UUpdateShadowMaps(ShadowMaps&, const std::vector<PointLight>&, const std::vector<ShadowCaster>&, GLuint)
+//
+//	lights: this frame's lights; the first global ones
+//	        (radius 0) are shadowed, in order
+//	casters: every caster this frame
+//	programId: the shadow program, with uniforms model,
+//	           uShadowFaces, uShadowFaceMask, uShadowLight
+//	           and uShadowRange
+//
+//	Redraws a light's cache only when the light or the
+//	static casters in its range differ from the last draw,
+//	and draws the dynamic casters over a copy of it when
+//	any are in range. Unchanged lights cost one pass over
+//	the casters on the CPU.
+///////////////////////////////////////////////////
+void UUpdateShadowMaps(ShadowMaps& maps, const std::vector<PointLight>& lights, const std::vector<ShadowCaster>& casters, GLuint programId)
+{
+	maps.stats.frames++;
+	bool drawing = false;
+	auto beginDrawing = [&]()
+	{
+		if (drawing)
+			return;
+		drawing = true;
+		glGetIntegerv(GL_VIEWPORT, maps.viewport);
+		glBindFramebuffer(GL_FRAMEBUFFER, maps.framebuffer);
+		glViewport(0, 0, maps.size, maps.size);
+		glUseProgram(programId);
+	};
+
+	maps.activeLights = 0;
+	for (const PointLight& point : lights)
+	{
+		if (maps.activeLights == maps.lights.size())
+			break;
+		if (point.radius > 0.0f)
+			continue;
+		ShadowLight& light = maps.lights[maps.activeLights++];
+		light.position = point.position;
+
+		// what the cache would hold now
+		uint64_t signature = UHashBytes(&light.position, sizeof(light.position), UHashBytes(&maps.range, sizeof(maps.range)));
+		bool dynamic = false;
+		for (const ShadowCaster& caster : casters)
+		{
+			if (!caster.vao || !UShadowFaceMask(light.position, maps.range, caster))
+				continue;
+			if (caster.dynamic)
+			{
+				dynamic = true;
+				continue;
+			}
+			signature = UHashBytes(&caster.model, sizeof(caster.model), signature);
+			signature = UHashBytes(&caster.vao, sizeof(caster.vao), signature);
+		}
+
+		if (!light.valid || signature != light.signature)
+		{
+			beginDrawing();
+			UDrawShadowCasters(maps, light, light.staticCube, casters, false, programId);
+			light.signature = signature;
+			light.valid = true;
+			maps.stats.staticRenders++;
+		}
+
+		light.dynamic = dynamic;
+		if (dynamic)
+		{
+			beginDrawing();
+			if (!light.dynamicCube)
+				light.dynamicCube = UCreateShadowCube(maps.size);
+			glCopyImageSubData(light.staticCube, GL_TEXTURE_CUBE_MAP, 0, 0, 0, 0,
+				light.dynamicCube, GL_TEXTURE_CUBE_MAP, 0, 0, 0, 0, maps.size, maps.size, 6);
+			UDrawShadowCasters(maps, light, light.dynamicCube, casters, true, programId);
+			maps.stats.dynamicRenders++;
+		}
+	}
+
+	if (drawing)
+	{
+		glFramebufferTexture(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, 0, 0);
+		glBindFramebuffer(GL_FRAMEBUFFER, 0);
+		glViewport(maps.viewport[0], maps.viewport[1], maps.viewport[2], maps.viewport[3]);
+	}
+}
+
+///////////////////////////////////////////////////
+//	UBindShadowMaps(const ShadowMaps&, GLuint)
+//
+//	Binds this frame's cubes and sets the uniforms of
+//	UShadowMapShaderSource() for a program in use. Call it
+//	for every program with that source, shadows or not:
+//	the samplers then keep units of their own.
+///////////////////////////////////////////////////
+void UBindShadowMaps(const ShadowMaps& maps, GLuint programId)
+{
+	GLint units[maxShadowLights];
+	glm::vec4 lights[maxShadowLights] = {};
+	for (GLuint i = 0; i < maxShadowLights; ++i)
+	{
+		units[i] = GLint(shadowFirstUnit + i);
+		GLuint texture = 0;
+		if (i < maps.activeLights)
+		{
+			const ShadowLight& light = maps.lights[i];
+			texture = light.dynamic ? light.dynamicCube : light.staticCube;
+			lights[i] = glm::vec4(light.position, maps.range);
+		}
+		glActiveTexture(GL_TEXTURE0 + shadowFirstUnit + i);
+		glBindTexture(GL_TEXTURE_CUBE_MAP, texture);
+	}
+	glActiveTexture(GL_TEXTURE0);
+	glUniform1iv(glGetUniformLocation(programId, "uShadowMaps"), maxShadowLights, units);
+	glUniform4fv(glGetUniformLocation(programId, "uShadowLights"), maxShadowLights, glm::value_ptr(lights[0]));
+	glUniform1ui(glGetUniformLocation(programId, "uShadowLightCount"), maps.activeLights);
+}
+
+///////////////////////////////////////////////////
+//	UShadowMapShaderSource()
+//
+//	Defines float globalLightShadow(uint light, vec3
+//	position, vec3 normal), which shadeLights() of
+//	ULightClusterShaderSource() calls for each global
+//	light: how much of the light reaches position, 0 to 1,
+//	and 1 for lights without a shadow map or for every
+//	light in variants without FEATURE_SHADOWS
+///////////////////////////////////////////////////
+const char* UShadowMapShaderSource()
+{
+	return
+		"uniform samplerCubeShadow uShadowMaps[2];\n"
+		"uniform vec4 uShadowLights[2];\n"
+		"uniform uint uShadowLightCount;\n"
+		"float globalLightShadow(uint light, vec3 position, vec3 normal)\n"
+		"{\n"
+		"#if FEATURE_SHADOWS\n"
+		"	if (light >= uShadowLightCount)\n"
+		"		return 1.0;\n"
+		"	// pushed off the surface along its normal, and a little closer, against self shadowing\n"
+		"	vec3 toSurface = position + normal * 0.02 - uShadowLights[light].xyz;\n"
+		"	float depth = length(toSurface) / uShadowLights[light].w - 0.001;\n"
+		"	return texture(uShadowMaps[light], vec4(toSurface, depth));\n"
+		"#else\n"
+		"	return 1.0;\n"
+		"#endif\n"
+		"}\n";
+}
+
+void UPrintShadowMapStats(const ShadowMaps& maps)
+{
+	if (!maps.stats.frames)
+		return;
+	const ShadowMapStats& stats = maps.stats;
+	std::cout << "INFO: Shadow maps: caches drawn " << stats.staticRenders << " times and dynamic casters " << stats.dynamicRenders
+		<< " times in " << stats.frames << " frames; " << stats.casters << " casters drawn, "
+		<< (stats.casters ? 100.0 * stats.facesSkipped / (6.0 * stats.casters) : 0.0) << "% of their cube faces culled" << std::endl;
+}
@@ -0,0 +1,92 @@
+///////////////////////////////////////////////////////////////////////////////
+// shadowmaps.h
+// ========
+// cached omnidirectional shadows for the global point lights: each light
+// has a depth cube map drawn in a single layered pass, a geometry shader
+// sending every triangle to the faces (gl_Layer) its caster touches. The
+// cube is a cache of the static casters, drawn again only when the light
+// moves or a caster within its range changes. Dynamic casters are drawn
+// each frame over a copy of the cache. Depth is stored as the distance to
+// the light over the shadow range, so one comparison works on every face.
+///////////////////////////////////////////////////////////////////////////////
+
+#ifndef SHADOWMAPS_H
+#define SHADOWMAPS_H
+
+#include <GL/glew.h>
+#include <cstdint>
+#include <vector>
+
+#include <glm/glm.hpp>
+
+#include "clusteredlighting.h"
+#include "meshdata.h"
+
+// Shadowed lights (the first global lights) and the texture units their
+// cube maps are bound to, after the visibility buffer's
+const GLuint maxShadowLights = 2;
+const GLuint shadowFirstUnit = 9;
+
+// A mesh as the shadow pass draws it: indexed, or by the draw calls of an
+// unindexed shape
+struct ShadowMesh
+{
+	GLuint vao = 0;
+	GLsizei indexCount = 0;			// GL_UNSIGNED_INT indices, 0 to use ranges
+	std::vector<DrawRange> ranges;
+	float radius = 0.0f;			// bounding sphere about the mesh origin
+};
+
+// One object that casts shadows this frame
+struct ShadowCaster
+{
+	GLuint vao = 0;
+	GLsizei indexCount = 0;
+	const std::vector<DrawRange>* ranges = nullptr;
+	glm::mat4 model = glm::mat4(1.0f);
+	glm::vec3 center = glm::vec3(0.0f);	// world space bounding sphere
+	float radius = 0.0f;
+	bool dynamic = false;			// drawn every frame instead of cached
+};
+
+struct ShadowLight
+{
+	GLuint staticCube = 0;		// DEPTH_COMPONENT32F cube of the static casters
+	GLuint dynamicCube = 0;		// the static cube plus the dynamic casters, made when first needed
+	glm::vec3 position = glm::vec3(0.0f);
+	uint64_t signature = 0;		// light and static casters the cache was drawn with
+	bool valid = false;
+	bool dynamic = false;		// dynamicCube holds this frame's shadows
+};
+
+struct ShadowMapStats
+{
+	unsigned long long frames = 0;
+	unsigned long long staticRenders = 0;	// cache redraws, summed over lights
+	unsigned long long dynamicRenders = 0;
+	unsigned long long casters = 0;			// casters drawn in those passes
+	unsigned long long facesSkipped = 0;	// cube faces those casters did not touch
+};
+
+struct ShadowMaps
+{
+	GLsizei size = 0;				// texels per cube face side
+	float range = 0.0f;				// shadows end this far from a light
+	GLuint framebuffer = 0;
+	std::vector<ShadowLight> lights;
+	GLuint activeLights = 0;		// lights with a shadow this frame
+	GLint viewport[4] = {};			// restored after drawing
+	ShadowMapStats stats;
+};
+
+bool UCreateShadowMaps(GLsizei size, float range, GLuint lightCount, ShadowMaps& maps);
+void UDestroyShadowMaps(ShadowMaps& maps);
+bool UCreateShadowMesh(const Meshes::GLMesh& mesh, const std::vector<DrawRange>& ranges, ShadowMesh& shadowMesh);
+ShadowCaster UMakeShadowCaster(const ShadowMesh& mesh, const glm::mat4& model, bool dynamic = false);
+
+void UUpdateShadowMaps(ShadowMaps& maps, const std::vector<PointLight>& lights, const std::vector<ShadowCaster>& casters, GLuint programId);
+void UBindShadowMaps(const ShadowMaps& maps, GLuint programId);
+const char* UShadowMapShaderSource();
+void UPrintShadowMapStats(const ShadowMaps& maps);
+
+#endif
@@ -0,0 +1,193 @@
+///////////////////////////////////////////////////////////////////////////////
+// staticbatch.cpp
+// ========
+// pre-transforming instances, grouping by material and uploading the batch
+///////////////////////////////////////////////////////////////////////////////
+
+#include "staticbatch.h"
+
+#include <algorithm>
+#include <array>
+#include <map>
+#include <numeric>
+#include <utility>
+
+///////////////////////////////////////////////////
+//	UAddStaticBatchInstance(StaticBatchData&, const MeshData&, const glm::mat4&, int)
+//
+//	mesh: object space geometry, as UReadbackMesh() gives it
+//	model: the instance's model matrix
+//	material: index the caller draws the triangles with
+//
+//	Appends the mesh moved into world space: positions by
+//	model, normals by its inverse transpose. Lightmap
+//	coords start at 0 until the lightmap UVs are unwrapped
+//	and occlusion at 1 until it is baked.
+///////////////////////////////////////////////////
+void UAddStaticBatchInstance(StaticBatchData& batch, const MeshData& mesh, const glm::mat4& model, int material)
+{
+	const glm::mat3 normalMatrix = glm::transpose(glm::inverse(glm::mat3(model)));
+	const GLuint firstVertex = GLuint(batch.VertexCount());
+	for (size_t v = 0; v < mesh.VertexCount(); ++v)
+	{
+		const GLfloat* source = &mesh.vertices[v * floatsPerMeshVertex];
+		const glm::vec3 position = glm::vec3(model * glm::vec4(source[0], source[1], source[2], 1.0f));
+		glm::vec3 normal = normalMatrix * glm::vec3(source[3], source[4], source[5]);
+		const float length = glm::length(normal);
+		if (length > 0.0f)
+			normal /= length;
+		batch.vertices.insert(batch.vertices.end(), { position.x, position.y, position.z, normal.x, normal.y, normal.z, source[6], source[7], 0.0f, 0.0f, 0.0f, 1.0f });
+	}
+	for (GLuint index : mesh.indices)
+		batch.indices.push_back(firstVertex + index);
+	batch.triangleMaterials.insert(batch.triangleMaterials.end(), mesh.TriangleCount(), material);
+	batch.triangleInstances.insert(batch.triangleInstances.end(), mesh.TriangleCount(), GLuint(batch.instances));
+	batch.instances++;
+}
+
+///////////////////////////////////////////////////
+//	USubdivideStaticBatch(StaticBatchData&, float)
+//
+//	maxEdge: world units no triangle edge may exceed
+//
+//	Splits triangles at the midpoint of their longest
+//	edge until every edge fits, so large flat faces (the
+//	floor is one quad) have vertices close enough together
+//	for per vertex data to vary across them. Midpoints
+//	are shared by the triangles on either side of an edge
+//	and take the average of its two vertices.
+///////////////////////////////////////////////////
+void USubdivideStaticBatch(StaticBatchData& batch, float maxEdge)
+{
+	std::map<std::pair<GLuint, GLuint>, GLuint> midpoints;
+	auto midpoint = [&](GLuint a, GLuint b)
+	{
+		const std::pair<GLuint, GLuint> edge(std::min(a, b), std::max(a, b));
+		auto found = midpoints.find(edge);
+		if (found != midpoints.end())
+			return found->second;
+		const GLuint vertex = GLuint(batch.VertexCount());
+		for (GLuint f = 0; f < floatsPerBatchVertex; ++f)
+			batch.vertices.push_back(0.5f * (batch.vertices[size_t(a) * floatsPerBatchVertex + f] + batch.vertices[size_t(b) * floatsPerBatchVertex + f]));
+		const glm::vec3 normal = batch.Normal(vertex);
+		const float length = glm::length(normal);
+		if (length > 0.0f)
+		{
+			for (int c = 0; c < 3; ++c)
+				batch.vertices[size_t(vertex) * floatsPerBatchVertex + 3 + c] /= length;
+		}
+		midpoints.emplace(edge, vertex);
+		return vertex;
+	};
+
+	std::vector<GLuint> indices;
+	std::vector<int> materials;
+	std::vector<GLuint> instances;
+	std::vector<std::array<GLuint, 3>> pending;
+	for (size_t t = 0; t < batch.TriangleCount(); ++t)
+	{
+		pending.push_back({ batch.indices[t * 3], batch.indices[t * 3 + 1], batch.indices[t * 3 + 2] });
+		while (!pending.empty())
+		{
+			const std::array<GLuint, 3> triangle = pending.back();
+			pending.pop_back();
+			int longest = 0;
+			float longestLength = 0.0f;
+			for (int e = 0; e < 3; ++e)
+			{
+				const float length = glm::length(batch.Position(triangle[(e + 1) % 3]) - batch.Position(triangle[e]));
+				if (length > longestLength)
+				{
+					longest = e;
+					longestLength = length;
+				}
+			}
+			if (longestLength <= maxEdge)
+			{
+				indices.insert(indices.end(), triangle.begin(), triangle.end());
+				materials.push_back(batch.triangleMaterials[t]);
+				instances.push_back(batch.triangleInstances[t]);
+				continue;
+			}
+
+			// corners a, b along the longest edge and c opposite, in winding order
+			const GLuint a = triangle[longest], b = triangle[(longest + 1) % 3], c = triangle[(longest + 2) % 3];
+			const GLuint middle = midpoint(a, b);
+			pending.push_back({ a, middle, c });
+			pending.push_back({ middle, b, c });
+		}
+	}
+	batch.indices.swap(indices);
+	batch.triangleMaterials.swap(materials);
+	batch.triangleInstances.swap(instances);
+}
+
+// Groups the triangles by material, keeping their order within one, and fills in the ranges
+void USortStaticBatch(StaticBatchData& batch)
+{
+	std::vector<size_t> order(batch.TriangleCount());
+	std::iota(order.begin(), order.end(), size_t(0));
+	std::stable_sort(order.begin(), order.end(), [&](size_t a, size_t b) { return batch.triangleMaterials[a] < batch.triangleMaterials[b]; });
+
+	std::vector<GLuint> indices(batch.indices.size());
+	std::vector<int> materials(order.size());
+	std::vector<GLuint> instances(order.size());
+	batch.ranges.clear();
+	for (size_t i = 0; i < order.size(); ++i)
+	{
+		std::copy_n(&batch.indices[order[i] * 3], 3, &indices[i * 3]);
+		materials[i] = batch.triangleMaterials[order[i]];
+		instances[i] = batch.triangleInstances[order[i]];
+		if (batch.ranges.empty() || batch.ranges.back().material != materials[i])
+			batch.ranges.push_back({ materials[i], GLuint(i * 3), 0 });
+		batch.ranges.back().count += 3;
+	}
+	batch.indices.swap(indices);
+	batch.triangleMaterials.swap(materials);
+	batch.triangleInstances.swap(instances);
+}
+
+// Three world space corners per triangle, in index order, for UBuildSceneBVH()
+std::vector<glm::vec3> UStaticBatchTriangles(const StaticBatchData& batch)
+{
+	std::vector<glm::vec3> triangles(batch.indices.size());
+	for (size_t i = 0; i < batch.indices.size(); ++i)
+		triangles[i] = batch.Position(batch.indices[i]);
+	return triangles;
+}
+
+///////////////////////////////////////////////////
+//	UCreateStaticBatch(const StaticBatchData&, GLMesh&)
+//
+//	Stores the batch in a VAO/VBO with the attribute
+//	layout of the meshes in meshes.cpp plus the lightmap
+//	coords and layer and the occlusion. Draw each range with
+//
+//	glDrawElements(GL_TRIANGLES, range.count, GL_UNSIGNED_INT, (void*)(sizeof(GLuint) * range.firstIndex));
+///////////////////////////////////////////////////
+void UCreateStaticBatch(const StaticBatchData& batch, Meshes::GLMesh& mesh)
+{
+	mesh.nVertices = (GLuint)batch.VertexCount();
+	mesh.nIndices = (GLuint)batch.indices.size();
+
+	glGenVertexArrays(1, &mesh.vao);
+	glBindVertexArray(mesh.vao);
+	glGenBuffers(2, mesh.vbos);
+	glBindBuffer(GL_ARRAY_BUFFER, mesh.vbos[0]);
+	glBufferData(GL_ARRAY_BUFFER, sizeof(GLfloat) * batch.vertices.size(), batch.vertices.data(), GL_STATIC_DRAW);
+	glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, mesh.vbos[1]);
+	glBufferData(GL_ELEMENT_ARRAY_BUFFER, sizeof(GLuint) * batch.indices.size(), batch.indices.data(), GL_STATIC_DRAW);
+
+	// position, normal, texture coords, lightmap coords and layer, occlusion
+	const GLint stride = sizeof(GLfloat) * floatsPerBatchVertex;
+	const GLint sizes[] = { 3, 3, 2, 3, 1 };
+	GLuint offset = 0;
+	for (GLuint attribute = 0; attribute < 5; ++attribute)
+	{
+		glVertexAttribPointer(attribute, sizes[attribute], GL_FLOAT, GL_FALSE, stride, (void*)(sizeof(GLfloat) * offset));
+		glEnableVertexAttribArray(attribute);
+		offset += sizes[attribute];
+	}
+
+	glBindVertexArray(0);
+}
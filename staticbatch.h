@@ -0,0 +1,59 @@
+///////////////////////////////////////////////////////////////////////////////
+// staticbatch.h
+// ========
+// the scene's static objects merged into one vertex and index buffer:
+// every instance is transformed into world space once at load, and the
+// triangles are grouped by material so the whole batch draws with one
+// glDrawElements per material and an identity model matrix. Vertices carry
+// baked data after the usual attributes: lightmap coords (a second texture
+// coordinate and the atlas, a texture array layer, it points into) and the
+// ambient occlusion of the vertex.
+///////////////////////////////////////////////////////////////////////////////
+
+#ifndef STATICBATCH_H
+#define STATICBATCH_H
+
+#include <GL/glew.h>
+#include <vector>
+
+#include <glm/glm.hpp>
+
+#include "meshdata.h"
+
+// Interleaved batch vertex: the floatsPerMeshVertex attributes of meshdata.h,
+// then lightmap coords and layer (3) at attribute location 3 and ambient
+// occlusion (1, 1 for unoccluded) at location 4
+const GLuint floatsPerBatchVertex = 12;
+const GLuint batchLightmapOffset = 8;
+const GLuint batchOcclusionOffset = 11;
+
+// The triangles of one material, contiguous in the index buffer
+struct StaticBatchRange
+{
+	int material;
+	GLuint firstIndex;
+	GLsizei count;		// indices
+};
+
+struct StaticBatchData
+{
+	std::vector<GLfloat> vertices;		// floatsPerBatchVertex per vertex, world space
+	std::vector<GLuint> indices;		// three per triangle, grouped by material after USortStaticBatch()
+	std::vector<int> triangleMaterials;	// per triangle
+	std::vector<GLuint> triangleInstances;	// per triangle, in the order the instances were added
+	std::vector<StaticBatchRange> ranges;
+	size_t instances = 0;
+
+	size_t VertexCount() const { return vertices.size() / floatsPerBatchVertex; }
+	size_t TriangleCount() const { return indices.size() / 3; }
+	glm::vec3 Position(GLuint vertex) const { return glm::vec3(vertices[size_t(vertex) * floatsPerBatchVertex], vertices[size_t(vertex) * floatsPerBatchVertex + 1], vertices[size_t(vertex) * floatsPerBatchVertex + 2]); }
+	glm::vec3 Normal(GLuint vertex) const { return glm::vec3(vertices[size_t(vertex) * floatsPerBatchVertex + 3], vertices[size_t(vertex) * floatsPerBatchVertex + 4], vertices[size_t(vertex) * floatsPerBatchVertex + 5]); }
+};
+
+void UAddStaticBatchInstance(StaticBatchData& batch, const MeshData& mesh, const glm::mat4& model, int material);
+void USubdivideStaticBatch(StaticBatchData& batch, float maxEdge);
+void USortStaticBatch(StaticBatchData& batch);
+std::vector<glm::vec3> UStaticBatchTriangles(const StaticBatchData& batch);
+void UCreateStaticBatch(const StaticBatchData& batch, Meshes::GLMesh& mesh);
+
+#endif
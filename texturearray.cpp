@@ -0,0 +1,647 @@
+///////////////////////////////////////////////////////////////////////////////
+// texturearray.cpp
+// ========
+// loading material textures into size/format matched texture arrays. The
+// arrays are created up front filled with a placeholder colour; images are
+// then read asynchronously (see asyncio.h), decoded on worker threads
+// straight into a persistently mapped pixel unpack buffer and copied into
+// their layers as they finish.
+///////////////////////////////////////////////////////////////////////////////
+
+#include "texturearray.h"
+#include "texturecook.h"
+#include "imagekernels.h"
+#include "blockcompress.h"
+#include "asyncio.h"
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cmath>
+#include <cstring>
+#include <iostream>
+#include <memory>
+#include <string>
+#include <unordered_map>
+
+#include <stb_image.h>
+
+namespace
+{
+	// Mid grey, shown until a layer's pixels arrive
+	const unsigned char placeholderColor[4] = { 128, 128, 128, 255 };
+	const size_t stagingAlignment = 64;
+	// Leading bytes of a texture file compared to find duplicates; covers the image header
+	const size_t textureKeyBytes = 256;
+
+	enum UploadState
+	{
+		UPLOAD_PENDING,
+		UPLOAD_READY,
+		UPLOAD_FAILED,
+		UPLOAD_DONE
+	};
+
+	// Names a texture file without reading all of it: the name it is stored under
+	// (see UPackEntryName), its size and its header, so the same file spelled two
+	// ways loads once while every file is still only read in the background
+	uint64_t UTextureFileKey(const char* filename, const AssetFile& source)
+	{
+		const std::string name = UPackEntryName(filename);
+		const uint64_t key = UHashBytes(name.data(), name.size(), source.Size());
+		return UHashBytes(source.Data(), std::min(source.Size(), textureKeyBytes), key);
+	}
+
+	size_t UAlignStaging(size_t offset)
+	{
+		return (offset + stagingAlignment - 1) / stagingAlignment * stagingAlignment;
+	}
+
+	// Bytes of one layer of a level, as stored by the driver
+	size_t UArrayLevelSize(GLenum internalFormat, GLsizei width, GLsizei height)
+	{
+		switch (internalFormat)
+		{
+		case GL_COMPRESSED_RGB_S3TC_DXT1_EXT: return UCompressedSize(BlockFormat::BC1, width, height);
+		case GL_COMPRESSED_RGBA_BPTC_UNORM: return UCompressedSize(BlockFormat::BC7, width, height);
+		default: return size_t(width) * height * 4;
+		}
+	}
+
+	// One block of the placeholder colour in a compressed array format
+	void UPlaceholderBlock(GLenum internalFormat, std::vector<unsigned char>& block)
+	{
+		unsigned char pixels[64];
+		for (int i = 0; i < 16; ++i)
+			memcpy(pixels + i * 4, placeholderColor, 4);
+
+		if (internalFormat == GL_COMPRESSED_RGBA_BPTC_UNORM)
+		{
+			block.resize(16);
+			UEncodeBC7Block(pixels, block.data());
+			return;
+		}
+		block.resize(8);
+		UEncodeBC1Block(pixels, block.data());
+	}
+}
+
+// Decode and upload state for the layers still streaming in
+struct TextureLoader
+{
+	struct Level
+	{
+		size_t offset;	// into the staging buffer
+		size_t size;
+		GLsizei width, height;
+	};
+
+	struct Upload
+	{
+		std::string path;
+		std::unique_ptr<CookedTexture> cooked;	// null: decode path with stb_image
+		GLint array = -1;
+		GLint layer = -1;
+		int channels = 0;
+		GLenum format = 0;
+		GLenum internalFormat = 0;
+		bool compress = false;	// decode path: block compress after building the mips
+		std::vector<Level> levels;
+		size_t firstLevel = 0;	// finer levels are left to texture streaming
+
+		std::atomic<int> state{ UPLOAD_PENDING };
+	};
+
+	std::vector<std::unique_ptr<Upload>> uploads;
+	std::unique_ptr<AsyncIO> io;
+	GLuint stagingBuffer = 0;
+	unsigned char* staging = nullptr;
+	GLsync fence = nullptr;
+	size_t remaining = 0;
+	size_t cookedCount = 0;
+	std::chrono::steady_clock::time_point start;
+
+	~TextureLoader()
+	{
+		io.reset(); // finish any decode still writing into the staging buffer
+		if (fence)
+			glDeleteSync(fence);
+		if (stagingBuffer)
+			glDeleteBuffers(1, &stagingBuffer);
+	}
+};
+
+namespace
+{
+	// Load coroutine: fills the upload's staging range, cooked levels by
+	// copy, images by reading the file, then on a worker decoding to RGBA,
+	// flipping and building the mip chain (then block compressing it, if
+	// asked to)
+	AsyncTask UDecodeUpload(AsyncIO& io, TextureLoader::Upload& upload, unsigned char* staging)
+	{
+		if (upload.cooked)
+		{
+			for (size_t level = upload.firstLevel; level < upload.levels.size(); ++level)
+				memcpy(staging + upload.levels[level].offset, upload.cooked->LevelData((uint32_t)level), upload.levels[level].size);
+			upload.cooked.reset(); // done with the mapping
+			upload.state.store(UPLOAD_READY, std::memory_order_release);
+			co_return;
+		}
+
+		AsyncBuffer file;
+		int channels;
+		std::vector<ImageLevel> levels;
+		if (!co_await io.ReadFile(upload.path.c_str(), file) || !UDecodeTextureFromMemory(file.Data(), file.Size(), channels, levels)
+			|| levels[0].width != upload.levels[0].width || levels[0].height != upload.levels[0].height || levels.size() != upload.levels.size())
+		{
+			upload.state.store(UPLOAD_FAILED, std::memory_order_release);
+			co_return;
+		}
+		levels.erase(levels.begin(), levels.begin() + upload.firstLevel);
+
+		// the staging buffer may be write combined, so it is only ever written
+		if (upload.compress)
+		{
+			std::vector<std::vector<unsigned char>> blocks;
+			UCompressMipChain(levels, upload.channels == 3 ? BlockFormat::BC1 : BlockFormat::BC7, blocks);
+			for (size_t level = upload.firstLevel; level < upload.levels.size(); ++level)
+				memcpy(staging + upload.levels[level].offset, blocks[level - upload.firstLevel].data(), upload.levels[level].size);
+		}
+		else
+		{
+			for (size_t level = upload.firstLevel; level < upload.levels.size(); ++level)
+				memcpy(staging + upload.levels[level].offset, levels[level - upload.firstLevel].pixels.data(), upload.levels[level].size);
+		}
+		upload.state.store(UPLOAD_READY, std::memory_order_release);
+	}
+}
+
+///////////////////////////////////////////////////
+//	UCreateTextureArrays(const std::vector<const char*>&, const TextureArrayOptions&, TextureArraySet&, std::vector<TextureRef>&)
+//
+//	filenames: images to load, one per material
+//	options: bindless, block compression and streaming choices
+//	set: receives one texture array per distinct size and format
+//	refs: receives where each file ended up, in filename order
+//
+//	Files named more than once (by the same normalised path,
+//	with the same size and header) are loaded once and share
+//	a layer; their refs carry the id of the first of them.
+//
+//	Every image with the same width, height and format becomes a
+//	layer of the same array, with a full mip chain. Only headers
+//	are read here: the arrays start out filled with a placeholder
+//	and the pixels are decoded (and mipmapped, see
+//	UBuildMipChain) in the background, then copied in by
+//	UUpdateTextureArrays(). A cooked container next to the
+//	image (see UCookedTexturePath) is used instead when there is
+//	one; its levels only need copying.
+//
+//	With options.streamed only the levels up to
+//	streamedResidentSize are loaded; the larger ones are
+//	marked in TextureArray::streamedLevels for a
+//	TextureStreamer to page in and out. Where the driver has
+//	ARB_sparse_texture for the format, those levels are not
+//	backed by memory until they are committed.
+///////////////////////////////////////////////////
+bool UCreateTextureArrays(const std::vector<const char*>& filenames, const TextureArrayOptions& options, TextureArraySet& set, std::vector<TextureRef>& refs)
+{
+	std::shared_ptr<TextureLoader> loader = std::make_shared<TextureLoader>();
+	loader->start = std::chrono::steady_clock::now();
+
+	// Read each texture's size, format and level sizes
+	std::vector<size_t> uploadOf(filenames.size());	// filename -> upload
+	std::vector<size_t> firstFile;					// upload -> filename
+	std::unordered_map<uint64_t, size_t> uploadByFile;
+	for (size_t f = 0; f < filenames.size(); ++f)
+	{
+		const char* filename = filenames[f];
+		AssetFile source;
+		const uint64_t fileKey = source.Open(filename) ? UTextureFileKey(filename, source) : 0;
+		auto duplicate = uploadByFile.find(fileKey);
+		if (fileKey && duplicate != uploadByFile.end())
+		{
+			uploadOf[f] = duplicate->second;
+			continue;
+		}
+		if (fileKey)
+			uploadByFile[fileKey] = loader->uploads.size();
+		uploadOf[f] = loader->uploads.size();
+		firstFile.push_back(f);
+
+		std::unique_ptr<TextureLoader::Upload> upload(new TextureLoader::Upload);
+		upload->path = filename;
+
+		std::unique_ptr<CookedTexture> cooked(new CookedTexture);
+		if (UOpenCookedTexture(UCookedTexturePath(filename).c_str(), *cooked))
+		{
+			for (uint32_t level = 0; level < cooked->header->levels; ++level)
+			{
+				const CookedTextureLevel& data = cooked->levels[level];
+				upload->levels.push_back({ 0, (size_t)data.size, (GLsizei)data.width, (GLsizei)data.height });
+			}
+			upload->format = cooked->header->format;
+			upload->internalFormat = cooked->header->internalFormat;
+			upload->cooked = std::move(cooked);
+			++loader->cookedCount;
+		}
+		else
+		{
+			int width, height, channels;
+			if (!source.IsOpen() || !stbi_info_from_memory(source.Data(), (int)source.Size(), &width, &height, &channels))
+			{
+				std::cout << "Failed to load texture " << filename << std::endl;
+				return false;
+			}
+			if (channels != 3 && channels != 4)
+			{
+				std::cout << "Not implemented to handle image with " << channels << " channels" << std::endl;
+				return false;
+			}
+			// decoded as RGBA with a full mip chain
+			const BlockFormat blockFormat = channels == 3 ? BlockFormat::BC1 : BlockFormat::BC7;
+			upload->channels = channels;
+			upload->format = GL_RGBA;
+			upload->internalFormat = options.compress ? UBlockFormatGL(blockFormat) : GL_RGBA8;
+			upload->compress = options.compress;
+			for (;;)
+			{
+				const size_t size = options.compress ? UCompressedSize(blockFormat, width, height) : size_t(width) * height * 4;
+				upload->levels.push_back({ 0, size, width, height });
+				if (width == 1 && height == 1)
+					break;
+				width = std::max(1, width / 2);
+				height = std::max(1, height / 2);
+			}
+		}
+		loader->uploads.push_back(std::move(upload));
+	}
+
+	// Group images by size and format; each group becomes one array
+	set.arrays.clear();
+	std::vector<TextureRef> layers(loader->uploads.size());
+	for (size_t i = 0; i < loader->uploads.size(); ++i)
+	{
+		const TextureLoader::Upload& upload = *loader->uploads[i];
+		size_t a = 0;
+		while (a < set.arrays.size() && !(set.arrays[a].width == upload.levels[0].width && set.arrays[a].height == upload.levels[0].height && set.arrays[a].internalFormat == upload.internalFormat))
+			++a;
+		if (a == set.arrays.size())
+		{
+			TextureArray array;
+			array.width = upload.levels[0].width;
+			array.height = upload.levels[0].height;
+			array.internalFormat = upload.internalFormat;
+			set.arrays.push_back(array);
+		}
+		layers[i].id = (GLint)firstFile[i];
+		layers[i].array = (GLint)a;
+		layers[i].layer = set.arrays[a].layers++;
+		loader->uploads[i]->array = layers[i].array;
+		loader->uploads[i]->layer = layers[i].layer;
+	}
+
+	set.bindless = options.allowBindless && GLEW_ARB_bindless_texture;
+	if (!set.bindless && (GLint)set.arrays.size() > maxTextureArrays)
+	{
+		std::cout << "Too many texture sizes/formats (" << set.arrays.size() << ") for " << maxTextureArrays << " texture array units" << std::endl;
+		set.arrays.clear();
+		return false;
+	}
+
+	for (TextureArray& array : set.arrays)
+	{
+		array.levels = (GLsizei)std::floor(std::log2((double)std::max(array.width, array.height))) + 1;
+
+		// Levels larger than the resident size are streamed
+		if (options.streamed)
+		{
+			while (array.streamedLevels < array.levels - 1 && std::max(array.width >> array.streamedLevels, array.height >> array.streamedLevels) > streamedResidentSize)
+				++array.streamedLevels;
+			GLint pageSizes = 0;
+			if (GLEW_ARB_sparse_texture && array.streamedLevels > 0)
+				glGetInternalformativ(GL_TEXTURE_2D_ARRAY, array.internalFormat, GL_NUM_VIRTUAL_PAGE_SIZES_ARB, 1, &pageSizes);
+			array.sparse = pageSizes > 0;
+		}
+
+		glGenTextures(1, &array.texture);
+		glBindTexture(GL_TEXTURE_2D_ARRAY, array.texture);
+		if (array.sparse)
+			glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_SPARSE_ARB, GL_TRUE);
+		glTexStorage3D(GL_TEXTURE_2D_ARRAY, array.levels, array.internalFormat, array.width, array.height, array.layers);
+
+		// set the texture wrapping parameters
+		glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_WRAP_S, GL_REPEAT);
+		glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_WRAP_T, GL_REPEAT);
+		// set texture filtering parameters: trilinear, so the mip chain (and the
+		// shaders' uMaterialMinLod clamp above streamed out levels) is used
+		glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MIN_FILTER, GL_LINEAR_MIPMAP_LINEAR);
+		glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+
+		// The sparse mip tail is committed as a whole, so its levels can
+		// never be streamed out; commit the always resident levels
+		if (array.sparse)
+		{
+			GLint tailLevel = array.levels;
+			glGetTexParameteriv(GL_TEXTURE_2D_ARRAY, GL_NUM_SPARSE_LEVELS_ARB, &tailLevel);
+			array.streamedLevels = std::min(array.streamedLevels, tailLevel);
+			for (GLint level = array.streamedLevels; level < array.levels; ++level)
+				glTexPageCommitmentARB(GL_TEXTURE_2D_ARRAY, level, 0, 0, 0, std::max(1, array.width >> level), std::max(1, array.height >> level), array.layers, GL_TRUE);
+		}
+
+		// Placeholder in every level and layer until the real pixels land
+		const GLint firstLevel = array.sparse ? array.streamedLevels : 0;
+		if (array.internalFormat == GL_RGB8 || array.internalFormat == GL_RGBA8)
+		{
+			for (GLint level = firstLevel; level < array.levels; ++level)
+				glClearTexImage(array.texture, level, GL_RGBA, GL_UNSIGNED_BYTE, placeholderColor);
+		}
+		else
+		{
+			std::vector<unsigned char> block, blocks;
+			UPlaceholderBlock(array.internalFormat, block);
+			for (GLint level = firstLevel; level < array.levels; ++level)
+			{
+				const GLsizei width = std::max(1, array.width >> level), height = std::max(1, array.height >> level);
+				const size_t blockCount = size_t((width + 3) / 4) * ((height + 3) / 4) * array.layers;
+				blocks.resize(blockCount * block.size());
+				for (size_t b = 0; b < blockCount; ++b)
+					memcpy(&blocks[b * block.size()], block.data(), block.size());
+				glCompressedTexSubImage3D(GL_TEXTURE_2D_ARRAY, level, 0, 0, 0, width, height, array.layers, array.internalFormat, (GLsizei)blocks.size(), blocks.data());
+			}
+		}
+		glBindTexture(GL_TEXTURE_2D_ARRAY, 0);
+
+		// The handle freezes the texture's state, so it is taken last
+		if (set.bindless)
+		{
+			array.handle = glGetTextureHandleARB(array.texture);
+			glMakeTextureHandleResidentARB(array.handle);
+		}
+
+		if (options.registry)
+		{
+			size_t bytes = 0;
+			for (GLint level = 0; level < array.levels; ++level)
+				bytes += UArrayLevelSize(array.internalFormat, std::max(1, array.width >> level), std::max(1, array.height >> level));
+			const std::string label = "texture array " + std::to_string(array.width) + "x" + std::to_string(array.height) + "x" + std::to_string(array.layers);
+			array.resource = URegisterResource(*options.registry, ResourceType::Texture, array.texture, bytes * array.layers, label.c_str());
+		}
+	}
+	set.registry = options.registry;
+	for (TextureRef& layer : layers)
+	{
+		layer.handle = set.arrays[layer.array].handle;
+		layer.minLod = (float)set.arrays[layer.array].streamedLevels;
+	}
+	refs.resize(filenames.size());
+	for (size_t f = 0; f < filenames.size(); ++f)
+		refs[f] = layers[uploadOf[f]];
+
+	// Lay out the staging ranges of the levels loaded up front
+	size_t stagingSize = 0;
+	for (auto& upload : loader->uploads)
+	{
+		upload->firstLevel = std::min(upload->levels.size() - 1, (size_t)set.arrays[upload->array].streamedLevels);
+		for (size_t level = upload->firstLevel; level < upload->levels.size(); ++level)
+		{
+			upload->levels[level].offset = stagingSize;
+			stagingSize = UAlignStaging(stagingSize + upload->levels[level].size);
+		}
+	}
+
+	// Persistently mapped staging buffer the workers decode into
+	const GLbitfield mapFlags = GL_MAP_WRITE_BIT | GL_MAP_PERSISTENT_BIT | GL_MAP_COHERENT_BIT;
+	glGenBuffers(1, &loader->stagingBuffer);
+	glBindBuffer(GL_PIXEL_UNPACK_BUFFER, loader->stagingBuffer);
+	glBufferStorage(GL_PIXEL_UNPACK_BUFFER, std::max<size_t>(stagingSize, 1), nullptr, mapFlags);
+	loader->staging = (unsigned char*)glMapBufferRange(GL_PIXEL_UNPACK_BUFFER, 0, std::max<size_t>(stagingSize, 1), mapFlags);
+	glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+	if (!loader->staging)
+	{
+		std::cout << "Failed to map the texture staging buffer" << std::endl;
+		UDestroyTextureArrays(set);
+		refs.clear();
+		return false;
+	}
+
+	loader->remaining = loader->uploads.size();
+	loader->io.reset(new AsyncIO(std::min<unsigned>(UWorkerCount(), (unsigned)loader->uploads.size())));
+	for (auto& upload : loader->uploads)
+		loader->io->Start(UDecodeUpload(*loader->io, *upload, loader->staging));
+	set.loader = loader;
+
+	double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - loader->start).count();
+	std::cout << "INFO: Created " << set.arrays.size() << " texture arrays for " << refs.size() << " textures"
+		<< (refs.size() > layers.size() ? " (" + std::to_string(refs.size() - layers.size()) + " duplicates shared)" : std::string())
+		<< (set.bindless ? " (bindless)" : "") << " in " << seconds * 1000.0 << " ms; pixels are streaming in"
+		<< (loader->io->UsingIoUring() ? " through io_uring" : "") << std::endl;
+	return true;
+}
+
+///////////////////////////////////////////////////
+//	UUpdateTextureArrays(TextureArraySet&)
+//
+//	Called once per frame on the GL thread. Copies every
+//	layer the workers have finished from the staging
+//	buffer into its array (the copy runs on the GPU, the
+//	call returns immediately). Once all layers are in and
+//	the GPU has consumed the staging buffer, it is released.
+//	Returns true while textures are still arriving.
+///////////////////////////////////////////////////
+bool UUpdateTextureArrays(TextureArraySet& set)
+{
+	TextureLoader* loader = set.loader.get();
+	if (!loader)
+		return false;
+
+	if (loader->remaining > 0)
+	{
+		bool bound = false;
+		for (auto& upload : loader->uploads)
+		{
+			const int state = upload->state.load(std::memory_order_acquire);
+			if (state == UPLOAD_FAILED)
+			{
+				std::cout << "Failed to load texture " << upload->path << std::endl;
+				upload->state.store(UPLOAD_DONE, std::memory_order_relaxed);
+				--loader->remaining;
+			}
+			if (state != UPLOAD_READY)
+				continue;
+
+			if (!bound)
+			{
+				glBindBuffer(GL_PIXEL_UNPACK_BUFFER, loader->stagingBuffer);
+				glPixelStorei(GL_UNPACK_ALIGNMENT, 1); // levels are packed tightly
+				bound = true;
+			}
+			const TextureArray& array = set.arrays[upload->array];
+			glBindTexture(GL_TEXTURE_2D_ARRAY, array.texture);
+			for (size_t level = upload->firstLevel; level < upload->levels.size(); ++level)
+			{
+				const TextureLoader::Level& data = upload->levels[level];
+				if (array.internalFormat != GL_RGB8 && array.internalFormat != GL_RGBA8)
+					glCompressedTexSubImage3D(GL_TEXTURE_2D_ARRAY, (GLint)level, 0, 0, upload->layer, data.width, data.height, 1, array.internalFormat, (GLsizei)data.size, (const void*)data.offset);
+				else
+					glTexSubImage3D(GL_TEXTURE_2D_ARRAY, (GLint)level, 0, 0, upload->layer, data.width, data.height, 1, upload->format, GL_UNSIGNED_BYTE, (const void*)data.offset);
+			}
+			upload->state.store(UPLOAD_DONE, std::memory_order_relaxed);
+			--loader->remaining;
+		}
+
+		if (bound)
+		{
+			glPixelStorei(GL_UNPACK_ALIGNMENT, 4);
+			glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+			glBindTexture(GL_TEXTURE_2D_ARRAY, 0);
+		}
+
+		if (loader->remaining == 0)
+		{
+			loader->fence = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+			double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - loader->start).count();
+			std::cout << "INFO: Streamed " << loader->uploads.size() << " textures (" << loader->cookedCount << " cooked) in "
+				<< seconds * 1000.0 << " ms" << std::endl;
+		}
+		return true;
+	}
+
+	// Keep the staging buffer until the GPU has finished reading it
+	if (glClientWaitSync(loader->fence, 0, 0) == GL_TIMEOUT_EXPIRED)
+		return true;
+	set.loader.reset();
+	return false;
+}
+
+void UDestroyTextureArrays(TextureArraySet& set)
+{
+	set.loader.reset();
+	for (TextureArray& array : set.arrays)
+	{
+		if (array.handle)
+			glMakeTextureHandleNonResidentARB(array.handle);
+		if (set.registry && array.resource.Valid())
+			UReleaseResource(*set.registry, array.resource);
+		else if (array.texture)
+			glDeleteTextures(1, &array.texture);
+	}
+	set.arrays.clear();
+}
+
+///////////////////////////////////////////////////
+//	UTextureArrayShaderHeader(bool)
+//
+//	Lines that must follow #version in a fragment shader
+//	using UTextureArrayShaderSource(bindless)
+///////////////////////////////////////////////////
+const char* UTextureArrayShaderHeader(bool bindless)
+{
+	return bindless ? "#extension GL_ARB_bindless_texture : require\n" : "";
+}
+
+///////////////////////////////////////////////////
+//	UTextureArrayShaderSource(bool)
+//
+//	Defines vec4 sampleMaterial(vec2 uv), which reads the
+//	current material's layer from its texture array. Levels
+//	finer than uMaterialMinLod may not be resident, so the
+//	lookup is clamped to it while it is above zero.
+//
+//	Also defines uint materialFeedback(vec2 uv, float lodBias)
+//	for the texture feedback pass: the material id and the
+//	mip level the lookup wants, packed as in
+//	UPackTextureFeedback (texturefeedback.h).
+///////////////////////////////////////////////////
+const char* UTextureArrayShaderSource(bool bindless)
+{
+	if (bindless)
+	{
+		return
+			"uniform uvec2 uMaterialHandle;\n"
+			"uniform int uMaterialLayer;\n"
+			"uniform float uMaterialMinLod;\n"
+			"uniform int uMaterialId;\n"
+			"vec4 sampleMaterial(vec2 uv)\n"
+			"{\n"
+			"	vec3 coord = vec3(uv, float(uMaterialLayer));\n"
+			"	if (uMaterialMinLod > 0.0)\n"
+			"		return textureLod(sampler2DArray(uMaterialHandle), coord, max(textureQueryLod(sampler2DArray(uMaterialHandle), uv).x, uMaterialMinLod));\n"
+			"	return texture(sampler2DArray(uMaterialHandle), coord);\n"
+			"}\n"
+			"uint materialFeedback(vec2 uv, float lodBias)\n"
+			"{\n"
+			"	float lod = textureQueryLod(sampler2DArray(uMaterialHandle), uv).y + lodBias;\n"
+			"	return (uint(uMaterialId + 1) << 8) | uint(clamp(lod, 0.0, 255.0));\n"
+			"}\n";
+	}
+	return
+		"uniform sampler2DArray uTextureArrays[4];\n"
+		"uniform int uMaterialArray;\n"
+		"uniform int uMaterialLayer;\n"
+		"uniform float uMaterialMinLod;\n"
+		"uniform int uMaterialId;\n"
+		"vec4 sampleMaterial(vec2 uv)\n"
+		"{\n"
+		"	vec3 coord = vec3(uv, float(uMaterialLayer));\n"
+		"	if (uMaterialMinLod > 0.0)\n"
+		"		return textureLod(uTextureArrays[uMaterialArray], coord, max(textureQueryLod(uTextureArrays[uMaterialArray], uv).x, uMaterialMinLod));\n"
+		"	return texture(uTextureArrays[uMaterialArray], coord);\n"
+		"}\n"
+		"uint materialFeedback(vec2 uv, float lodBias)\n"
+		"{\n"
+		"	float lod = textureQueryLod(uTextureArrays[uMaterialArray], uv).y + lodBias;\n"
+		"	return (uint(uMaterialId + 1) << 8) | uint(clamp(lod, 0.0, 255.0));\n"
+		"}\n";
+}
+
+///////////////////////////////////////////////////
+//	UGetMaterialUniforms(GLuint, const TextureArraySet&)
+//
+//	Looks up the material uniforms and points the array
+//	samplers at their texture units. The program must be
+//	in use.
+///////////////////////////////////////////////////
+MaterialUniforms UGetMaterialUniforms(GLuint programId, const TextureArraySet& set)
+{
+	MaterialUniforms uniforms;
+	uniforms.layer = glGetUniformLocation(programId, "uMaterialLayer");
+	uniforms.minLod = glGetUniformLocation(programId, "uMaterialMinLod");
+	uniforms.id = glGetUniformLocation(programId, "uMaterialId");
+	if (set.bindless)
+	{
+		uniforms.handle = glGetUniformLocation(programId, "uMaterialHandle");
+	}
+	else
+	{
+		uniforms.arrayIndex = glGetUniformLocation(programId, "uMaterialArray");
+		const GLint units[maxTextureArrays] = { 0, 1, 2, 3 };
+		glUniform1iv(glGetUniformLocation(programId, "uTextureArrays"), maxTextureArrays, units);
+	}
+	return uniforms;
+}
+
+// Binds every array to its texture unit; nothing to do with bindless handles
+void UBindTextureArrays(const TextureArraySet& set)
+{
+	if (set.bindless)
+		return;
+	for (size_t a = 0; a < set.arrays.size(); ++a)
+	{
+		glActiveTexture(GL_TEXTURE0 + (GLenum)a);
+		glBindTexture(GL_TEXTURE_2D_ARRAY, set.arrays[a].texture);
+	}
+	glActiveTexture(GL_TEXTURE0);
+}
+
+// Selects the material for the next draws: a few small uniform updates, no binds
+void USetMaterial(const MaterialUniforms& uniforms, const TextureRef& texture)
+{
+	if (uniforms.handle >= 0)
+		glUniform2ui(uniforms.handle, (GLuint)(texture.handle & 0xFFFFFFFFu), (GLuint)(texture.handle >> 32));
+	else
+		glUniform1i(uniforms.arrayIndex, texture.array);
+	glUniform1i(uniforms.layer, texture.layer);
+	glUniform1f(uniforms.minLod, texture.minLod);
+	glUniform1i(uniforms.id, texture.id);
+}
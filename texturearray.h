@@ -0,0 +1,91 @@
+///////////////////////////////////////////////////////////////////////////////
+// texturearray.h
+// ========
+// material textures packed into GL_TEXTURE_2D_ARRAYs, one array per distinct
+// size and format, so changing material between draws is a uniform update
+// instead of a glBindTexture. Where ARB_bindless_texture is available each
+// array also gets a resident handle that per-object data can carry directly.
+///////////////////////////////////////////////////////////////////////////////
+
+#ifndef TEXTUREARRAY_H
+#define TEXTUREARRAY_H
+
+#include <GL/glew.h>
+#include <memory>
+#include <vector>
+
+#include "resourceregistry.h"
+
+// Texture units 0 .. maxTextureArrays - 1 hold the arrays on the non-bindless path
+const GLint maxTextureArrays = 4;
+
+// Where one material texture lives
+struct TextureRef
+{
+	GLint id = -1;			// position in the filenames (of the first identical file), reported by texture feedback
+	GLint array = -1;		// index into TextureArraySet::arrays (and texture unit)
+	GLint layer = -1;		// layer inside that array
+	GLuint64 handle = 0;	// bindless handle of the array, 0 when bindless is off
+	float minLod = 0.0f;	// finest mip level that may be sampled; raised while levels are streamed out
+};
+
+struct TextureArray
+{
+	GLuint texture = 0;
+	GLsizei width = 0;
+	GLsizei height = 0;
+	GLenum internalFormat = 0;
+	GLsizei layers = 0;
+	GLsizei levels = 0;
+	GLuint64 handle = 0;
+	GLint streamedLevels = 0;	// levels 0 .. streamedLevels - 1 are left to a TextureStreamer
+	bool sparse = false;		// ARB_sparse_texture storage: streamed levels are committed per layer
+	ResourceHandle resource;	// when the set has a registry, which then owns texture
+};
+
+// How UCreateTextureArrays loads the images
+struct TextureArrayOptions
+{
+	bool allowBindless = true;	// use ARB_bindless_texture handles if the driver has them
+	bool compress = false;		// block compress images that are not cooked, BC1 opaque / BC7 alpha
+	bool streamed = false;		// load only the small mips up front and leave the rest to streaming
+	ResourceRegistry* registry = nullptr;	// registers the array textures, which it then deletes
+};
+
+// With streamed arrays, levels no larger than this are always resident
+const GLsizei streamedResidentSize = 128;
+
+// Background decode and upload state, alive until every layer is in (texturearray.cpp)
+struct TextureLoader;
+
+struct TextureArraySet
+{
+	std::vector<TextureArray> arrays;
+	bool bindless = false;
+	std::shared_ptr<TextureLoader> loader;
+	ResourceRegistry* registry = nullptr;
+};
+
+// Material uniforms of a program built with UTextureArrayShaderHeader() and
+// UTextureArrayShaderSource(), which declare vec4 sampleMaterial(vec2 uv) and
+// uint materialFeedback(vec2 uv, float lodBias)
+struct MaterialUniforms
+{
+	GLint arrayIndex = -1;
+	GLint layer = -1;
+	GLint handle = -1;
+	GLint minLod = -1;
+	GLint id = -1;
+};
+
+bool UCreateTextureArrays(const std::vector<const char*>& filenames, const TextureArrayOptions& options, TextureArraySet& set, std::vector<TextureRef>& refs);
+bool UUpdateTextureArrays(TextureArraySet& set);
+void UDestroyTextureArrays(TextureArraySet& set);
+
+const char* UTextureArrayShaderHeader(bool bindless);
+const char* UTextureArrayShaderSource(bool bindless);
+MaterialUniforms UGetMaterialUniforms(GLuint programId, const TextureArraySet& set);
+void UBindTextureArrays(const TextureArraySet& set);
+void USetMaterial(const MaterialUniforms& uniforms, const TextureRef& texture);
+
+#endif
@@ -0,0 +1,219 @@
+///////////////////////////////////////////////////////////////////////////////
+// texturecook.cpp
+// ========
+// writing and mapping cooked texture containers
+///////////////////////////////////////////////////////////////////////////////
+
+#include "texturecook.h"
+#include "imagekernels.h"
+#include "blockcompress.h"
+
+#include <algorithm>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <vector>
+
+#include <stb_image.h>
+
+namespace
+{
+	const uint32_t maxCookedLevels = 16;
+
+	uint64_t UAlignUp(uint64_t value, uint64_t alignment)
+	{
+		return (value + alignment - 1) / alignment * alignment;
+	}
+}
+
+// couch.jpg -> couch.ctex, next to the source image
+std::string UCookedTexturePath(const char* sourcePath)
+{
+	std::string path(sourcePath);
+	size_t dot = path.find_last_of('.');
+	size_t slash = path.find_last_of("/\\");
+	if (dot != std::string::npos && (slash == std::string::npos || dot > slash))
+		path.erase(dot);
+	return path + ".ctex";
+}
+
+///////////////////////////////////////////////////
+//	UDecodeTexture(const char*, int&, std::vector<ImageLevel>&)
+//
+//	path: image stb_image can decode, loose or in a mounted pack
+//	channels: receives the channel count of the image (3 or 4)
+//	mips: receives the full RGBA mip chain, largest first
+//
+//	Widens the image to RGBA, flips it to OpenGL's bottom
+//	up row order and builds every level with sRGB-correct
+//	Kaiser filtering. Prints nothing, so worker threads can
+//	call it; fails on unreadable images and on images that
+//	are not RGB or RGBA.
+///////////////////////////////////////////////////
+bool UDecodeTexture(const char* path, int& channels, std::vector<ImageLevel>& mips)
+{
+	AssetFile file;
+	if (!file.Open(path))
+		return false;
+	return UDecodeTextureFromMemory(file.Data(), file.Size(), channels, mips);
+}
+
+// UDecodeTexture for an image already read into memory
+bool UDecodeTextureFromMemory(const unsigned char* data, size_t size, int& channels, std::vector<ImageLevel>& mips)
+{
+	int width, height;
+	unsigned char* image = stbi_load_from_memory(data, (int)size, &width, &height, &channels, 0);
+	if (!image)
+		return false;
+	if (channels != 3 && channels != 4)
+	{
+		stbi_image_free(image);
+		return false;
+	}
+
+	mips.resize(1);
+	mips[0].width = width;
+	mips[0].height = height;
+	mips[0].pixels.resize(size_t(width) * height * 4);
+	if (channels == 3)
+		UExpandRGBToRGBA(image, mips[0].pixels.data(), size_t(width) * height);
+	else
+		memcpy(mips[0].pixels.data(), image, mips[0].pixels.size());
+	stbi_image_free(image);
+	UFlipRowsInPlace(mips[0].pixels.data(), size_t(width) * 4, height);
+
+	// the colour is sRGB encoded, so mips are filtered in linear light
+	UBuildMipChain(4, true, mips);
+	return true;
+}
+
+///////////////////////////////////////////////////
+//	UCookTexture(const char*, const char*, bool, bool)
+//
+//	sourcePath: image stb_image can decode
+//	cookedPath: container to write
+//	compress: store blocks instead of raw pixels, BC1 for
+//	          opaque images and BC7 for images with alpha
+//	highQuality: use BC7 for opaque images too
+//
+//	Decodes the image with UDecodeTexture and writes every
+//	level, so the runtime only has to map the file and
+//	upload.
+///////////////////////////////////////////////////
+bool UCookTexture(const char* sourcePath, const char* cookedPath, bool compress, bool highQuality)
+{
+	int channels;
+	std::vector<ImageLevel> mips;
+	if (!UDecodeTexture(sourcePath, channels, mips))
+	{
+		std::cout << "Failed to load texture " << sourcePath << std::endl;
+		return false;
+	}
+	if (mips.size() > maxCookedLevels)
+		mips.resize(maxCookedLevels);
+	const int width = mips[0].width, height = mips[0].height;
+
+	CookedTextureHeader header = {};
+	memcpy(header.magic, "CTEX", 4);
+	header.version = cookedTextureVersion;
+	header.width = width;
+	header.height = height;
+	header.levels = (uint32_t)mips.size();
+	header.internalFormat = GL_RGBA8;
+	header.format = GL_RGBA;
+	header.type = GL_UNSIGNED_BYTE;
+
+	std::vector<std::vector<unsigned char>> payloads(mips.size());
+	double psnr = 0.0;
+	if (compress)
+	{
+		// every block of every level is encoded in one parallel pass
+		const BlockFormat blockFormat = channels == 3 && !highQuality ? BlockFormat::BC1 : BlockFormat::BC7;
+		UCompressMipChain(mips, blockFormat, payloads);
+		header.internalFormat = UBlockFormatGL(blockFormat);
+		header.flags |= cookedTextureCompressed;
+
+		std::vector<unsigned char> decoded(mips[0].pixels.size());
+		UDecompressImage(payloads[0].data(), width, height, blockFormat, decoded.data());
+		psnr = UComputePSNR(mips[0].pixels.data(), decoded.data(), size_t(width) * height, channels);
+	}
+	else
+	{
+		for (size_t i = 0; i < mips.size(); ++i)
+			payloads[i] = std::move(mips[i].pixels);
+	}
+
+	std::vector<CookedTextureLevel> levels(mips.size());
+	uint64_t offset = UAlignUp(sizeof(CookedTextureHeader) + sizeof(CookedTextureLevel) * levels.size(), cookedTextureAlignment);
+	for (size_t i = 0; i < levels.size(); ++i)
+	{
+		levels[i].offset = offset;
+		levels[i].size = payloads[i].size();
+		levels[i].width = mips[i].width;
+		levels[i].height = mips[i].height;
+		offset = UAlignUp(offset + levels[i].size, cookedTextureAlignment);
+	}
+
+	std::ofstream file(cookedPath, std::ios::binary | std::ios::trunc);
+	if (!file)
+	{
+		std::cout << "Failed to create " << cookedPath << std::endl;
+		return false;
+	}
+	file.write((const char*)&header, sizeof(header));
+	file.write((const char*)levels.data(), sizeof(CookedTextureLevel) * levels.size());
+	const char padding[cookedTextureAlignment] = {};
+	for (size_t i = 0; i < levels.size(); ++i)
+	{
+		file.write(padding, levels[i].offset - (uint64_t)file.tellp());
+		file.write((const char*)payloads[i].data(), payloads[i].size());
+	}
+	file.write(padding, offset - (uint64_t)file.tellp());
+
+	std::cout << "INFO: Cooked " << sourcePath << " -> " << cookedPath << " (" << width << "x" << height << ", "
+		<< levels.size() << " levels, ";
+	if (compress)
+		std::cout << (header.internalFormat == GL_COMPRESSED_RGB_S3TC_DXT1_EXT ? "BC1" : "BC7") << " PSNR " << psnr << " dB, ";
+	std::cout << offset / 1024 << " KB)" << std::endl;
+	return (bool)file;
+}
+
+///////////////////////////////////////////////////
+//	UOpenCookedTexture(const char*, CookedTexture&)
+//
+//	Maps a cooked texture and checks that the header and
+//	every level lie inside the file, and that it holds a
+//	format the texture arrays upload: RGBA8, BC1 or BC7
+///////////////////////////////////////////////////
+bool UOpenCookedTexture(const char* path, CookedTexture& texture)
+{
+	if (!texture.file.Open(path))
+		return false;
+
+	const size_t size = texture.file.Size();
+	const CookedTextureHeader* header = (const CookedTextureHeader*)texture.file.Data();
+	if (size < sizeof(CookedTextureHeader) || memcmp(header->magic, "CTEX", 4) != 0 || header->version != cookedTextureVersion
+		|| (header->internalFormat != GL_RGBA8 && header->internalFormat != GL_COMPRESSED_RGB_S3TC_DXT1_EXT && header->internalFormat != GL_COMPRESSED_RGBA_BPTC_UNORM)
+		|| header->levels == 0 || header->levels > maxCookedLevels
+		|| size < sizeof(CookedTextureHeader) + sizeof(CookedTextureLevel) * header->levels)
+	{
+		std::cout << "Invalid cooked texture " << path << std::endl;
+		texture.file.Close();
+		return false;
+	}
+
+	const CookedTextureLevel* levels = (const CookedTextureLevel*)(texture.file.Data() + sizeof(CookedTextureHeader));
+	for (uint32_t i = 0; i < header->levels; ++i)
+	{
+		if (levels[i].offset > size || levels[i].size > size - levels[i].offset)
+		{
+			std::cout << "Invalid cooked texture " << path << std::endl;
+			texture.file.Close();
+			return false;
+		}
+	}
+
+	texture.header = header;
+	texture.levels = levels;
+	return true;
+}
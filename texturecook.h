@@ -0,0 +1,66 @@
+///////////////////////////////////////////////////////////////////////////////
+// texturecook.h
+// ========
+// offline texture cooking: images are decoded, flipped and mipmapped once
+// and written to a small container whose levels can be handed to
+// glTexSubImage straight out of a memory mapping at startup
+///////////////////////////////////////////////////////////////////////////////
+
+#ifndef TEXTURECOOK_H
+#define TEXTURECOOK_H
+
+#include <GL/glew.h>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+#include "packfile.h"
+#include "imagekernels.h"
+
+// File layout: header, one CookedTextureLevel per mip (largest first), then
+// the level data, each level starting on a cookedTextureAlignment boundary
+const uint32_t cookedTextureVersion = 1;
+const uint32_t cookedTextureAlignment = 64;
+const uint32_t cookedTextureCompressed = 1;	// header flag: levels are block compressed
+
+struct CookedTextureHeader
+{
+	char magic[4];				// "CTEX"
+	uint32_t version;
+	uint32_t width;
+	uint32_t height;
+	uint32_t levels;
+	uint32_t internalFormat;	// GL_RGBA8, or BC1 / BC7 compressed
+	uint32_t format;			// pixel format for uncompressed uploads
+	uint32_t type;				// pixel type for uncompressed uploads
+	uint32_t flags;
+	uint32_t reserved[3];
+};
+
+struct CookedTextureLevel
+{
+	uint64_t offset;	// from the start of the file
+	uint64_t size;		// bytes, tightly packed rows
+	uint32_t width;
+	uint32_t height;
+};
+
+// A cooked texture mapped into memory (or found in a mounted pack); levels
+// point into the mapping
+struct CookedTexture
+{
+	AssetFile file;
+	const CookedTextureHeader* header = nullptr;
+	const CookedTextureLevel* levels = nullptr;
+
+	const unsigned char* LevelData(uint32_t level) const { return file.Data() + levels[level].offset; }
+	bool Compressed() const { return (header->flags & cookedTextureCompressed) != 0; }
+};
+
+std::string UCookedTexturePath(const char* sourcePath);
+bool UDecodeTexture(const char* path, int& channels, std::vector<ImageLevel>& mips);
+bool UDecodeTextureFromMemory(const unsigned char* data, size_t size, int& channels, std::vector<ImageLevel>& mips);
+bool UCookTexture(const char* sourcePath, const char* cookedPath, bool compress, bool highQuality);
+bool UOpenCookedTexture(const char* path, CookedTexture& texture);
+
+#endif
@@ -0,0 +1,194 @@
+///////////////////////////////////////////////////////////////////////////////
+// texturefeedback.cpp
+// ========
+// feedback render target, asynchronous readback and aggregation
+///////////////////////////////////////////////////////////////////////////////
+
+#include "texturefeedback.h"
+
+#include <algorithm>
+#include <cmath>
+#include <iostream>
+
+///////////////////////////////////////////////////
+//	UCreateTextureFeedback(GLsizei, GLsizei, int, int, size_t, TextureFeedback&)
+//
+//	viewportWidth, viewportHeight: size of the main pass
+//	downscale: the feedback target is this many times smaller
+//	           on each axis
+//	interval: a feedback pass runs every interval frames
+//	textureCount: ids written by the shader are below this
+//
+//	Only uses core GL 4.4 (integer colour attachment, pixel
+//	pack buffers and fences), so it also runs on software
+//	drivers such as llvmpipe
+///////////////////////////////////////////////////
+bool UCreateTextureFeedback(GLsizei viewportWidth, GLsizei viewportHeight, int downscale, int interval, size_t textureCount, TextureFeedback& feedback)
+{
+	downscale = std::max(1, downscale);
+	feedback.width = std::max(1, viewportWidth / downscale);
+	feedback.height = std::max(1, viewportHeight / downscale);
+	// derivatives are downscale times larger at the lower resolution
+	feedback.lodBias = -std::log2((float)downscale);
+	feedback.interval = std::max(1, interval);
+	feedback.levels.assign(textureCount, -1);
+
+	glGenTextures(1, &feedback.feedbackTexture);
+	glBindTexture(GL_TEXTURE_2D, feedback.feedbackTexture);
+	glTexStorage2D(GL_TEXTURE_2D, 1, GL_R32UI, feedback.width, feedback.height);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+	glBindTexture(GL_TEXTURE_2D, 0);
+
+	glGenRenderbuffers(1, &feedback.depthBuffer);
+	glBindRenderbuffer(GL_RENDERBUFFER, feedback.depthBuffer);
+	glRenderbufferStorage(GL_RENDERBUFFER, GL_DEPTH_COMPONENT24, feedback.width, feedback.height);
+	glBindRenderbuffer(GL_RENDERBUFFER, 0);
+
+	// The feedback shader's one output (location 1) goes to the R32UI target
+	glGenFramebuffers(1, &feedback.framebuffer);
+	glBindFramebuffer(GL_FRAMEBUFFER, feedback.framebuffer);
+	glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT1, GL_TEXTURE_2D, feedback.feedbackTexture, 0);
+	glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, GL_RENDERBUFFER, feedback.depthBuffer);
+	const GLenum drawBuffers[2] = { GL_NONE, GL_COLOR_ATTACHMENT1 };
+	glDrawBuffers(2, drawBuffers);
+	glReadBuffer(GL_COLOR_ATTACHMENT1);
+	const GLenum status = glCheckFramebufferStatus(GL_FRAMEBUFFER);
+	glBindFramebuffer(GL_FRAMEBUFFER, 0);
+	if (status != GL_FRAMEBUFFER_COMPLETE)
+	{
+		std::cout << "Texture feedback framebuffer is incomplete (0x" << std::hex << status << std::dec << ")" << std::endl;
+		UDestroyTextureFeedback(feedback);
+		return false;
+	}
+
+	const GLsizeiptr size = GLsizeiptr(feedback.width) * feedback.height * sizeof(uint32_t);
+	glGenBuffers(textureFeedbackBuffers, feedback.readback);
+	for (GLuint buffer : feedback.readback)
+	{
+		glBindBuffer(GL_PIXEL_PACK_BUFFER, buffer);
+		glBufferStorage(GL_PIXEL_PACK_BUFFER, size, nullptr, GL_MAP_READ_BIT);
+	}
+	glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+
+	std::cout << "INFO: Texture feedback at " << feedback.width << "x" << feedback.height << " every " << feedback.interval << " frames" << std::endl;
+	return true;
+}
+
+void UDestroyTextureFeedback(TextureFeedback& feedback)
+{
+	for (int i = 0; i < textureFeedbackBuffers; ++i)
+	{
+		if (feedback.fences[i])
+			glDeleteSync(feedback.fences[i]);
+		feedback.fences[i] = nullptr;
+	}
+	if (feedback.readback[0])
+		glDeleteBuffers(textureFeedbackBuffers, feedback.readback);
+	if (feedback.framebuffer)
+		glDeleteFramebuffers(1, &feedback.framebuffer);
+	if (feedback.feedbackTexture)
+		glDeleteTextures(1, &feedback.feedbackTexture);
+	if (feedback.depthBuffer)
+		glDeleteRenderbuffers(1, &feedback.depthBuffer);
+	feedback = TextureFeedback();
+}
+
+///////////////////////////////////////////////////
+//	UBeginTextureFeedbackPass(TextureFeedback&)
+//
+//	Returns false on frames without a feedback pass, or
+//	while the next readback buffer is still in flight.
+//	Otherwise binds and clears the feedback target; draw
+//	the scene with the feedback uniform set, then call
+//	UEndTextureFeedbackPass().
+///////////////////////////////////////////////////
+bool UBeginTextureFeedbackPass(TextureFeedback& feedback)
+{
+	if (feedback.frame++ % feedback.interval != 0 || feedback.fences[feedback.next])
+		return false;
+
+	glGetIntegerv(GL_VIEWPORT, feedback.viewport);
+	glBindFramebuffer(GL_FRAMEBUFFER, feedback.framebuffer);
+	glViewport(0, 0, feedback.width, feedback.height);
+	const GLuint empty[4] = {};
+	glClearBufferuiv(GL_COLOR, 1, empty);
+	glClear(GL_DEPTH_BUFFER_BIT);
+	return true;
+}
+
+// Queues the copy into the next readback buffer and restores the default framebuffer
+void UEndTextureFeedbackPass(TextureFeedback& feedback)
+{
+	glBindBuffer(GL_PIXEL_PACK_BUFFER, feedback.readback[feedback.next]);
+	glPixelStorei(GL_PACK_ALIGNMENT, 4);
+	glReadPixels(0, 0, feedback.width, feedback.height, GL_RED_INTEGER, GL_UNSIGNED_INT, nullptr);
+	glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+	feedback.fences[feedback.next] = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+	feedback.next = (feedback.next + 1) % textureFeedbackBuffers;
+	++feedback.passes;
+
+	glBindFramebuffer(GL_FRAMEBUFFER, 0);
+	glViewport(feedback.viewport[0], feedback.viewport[1], feedback.viewport[2], feedback.viewport[3]);
+}
+
+///////////////////////////////////////////////////
+//	UCollectTextureFeedback(TextureFeedback&)
+//
+//	Reads every buffer whose copy has finished, oldest
+//	first, without waiting on the others. Returns true
+//	when feedback.levels was refreshed.
+///////////////////////////////////////////////////
+bool UCollectTextureFeedback(TextureFeedback& feedback)
+{
+	bool updated = false;
+	for (int i = 0; i < textureFeedbackBuffers; ++i)
+	{
+		const int slot = (feedback.next + i) % textureFeedbackBuffers;
+		GLsync fence = feedback.fences[slot];
+		if (!fence)
+			continue;
+		const GLenum status = glClientWaitSync(fence, 0, 0);
+		if (status == GL_TIMEOUT_EXPIRED)
+			break; // later copies cannot have finished either
+		glDeleteSync(fence);
+		feedback.fences[slot] = nullptr;
+		if (status == GL_WAIT_FAILED)
+			continue;
+
+		const size_t count = size_t(feedback.width) * feedback.height;
+		glBindBuffer(GL_PIXEL_PACK_BUFFER, feedback.readback[slot]);
+		const uint32_t* texels = (const uint32_t*)glMapBufferRange(GL_PIXEL_PACK_BUFFER, 0, count * sizeof(uint32_t), GL_MAP_READ_BIT);
+		if (texels)
+		{
+			UAggregateTextureFeedback(texels, count, feedback.levels);
+			glUnmapBuffer(GL_PIXEL_PACK_BUFFER);
+			++feedback.readbacks;
+			updated = true;
+		}
+		glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+	}
+	return updated;
+}
+
+///////////////////////////////////////////////////
+//	UAggregateTextureFeedback(const uint32_t*, size_t, std::vector<int>&)
+//
+//	texels: packed feedback (see UPackTextureFeedback)
+//	levels: one entry per texture, receives the finest
+//	        level any texel asked for, -1 if none did
+///////////////////////////////////////////////////
+void UAggregateTextureFeedback(const uint32_t* texels, size_t count, std::vector<int>& levels)
+{
+	std::fill(levels.begin(), levels.end(), -1);
+	for (size_t i = 0; i < count; ++i)
+	{
+		const uint32_t texel = texels[i];
+		if (texel == 0)
+			continue;
+		const size_t texture = (texel >> 8) - 1;
+		const int level = int(texel & 0xFF);
+		if (texture < levels.size() && (levels[texture] < 0 || level < levels[texture]))
+			levels[texture] = level;
+	}
+}
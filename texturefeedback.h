@@ -0,0 +1,59 @@
+///////////////////////////////////////////////////////////////////////////////
+// texturefeedback.h
+// ========
+// emulated sampler feedback: every few frames the scene is drawn into a small
+// R32UI target where each texel records which material the fragment sampled
+// and the mip level textureQueryLod chose for it. The target is copied into
+// a pixel pack buffer, read back once its fence has passed (never stalling
+// the frame) and reduced on the CPU to the finest level each texture needs.
+///////////////////////////////////////////////////////////////////////////////
+
+#ifndef TEXTUREFEEDBACK_H
+#define TEXTUREFEEDBACK_H
+
+#include <GL/glew.h>
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+// Readbacks that may be in flight at once
+const int textureFeedbackBuffers = 3;
+
+// Feedback texel: 0 where nothing was drawn, otherwise
+// (texture id + 1) << 8 | mip level
+inline uint32_t UPackTextureFeedback(int texture, int level)
+{
+	return (uint32_t(texture + 1) << 8) | uint32_t(level & 0xFF);
+}
+
+struct TextureFeedback
+{
+	GLuint framebuffer = 0;
+	GLuint feedbackTexture = 0;	// R32UI, colour attachment 1
+	GLuint depthBuffer = 0;
+	GLsizei width = 0;
+	GLsizei height = 0;
+	float lodBias = 0.0f;		// corrects textureQueryLod for the reduced resolution
+	int interval = 1;			// frames between feedback passes
+	GLint viewport[4] = {};		// main pass viewport, restored after the feedback pass
+
+	GLuint readback[textureFeedbackBuffers] = {};
+	GLsync fences[textureFeedbackBuffers] = {};
+	int next = 0;
+	unsigned long long frame = 0;
+
+	std::vector<int> levels;	// finest level each texture asked for in the last readback, -1 unseen
+	unsigned long long passes = 0;
+	unsigned long long readbacks = 0;
+};
+
+bool UCreateTextureFeedback(GLsizei viewportWidth, GLsizei viewportHeight, int downscale, int interval, size_t textureCount, TextureFeedback& feedback);
+void UDestroyTextureFeedback(TextureFeedback& feedback);
+
+bool UBeginTextureFeedbackPass(TextureFeedback& feedback);
+void UEndTextureFeedbackPass(TextureFeedback& feedback);
+bool UCollectTextureFeedback(TextureFeedback& feedback);
+
+void UAggregateTextureFeedback(const uint32_t* texels, size_t count, std::vector<int>& levels);
+
+#endif
@@ -0,0 +1,399 @@
+///////////////////////////////////////////////////////////////////////////////
+// texturestreaming.cpp
+// ========
+// LRU mip streaming under a memory budget
+///////////////////////////////////////////////////////////////////////////////
+
+#include "texturestreaming.h"
+#include "texturecook.h"
+#include "blockcompress.h"
+#include "asyncio.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <cstring>
+#include <iostream>
+#include <mutex>
+#include <string>
+
+namespace
+{
+	// Level loads queued on the worker at any time
+	const size_t maxLoadsInFlight = 2;
+
+	struct StreamedLevel
+	{
+		size_t size;
+		GLsizei width, height;
+	};
+
+	struct StreamedTexture
+	{
+		std::string path;
+		size_t owner = 0;			// texture streaming the layer; another one for a duplicate file
+		GLint array = -1;
+		GLint layer = -1;
+		GLenum internalFormat = 0;
+		bool sparse = false;
+		std::vector<StreamedLevel> levels;
+		GLint streamedLevels = 0;	// levels below this are managed here
+		GLint resident = 0;			// finest level in memory (streamedLevels: none)
+		GLint wanted = 0;			// finest level asked for since the last update
+		GLint loading = -1;			// finest level of the load in flight, -1 for none
+		uint64_t lastUsed = 0;		// frame of the last request
+		bool failed = false;
+	};
+
+	// Pixels of levels [firstLevel, resident) produced by a worker
+	struct LoadedLevels
+	{
+		size_t texture;
+		GLint firstLevel;
+		std::vector<std::vector<unsigned char>> levels;
+		bool ok;
+	};
+}
+
+struct TextureStreamer
+{
+	std::vector<StreamedTexture> textures;
+	TextureStreamingStats stats;
+	uint64_t frame = 0;
+	size_t inFlight = 0;
+
+	std::mutex mutex;
+	std::vector<LoadedLevels> finished;
+
+	// last, so it is destroyed first and no job outlives the state above
+	std::unique_ptr<AsyncIO> io;
+};
+
+namespace
+{
+	size_t ULevelBytes(const StreamedTexture& texture, GLint first, GLint end)
+	{
+		size_t bytes = 0;
+		for (GLint level = first; level < end; ++level)
+			bytes += texture.levels[level].size;
+		return bytes;
+	}
+
+	// Copies levels [first, end) out of the cooked container; false when
+	// the texture has none, or a stale one the source image must replace
+	bool UReadCookedLevels(const std::string& path, GLenum internalFormat, GLint first, GLint end, LoadedLevels& result)
+	{
+		const std::string cookedPath = UCookedTexturePath(path.c_str());
+		CookedTexture cooked;
+		if (!UOpenCookedTexture(cookedPath.c_str(), cooked))
+			return false;
+		if ((GLint)cooked.header->levels < end || cooked.header->internalFormat != internalFormat)
+		{
+			std::cout << "Stale cooked texture " << cookedPath << " (levels or format differ), decoding " << path << std::endl;
+			return false;
+		}
+		for (GLint level = first; level < end; ++level)
+		{
+			const unsigned char* data = cooked.LevelData((uint32_t)level);
+			result.levels.emplace_back(data, data + cooked.levels[level].size);
+		}
+		result.ok = true;
+		return true;
+	}
+
+	// Decodes the image, builds its mips and block compresses levels
+	// [first, end) when the array is compressed
+	void UDecodeLevels(const unsigned char* image, size_t size, GLenum internalFormat, GLint first, GLint end, LoadedLevels& result)
+	{
+		int channels;
+		std::vector<ImageLevel> mips;
+		if (!UDecodeTextureFromMemory(image, size, channels, mips) || (GLint)mips.size() < end)
+			return;
+		mips.erase(mips.begin() + end, mips.end());
+		mips.erase(mips.begin(), mips.begin() + first);
+
+		if (internalFormat == GL_RGBA8)
+		{
+			for (ImageLevel& mip : mips)
+				result.levels.push_back(std::move(mip.pixels));
+		}
+		else
+		{
+			UCompressMipChain(mips, internalFormat == GL_COMPRESSED_RGB_S3TC_DXT1_EXT ? BlockFormat::BC1 : BlockFormat::BC7, result.levels);
+		}
+		result.ok = true;
+	}
+
+	///////////////////////////////////////////////////
+	//	ULoadLevels(AsyncIO&, TextureStreamer&, size_t, std::string, GLenum, GLint, GLint)
+	//
+	//	Load coroutine for levels [first, end) of one texture:
+	//	from the cooked container if there is one, otherwise
+	//	the image is read and then decoded on the worker.
+	//	The result goes on the finished list either way.
+	///////////////////////////////////////////////////
+	AsyncTask ULoadLevels(AsyncIO& io, TextureStreamer& owner, size_t texture, std::string path, GLenum internalFormat, GLint first, GLint end)
+	{
+		LoadedLevels loaded;
+		loaded.texture = texture;
+		loaded.firstLevel = first;
+		loaded.ok = false;
+		if (!UReadCookedLevels(path, internalFormat, first, end, loaded))
+		{
+			AsyncBuffer file;
+			if (co_await io.ReadFile(path.c_str(), file))
+				UDecodeLevels(file.Data(), file.Size(), internalFormat, first, end, loaded);
+		}
+
+		std::lock_guard<std::mutex> lock(owner.mutex);
+		owner.finished.push_back(std::move(loaded));
+	}
+
+	void UCommitLevel(const StreamedTexture& texture, GLint level, GLboolean commit)
+	{
+		const StreamedLevel& data = texture.levels[level];
+		glTexPageCommitmentARB(GL_TEXTURE_2D_ARRAY, level, 0, 0, texture.layer, data.width, data.height, 1, commit);
+	}
+
+	// Drops the finest resident level of a texture
+	void UEvictLevel(TextureStreamer& streamer, const TextureArraySet& set, StreamedTexture& texture)
+	{
+		if (texture.sparse)
+		{
+			glBindTexture(GL_TEXTURE_2D_ARRAY, set.arrays[texture.array].texture);
+			UCommitLevel(texture, texture.resident, GL_FALSE);
+			glBindTexture(GL_TEXTURE_2D_ARRAY, 0);
+		}
+		streamer.stats.resident -= texture.levels[texture.resident].size;
+		++texture.resident;
+		++streamer.stats.evictions;
+	}
+
+	///////////////////////////////////////////////////
+	//	UMakeRoom(TextureStreamer&, const TextureArraySet&, size_t, size_t)
+	//
+	//	Evicts levels until bytes more fit in the budget. Only
+	//	levels finer than their texture currently wants are
+	//	candidates, taken from the least recently used texture
+	//	first. Returns false when that is not enough.
+	///////////////////////////////////////////////////
+	bool UMakeRoom(TextureStreamer& streamer, const TextureArraySet& set, size_t bytes, size_t requester)
+	{
+		while (streamer.stats.resident + bytes > streamer.stats.budget)
+		{
+			StreamedTexture* victim = nullptr;
+			for (size_t i = 0; i < streamer.textures.size(); ++i)
+			{
+				StreamedTexture& texture = streamer.textures[i];
+				if (i == requester || texture.loading >= 0 || texture.resident >= texture.wanted)
+					continue;
+				if (!victim || texture.lastUsed < victim->lastUsed)
+					victim = &texture;
+			}
+			if (!victim)
+				return false;
+			UEvictLevel(streamer, set, *victim);
+		}
+		return true;
+	}
+
+	// GL side: puts finished levels into the arrays
+	void UUploadLevels(TextureStreamer& streamer, const TextureArraySet& set, LoadedLevels& loaded)
+	{
+		StreamedTexture& texture = streamer.textures[loaded.texture];
+		const GLint end = texture.resident;
+		texture.loading = -1;
+		--streamer.inFlight;
+		if (!loaded.ok)
+		{
+			std::cout << "Failed to stream texture " << texture.path << std::endl;
+			streamer.stats.resident -= ULevelBytes(texture, loaded.firstLevel, end);
+			texture.failed = true;
+			return;
+		}
+
+		const TextureArray& array = set.arrays[texture.array];
+		glBindTexture(GL_TEXTURE_2D_ARRAY, array.texture);
+		glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+		for (GLint level = loaded.firstLevel; level < end; ++level)
+		{
+			const StreamedLevel& data = texture.levels[level];
+			const std::vector<unsigned char>& pixels = loaded.levels[level - loaded.firstLevel];
+			if (texture.sparse)
+				UCommitLevel(texture, level, GL_TRUE);
+			if (array.internalFormat != GL_RGBA8)
+				glCompressedTexSubImage3D(GL_TEXTURE_2D_ARRAY, level, 0, 0, texture.layer, data.width, data.height, 1, array.internalFormat, (GLsizei)pixels.size(), pixels.data());
+			else
+				glTexSubImage3D(GL_TEXTURE_2D_ARRAY, level, 0, 0, texture.layer, data.width, data.height, 1, GL_RGBA, GL_UNSIGNED_BYTE, pixels.data());
+		}
+		glPixelStorei(GL_UNPACK_ALIGNMENT, 4);
+		glBindTexture(GL_TEXTURE_2D_ARRAY, 0);
+
+		streamer.stats.loads += size_t(end - loaded.firstLevel);
+		texture.resident = loaded.firstLevel;
+	}
+}
+
+///////////////////////////////////////////////////
+//	UCreateTextureStreamer(const std::vector<const char*>&, const TextureArraySet&, const std::vector<TextureRef>&, size_t)
+//
+//	filenames, refs: the images given to UCreateTextureArrays
+//	                 and where they were put
+//	set: arrays created with TextureArrayOptions::streamed
+//	budget: bytes the streamed levels may use in total
+//
+//	Levels at or below streamedResidentSize stay with the
+//	arrays and are not counted against the budget
+///////////////////////////////////////////////////
+std::shared_ptr<TextureStreamer> UCreateTextureStreamer(const std::vector<const char*>& filenames, const TextureArraySet& set, const std::vector<TextureRef>& refs, size_t budget)
+{
+	std::shared_ptr<TextureStreamer> streamer = std::make_shared<TextureStreamer>();
+	streamer->stats.budget = budget;
+
+	size_t total = 0;
+	bool sparse = true;
+	for (size_t i = 0; i < filenames.size() && i < refs.size(); ++i)
+	{
+		StreamedTexture texture;
+		texture.path = filenames[i];
+		texture.owner = refs[i].id >= 0 ? (size_t)refs[i].id : i;
+		texture.array = refs[i].array;
+		texture.layer = refs[i].layer;
+
+		const TextureArray& array = set.arrays[texture.array];
+		texture.internalFormat = array.internalFormat;
+		texture.sparse = array.sparse;
+		texture.streamedLevels = array.streamedLevels;
+		texture.resident = array.streamedLevels;
+		texture.wanted = array.streamedLevels;
+		for (GLint level = 0; level < array.levels; ++level)
+		{
+			const GLsizei w = std::max(1, array.width >> level), h = std::max(1, array.height >> level);
+			const size_t size = array.internalFormat == GL_RGBA8 ? size_t(w) * h * 4
+				: UCompressedSize(array.internalFormat == GL_COMPRESSED_RGB_S3TC_DXT1_EXT ? BlockFormat::BC1 : BlockFormat::BC7, w, h);
+			texture.levels.push_back({ size, w, h });
+		}
+		if (texture.owner == i)
+			total += ULevelBytes(texture, 0, texture.streamedLevels);
+		sparse = sparse && (texture.sparse || texture.streamedLevels == 0);
+		streamer->textures.push_back(texture);
+	}
+
+	streamer->io.reset(new AsyncIO(1));
+	std::cout << "INFO: Streaming " << total / (1024 * 1024) << " MB of texture levels within a " << budget / (1024 * 1024) << " MB budget"
+		<< (sparse ? " (sparse)" : " (no ARB_sparse_texture: levels are clamped but stay allocated)") << std::endl;
+	return streamer;
+}
+
+///////////////////////////////////////////////////
+//	URequestTextureResidency(TextureStreamer&, size_t, float, float)
+//
+//	texture: index of the texture in the filenames
+//	screenSize: pixels the object spans on screen (its
+//	            projected diameter), 0 or less when hidden
+//	uvRepeat: how many times the texture repeats across
+//	          the object
+//
+//	Call for every draw; asks for the level where a texel
+//	covers about a pixel (see URequestTextureLevel)
+///////////////////////////////////////////////////
+void URequestTextureResidency(TextureStreamer& streamer, size_t texture, float screenSize, float uvRepeat)
+{
+	if (texture >= streamer.textures.size() || screenSize <= 0.0f)
+		return;
+
+	const StreamedTexture& streamed = streamer.textures[texture];
+	const float texels = uvRepeat * (float)std::max(streamed.levels[0].width, streamed.levels[0].height);
+	URequestTextureLevel(streamer, texture, (int)std::floor(std::log2(std::max(texels / screenSize, 1.0f))));
+}
+
+///////////////////////////////////////////////////
+//	URequestTextureLevel(TextureStreamer&, size_t, int)
+//
+//	Marks the texture as used this frame and asks for level
+//	and everything coarser to be resident. The finest level
+//	asked for during a frame is what the next update tries
+//	to load.
+///////////////////////////////////////////////////
+void URequestTextureLevel(TextureStreamer& streamer, size_t texture, int level)
+{
+	if (texture >= streamer.textures.size() || level < 0)
+		return;
+
+	StreamedTexture& streamed = streamer.textures[streamer.textures[texture].owner];
+	streamed.wanted = std::min(streamed.wanted, std::min((GLint)level, streamed.streamedLevels));
+	streamed.lastUsed = streamer.frame;
+}
+
+///////////////////////////////////////////////////
+//	UUpdateTextureStreamer(TextureStreamer&, const TextureArraySet&, std::vector<TextureRef>&)
+//
+//	Once per frame on the GL thread, before drawing:
+//	uploads levels the worker has finished, starts loads
+//	for textures that want finer levels (evicting least
+//	recently used levels to stay inside the budget) and
+//	writes each texture's finest resident level to its
+//	TextureRef::minLod
+///////////////////////////////////////////////////
+void UUpdateTextureStreamer(TextureStreamer& streamer, const TextureArraySet& set, std::vector<TextureRef>& refs)
+{
+	std::vector<LoadedLevels> finished;
+	{
+		std::lock_guard<std::mutex> lock(streamer.mutex);
+		finished.swap(streamer.finished);
+	}
+	for (LoadedLevels& loaded : finished)
+		UUploadLevels(streamer, set, loaded);
+
+	// Most recently used textures first, then the ones missing the most levels
+	std::vector<size_t> order;
+	for (size_t i = 0; i < streamer.textures.size(); ++i)
+	{
+		const StreamedTexture& texture = streamer.textures[i];
+		if (texture.owner == i && texture.wanted < texture.resident && texture.loading < 0 && !texture.failed)
+			order.push_back(i);
+	}
+	std::sort(order.begin(), order.end(), [&](size_t a, size_t b)
+	{
+		const StreamedTexture& x = streamer.textures[a];
+		const StreamedTexture& y = streamer.textures[b];
+		if (x.lastUsed != y.lastUsed)
+			return x.lastUsed > y.lastUsed;
+		return x.resident - x.wanted > y.resident - y.wanted;
+	});
+
+	for (size_t i : order)
+	{
+		if (streamer.inFlight >= maxLoadsInFlight)
+			break;
+
+		// settle for coarser levels when the budget cannot hold the finest
+		StreamedTexture& texture = streamer.textures[i];
+		GLint first = texture.wanted;
+		while (first < texture.resident && !UMakeRoom(streamer, set, ULevelBytes(texture, first, texture.resident), i))
+			++first;
+		if (first >= texture.resident)
+			continue;
+
+		streamer.stats.resident += ULevelBytes(texture, first, texture.resident);
+		streamer.stats.peak = std::max(streamer.stats.peak, streamer.stats.resident);
+		texture.loading = first;
+		++streamer.inFlight;
+
+		streamer.io->Start(ULoadLevels(*streamer.io, streamer, i, texture.path, texture.internalFormat, first, texture.resident));
+	}
+
+	// Shaders sample no finer than what is resident; requests start over
+	for (size_t i = 0; i < streamer.textures.size() && i < refs.size(); ++i)
+	{
+		StreamedTexture& texture = streamer.textures[i];
+		refs[i].minLod = (float)streamer.textures[texture.owner].resident;
+		texture.wanted = texture.streamedLevels;
+	}
+	++streamer.frame;
+}
+
+TextureStreamingStats UGetTextureStreamingStats(const TextureStreamer& streamer)
+{
+	return streamer.stats;
+}
@@ -0,0 +1,38 @@
+///////////////////////////////////////////////////////////////////////////////
+// texturestreaming.h
+// ========
+// mip level residency for streamed texture arrays. Draws report how large
+// each material appears on screen; once per frame the streamer works out the
+// finest mip every texture needs, loads missing levels on a worker thread and
+// drops the finest levels of the least recently used textures whenever the
+// resident levels would exceed a memory budget.
+///////////////////////////////////////////////////////////////////////////////
+
+#ifndef TEXTURESTREAMING_H
+#define TEXTURESTREAMING_H
+
+#include <cstddef>
+#include <memory>
+#include <vector>
+
+#include "texturearray.h"
+
+// Residency state of every streamed texture (texturestreaming.cpp)
+struct TextureStreamer;
+
+struct TextureStreamingStats
+{
+	size_t budget = 0;		// bytes allowed for the streamed levels
+	size_t resident = 0;	// bytes of streamed levels resident or loading
+	size_t peak = 0;
+	size_t loads = 0;		// levels loaded
+	size_t evictions = 0;	// levels dropped
+};
+
+std::shared_ptr<TextureStreamer> UCreateTextureStreamer(const std::vector<const char*>& filenames, const TextureArraySet& set, const std::vector<TextureRef>& refs, size_t budget);
+void URequestTextureResidency(TextureStreamer& streamer, size_t texture, float screenSize, float uvRepeat);
+void URequestTextureLevel(TextureStreamer& streamer, size_t texture, int level);
+void UUpdateTextureStreamer(TextureStreamer& streamer, const TextureArraySet& set, std::vector<TextureRef>& refs);
+TextureStreamingStats UGetTextureStreamingStats(const TextureStreamer& streamer);
+
+#endif
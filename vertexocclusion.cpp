@@ -0,0 +1,126 @@
+///////////////////////////////////////////////////////////////////////////////
+// vertexocclusion.cpp
+// ========
+// hemisphere sampling per vertex and the worker pool that spreads it
+///////////////////////////////////////////////////////////////////////////////
+
+#include "vertexocclusion.h"
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cmath>
+#include <iostream>
+
+#include "parallel.h"
+
+namespace
+{
+	// Vertices per job queued on the pool
+	const size_t occlusionBlockSize = 256;
+
+	// How far rays start off the surface, against hitting it again
+	const float occlusionRayOffset = 0.002f;
+
+	///////////////////////////////////////////////////
+	//	UVertexOcclusion(const SceneBVH&, const glm::vec3&, const glm::vec3&, int, float, float)
+	//
+	//	Share of count cosine weighted rays from position
+	//	about normal that reach radius without a hit, 1 for
+	//	open sky. The directions follow a Fibonacci spiral
+	//	over the disc below the hemisphere, turned by
+	//	rotation so neighbouring vertices do not band.
+	///////////////////////////////////////////////////
+	float UVertexOcclusion(const SceneBVH& bvh, const glm::vec3& position, const glm::vec3& normal, int count, float radius, float rotation)
+	{
+		const glm::vec3 tangent = glm::normalize(std::abs(normal.x) > 0.5f ? glm::cross(normal, glm::vec3(0.0f, 1.0f, 0.0f)) : glm::cross(normal, glm::vec3(1.0f, 0.0f, 0.0f)));
+		const glm::vec3 bitangent = glm::cross(normal, tangent);
+		const glm::vec3 origin = position + normal * occlusionRayOffset;
+
+		RayPacket4 packet;
+		for (int lane = 0; lane < 4; ++lane)
+		{
+			packet.originX[lane] = origin.x;
+			packet.originY[lane] = origin.y;
+			packet.originZ[lane] = origin.z;
+			packet.maxDistance[lane] = radius;
+		}
+		int blocked = 0;
+		for (int first = 0; first < count; first += 4)
+		{
+			for (int lane = 0; lane < 4; ++lane)
+			{
+				const int s = first + lane;
+				const float disc = std::sqrt((s + 0.5f) / count);
+				const float angle = 2.39996323f * s + rotation;
+				const float height = std::sqrt(std::max(0.0f, 1.0f - disc * disc));
+				const glm::vec3 direction = tangent * (disc * std::cos(angle)) + bitangent * (disc * std::sin(angle)) + normal * height;
+				packet.directionX[lane] = direction.x;
+				packet.directionY[lane] = direction.y;
+				packet.directionZ[lane] = direction.z;
+			}
+			const int occluded = UOccluded4(bvh, packet);
+			for (int lane = 0; lane < 4; ++lane)
+				blocked += (occluded >> lane) & 1;
+		}
+		return 1.0f - float(blocked) / count;
+	}
+}
+
+///////////////////////////////////////////////////
+//	UBakeVertexOcclusion(StaticBatchData&, const SceneBVH&, const VertexOcclusionOptions&, VertexOcclusionStats&)
+//
+//	bvh: built from UStaticBatchTriangles(batch)
+//
+//	Writes every vertex's occlusion into the batch. The
+//	vertices are cut into blocks of occlusionBlockSize,
+//	queued on a WorkerPool of one thread per core and
+//	waited for; each block writes only its own vertices.
+///////////////////////////////////////////////////
+void UBakeVertexOcclusion(StaticBatchData& batch, const SceneBVH& bvh, const VertexOcclusionOptions& options, VertexOcclusionStats& stats)
+{
+	const auto start = std::chrono::steady_clock::now();
+	const size_t vertexCount = batch.VertexCount();
+	const int count = std::max(4, (options.samples + 3) & ~3);
+	stats = VertexOcclusionStats();
+	stats.vertices = vertexCount;
+	stats.threads = UWorkerCount();
+
+	std::atomic<unsigned long long> rays(0);
+	{
+		WorkerPool pool(stats.threads);
+		for (size_t first = 0; first < vertexCount; first += occlusionBlockSize)
+		{
+			pool.Submit([&, first]()
+			{
+				const size_t last = std::min(vertexCount, first + occlusionBlockSize);
+				unsigned long long traced = 0;
+				for (size_t v = first; v < last; ++v)
+				{
+					const glm::vec3 normal = batch.Normal(GLuint(v));
+					const float length = glm::length(normal);
+					if (length == 0.0f)
+						continue;
+					batch.vertices[v * floatsPerBatchVertex + batchOcclusionOffset] =
+						UVertexOcclusion(bvh, batch.Position(GLuint(v)), normal / length, count, options.radius, float(v % 64) * 0.0981748f);
+					traced += count;
+				}
+				rays += traced;
+			});
+		}
+		pool.Wait();
+	}
+
+	double sum = 0.0;
+	for (size_t v = 0; v < vertexCount; ++v)
+		sum += batch.vertices[v * floatsPerBatchVertex + batchOcclusionOffset];
+	stats.averageOcclusion = vertexCount > 0 ? float(sum / vertexCount) : 1.0f;
+	stats.rays = rays;
+	stats.seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+}
+
+void UPrintVertexOcclusionStats(const VertexOcclusionStats& stats)
+{
+	std::cout << "INFO: Vertex occlusion of " << stats.vertices << " vertices baked in " << stats.seconds * 1000.0 << " ms on " << stats.threads
+		<< " threads: " << (stats.seconds > 0.0 ? stats.rays / stats.seconds / 1e6 : 0.0) << " Mrays/s, average " << stats.averageOcclusion << std::endl;
+}
@@ -0,0 +1,38 @@
+///////////////////////////////////////////////////////////////////////////////
+// vertexocclusion.h
+// ========
+// bakes ambient occlusion per vertex of the static batch at load: rays over
+// the hemisphere about each vertex normal are cast against the scene BVH four
+// at a time with SSE, by blocks of vertices queued on a worker pool. The
+// runtime only multiplies the result into its ambient term, so the contact
+// shadows cost nothing per frame. Cheaper to bake and store than a lightmap,
+// at the price of following the mesh's vertex density.
+///////////////////////////////////////////////////////////////////////////////
+
+#ifndef VERTEXOCCLUSION_H
+#define VERTEXOCCLUSION_H
+
+#include <cstddef>
+
+#include "scenebvh.h"
+#include "staticbatch.h"
+
+struct VertexOcclusionOptions
+{
+	int samples = 64;		// rays per vertex, rounded up to whole packets of four
+	float radius = 1.0f;	// world units; geometry further away does not occlude
+};
+
+struct VertexOcclusionStats
+{
+	size_t vertices = 0;
+	unsigned long long rays = 0;
+	double seconds = 0.0;
+	unsigned threads = 0;
+	float averageOcclusion = 0.0f;	// mean baked value, 1 for open sky
+};
+
+void UBakeVertexOcclusion(StaticBatchData& batch, const SceneBVH& bvh, const VertexOcclusionOptions& options, VertexOcclusionStats& stats);
+void UPrintVertexOcclusionStats(const VertexOcclusionStats& stats);
+
+#endif
@@ -0,0 +1,343 @@
+///////////////////////////////////////////////////////////////////////////////
+// visibilitybuffer.cpp
+// ========
+// the id target, the shared mesh buffers, per-frame draw records and the
+// resolve shader code that rebuilds a surface from its triangle id
+///////////////////////////////////////////////////////////////////////////////
+
+#include "visibilitybuffer.h"
+
+#include <algorithm>
+#include <iostream>
+
+#include <glm/gtc/type_ptr.hpp>
+
+bool UCreateVisibilityBuffer(GLsizei width, GLsizei height, VisibilityBuffer& visibility)
+{
+	visibility.width = width;
+	visibility.height = height;
+
+	glGenTextures(1, &visibility.idTexture);
+	glBindTexture(GL_TEXTURE_2D, visibility.idTexture);
+	glTexStorage2D(GL_TEXTURE_2D, 1, GL_R32UI, width, height);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+	glGenTextures(1, &visibility.depthTexture);
+	glBindTexture(GL_TEXTURE_2D, visibility.depthTexture);
+	glTexStorage2D(GL_TEXTURE_2D, 1, GL_DEPTH_COMPONENT32F, width, height);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+	glBindTexture(GL_TEXTURE_2D, 0);
+
+	glGenFramebuffers(1, &visibility.framebuffer);
+	glBindFramebuffer(GL_FRAMEBUFFER, visibility.framebuffer);
+	glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, visibility.idTexture, 0);
+	glFramebufferTexture2D(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, GL_TEXTURE_2D, visibility.depthTexture, 0);
+	const GLenum status = glCheckFramebufferStatus(GL_FRAMEBUFFER);
+	glBindFramebuffer(GL_FRAMEBUFFER, 0);
+	if (status != GL_FRAMEBUFFER_COMPLETE)
+	{
+		std::cout << "Visibility framebuffer is incomplete (0x" << std::hex << status << std::dec << ")" << std::endl;
+		UDestroyVisibilityBuffer(visibility);
+		return false;
+	}
+
+	glGenBuffers(1, &visibility.drawBuffer);
+	return true;
+}
+
+void UDestroyVisibilityBuffer(VisibilityBuffer& visibility)
+{
+	if (visibility.framebuffer)
+		glDeleteFramebuffers(1, &visibility.framebuffer);
+	for (GLuint texture : { visibility.idTexture, visibility.depthTexture })
+	{
+		if (texture)
+			glDeleteTextures(1, &texture);
+	}
+	for (GLuint buffer : { visibility.vertexBuffer, visibility.indexBuffer, visibility.drawBuffer })
+	{
+		if (buffer)
+			glDeleteBuffers(1, &buffer);
+	}
+	if (visibility.vertexArray)
+		glDeleteVertexArrays(1, &visibility.vertexArray);
+	visibility = VisibilityBuffer();
+}
+
+///////////////////////////////////////////////////
+//	UAddVisibilityMesh(VisibilityBuffer&, const MeshData&)
+//
+//	Appends a triangle list to the shared geometry and
+//	returns its mesh index, or -1 when it has more
+//	triangles than an id can address. Call
+//	UUploadVisibilityGeometry() once every mesh is in.
+///////////////////////////////////////////////////
+int UAddVisibilityMesh(VisibilityBuffer& visibility, const MeshData& data)
+{
+	if (data.TriangleCount() > visibilityMaxTriangles)
+	{
+		std::cout << "Mesh of " << data.TriangleCount() << " triangles is too large for the visibility buffer" << std::endl;
+		return -1;
+	}
+
+	VisibilityMesh mesh;
+	mesh.firstIndex = GLuint(visibility.indices.size());
+	mesh.baseVertex = GLint(visibility.vertices.size() / floatsPerMeshVertex);
+	mesh.triangles = GLuint(data.TriangleCount());
+	visibility.vertices.insert(visibility.vertices.end(), data.vertices.begin(), data.vertices.end());
+	visibility.indices.insert(visibility.indices.end(), data.indices.begin(), data.indices.end());
+	visibility.meshes.push_back(mesh);
+	return int(visibility.meshes.size() - 1);
+}
+
+// Creates the shared buffers, with the attribute layout of meshes.cpp for the geometry pass
+void UUploadVisibilityGeometry(VisibilityBuffer& visibility)
+{
+	glGenVertexArrays(1, &visibility.vertexArray);
+	glBindVertexArray(visibility.vertexArray);
+	glGenBuffers(1, &visibility.vertexBuffer);
+	glBindBuffer(GL_ARRAY_BUFFER, visibility.vertexBuffer);
+	glBufferStorage(GL_ARRAY_BUFFER, visibility.vertices.size() * sizeof(GLfloat), visibility.vertices.data(), 0);
+	glGenBuffers(1, &visibility.indexBuffer);
+	glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, visibility.indexBuffer);
+	glBufferStorage(GL_ELEMENT_ARRAY_BUFFER, visibility.indices.size() * sizeof(GLuint), visibility.indices.data(), 0);
+
+	// only the position is read by the geometry pass; the resolve fetches the rest
+	glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, sizeof(GLfloat) * floatsPerMeshVertex, nullptr);
+	glEnableVertexAttribArray(0);
+	glBindVertexArray(0);
+	glBindBuffer(GL_ARRAY_BUFFER, 0);
+
+	std::cout << "INFO: Visibility buffer geometry: " << visibility.meshes.size() << " meshes, "
+		<< visibility.vertices.size() / floatsPerMeshVertex << " vertices, " << visibility.indices.size() / 3 << " triangles" << std::endl;
+	visibility.vertices = std::vector<GLfloat>();
+	visibility.indices = std::vector<GLuint>();
+}
+
+///////////////////////////////////////////////////
+//	UBeginVisibilityPass(VisibilityBuffer&, GLuint)
+//
+//	programId: the geometry pass program, in use, with
+//	           a uint uniform uDrawId and a mat4 model
+//
+//	Binds and clears the id target and the shared
+//	geometry. Submit with UDrawVisibilityMesh(), then
+//	call UEndVisibilityPass().
+///////////////////////////////////////////////////
+void UBeginVisibilityPass(VisibilityBuffer& visibility, GLuint programId)
+{
+	glGetIntegerv(GL_VIEWPORT, visibility.viewport);
+	glBindFramebuffer(GL_FRAMEBUFFER, visibility.framebuffer);
+	glViewport(0, 0, visibility.width, visibility.height);
+	const GLuint empty[4] = {};
+	glClearBufferuiv(GL_COLOR, 0, empty);
+	glClear(GL_DEPTH_BUFFER_BIT);
+
+	visibility.draws.clear();
+	visibility.drawIdLocation = glGetUniformLocation(programId, "uDrawId");
+	visibility.modelLocation = glGetUniformLocation(programId, "model");
+	glBindVertexArray(visibility.vertexArray);
+}
+
+void UDrawVisibilityMesh(VisibilityBuffer& visibility, int mesh, const glm::mat4& model, const TextureRef& material)
+{
+	if (mesh < 0)
+		return;
+	if (visibility.draws.size() >= visibilityMaxDraws)
+	{
+		++visibility.droppedDraws;
+		return;
+	}
+
+	const VisibilityMesh& range = visibility.meshes[mesh];
+	VisibilityDraw draw = {};
+	draw.model = model;
+	draw.normalMatrix = glm::mat4(glm::transpose(glm::inverse(glm::mat3(model))));
+	draw.firstIndex = range.firstIndex;
+	draw.baseVertex = range.baseVertex;
+	draw.materialArray = material.array;
+	draw.materialLayer = material.layer;
+	draw.materialMinLod = material.minLod;
+
+	glUniform1ui(visibility.drawIdLocation, GLuint(visibility.draws.size()));
+	glUniformMatrix4fv(visibility.modelLocation, 1, GL_FALSE, glm::value_ptr(model));
+	visibility.draws.push_back(draw);
+	glDrawElementsBaseVertex(GL_TRIANGLES, GLsizei(range.triangles * 3), GL_UNSIGNED_INT,
+		(void*)(sizeof(GLuint) * range.firstIndex), range.baseVertex);
+}
+
+// Hands this frame's draw records to the resolve and restores the default framebuffer
+void UEndVisibilityPass(VisibilityBuffer& visibility)
+{
+	glBindVertexArray(0);
+	glBindFramebuffer(GL_FRAMEBUFFER, 0);
+	glViewport(visibility.viewport[0], visibility.viewport[1], visibility.viewport[2], visibility.viewport[3]);
+
+	// a fresh store each frame, so the previous frame's records are never overwritten in use
+	glBindBuffer(GL_SHADER_STORAGE_BUFFER, visibility.drawBuffer);
+	glBufferData(GL_SHADER_STORAGE_BUFFER, std::max<size_t>(visibility.draws.size(), 1) * sizeof(VisibilityDraw), visibility.draws.data(), GL_STREAM_DRAW);
+	glBindBuffer(GL_SHADER_STORAGE_BUFFER, 0);
+}
+
+///////////////////////////////////////////////////
+//	UBindVisibilityBuffer(const VisibilityBuffer&, GLuint, const TextureArraySet&)
+//
+//	Binds the ids, depth, shared geometry, draw records
+//	and every texture array for a resolve program using
+//	UVisibilityShaderHeader(). The arrays are bound to
+//	units even with bindless handles, since the resolve
+//	picks the material per pixel.
+///////////////////////////////////////////////////
+void UBindVisibilityBuffer(const VisibilityBuffer& visibility, GLuint programId, const TextureArraySet& textures)
+{
+	glBindBufferBase(GL_SHADER_STORAGE_BUFFER, visibilityVertexBinding, visibility.vertexBuffer);
+	glBindBufferBase(GL_SHADER_STORAGE_BUFFER, visibilityIndexBinding, visibility.indexBuffer);
+	glBindBufferBase(GL_SHADER_STORAGE_BUFFER, visibilityDrawBinding, visibility.drawBuffer);
+
+	glActiveTexture(GL_TEXTURE0 + visibilityFirstUnit);
+	glBindTexture(GL_TEXTURE_2D, visibility.idTexture);
+	glActiveTexture(GL_TEXTURE0 + visibilityFirstUnit + 1);
+	glBindTexture(GL_TEXTURE_2D, visibility.depthTexture);
+	glUniform1i(glGetUniformLocation(programId, "uVisibilityIds"), GLint(visibilityFirstUnit));
+	glUniform1i(glGetUniformLocation(programId, "uVisibilityDepth"), GLint(visibilityFirstUnit + 1));
+
+	GLint units[maxTextureArrays];
+	for (GLint a = 0; a < maxTextureArrays; ++a)
+	{
+		units[a] = a;
+		glActiveTexture(GL_TEXTURE0 + a);
+		glBindTexture(GL_TEXTURE_2D_ARRAY, size_t(a) < textures.arrays.size() ? textures.arrays[a].texture : 0);
+	}
+	glUniform1iv(glGetUniformLocation(programId, "uVisibilityArrays"), maxTextureArrays, units);
+	glActiveTexture(GL_TEXTURE0);
+}
+
+// Covers the viewport with one triangle made from gl_VertexID; the shared
+// geometry's vertex array stands in for an empty one, its attribute unread
+void UDrawVisibilityResolve(const VisibilityBuffer& visibility)
+{
+	glBindVertexArray(visibility.vertexArray);
+	glDrawArrays(GL_TRIANGLES, 0, 3);
+	glBindVertexArray(0);
+}
+
+// Declarations for the top of a resolve shader using UVisibilityShaderSource()
+const char* UVisibilityShaderHeader()
+{
+	return
+		"struct VisibilityDraw\n"
+		"{\n"
+		"	mat4 model;\n"
+		"	mat4 normalMatrix;\n"
+		"	uint firstIndex;\n"
+		"	int baseVertex;\n"
+		"	int materialArray;\n"
+		"	int materialLayer;\n"
+		"	float materialMinLod;\n"
+		"};\n"
+		"struct VisibilitySurface\n"
+		"{\n"
+		"	vec3 position;\n"
+		"	vec3 normal;\n"
+		"	vec2 uv;\n"
+		"	vec2 uvDx;\n"
+		"	vec2 uvDy;\n"
+		"	int materialArray;\n"
+		"	int materialLayer;\n"
+		"	float materialMinLod;\n"
+		"};\n"
+		"layout(std430, binding = 6) readonly buffer VisibilityVertexBuffer { float uVisibilityVertices[]; };\n"
+		"layout(std430, binding = 7) readonly buffer VisibilityIndexBuffer { uint uVisibilityIndices[]; };\n"
+		"layout(std430, binding = 8) readonly buffer VisibilityDrawBuffer { VisibilityDraw uVisibilityDraws[]; };\n"
+		"uniform usampler2D uVisibilityIds;\n"
+		"uniform sampler2D uVisibilityDepth;\n"
+		"uniform sampler2DArray uVisibilityArrays[4];\n"
+		"uniform mat4 uViewProjection;\n";
+}
+
+///////////////////////////////////////////////////
+//	UVisibilityShaderSource()
+//
+//	Defines bool visibilitySurface(ivec2 pixel, out
+//	VisibilitySurface), which rebuilds the world position,
+//	normal and uv (with its per-pixel derivatives) of the
+//	triangle seen at a pixel from the triangle's three
+//	vertices, false where nothing was drawn; and vec4
+//	sampleVisibilityMaterial(VisibilitySurface) to read
+//	its material with those derivatives. Barycentrics
+//	follow Schied and Dachsbacher's analytic derivatives.
+///////////////////////////////////////////////////
+const char* UVisibilityShaderSource()
+{
+	return
+		"bool visibilitySurface(ivec2 pixel, out VisibilitySurface surface)\n"
+		"{\n"
+		"	uint id = texelFetch(uVisibilityIds, pixel, 0).r;\n"
+		"	if (id == 0u)\n"
+		"		return false;\n"
+		"	VisibilityDraw draw = uVisibilityDraws[(id >> 20) - 1u];\n"
+		"	uint firstIndex = draw.firstIndex + (id & 0xFFFFFu) * 3u;\n"
+		"\n"
+		"	vec3 positions[3], normals[3];\n"
+		"	vec2 uvs[3];\n"
+		"	vec4 clip[3];\n"
+		"	for (int corner = 0; corner < 3; ++corner)\n"
+		"	{\n"
+		"		uint vertex = uint(int(uVisibilityIndices[firstIndex + uint(corner)]) + draw.baseVertex) * 8u;\n"
+		"		vec3 position = vec3(uVisibilityVertices[vertex], uVisibilityVertices[vertex + 1u], uVisibilityVertices[vertex + 2u]);\n"
+		"		normals[corner] = vec3(uVisibilityVertices[vertex + 3u], uVisibilityVertices[vertex + 4u], uVisibilityVertices[vertex + 5u]);\n"
+		"		uvs[corner] = vec2(uVisibilityVertices[vertex + 6u], uVisibilityVertices[vertex + 7u]);\n"
+		"		positions[corner] = (draw.model * vec4(position, 1.0)).xyz;\n"
+		"		clip[corner] = uViewProjection * vec4(positions[corner], 1.0);\n"
+		"	}\n"
+		"\n"
+		"	// perspective correct barycentrics at the pixel centre and one pixel right and up\n"
+		"	vec2 size = vec2(textureSize(uVisibilityIds, 0));\n"
+		"	vec2 ndc = (vec2(pixel) + 0.5) / size * 2.0 - 1.0;\n"
+		"	vec3 invW = 1.0 / vec3(clip[0].w, clip[1].w, clip[2].w);\n"
+		"	vec2 ndc0 = clip[0].xy * invW.x, ndc1 = clip[1].xy * invW.y, ndc2 = clip[2].xy * invW.z;\n"
+		"	float invDet = 1.0 / determinant(mat2(ndc2 - ndc1, ndc0 - ndc1));\n"
+		"	vec3 ddx = vec3(ndc1.y - ndc2.y, ndc2.y - ndc0.y, ndc0.y - ndc1.y) * invDet * invW;\n"
+		"	vec3 ddy = vec3(ndc2.x - ndc1.x, ndc0.x - ndc2.x, ndc1.x - ndc0.x) * invDet * invW;\n"
+		"	float ddxSum = ddx.x + ddx.y + ddx.z, ddySum = ddy.x + ddy.y + ddy.z;\n"
+		"	vec2 delta = ndc - ndc0;\n"
+		"	float interpInvW = invW.x + delta.x * ddxSum + delta.y * ddySum;\n"
+		"	vec3 lambda = (vec3(invW.x, 0.0, 0.0) + delta.x * ddx + delta.y * ddy) / interpInvW;\n"
+		"	ddx *= 2.0 / size.x;\n"
+		"	ddy *= 2.0 / size.y;\n"
+		"	ddxSum *= 2.0 / size.x;\n"
+		"	ddySum *= 2.0 / size.y;\n"
+		"	vec3 lambdaDx = (lambda * interpInvW + ddx) / (interpInvW + ddxSum) - lambda;\n"
+		"	vec3 lambdaDy = (lambda * interpInvW + ddy) / (interpInvW + ddySum) - lambda;\n"
+		"\n"
+		"	mat3x2 uv = mat3x2(uvs[0], uvs[1], uvs[2]);\n"
+		"	surface.position = mat3(positions[0], positions[1], positions[2]) * lambda;\n"
+		"	surface.normal = normalize(mat3(draw.normalMatrix) * (mat3(normals[0], normals[1], normals[2]) * lambda));\n"
+		"	surface.uv = uv * lambda;\n"
+		"	surface.uvDx = uv * lambdaDx;\n"
+		"	surface.uvDy = uv * lambdaDy;\n"
+		"	surface.materialArray = draw.materialArray;\n"
+		"	surface.materialLayer = draw.materialLayer;\n"
+		"	surface.materialMinLod = draw.materialMinLod;\n"
+		"	return true;\n"
+		"}\n"
+		"vec4 sampleVisibilityMaterial(VisibilitySurface surface)\n"
+		"{\n"
+		"	vec3 coord = vec3(surface.uv, float(surface.materialLayer));\n"
+		"	// the array differs per pixel, so each is sampled under its own (uniform) index\n"
+		"	for (int array = 0; array < 4; ++array)\n"
+		"	{\n"
+		"		if (array != surface.materialArray)\n"
+		"			continue;\n"
+		"		if (surface.materialMinLod > 0.0)\n"
+		"		{\n"
+		"			vec2 texels = vec2(textureSize(uVisibilityArrays[array], 0).xy);\n"
+		"			float lod = log2(max(length(surface.uvDx * texels), length(surface.uvDy * texels)));\n"
+		"			return textureLod(uVisibilityArrays[array], coord, max(lod, surface.materialMinLod));\n"
+		"		}\n"
+		"		return textureGrad(uVisibilityArrays[array], coord, surface.uvDx, surface.uvDy);\n"
+		"	}\n"
+		"	return vec4(1.0);\n"
+		"}\n";
+}
@@ -0,0 +1,96 @@
+///////////////////////////////////////////////////////////////////////////////
+// visibilitybuffer.h
+// ========
+// visibility buffer rendering: the geometry pass writes nothing but a 32-bit
+// (draw, triangle) id per pixel. A full-screen resolve then fetches that
+// triangle's vertices straight from the mesh buffers, rebuilds perspective
+// correct barycentrics and their screen derivatives, and shades every pixel
+// exactly once. Small triangles cost no quad overdraw in shading and there
+// are no G-buffer attributes to write and read back. All meshes drawn this
+// way share one vertex and one index buffer, also bound as shader storage.
+///////////////////////////////////////////////////////////////////////////////
+
+#ifndef VISIBILITYBUFFER_H
+#define VISIBILITYBUFFER_H
+
+#include <GL/glew.h>
+#include <vector>
+
+#include <glm/glm.hpp>
+
+#include "meshdata.h"
+#include "texturearray.h"
+
+// Id layout: (draw + 1) << visibilityTriangleBits | triangle; 0 is empty
+const GLuint visibilityTriangleBits = 20;
+const GLuint visibilityMaxDraws = (1u << (32 - visibilityTriangleBits)) - 2;
+const GLuint visibilityMaxTriangles = 1u << visibilityTriangleBits;
+
+// Shader storage bindings and texture units of the resolve pass; the
+// texture arrays keep units 0 .. maxTextureArrays - 1
+const GLuint visibilityVertexBinding = 6;
+const GLuint visibilityIndexBinding = 7;
+const GLuint visibilityDrawBinding = 8;
+const GLuint visibilityFirstUnit = 7;
+
+// Where a mesh sits in the shared buffers
+struct VisibilityMesh
+{
+	GLuint firstIndex = 0;
+	GLint baseVertex = 0;
+	GLuint triangles = 0;
+};
+
+// One draw as the resolve pass reads it (std430 layout)
+struct VisibilityDraw
+{
+	glm::mat4 model;
+	glm::mat4 normalMatrix;		// upper 3x3 used
+	GLuint firstIndex;
+	GLint baseVertex;
+	GLint materialArray;
+	GLint materialLayer;
+	GLfloat materialMinLod;
+	GLfloat padding[3];
+};
+
+struct VisibilityBuffer
+{
+	GLuint framebuffer = 0;
+	GLuint idTexture = 0;		// R32UI
+	GLuint depthTexture = 0;	// DEPTH_COMPONENT32F
+	GLsizei width = 0;
+	GLsizei height = 0;
+	GLint viewport[4] = {};		// restored after the geometry pass
+
+	// shared geometry, filled by UAddVisibilityMesh and then uploaded
+	std::vector<GLfloat> vertices;
+	std::vector<GLuint> indices;
+	std::vector<VisibilityMesh> meshes;
+	GLuint vertexArray = 0;
+	GLuint vertexBuffer = 0;
+	GLuint indexBuffer = 0;
+
+	// this frame's draws
+	std::vector<VisibilityDraw> draws;
+	GLuint drawBuffer = 0;
+	GLint drawIdLocation = -1;
+	GLint modelLocation = -1;
+	unsigned long long droppedDraws = 0;	// past visibilityMaxDraws
+};
+
+bool UCreateVisibilityBuffer(GLsizei width, GLsizei height, VisibilityBuffer& visibility);
+void UDestroyVisibilityBuffer(VisibilityBuffer& visibility);
+int UAddVisibilityMesh(VisibilityBuffer& visibility, const MeshData& data);
+void UUploadVisibilityGeometry(VisibilityBuffer& visibility);
+
+void UBeginVisibilityPass(VisibilityBuffer& visibility, GLuint programId);
+void UDrawVisibilityMesh(VisibilityBuffer& visibility, int mesh, const glm::mat4& model, const TextureRef& material);
+void UEndVisibilityPass(VisibilityBuffer& visibility);
+void UBindVisibilityBuffer(const VisibilityBuffer& visibility, GLuint programId, const TextureArraySet& textures);
+void UDrawVisibilityResolve(const VisibilityBuffer& visibility);
+
+const char* UVisibilityShaderHeader();
+const char* UVisibilityShaderSource();
+
+#endif
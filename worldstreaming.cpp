@@ -0,0 +1,478 @@
+///////////////////////////////////////////////////////////////////////////////
+// worldstreaming.cpp
+// ========
+// distance and direction driven chunk residency under a memory budget
+///////////////////////////////////////////////////////////////////////////////
+
+#include "worldstreaming.h"
+#include "meshdata.h"
+#include "meshimport.h"
+#include "packfile.h"
+#include "asyncio.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstring>
+#include <iostream>
+#include <mutex>
+#include <sstream>
+
+const char* const worldShapeNames[5] = { "cube", "cylinder", "plane", "sphere", "torus" };
+
+namespace
+{
+	// Chunks being read and parsed at any time
+	const size_t maxLoadsInFlight = 4;
+
+	enum class ChunkPhase
+	{
+		Unloaded,
+		Loading,	// on the workers
+		Uploading,	// parsed, waiting for the render thread
+		Resident
+	};
+
+	struct ChunkState
+	{
+		ChunkPhase phase = ChunkPhase::Unloaded;
+		float distance = 0.0f;		// this frame, stretched by the camera direction
+		size_t bytes = 0;			// of its meshes, once loaded
+		bool bytesKnown = false;
+		std::vector<char> failed;	// per mesh: not tried again
+		std::vector<MeshData> pending;	// parsed meshes, uploaded in order
+		size_t uploaded = 0;
+		std::vector<ResourceHandle> resources;	// vao, vertex and index buffer of each uploaded mesh
+	};
+
+	// Meshes of a chunk parsed by a worker
+	struct LoadedChunk
+	{
+		size_t chunk;
+		std::vector<MeshData> meshes;
+		std::vector<char> ok;
+		std::vector<glm::vec4> bounds;	// object space center and radius
+	};
+
+	size_t UMeshBytes(const MeshData& data)
+	{
+		return (data.vertices.size() + data.indices.size()) * sizeof(GLfloat);
+	}
+
+	// Bounding sphere of the positions: box center, farthest vertex
+	glm::vec4 UMeshBounds(const MeshData& data)
+	{
+		if (data.vertices.empty())
+			return glm::vec4(0.0f);
+		glm::vec3 low(data.vertices[0], data.vertices[1], data.vertices[2]), high = low;
+		for (size_t i = 0; i < data.vertices.size(); i += floatsPerMeshVertex)
+		{
+			const glm::vec3 p(data.vertices[i], data.vertices[i + 1], data.vertices[i + 2]);
+			low = glm::min(low, p);
+			high = glm::max(high, p);
+		}
+		const glm::vec3 center = 0.5f * (low + high);
+		float radius = 0.0f;
+		for (size_t i = 0; i < data.vertices.size(); i += floatsPerMeshVertex)
+			radius = std::max(radius, glm::length(glm::vec3(data.vertices[i], data.vertices[i + 1], data.vertices[i + 2]) - center));
+		return glm::vec4(center, radius);
+	}
+}
+
+struct WorldStreamer
+{
+	std::vector<WorldChunk> chunks;
+	std::vector<ChunkState> states;
+	WorldStreamingOptions options;
+	WorldStreamingStats stats;
+	size_t inFlight = 0;
+
+	std::mutex mutex;
+	std::vector<LoadedChunk> finished;
+
+	// last, so it is destroyed first and no load outlives the state above
+	std::unique_ptr<AsyncIO> io;
+};
+
+namespace
+{
+	///////////////////////////////////////////////////
+	//	ULoadChunk(AsyncIO&, WorldStreamer&, size_t, std::vector<std::string>, std::vector<char>)
+	//
+	//	Load coroutine: reads the chunk's mesh files one after
+	//	the other and parses each on the worker it resumes on.
+	//	Meshes marked in skip failed before and are not read.
+	///////////////////////////////////////////////////
+	AsyncTask ULoadChunk(AsyncIO& io, WorldStreamer& owner, size_t chunk, std::vector<std::string> paths, std::vector<char> skip)
+	{
+		LoadedChunk loaded;
+		loaded.chunk = chunk;
+		loaded.meshes.resize(paths.size());
+		loaded.ok.assign(paths.size(), 0);
+		loaded.bounds.assign(paths.size(), glm::vec4(0.0f));
+		for (size_t i = 0; i < paths.size(); ++i)
+		{
+			AsyncBuffer file;
+			if (skip[i] || !co_await io.ReadFile(paths[i].c_str(), file))
+				continue;
+			switch (UMeshFormatFromPath(paths[i].c_str()))
+			{
+			case MeshFormat::OBJ: loaded.ok[i] = UParseObj((const char*)file.Data(), file.Size(), loaded.meshes[i]); break;
+			case MeshFormat::GLB: loaded.ok[i] = UParseGlb(file.Data(), file.Size(), loaded.meshes[i]); break;
+			default: break;
+			}
+			if (loaded.ok[i])
+				loaded.bounds[i] = UMeshBounds(loaded.meshes[i]);
+		}
+
+		std::lock_guard<std::mutex> lock(owner.mutex);
+		owner.finished.push_back(std::move(loaded));
+	}
+
+	// Releases what a chunk holds and drops any parsed meshes not yet uploaded
+	void UUnloadChunk(WorldStreamer& streamer, size_t index)
+	{
+		WorldChunk& chunk = streamer.chunks[index];
+		ChunkState& state = streamer.states[index];
+		for (ResourceHandle& resource : state.resources)
+			UReleaseResource(*streamer.options.registry, resource);
+		state.resources.clear();
+		state.pending.clear();
+		state.uploaded = 0;
+		for (ChunkMesh& mesh : chunk.meshes)
+			mesh.mesh = Meshes::GLMesh();
+
+		if (chunk.resident)
+			++streamer.stats.unloads;
+		chunk.resident = false;
+		if (state.phase == ChunkPhase::Uploading || state.phase == ChunkPhase::Resident)
+			streamer.stats.resident -= state.bytes;
+		state.phase = ChunkPhase::Unloaded;
+	}
+
+	///////////////////////////////////////////////////
+	//	UMakeRoom(WorldStreamer&, size_t, float)
+	//
+	//	Unloads resident and uploading chunks farther away than
+	//	distance, farthest first, until bytes more fit in the
+	//	budget. Returns false when that is not enough.
+	///////////////////////////////////////////////////
+	bool UMakeRoom(WorldStreamer& streamer, size_t bytes, float distance)
+	{
+		while (streamer.stats.resident + bytes > streamer.stats.budget)
+		{
+			size_t victim = streamer.chunks.size();
+			for (size_t i = 0; i < streamer.chunks.size(); ++i)
+			{
+				const ChunkState& state = streamer.states[i];
+				if (state.phase != ChunkPhase::Uploading && state.phase != ChunkPhase::Resident)
+					continue;
+				if (state.distance > distance && (victim == streamer.chunks.size() || state.distance > streamer.states[victim].distance))
+					victim = i;
+			}
+			if (victim == streamer.chunks.size())
+				return false;
+			UUnloadChunk(streamer, victim);
+		}
+		return true;
+	}
+
+	// Takes over a worker's result: parsed meshes wait for upload if the chunk is still wanted and fits
+	void UAcceptLoadedChunk(WorldStreamer& streamer, LoadedChunk& loaded)
+	{
+		WorldChunk& chunk = streamer.chunks[loaded.chunk];
+		ChunkState& state = streamer.states[loaded.chunk];
+		--streamer.inFlight;
+
+		state.bytes = 0;
+		for (size_t i = 0; i < loaded.meshes.size(); ++i)
+		{
+			if (!loaded.ok[i])
+			{
+				if (!state.failed[i])
+				{
+					std::cout << "Failed to load chunk mesh " << chunk.meshes[i].path << std::endl;
+					++streamer.stats.failures;
+				}
+				state.failed[i] = 1;
+				loaded.meshes[i] = MeshData();
+				continue;
+			}
+			const glm::vec4 bounds = loaded.bounds[i];
+			chunk.meshes[i].center = glm::vec3(bounds) + chunk.meshes[i].offset;
+			chunk.meshes[i].radius = bounds.w;
+			state.bytes += UMeshBytes(loaded.meshes[i]);
+		}
+		state.bytesKnown = true;
+		state.phase = ChunkPhase::Unloaded;
+
+		const WorldStreamingOptions& options = streamer.options;
+		if (state.distance > options.prefetchRadius + options.unloadMargin || !UMakeRoom(streamer, state.bytes, state.distance))
+			return;
+		state.pending = std::move(loaded.meshes);
+		state.uploaded = 0;
+		state.phase = ChunkPhase::Uploading;
+		streamer.stats.resident += state.bytes;
+		streamer.stats.peak = std::max(streamer.stats.peak, streamer.stats.resident);
+	}
+
+	// Render thread: uploads the next mesh of a chunk; true once all of them are in
+	bool UUploadNextMesh(WorldStreamer& streamer, size_t index, size_t& bytes)
+	{
+		WorldChunk& chunk = streamer.chunks[index];
+		ChunkState& state = streamer.states[index];
+		while (state.uploaded < state.pending.size())
+		{
+			const size_t i = state.uploaded++;
+			MeshData& data = state.pending[i];
+			if (data.indices.empty())
+				continue;
+
+			ChunkMesh& mesh = chunk.meshes[i];
+			UCreateMeshFromData(data, mesh.mesh);
+			ResourceRegistry& registry = *streamer.options.registry;
+			const char* label = mesh.path.c_str();
+			state.resources.push_back(URegisterResource(registry, ResourceType::VertexArray, mesh.mesh.vao, 0, label));
+			state.resources.push_back(URegisterResource(registry, ResourceType::Buffer, mesh.mesh.vbos[0], data.vertices.size() * sizeof(GLfloat), label));
+			state.resources.push_back(URegisterResource(registry, ResourceType::Buffer, mesh.mesh.vbos[1], data.indices.size() * sizeof(GLuint), label));
+			bytes += UMeshBytes(data);
+			data = MeshData();
+			break;
+		}
+		return state.uploaded == state.pending.size();
+	}
+}
+
+///////////////////////////////////////////////////
+//	ULoadWorldFile(const char*, std::vector<WorldChunk>&)
+//
+//	path: world file, loose or in a mounted pack (format in
+//	      worldstreaming.h)
+//	chunks: receives the chunks, nothing loaded yet
+//
+//	Prints the line of the first statement it cannot read
+///////////////////////////////////////////////////
+bool ULoadWorldFile(const char* path, std::vector<WorldChunk>& chunks)
+{
+	chunks.clear();
+	AssetFile file;
+	if (!file.Open(path))
+	{
+		std::cout << "Failed to open world file " << path << std::endl;
+		return false;
+	}
+
+	std::istringstream text(std::string((const char*)file.Data(), file.Size()));
+	std::string line;
+	for (int lineNumber = 1; std::getline(text, line); ++lineNumber)
+	{
+		const size_t comment = line.find('#');
+		if (comment != std::string::npos)
+			line.erase(comment);
+		std::istringstream words(line);
+		std::string statement;
+		if (!(words >> statement))
+			continue;
+
+		bool ok = false;
+		if (statement == "chunk")
+		{
+			WorldChunk chunk;
+			ok = (bool)(words >> chunk.min.x >> chunk.min.y >> chunk.max.x >> chunk.max.y) && chunk.min.x < chunk.max.x && chunk.min.y < chunk.max.y;
+			if (ok)
+				chunks.push_back(chunk);
+		}
+		else if (statement == "object" && !chunks.empty())
+		{
+			ChunkObject object;
+			std::string shape;
+			ok = (bool)(words >> shape >> object.material >> object.scale.x >> object.scale.y >> object.scale.z >> object.rotAmt
+				>> object.rotation.x >> object.rotation.y >> object.rotation.z >> object.translation.x >> object.translation.y >> object.translation.z);
+			const char* const* name = std::find_if(std::begin(worldShapeNames), std::end(worldShapeNames), [&](const char* n) { return shape == n; });
+			ok = ok && name != std::end(worldShapeNames);
+			if (ok)
+			{
+				object.shape = int(name - std::begin(worldShapeNames));
+				chunks.back().objects.push_back(object);
+			}
+		}
+		else if (statement == "mesh" && !chunks.empty())
+		{
+			ChunkMesh mesh;
+			ok = (bool)(words >> mesh.material >> mesh.offset.x >> mesh.offset.y >> mesh.offset.z) && (bool)std::getline(words >> std::ws, mesh.path);
+			if (ok)
+				chunks.back().meshes.push_back(mesh);
+		}
+
+		if (!ok)
+		{
+			std::cout << "Failed to read world file " << path << " line " << lineNumber << ": " << line << std::endl;
+			chunks.clear();
+			return false;
+		}
+	}
+	return true;
+}
+
+///////////////////////////////////////////////////
+//	UCreateWorldStreamer(std::vector<WorldChunk>, const WorldStreamingOptions&)
+//
+//	chunks: the world, from ULoadWorldFile or built by the
+//	        caller; nothing is loaded until the first update
+//	options: radii, budget and the registry to upload into
+///////////////////////////////////////////////////
+std::shared_ptr<WorldStreamer> UCreateWorldStreamer(std::vector<WorldChunk> chunks, const WorldStreamingOptions& options)
+{
+	if (!options.registry)
+		return nullptr;
+
+	std::shared_ptr<WorldStreamer> streamer = std::make_shared<WorldStreamer>();
+	streamer->chunks = std::move(chunks);
+	streamer->states.resize(streamer->chunks.size());
+	streamer->options = options;
+	streamer->options.frontBias = std::min(std::max(options.frontBias, 0.0f), 0.9f);
+	streamer->stats.chunks = streamer->chunks.size();
+	streamer->stats.budget = options.budget;
+
+	size_t meshes = 0, objects = 0;
+	for (size_t i = 0; i < streamer->chunks.size(); ++i)
+	{
+		WorldChunk& chunk = streamer->chunks[i];
+		chunk.resident = false;
+		streamer->states[i].failed.assign(chunk.meshes.size(), 0);
+		meshes += chunk.meshes.size();
+		objects += chunk.objects.size();
+	}
+	streamer->io.reset(new AsyncIO(std::min<unsigned>(UWorkerCount(), (unsigned)maxLoadsInFlight)));
+
+	std::cout << "INFO: Streaming a world of " << streamer->chunks.size() << " chunks (" << objects << " objects, " << meshes
+		<< " mesh files) within " << options.prefetchRadius << " units and a " << options.budget / (1024 * 1024) << " MB budget" << std::endl;
+	return streamer;
+}
+
+///////////////////////////////////////////////////
+//	UUpdateWorldStreamer(WorldStreamer&, const glm::vec3&, const glm::vec3&)
+//
+//	position, front: the camera this frame
+//
+//	Called once per frame on the GL thread. Ranks every
+//	chunk by its distance from the camera, scaled down when
+//	it lies ahead and up when it lies behind; takes over
+//	finished loads; unloads chunks past the prefetch radius
+//	plus the margin; starts loads for the nearest chunks
+//	inside the radius that fit the budget; and uploads at
+//	most uploadBytesPerFrame (one mesh at least) of parsed
+//	meshes, nearest chunk first. Nothing here blocks.
+///////////////////////////////////////////////////
+void UUpdateWorldStreamer(WorldStreamer& streamer, const glm::vec3& position, const glm::vec3& front)
+{
+	const auto start = std::chrono::steady_clock::now();
+	const WorldStreamingOptions& options = streamer.options;
+
+	const glm::vec2 eye(position.x, position.z);
+	glm::vec2 ahead(front.x, front.z);
+	const float aheadLength = glm::length(ahead);
+	ahead = aheadLength > 1e-4f ? ahead / aheadLength : glm::vec2(0.0f);
+	for (size_t i = 0; i < streamer.chunks.size(); ++i)
+	{
+		const WorldChunk& chunk = streamer.chunks[i];
+		const glm::vec2 nearest = glm::clamp(eye, chunk.min, chunk.max);
+		const float distance = glm::length(nearest - eye);
+		const float toward = distance > 0.0f ? glm::dot((nearest - eye) / distance, ahead) : 0.0f;
+		streamer.states[i].distance = distance * (1.0f - options.frontBias * toward);
+	}
+
+	std::vector<LoadedChunk> finished;
+	{
+		std::lock_guard<std::mutex> lock(streamer.mutex);
+		finished.swap(streamer.finished);
+	}
+	for (LoadedChunk& loaded : finished)
+		UAcceptLoadedChunk(streamer, loaded);
+
+	std::vector<size_t> order;
+	for (size_t i = 0; i < streamer.chunks.size(); ++i)
+	{
+		const ChunkState& state = streamer.states[i];
+		if (state.phase != ChunkPhase::Unloaded && state.phase != ChunkPhase::Loading && state.distance > options.prefetchRadius + options.unloadMargin)
+			UUnloadChunk(streamer, i);
+		else
+			order.push_back(i);
+	}
+	std::sort(order.begin(), order.end(), [&](size_t a, size_t b) { return streamer.states[a].distance < streamer.states[b].distance; });
+
+	for (size_t i : order)
+	{
+		ChunkState& state = streamer.states[i];
+		if (state.distance > options.prefetchRadius)
+			break;
+		if (state.phase != ChunkPhase::Unloaded)
+			continue;
+
+		// chunks loaded before are known not to fit while nearer ones hold the budget
+		if (state.bytesKnown && !UMakeRoom(streamer, state.bytes, state.distance))
+			continue;
+		const WorldChunk& chunk = streamer.chunks[i];
+		if (chunk.meshes.empty())
+		{
+			state.bytesKnown = true;
+			state.phase = ChunkPhase::Uploading;
+			continue;
+		}
+		if (streamer.inFlight >= maxLoadsInFlight)
+			continue;
+
+		std::vector<std::string> paths;
+		for (const ChunkMesh& mesh : chunk.meshes)
+			paths.push_back(mesh.path);
+		state.phase = ChunkPhase::Loading;
+		++streamer.inFlight;
+		streamer.io->Start(ULoadChunk(*streamer.io, streamer, i, std::move(paths), state.failed));
+	}
+
+	size_t uploaded = 0;
+	for (size_t i : order)
+	{
+		ChunkState& state = streamer.states[i];
+		if (state.phase != ChunkPhase::Uploading)
+			continue;
+		while (uploaded < options.uploadBytesPerFrame || uploaded == 0)
+		{
+			if (UUploadNextMesh(streamer, i, uploaded))
+			{
+				state.phase = ChunkPhase::Resident;
+				state.pending.clear();
+				streamer.chunks[i].resident = true;
+				++streamer.stats.loads;
+				break;
+			}
+		}
+	}
+
+	streamer.stats.residentChunks = 0;
+	for (const WorldChunk& chunk : streamer.chunks)
+		streamer.stats.residentChunks += chunk.resident ? 1 : 0;
+	const double ms = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+	streamer.stats.maxUpdateMs = std::max(streamer.stats.maxUpdateMs, ms);
+}
+
+const std::vector<WorldChunk>& UWorldChunks(const WorldStreamer& streamer)
+{
+	return streamer.chunks;
+}
+
+WorldStreamingStats UGetWorldStreamingStats(const WorldStreamer& streamer)
+{
+	return streamer.stats;
+}
+
+// Waits for the loads in flight, then releases every chunk; call before the registry goes
+void UDestroyWorldStreamer(std::shared_ptr<WorldStreamer>& streamer)
+{
+	if (!streamer)
+		return;
+	streamer->io.reset();
+	for (size_t i = 0; i < streamer->chunks.size(); ++i)
+		UUnloadChunk(*streamer, i);
+	streamer.reset();
+}
@@ -0,0 +1,98 @@
+///////////////////////////////////////////////////////////////////////////////
+// worldstreaming.h
+// ========
+// a world split into rectangular chunks on the ground plane, each with its
+// own object list and meshes, loaded and unloaded around the camera. Chunks
+// within a prefetch radius (stretched ahead of the camera, shrunk behind it)
+// are read and parsed on worker threads; the render thread only uploads a
+// bounded number of bytes per frame and releases chunks through the
+// resource registry, so streaming never waits on the disk or the GPU. The
+// resident chunks stay within a memory budget, farthest dropped first.
+///////////////////////////////////////////////////////////////////////////////
+
+#ifndef WORLDSTREAMING_H
+#define WORLDSTREAMING_H
+
+#include <cstddef>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include <glm/glm.hpp>
+
+#include "meshes.h"
+#include "resourceregistry.h"
+
+// One object drawn with a built-in shape; shape follows the order of
+// worldShapeNames, material indexes the application's materials
+struct ChunkObject
+{
+	int shape = 0;
+	int material = 0;
+	glm::vec3 scale = glm::vec3(1.0f);
+	float rotAmt = 0.0f;
+	glm::vec3 rotation = glm::vec3(1.0f, 0.0f, 0.0f);
+	glm::vec3 translation = glm::vec3(0.0f);
+};
+
+// A mesh file of a chunk, drawn at an offset; mesh and bounds are valid
+// while the chunk is resident
+struct ChunkMesh
+{
+	std::string path;
+	int material = 0;
+	glm::vec3 offset = glm::vec3(0.0f);
+	Meshes::GLMesh mesh = {};
+	glm::vec3 center = glm::vec3(0.0f);	// world space bounding sphere
+	float radius = 0.0f;
+};
+
+struct WorldChunk
+{
+	glm::vec2 min, max;		// extent on the XZ plane
+	std::vector<ChunkObject> objects;
+	std::vector<ChunkMesh> meshes;
+	bool resident = false;	// drawn this frame
+};
+
+// World file, one statement per line, '#' starts a comment:
+//	chunk <minX> <minZ> <maxX> <maxZ>		starts a chunk
+//	object <shape> <material> <sx sy sz> <angle> <ax ay az> <tx ty tz>
+//	mesh <material> <tx ty tz> <path>		OBJ or GLB file, rest of the line
+// Shapes are named as in worldShapeNames, materials by index.
+extern const char* const worldShapeNames[5];
+
+struct WorldStreamingOptions
+{
+	float prefetchRadius = 30.0f;	// chunks closer than this load
+	float unloadMargin = 10.0f;		// and unload once this much farther
+	float frontBias = 0.5f;			// 0..1: how much further ahead of the camera than behind it to look
+	size_t budget = 64 * 1024 * 1024;			// bytes of chunk meshes resident
+	size_t uploadBytesPerFrame = 2 * 1024 * 1024;	// render thread upload per frame (at least one mesh)
+	ResourceRegistry* registry = nullptr;		// required: owns the chunk meshes
+};
+
+struct WorldStreamingStats
+{
+	size_t chunks = 0;
+	size_t residentChunks = 0;
+	size_t loads = 0;		// chunks made resident
+	size_t unloads = 0;
+	size_t failures = 0;	// mesh files that could not be read or parsed
+	size_t resident = 0;	// bytes of resident and uploading chunk meshes
+	size_t peak = 0;
+	size_t budget = 0;
+	double maxUpdateMs = 0.0;	// longest UUpdateWorldStreamer call
+};
+
+// Chunk residency and the loads in flight (worldstreaming.cpp)
+struct WorldStreamer;
+
+bool ULoadWorldFile(const char* path, std::vector<WorldChunk>& chunks);
+std::shared_ptr<WorldStreamer> UCreateWorldStreamer(std::vector<WorldChunk> chunks, const WorldStreamingOptions& options);
+void UUpdateWorldStreamer(WorldStreamer& streamer, const glm::vec3& position, const glm::vec3& front);
+const std::vector<WorldChunk>& UWorldChunks(const WorldStreamer& streamer);
+WorldStreamingStats UGetWorldStreamingStats(const WorldStreamer& streamer);
+void UDestroyWorldStreamer(std::shared_ptr<WorldStreamer>& streamer);
+
+#endif